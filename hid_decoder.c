@@ -0,0 +1,324 @@
+#include <stdatomic.h>
+#include <string.h>
+#include "hid_decoder.h"
+
+#define USAGE_PAGE_KEYBOARD  0x07
+#define KEY_ERROR_ROLLOVER   0x01
+#define KEY_LEFT_CTRL        0xE0
+#define MOD_SHIFT_MASK       0x22    // left and right shift
+
+static const hid_report_layout_t boot_layout = {
+    .id = HID_BOOT_REPORT_ID, .used = true, .mod_bit = 0, .keys_bit = 16, .keys_count = 6,
+};
+
+static hid_key_event_t ring[HID_EVENT_RING_SIZE];
+static atomic_uint ring_head;   // written by the producer only
+static atomic_uint ring_tail;   // written by the consumer only
+static atomic_uint dropped;
+
+/* US layout, usages 0x04..0x38: unshifted and shifted character */
+static const char keymap[][2] = {
+    {'a', 'A'}, {'b', 'B'}, {'c', 'C'}, {'d', 'D'}, {'e', 'E'}, {'f', 'F'},
+    {'g', 'G'}, {'h', 'H'}, {'i', 'I'}, {'j', 'J'}, {'k', 'K'}, {'l', 'L'},
+    {'m', 'M'}, {'n', 'N'}, {'o', 'O'}, {'p', 'P'}, {'q', 'Q'}, {'r', 'R'},
+    {'s', 'S'}, {'t', 'T'}, {'u', 'U'}, {'v', 'V'}, {'w', 'W'}, {'x', 'X'},
+    {'y', 'Y'}, {'z', 'Z'},
+    {'1', '!'}, {'2', '@'}, {'3', '#'}, {'4', '$'}, {'5', '%'},
+    {'6', '^'}, {'7', '&'}, {'8', '*'}, {'9', '('}, {'0', ')'},
+    {'\n', '\n'}, {0, 0}, {'\b', '\b'}, {'\t', '\t'}, {' ', ' '},
+    {'-', '_'}, {'=', '+'}, {'[', '{'}, {']', '}'}, {'\\', '|'}, {0, 0},
+    {';', ':'}, {'\'', '"'}, {'`', '~'}, {',', '<'}, {'.', '>'}, {'/', '?'},
+};
+
+#define KEYMAP_FIRST 0x04
+#define KEYMAP_LAST  (KEYMAP_FIRST + sizeof(keymap) / sizeof(keymap[0]) - 1)
+
+/* ----------- REPORT MAP ----------- */
+
+void hid_decoder_init(hid_decoder_t *d, uint8_t source)
+{
+    memset(d, 0, sizeof(*d));
+    d->source = source;
+}
+
+static hid_report_layout_t *layout_for(hid_decoder_t *d, uint8_t id)
+{
+    for (int i = 0; i < HID_MAX_REPORT_IDS; i++) {
+        if (d->layouts[i].used && d->layouts[i].id == id) {
+            return &d->layouts[i];
+        }
+    }
+    for (int i = 0; i < HID_MAX_REPORT_IDS; i++) {
+        if (!d->layouts[i].used) {
+            d->layouts[i] = (hid_report_layout_t){ .id = id, .used = true, .mod_bit = -1, .keys_bit = -1 };
+            return &d->layouts[i];
+        }
+    }
+    return NULL;
+}
+
+int hid_decoder_parse_report_map(hid_decoder_t *d, const uint8_t *map, size_t len)
+{
+    uint32_t usage_page = 0, report_size = 0, report_count = 0, usage_min = 0;
+    uint8_t report_id = 0;
+    uint16_t input_bits[HID_MAX_REPORT_IDS + 1] = {0};  // per slot, by report ID order
+    uint8_t slot_ids[HID_MAX_REPORT_IDS + 1] = {0};
+    int slots = 0;
+
+    memset(d->layouts, 0, sizeof(d->layouts));
+
+    size_t i = 0;
+    while (i < len) {
+        uint8_t prefix = map[i++];
+        if (prefix == 0xFE) {                           // long item: skip
+            if (i + 1 >= len) {
+                break;
+            }
+            i += 2 + map[i];
+            continue;
+        }
+
+        size_t size = prefix & 0x03;
+        if (size == 3) {
+            size = 4;
+        }
+        if (i + size > len) {
+            break;
+        }
+        uint32_t value = 0;
+        for (size_t b = 0; b < size; b++) {
+            value |= (uint32_t)map[i + b] << (8 * b);
+        }
+        i += size;
+
+        uint8_t type = (prefix >> 2) & 0x03;
+        uint8_t tag = prefix >> 4;
+
+        if (type == 1) {                                // global
+            switch (tag) {
+            case 0x0: usage_page = value; break;
+            case 0x7: report_size = value; break;
+            case 0x8: report_id = value; break;
+            case 0x9: report_count = value; break;
+            }
+        } else if (type == 2) {                         // local
+            if (tag == 0x1) {
+                usage_min = value;
+            }
+        } else if (type == 0 && tag == 0x8) {           // Input
+            int s;
+            for (s = 0; s < slots && slot_ids[s] != report_id; s++) {
+            }
+            if (s == slots) {
+                if (slots == HID_MAX_REPORT_IDS + 1) {
+                    usage_min = 0;
+                    continue;
+                }
+                slot_ids[slots++] = report_id;
+            }
+            uint16_t bit = input_bits[s];
+            input_bits[s] += report_size * report_count;
+
+            if (usage_page == USAGE_PAGE_KEYBOARD && !(value & 0x01)) {   // data, not constant
+                hid_report_layout_t *l = layout_for(d, report_id);
+                if (l == NULL) {
+                    usage_min = 0;
+                    continue;
+                }
+                bool variable = value & 0x02;
+                // keep the first modifier byte and key array of each report
+                if (variable && report_size == 1 && usage_min == KEY_LEFT_CTRL && l->mod_bit < 0) {
+                    l->mod_bit = bit;
+                } else if (!variable && report_size == 8 && l->keys_bit < 0) {
+                    l->keys_bit = bit;
+                    l->keys_count = report_count > HID_MAX_KEYS ? HID_MAX_KEYS : report_count;
+                }
+            }
+            usage_min = 0;
+        } else if (type == 0) {                         // other main items end the local state
+            usage_min = 0;
+        }
+    }
+
+    /* a report without a key array is not a keyboard report */
+    int found = 0;
+    for (int l = 0; l < HID_MAX_REPORT_IDS; l++) {
+        if (d->layouts[l].used && d->layouts[l].keys_bit < 0) {
+            d->layouts[l].used = false;
+        } else if (d->layouts[l].used) {
+            found++;
+        }
+    }
+    hid_decoder_reset(d);
+    return found;
+}
+
+bool hid_decoder_has_layout(const hid_decoder_t *d, uint8_t report_id)
+{
+    for (int i = 0; i < HID_MAX_REPORT_IDS; i++) {
+        if (d->layouts[i].used && d->layouts[i].id == report_id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* ----------- EVENTS ----------- */
+
+static void push_event(const hid_decoder_t *d, uint8_t keycode, uint8_t mods, bool pressed,
+                       uint8_t report_id, uint32_t now_ms)
+{
+    unsigned head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&ring_tail, memory_order_acquire);
+
+    if (head - tail >= HID_EVENT_RING_SIZE) {
+        atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    hid_key_event_t *ev = &ring[head % HID_EVENT_RING_SIZE];
+    ev->source = d->source;
+    ev->keycode = keycode;
+    ev->modifiers = mods;
+    ev->pressed = pressed;
+    ev->report_id = report_id;
+    ev->timestamp_ms = now_ms;
+    ev->utf8[0] = 0;
+    if (pressed && keycode >= KEYMAP_FIRST && keycode <= KEYMAP_LAST) {
+        ev->utf8[0] = keymap[keycode - KEYMAP_FIRST][(mods & MOD_SHIFT_MASK) ? 1 : 0];
+        ev->utf8[1] = 0;
+    }
+
+    atomic_store_explicit(&ring_head, head + 1, memory_order_release);
+}
+
+static bool contains(const uint8_t *keys, int n, uint8_t k)
+{
+    for (int i = 0; i < n; i++) {
+        if (keys[i] == k) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint8_t read_byte(const uint8_t *data, size_t len, int bit)
+{
+    size_t byte = bit / 8;
+    int shift = bit % 8;
+
+    if (byte >= len) {
+        return 0;
+    }
+    uint16_t v = data[byte];
+    if (shift && byte + 1 < len) {
+        v |= data[byte + 1] << 8;
+    }
+    return v >> shift;
+}
+
+int hid_decoder_feed(hid_decoder_t *d, uint8_t report_id, const uint8_t *data, size_t len, uint32_t now_ms)
+{
+    const hid_report_layout_t *l = NULL;
+    hid_report_state_t *st = NULL;
+
+    for (int i = 0; i < HID_MAX_REPORT_IDS; i++) {
+        if (d->layouts[i].used && d->layouts[i].id == report_id) {
+            l = &d->layouts[i];
+            st = &d->states[i];
+            break;
+        }
+    }
+    if (l == NULL) {
+        if (report_id != HID_BOOT_REPORT_ID) {
+            return 0;
+        }
+        l = &boot_layout;
+        st = &d->states[HID_MAX_REPORT_IDS];
+    }
+
+    hid_report_state_t cur = {0};
+    cur.mods = l->mod_bit >= 0 ? read_byte(data, len, l->mod_bit) : 0;
+    for (int i = 0; i < l->keys_count; i++) {
+        cur.keys[i] = read_byte(data, len, l->keys_bit + 8 * i);
+        if (cur.keys[i] == KEY_ERROR_ROLLOVER) {
+            return 0;                                   // phantom state: keep the last one
+        }
+    }
+
+    unsigned before = atomic_load_explicit(&ring_head, memory_order_relaxed);
+
+    /* releases first, so a press in the same report sees the new modifiers */
+    for (int i = 0; i < l->keys_count; i++) {
+        uint8_t k = st->keys[i];
+        if (k && !contains(cur.keys, l->keys_count, k)) {
+            push_event(d, k, cur.mods, false, report_id, now_ms);
+        }
+    }
+    uint8_t changed = st->mods ^ cur.mods;
+    for (int b = 0; b < 8; b++) {
+        if (changed & (1 << b)) {
+            push_event(d, KEY_LEFT_CTRL + b, cur.mods, cur.mods & (1 << b), report_id, now_ms);
+        }
+    }
+    for (int i = 0; i < l->keys_count; i++) {
+        uint8_t k = cur.keys[i];
+        if (k && !contains(st->keys, l->keys_count, k)) {
+            push_event(d, k, cur.mods, true, report_id, now_ms);
+        }
+    }
+
+    *st = cur;
+    return atomic_load_explicit(&ring_head, memory_order_relaxed) - before;
+}
+
+int hid_decoder_drain(hid_key_event_cb_t cb, void *ctx)
+{
+    unsigned tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&ring_head, memory_order_acquire);
+    int n = 0;
+
+    while (tail != head) {
+        cb(&ring[tail % HID_EVENT_RING_SIZE], ctx);
+        tail++;
+        n++;
+    }
+    atomic_store_explicit(&ring_tail, tail, memory_order_release);
+    return n;
+}
+
+void hid_decoder_reset(hid_decoder_t *d)
+{
+    memset(d->states, 0, sizeof(d->states));
+}
+
+int hid_decoder_release_all(hid_decoder_t *d, uint32_t now_ms)
+{
+    unsigned before = atomic_load_explicit(&ring_head, memory_order_relaxed);
+
+    for (int s = 0; s <= HID_MAX_REPORT_IDS; s++) {
+        const hid_report_layout_t *l = s < HID_MAX_REPORT_IDS ? &d->layouts[s] : &boot_layout;
+        hid_report_state_t *st = &d->states[s];
+        if (!l->used) {
+            continue;
+        }
+        for (int i = 0; i < l->keys_count; i++) {
+            if (st->keys[i]) {
+                push_event(d, st->keys[i], 0, false, l->id, now_ms);
+            }
+        }
+        for (int b = 0; b < 8; b++) {
+            if (st->mods & (1 << b)) {
+                push_event(d, KEY_LEFT_CTRL + b, 0, false, l->id, now_ms);
+            }
+        }
+    }
+
+    hid_decoder_reset(d);
+    return atomic_load_explicit(&ring_head, memory_order_relaxed) - before;
+}
+
+uint32_t hid_decoder_dropped(void)
+{
+    return atomic_load_explicit(&dropped, memory_order_relaxed);
+}
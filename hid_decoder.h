@@ -0,0 +1,79 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Keyboard report decoder for the HID client.
+
+   Consecutive input reports of one report ID are diffed into press and
+   release events, modifiers included. Boot reports (8 bytes: modifiers,
+   reserved, 6 keycodes) use a fixed layout. In report-protocol mode the
+   layout of each report ID comes from the peer's report map. Each peer has
+   its own hid_decoder_t; all of them share one single-producer/single-consumer
+   event ring: the BLE host task decodes, an application task drains. Nothing
+   is allocated per event. */
+
+#define HID_BOOT_REPORT_ID     0       // pseudo ID for the boot input report
+#define HID_MAX_REPORT_IDS     4
+#define HID_MAX_KEYS           6
+#define HID_EVENT_RING_SIZE    64      // power of two
+
+/* where the modifier byte and key array sit inside one input report */
+typedef struct {
+    uint8_t id;
+    bool used;
+    int16_t mod_bit;        // -1 if the report has no modifier byte
+    int16_t keys_bit;
+    uint8_t keys_count;
+} hid_report_layout_t;
+
+typedef struct {
+    uint8_t mods;
+    uint8_t keys[HID_MAX_KEYS];
+} hid_report_state_t;
+
+/* one per connected keyboard */
+typedef struct {
+    uint8_t source;                                     // copied into every event
+    hid_report_layout_t layouts[HID_MAX_REPORT_IDS];
+    hid_report_state_t states[HID_MAX_REPORT_IDS + 1];  // last slot: boot report
+} hid_decoder_t;
+
+typedef struct {
+    uint8_t source;         // which decoder produced the event
+    uint8_t keycode;        // HID usage on page 0x07; 0xE0..0xE7 are modifiers
+    uint8_t modifiers;      // modifier byte after this event
+    uint8_t pressed;        // 1 = press, 0 = release
+    uint8_t report_id;
+    char utf8[4];           // NUL-terminated text for presses, "" otherwise
+    uint32_t timestamp_ms;
+} hid_key_event_t;
+
+typedef void (*hid_key_event_cb_t)(const hid_key_event_t *ev, void *ctx);
+
+void hid_decoder_init(hid_decoder_t *d, uint8_t source);
+
+/* Parse a report map and learn the keyboard input layout for each report
+   ID. Returns the number of keyboard layouts found. */
+int hid_decoder_parse_report_map(hid_decoder_t *d, const uint8_t *map, size_t len);
+
+/* Whether the report map gave report_id a keyboard layout */
+bool hid_decoder_has_layout(const hid_decoder_t *d, uint8_t report_id);
+
+/* Decode one input report and queue its events. Returns the number of
+   events queued; events beyond a full ring are counted as dropped.
+   All decoders must be fed from the same task. */
+int hid_decoder_feed(hid_decoder_t *d, uint8_t report_id, const uint8_t *data, size_t len, uint32_t now_ms);
+
+/* Deliver queued events to cb in order. Call from one consumer task. */
+int hid_decoder_drain(hid_key_event_cb_t cb, void *ctx);
+
+/* Forget the previous report state, e.g. after a disconnect */
+void hid_decoder_reset(hid_decoder_t *d);
+
+/* Queue a release for every key and modifier still held, then reset: a
+   keyboard that drops the link mid-keystroke never sends its release.
+   Returns the number of events queued. */
+int hid_decoder_release_all(hid_decoder_t *d, uint32_t now_ms);
+
+uint32_t hid_decoder_dropped(void);
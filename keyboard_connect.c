@@ -1,6 +1,3 @@
-// dodanie mapowania na klawisze przy wyjsciu, dodanie zeby sie ponownie polaczyl
-// po tym jak bedzie disconected W (24427) KBD_CLIENT: Disconnected w event handler
-
 #include <stdio.h>
 #include <string.h>
 
@@ -8,7 +5,9 @@
 #include "freertos/task.h"
 
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
+#include "nvs.h"
 
 #include "nimble/nimble_port.h"
 #include "nimble/nimble_port_freertos.h"
@@ -18,23 +17,606 @@
 #include "host/ble_gatt.h"
 #include "host/util/util.h"
 
+#include "hid_decoder.h"
+
 static const char *TAG = "KBD_CLIENT";
 
-#define TARGET_NAME_SUBSTR "Keyboard"
 #define HID_SERVICE_UUID 0x1812
 #define HID_BOOT_UUID 0x2A22
+#define HID_REPORT_MAP_UUID 0x2A4B
+#define HID_REPORT_UUID 0x2A4D
+#define HID_PROTO_MODE_UUID 0x2A4E
+#define HID_REPORT_REF_UUID 0x2908
+#define CCCD_UUID 0x2902
+#define CHR_DECL_UUID 0x2803
+#define DB_HASH_UUID 0x2B2A
+
+#define HID_PROTO_REPORT 0x01
+
+#define REPORT_MAP_MAX 512
+#define MAX_REPORT_CHRS HID_MAX_REPORT_IDS
+
+/* connection interval range in 1.25 ms units; the peripheral picks within it */
+#define CONN_ITVL_MIN 0x06 // 7.5 ms
+#define CONN_ITVL_MAX 0x18 // 30 ms
+
+/* keyboards served at once (door keypad, panel, ...) */
+#define MAX_PEERS 3
+/* conn handle -> peer slot; a power of two above the controller's handle range */
+#define PEER_HANDLE_SLOTS 16
+
+#define GATT_CACHE_NAMESPACE "gatt_cache"
+
+/* a connect attempt gives up after this (the keyboard stopped advertising
+   or took another central); its address is then passed over for a while so
+   the scan can reach the others */
+#define CONNECT_TIMEOUT_MS 3000
+#define CONNECT_BACKOFF_MS 10000
+
+/* scan profiles, in 0.625 ms units: a fast burst after boot or a lost peer,
+   then a low duty cycle. Both are passive; the HID UUID is in the
+   advertisement itself. */
+typedef enum
+{
+    SCAN_PROFILE_FAST,
+    SCAN_PROFILE_SLOW,
+} scan_profile_t;
+
+#define SCAN_FAST_ITVL 0x50   // 50 ms
+#define SCAN_FAST_WINDOW 0x30 // 30 ms
+#define SCAN_SLOW_ITVL 0x800  // 1.28 s
+#define SCAN_SLOW_WINDOW 0x24 // 22.5 ms
+#define SCAN_FAST_DURATION_MS 30000
+
+/* log time-to-discover and time-to-connect for comparing profiles */
+#define SCAN_MEASUREMENT 1
+
+/* ----------- PER-CONNECTION CONTEXT ----------- */
+typedef struct
+{
+    bool in_use;
+    uint16_t conn_handle;
+    ble_addr_t addr;
+
+    /* handle table, filled during discovery or from the cache */
+    uint16_t svc_start, svc_end;
+    uint16_t kbd_val_handle;
+    uint16_t kbd_cccd_handle;
+    uint16_t map_handle;
+    uint16_t proto_handle;
+    struct
+    {
+        uint16_t val_handle;
+        uint16_t ref_handle;  // Report Reference descriptor
+        uint16_t cccd_handle; // input reports only
+        uint8_t id;
+    } reports[MAX_REPORT_CHRS];
+    int num_reports;
+    int ref_next;
+    int sub_next; // next Report CCCD to write
+    uint16_t dsc_owner; // value handle the descriptors being discovered belong to
+    bool report_seen; // a Report notification was decoded
+
+    uint8_t report_map[REPORT_MAP_MAX];
+    uint16_t report_map_len;
+
+    uint8_t db_hash[16];
+    bool have_hash;
+    bool from_cache;
+
+    hid_decoder_t decoder;
+
+    /* link statistics */
+    struct
+    {
+        uint16_t itvl; // effective, 1.25 ms units
+        uint16_t latency;
+        uint32_t updates;
+        uint32_t rtt_last_us; // ATT read round trip
+        uint32_t rtt_max_us;
+        uint32_t first_report_ms; // connect to first notification
+    } stats;
+    int64_t rtt_start_us;
+    int64_t connect_us;
+} peer_t;
+
+/* what a reconnect needs to subscribe without discovery, stored per peer
+   address; the database hash tells whether the peer's table changed */
+typedef struct
+{
+    uint8_t db_hash[16];
+    uint16_t svc_start, svc_end;
+    uint16_t kbd_val_handle;
+    uint16_t kbd_cccd_handle;
+    uint16_t map_handle;
+    uint16_t proto_handle;
+    uint8_t num_reports;
+    struct
+    {
+        uint16_t val_handle;
+        uint16_t cccd_handle;
+        uint8_t id;
+    } reports[MAX_REPORT_CHRS];
+    uint16_t report_map_len;
+    uint8_t report_map[REPORT_MAP_MAX];
+} gatt_cache_t;
+
+static peer_t g_peers[MAX_PEERS];
+static uint8_t g_peer_slot[PEER_HANDLE_SLOTS]; // slot + 1, 0 = none
+static int g_num_peers;
+static bool g_connecting;
+static ble_addr_t g_connect_addr;
+static ble_addr_t g_backoff_addr;
+static int64_t g_backoff_until_us;
+
+static int64_t g_scan_fast_until_us;
+static int64_t g_scan_burst_us;
+static int64_t g_connect_start_us;
+
+static TaskHandle_t g_event_task;
+
+static void start_scan(void);
+static void scan_burst(void);
+static bool adv_has_hid_uuid(const struct ble_hs_adv_fields *f);
+
+static peer_t *peer_find(uint16_t conn_handle)
+{
+    uint8_t slot = g_peer_slot[conn_handle % PEER_HANDLE_SLOTS];
+    if (slot && g_peers[slot - 1].conn_handle == conn_handle)
+        return &g_peers[slot - 1];
+
+    // two live handles landed in the same slot: fall back to a scan
+    for (int i = 0; i < MAX_PEERS; i++)
+    {
+        if (g_peers[i].in_use && g_peers[i].conn_handle == conn_handle)
+            return &g_peers[i];
+    }
+    return NULL;
+}
+
+static bool peer_known(const ble_addr_t *addr)
+{
+    for (int i = 0; i < MAX_PEERS; i++)
+    {
+        if (g_peers[i].in_use && memcmp(g_peers[i].addr.val, addr->val, sizeof(addr->val)) == 0)
+            return true;
+    }
+    return false;
+}
 
-static uint16_t g_conn = BLE_HS_CONN_HANDLE_NONE;
-static uint16_t g_kbd_val_handle = 0;
+static bool in_backoff(const ble_addr_t *addr)
+{
+    return esp_timer_get_time() < g_backoff_until_us &&
+           memcmp(g_backoff_addr.val, addr->val, sizeof(addr->val)) == 0;
+}
+
+static peer_t *peer_add(uint16_t conn_handle)
+{
+    for (int i = 0; i < MAX_PEERS; i++)
+    {
+        peer_t *p = &g_peers[i];
+        if (p->in_use)
+            continue;
+
+        memset(p, 0, sizeof(*p));
+        p->in_use = true;
+        p->conn_handle = conn_handle;
+        hid_decoder_init(&p->decoder, i);
+
+        struct ble_gap_conn_desc desc;
+        if (ble_gap_conn_find(conn_handle, &desc) == 0)
+            p->addr = desc.peer_id_addr;
+
+        uint8_t *slot = &g_peer_slot[conn_handle % PEER_HANDLE_SLOTS];
+        if (*slot == 0)
+            *slot = i + 1;
+        g_num_peers++;
+        return p;
+    }
+    return NULL;
+}
+
+static void peer_remove(uint16_t conn_handle)
+{
+    peer_t *p = peer_find(conn_handle);
+    if (p == NULL)
+        return;
+
+    uint8_t *slot = &g_peer_slot[conn_handle % PEER_HANDLE_SLOTS];
+    if (*slot && &g_peers[*slot - 1] == p)
+        *slot = 0;
+
+    p->in_use = false;
+    p->conn_handle = BLE_HS_CONN_HANDLE_NONE;
+    g_num_peers--;
+}
+
+static void log_conn_params(peer_t *p)
+{
+    struct ble_gap_conn_desc desc;
+    if (ble_gap_conn_find(p->conn_handle, &desc) != 0)
+        return;
+
+    p->stats.itvl = desc.conn_itvl;
+    p->stats.latency = desc.conn_latency;
+    ESP_LOGI(TAG, "[%d] Conn interval %u (x1.25 ms), latency %u, timeout %u",
+             p->conn_handle, desc.conn_itvl, desc.conn_latency, desc.supervision_timeout);
+}
+
+/* ----------- HANDLE CACHE ----------- */
+static void cache_key(const peer_t *p, char key[16])
+{
+    const uint8_t *a = p->addr.val;
+    snprintf(key, 16, "h%02x%02x%02x%02x%02x%02x", a[5], a[4], a[3], a[2], a[1], a[0]);
+}
+
+static bool cache_load(peer_t *p)
+{
+    static gatt_cache_t c; // host task only; too big for its stack
+    nvs_handle_t nvs;
+    char key[16];
+    size_t len = sizeof(c);
+
+    /* Without a database hash nothing says the table is unchanged, and a
+       stale CCCD handle would write 0x0001 to whatever attribute sits there
+       now, which a write error does not reveal. Such entries are used only
+       for a bonded peer, whose address cannot be taken by another device. */
+    struct ble_gap_conn_desc desc;
+    if (!p->have_hash && (ble_gap_conn_find(p->conn_handle, &desc) != 0 || !desc.sec_state.bonded))
+        return false;
+
+    if (nvs_open(GATT_CACHE_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK)
+        return false;
+    cache_key(p, key);
+    esp_err_t err = nvs_get_blob(nvs, key, &c, &len);
+    nvs_close(nvs);
+
+    if (err != ESP_OK || len != sizeof(c))
+        return false;
+
+    if (p->have_hash && memcmp(c.db_hash, p->db_hash, sizeof(c.db_hash)) != 0)
+    {
+        ESP_LOGI(TAG, "[%d] Database hash changed, rediscovering", p->conn_handle);
+        return false;
+    }
+
+    p->svc_start = c.svc_start;
+    p->svc_end = c.svc_end;
+    p->kbd_val_handle = c.kbd_val_handle;
+    p->kbd_cccd_handle = c.kbd_cccd_handle;
+    p->map_handle = c.map_handle;
+    p->proto_handle = c.proto_handle;
+    p->num_reports = c.num_reports < MAX_REPORT_CHRS ? c.num_reports : MAX_REPORT_CHRS;
+    for (int i = 0; i < p->num_reports; i++)
+    {
+        p->reports[i].val_handle = c.reports[i].val_handle;
+        p->reports[i].cccd_handle = c.reports[i].cccd_handle;
+        p->reports[i].id = c.reports[i].id;
+    }
+    p->report_map_len = c.report_map_len < REPORT_MAP_MAX ? c.report_map_len : REPORT_MAP_MAX;
+    memcpy(p->report_map, c.report_map, p->report_map_len);
+    hid_decoder_parse_report_map(&p->decoder, p->report_map, p->report_map_len);
+    return true;
+}
+
+static void cache_save(const peer_t *p)
+{
+    static gatt_cache_t c;
+    nvs_handle_t nvs;
+    char key[16];
+
+    memset(&c, 0, sizeof(c));
+    memcpy(c.db_hash, p->db_hash, sizeof(c.db_hash));
+    c.svc_start = p->svc_start;
+    c.svc_end = p->svc_end;
+    c.kbd_val_handle = p->kbd_val_handle;
+    c.kbd_cccd_handle = p->kbd_cccd_handle;
+    c.map_handle = p->map_handle;
+    c.proto_handle = p->proto_handle;
+    c.num_reports = p->num_reports;
+    for (int i = 0; i < p->num_reports; i++)
+    {
+        c.reports[i].val_handle = p->reports[i].val_handle;
+        c.reports[i].cccd_handle = p->reports[i].cccd_handle;
+        c.reports[i].id = p->reports[i].id;
+    }
+    c.report_map_len = p->report_map_len;
+    memcpy(c.report_map, p->report_map, p->report_map_len);
+
+    if (nvs_open(GATT_CACHE_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK)
+        return;
+    cache_key(p, key);
+    if (nvs_set_blob(nvs, key, &c, sizeof(c)) == ESP_OK)
+        nvs_commit(nvs);
+    nvs_close(nvs);
+}
+
+static void cache_erase(const peer_t *p)
+{
+    nvs_handle_t nvs;
+    char key[16];
+
+    if (nvs_open(GATT_CACHE_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK)
+        return;
+    cache_key(p, key);
+    nvs_erase_key(nvs, key);
+    nvs_commit(nvs);
+    nvs_close(nvs);
+}
+
+/* ----------- ROUND TRIP ----------- */
+static int rtt_read_cb(
+    uint16_t conn_handle,
+    const struct ble_gatt_error *error,
+    struct ble_gatt_attr *attr,
+    void *arg)
+{
+    peer_t *p = peer_find(conn_handle);
+    if (p == NULL || error->status != 0)
+        return 0;
+
+    uint32_t rtt = esp_timer_get_time() - p->rtt_start_us;
+    p->stats.rtt_last_us = rtt;
+    if (rtt > p->stats.rtt_max_us)
+        p->stats.rtt_max_us = rtt;
+
+    ESP_LOGI(TAG, "[%d] ATT round trip %lu us (max %lu us)",
+             conn_handle, (unsigned long)rtt, (unsigned long)p->stats.rtt_max_us);
+    return 0;
+}
+
+static void measure_rtt(peer_t *p)
+{
+    p->rtt_start_us = esp_timer_get_time();
+    ble_gattc_read(p->conn_handle, p->kbd_val_handle, rtt_read_cb, NULL);
+}
 
 /* HEX dump */
-static void dump_hex(uint8_t *d, int len)
+static void dump_hex(uint16_t conn_handle, uint8_t *d, int len)
 {
     char buf[128];
     int p = 0;
     for (int i = 0; i < len; i++)
         p += snprintf(&buf[p], sizeof(buf) - p, "%02X ", d[i]);
-    ESP_LOGI(TAG, "[REPORT %d] %s", len, buf);
+    ESP_LOGI(TAG, "[%d][REPORT %d] %s", conn_handle, len, buf);
+}
+
+/* ----------- REPORT MAP / REFERENCES -----------
+   After subscribing to the boot input: read the report map, then the Report
+   Reference of every Report characteristic, and only then enable the Report
+   CCCDs, so report-protocol notifications are decoded by the right report
+   ID. Each step starts the next one from its completion callback. */
+static int ref_read_cb(
+    uint16_t conn_handle,
+    const struct ble_gatt_error *error,
+    struct ble_gatt_attr *attr,
+    void *arg);
+static void subscribe(peer_t *p);
+static void subscribe_reports(peer_t *p);
+
+static void read_next_ref(peer_t *p)
+{
+    while (p->ref_next < p->num_reports && p->reports[p->ref_next].ref_handle == 0)
+        p->ref_next++;
+
+    if (p->ref_next < p->num_reports)
+    {
+        ble_gattc_read(p->conn_handle, p->reports[p->ref_next].ref_handle, ref_read_cb, NULL);
+        return;
+    }
+
+    ESP_LOGI(TAG, "[%d] Report setup done: %d report characteristics", p->conn_handle, p->num_reports);
+    p->sub_next = 0;
+    subscribe_reports(p);
+}
+
+static int ref_read_cb(
+    uint16_t conn_handle,
+    const struct ble_gatt_error *error,
+    struct ble_gatt_attr *attr,
+    void *arg)
+{
+    peer_t *p = peer_find(conn_handle);
+    if (p == NULL)
+        return 0;
+
+    if (error->status == 0)
+    {
+        uint8_t ref[2] = {0};
+        os_mbuf_copydata(attr->om, 0, sizeof(ref), ref);
+        p->reports[p->ref_next].id = ref[0];
+        ESP_LOGI(TAG, "[%d] Report 0x%04X: id=%d type=%d",
+                 conn_handle, p->reports[p->ref_next].val_handle, ref[0], ref[1]);
+    }
+
+    p->ref_next++;
+    read_next_ref(p);
+    return 0;
+}
+
+static int dsc_disc_cb(
+    uint16_t conn_handle,
+    const struct ble_gatt_error *error,
+    uint16_t chr_val_handle,
+    const struct ble_gatt_dsc *dsc,
+    void *arg)
+{
+    peer_t *p = peer_find(conn_handle);
+    if (p == NULL)
+        return 0;
+
+    if (error->status != 0)
+    {
+        subscribe(p);
+        return 0;
+    }
+
+    /* NimBLE reports every attribute of the service here, declarations and
+       values too, all with the start handle as chr_val_handle: a descriptor
+       belongs to the characteristic value before it */
+    uint16_t uuid16 = ble_uuid_u16(&dsc->uuid.u);
+    if (uuid16 == CHR_DECL_UUID)
+    {
+        p->dsc_owner = 0;
+        return 0;
+    }
+    if (uuid16 == HID_BOOT_UUID || uuid16 == HID_REPORT_UUID)
+    {
+        p->dsc_owner = dsc->handle;
+        return 0;
+    }
+    if (p->dsc_owner == 0)
+        return 0;
+
+    if (uuid16 == CCCD_UUID && p->dsc_owner == p->kbd_val_handle)
+    {
+        p->kbd_cccd_handle = dsc->handle;
+        return 0;
+    }
+    for (int i = 0; i < p->num_reports; i++)
+    {
+        if (p->reports[i].val_handle != p->dsc_owner)
+            continue;
+        if (uuid16 == HID_REPORT_REF_UUID)
+            p->reports[i].ref_handle = dsc->handle;
+        else if (uuid16 == CCCD_UUID)
+            p->reports[i].cccd_handle = dsc->handle; // input reports notify
+    }
+    return 0;
+}
+
+static int map_read_cb(
+    uint16_t conn_handle,
+    const struct ble_gatt_error *error,
+    struct ble_gatt_attr *attr,
+    void *arg)
+{
+    peer_t *p = peer_find(conn_handle);
+    if (p == NULL)
+        return 0;
+
+    if (error->status == 0)
+    {
+        // read_long delivers the map in pieces
+        int n = OS_MBUF_PKTLEN(attr->om);
+        if (p->report_map_len + n > REPORT_MAP_MAX)
+            n = REPORT_MAP_MAX - p->report_map_len;
+        os_mbuf_copydata(attr->om, 0, n, p->report_map + p->report_map_len);
+        p->report_map_len += n;
+        return 0;
+    }
+
+    if (error->status == BLE_HS_EDONE)
+    {
+        int n = hid_decoder_parse_report_map(&p->decoder, p->report_map, p->report_map_len);
+        ESP_LOGI(TAG, "[%d] Report map: %d bytes, %d keyboard report(s)", conn_handle, p->report_map_len, n);
+    }
+
+    p->ref_next = 0;
+    read_next_ref(p);
+    return 0;
+}
+
+static void start_discovery(peer_t *p);
+
+static int cccd_write_cb(
+    uint16_t conn_handle,
+    const struct ble_gatt_error *error,
+    struct ble_gatt_attr *attr,
+    void *arg)
+{
+    peer_t *p = peer_find(conn_handle);
+    if (p == NULL)
+        return 0;
+
+    if (error->status != 0 && p->from_cache)
+    {
+        ESP_LOGW(TAG, "[%d] Cached handles rejected (0x%x), rediscovering", conn_handle, error->status);
+        cache_erase(p);
+        start_discovery(p);
+        return 0;
+    }
+
+    if (p->from_cache)
+    {
+        // report IDs are known already
+        p->sub_next = 0;
+        subscribe_reports(p);
+    }
+    else if (p->map_handle)
+    {
+        p->report_map_len = 0;
+        ble_gattc_read_long(conn_handle, p->map_handle, 0, map_read_cb, NULL);
+    }
+    else
+    {
+        p->sub_next = 0;
+        subscribe_reports(p);
+    }
+    return 0;
+}
+
+static int report_cccd_write_cb(
+    uint16_t conn_handle,
+    const struct ble_gatt_error *error,
+    struct ble_gatt_attr *attr,
+    void *arg)
+{
+    peer_t *p = peer_find(conn_handle);
+    if (p == NULL)
+        return 0;
+
+    if (error->status != 0 && p->from_cache)
+    {
+        ESP_LOGW(TAG, "[%d] Cached report handles rejected (0x%x), rediscovering", conn_handle, error->status);
+        cache_erase(p);
+        start_discovery(p);
+        return 0;
+    }
+
+    p->sub_next++;
+    subscribe_reports(p);
+    return 0;
+}
+
+/* enable notifications of every input Report, one write at a time */
+static void subscribe_reports(peer_t *p)
+{
+    uint8_t cfg[2] = {1, 0};
+
+    while (p->sub_next < p->num_reports && p->reports[p->sub_next].cccd_handle == 0)
+        p->sub_next++;
+
+    if (p->sub_next < p->num_reports)
+    {
+        ble_gattc_write_flat(p->conn_handle, p->reports[p->sub_next].cccd_handle, cfg, 2,
+                             report_cccd_write_cb, NULL);
+        return;
+    }
+
+    if (!p->from_cache)
+        cache_save(p);
+    measure_rtt(p);
+}
+
+/* report protocol (the keyboard may have been left in boot mode by another
+   host), then boot input notifications */
+static void subscribe(peer_t *p)
+{
+    if (p->kbd_cccd_handle == 0)
+    {
+        ESP_LOGE(TAG, "[%d] No CCCD for the boot input report", p->conn_handle);
+        return;
+    }
+
+    if (p->proto_handle)
+    {
+        uint8_t mode = HID_PROTO_REPORT;
+        ble_gattc_write_no_rsp_flat(p->conn_handle, p->proto_handle, &mode, 1);
+    }
+
+    uint8_t cfg[2] = {1, 0};
+    ble_gattc_write_flat(p->conn_handle, p->kbd_cccd_handle, cfg, 2, cccd_write_cb, NULL);
 }
 
 /* ----------- CHARACTERISTICS DISCOVERY ----------- */
@@ -44,15 +626,19 @@ static int chr_disc_cb(
     const struct ble_gatt_chr *chr,
     void *arg)
 {
+    peer_t *p = peer_find(conn_handle);
+    if (p == NULL)
+        return 0;
+
     if (error->status != 0)
     {
-        ESP_LOGI(TAG, "Characteristics discovery finished");
+        ESP_LOGI(TAG, "[%d] Characteristics discovery finished", conn_handle);
 
-        if (g_kbd_val_handle)
+        // descriptors: CCCD of the boot input and the Report References
+        if (p->kbd_val_handle)
         {
-            uint16_t cccd = g_kbd_val_handle + 1;
-            uint8_t cfg[2] = {1, 0};
-            ble_gattc_write_flat(conn_handle, cccd, cfg, 2, NULL, NULL);
+            p->dsc_owner = 0;
+            ble_gattc_disc_all_dscs(conn_handle, p->svc_start, p->svc_end, dsc_disc_cb, NULL);
         }
         return 0;
     }
@@ -60,8 +646,24 @@ static int chr_disc_cb(
     uint16_t uuid16 = ble_uuid_u16(&chr->uuid.u);
     if (uuid16 == HID_BOOT_UUID)
     {
-        g_kbd_val_handle = chr->val_handle;
-        ESP_LOGI(TAG, "Found Boot Input Report: val=0x%04X", g_kbd_val_handle);
+        p->kbd_val_handle = chr->val_handle;
+        ESP_LOGI(TAG, "[%d] Found Boot Input Report: val=0x%04X", conn_handle, p->kbd_val_handle);
+    }
+    else if (uuid16 == HID_REPORT_MAP_UUID)
+    {
+        p->map_handle = chr->val_handle;
+    }
+    else if (uuid16 == HID_PROTO_MODE_UUID)
+    {
+        p->proto_handle = chr->val_handle;
+    }
+    else if (uuid16 == HID_REPORT_UUID && p->num_reports < MAX_REPORT_CHRS)
+    {
+        p->reports[p->num_reports].val_handle = chr->val_handle;
+        p->reports[p->num_reports].ref_handle = 0;
+        p->reports[p->num_reports].cccd_handle = 0;
+        p->reports[p->num_reports].id = 0;
+        p->num_reports++;
     }
 
     return 0;
@@ -74,15 +676,18 @@ static int svc_disc_cb(
     const struct ble_gatt_svc *svc,
     void *arg)
 {
-    if (error->status != 0)
+    peer_t *p = peer_find(conn_handle);
+    if (p == NULL || error->status != 0)
         return 0;
 
     uint16_t uuid16 = ble_uuid_u16(&svc->uuid.u);
     if (uuid16 == HID_SERVICE_UUID)
     {
 
-        ESP_LOGI(TAG, "HID Service: start=0x%04X end=0x%04X",
-                 svc->start_handle, svc->end_handle);
+        ESP_LOGI(TAG, "[%d] HID Service: start=0x%04X end=0x%04X",
+                 conn_handle, svc->start_handle, svc->end_handle);
+        p->svc_start = svc->start_handle;
+        p->svc_end = svc->end_handle;
 
         ble_gattc_disc_all_chrs(
             conn_handle,
@@ -95,6 +700,108 @@ static int svc_disc_cb(
     return 0;
 }
 
+static void start_discovery(peer_t *p)
+{
+    p->from_cache = false;
+    p->kbd_val_handle = 0;
+    p->kbd_cccd_handle = 0;
+    p->map_handle = 0;
+    p->proto_handle = 0;
+    p->num_reports = 0;
+    p->report_seen = false;
+
+    ble_uuid16_t svc = BLE_UUID16_INIT(HID_SERVICE_UUID);
+    ble_gattc_disc_svc_by_uuid(p->conn_handle, &svc.u, svc_disc_cb, NULL);
+}
+
+/* the Database Hash decides whether the cached handle table is still valid */
+static int hash_read_cb(
+    uint16_t conn_handle,
+    const struct ble_gatt_error *error,
+    struct ble_gatt_attr *attr,
+    void *arg)
+{
+    peer_t *p = peer_find(conn_handle);
+    if (p == NULL)
+        return 0;
+
+    if (error->status == 0)
+    {
+        if (OS_MBUF_PKTLEN(attr->om) == sizeof(p->db_hash))
+        {
+            os_mbuf_copydata(attr->om, 0, sizeof(p->db_hash), p->db_hash);
+            p->have_hash = true;
+        }
+        return 0;
+    }
+
+    // BLE_HS_EDONE after the value, or an ATT error if the peer has no hash
+    if (cache_load(p))
+    {
+        ESP_LOGI(TAG, "[%d] Handle cache hit%s", conn_handle, p->have_hash ? "" : " (no database hash)");
+        p->from_cache = true;
+        subscribe(p);
+    }
+    else
+    {
+        start_discovery(p);
+    }
+    return 0;
+}
+
+/* ----------- KEY EVENTS ----------- */
+/* Both the boot input and the Report characteristics are subscribed. In
+   report protocol a keyboard sends only the latter, but some keep sending
+   boot reports too; once a Report has been decoded those are ignored so no
+   key is seen twice. */
+static int feed_report(peer_t *p, uint16_t attr_handle, const uint8_t *data, int len)
+{
+    uint32_t now_ms = esp_timer_get_time() / 1000;
+
+    if (attr_handle == p->kbd_val_handle)
+        return p->report_seen ? 0 : hid_decoder_feed(&p->decoder, HID_BOOT_REPORT_ID, data, len, now_ms);
+
+    for (int i = 0; i < p->num_reports; i++)
+    {
+        if (p->reports[i].val_handle != attr_handle)
+            continue;
+        // IDs without a keyboard layout (consumer keys, ...) decode to nothing
+        if (hid_decoder_has_layout(&p->decoder, p->reports[i].id))
+            p->report_seen = true;
+        return hid_decoder_feed(&p->decoder, p->reports[i].id, data, len, now_ms);
+    }
+    return 0;
+}
+
+/* application callback: runs on the event task, never on the host task */
+static void on_key_event(const hid_key_event_t *ev, void *ctx)
+{
+    if (ev->pressed && ev->utf8[0])
+        ESP_LOGI(TAG, "<%d> KEY '%s' (0x%02X, mods 0x%02X)", ev->source,
+                 ev->utf8[0] == '\n' ? "\\n" : ev->utf8, ev->keycode, ev->modifiers);
+    else
+        ESP_LOGD(TAG, "<%d> %s 0x%02X (mods 0x%02X)", ev->source,
+                 ev->pressed ? "press" : "release", ev->keycode, ev->modifiers);
+}
+
+static void key_event_task(void *param)
+{
+    uint32_t reported = 0;
+
+    while (1)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        hid_decoder_drain(on_key_event, NULL);
+
+        uint32_t dropped = hid_decoder_dropped();
+        if (dropped != reported)
+        {
+            ESP_LOGW(TAG, "%lu key events dropped so far", (unsigned long)dropped);
+            reported = dropped;
+        }
+    }
+}
+
 /* ----------- GAP EVENTS ----------- */
 static int gap_cb(struct ble_gap_event *ev, void *arg)
 {
@@ -103,86 +810,207 @@ static int gap_cb(struct ble_gap_event *ev, void *arg)
 
     case BLE_GAP_EVENT_DISC:
     {
+        if (g_connecting || peer_known(&ev->disc.addr) || in_backoff(&ev->disc.addr))
+            return 0;
+
         struct ble_hs_adv_fields f;
         if (ble_hs_adv_parse_fields(&f, ev->disc.data, ev->disc.length_data))
             return 0;
 
+        if (!adv_has_hid_uuid(&f))
+            return 0;
+
+        char name[32] = "?";
         if (f.name != NULL)
         {
-            char name[32] = {0};
-            memcpy(name, f.name, f.name_len);
+            int n = f.name_len < sizeof(name) - 1 ? f.name_len : sizeof(name) - 1;
+            memcpy(name, f.name, n);
+            name[n] = 0;
+        }
 
-            if (strstr(name, TARGET_NAME_SUBSTR))
-            {
+#if SCAN_MEASUREMENT
+        g_connect_start_us = esp_timer_get_time();
+        ESP_LOGI(TAG, "Discovered %s %lld ms after scan start", name,
+                 (long long)(g_connect_start_us - g_scan_burst_us) / 1000);
+#endif
+        ESP_LOGI(TAG, "FOUND %s, connecting...", name);
+        // NimBLE cannot connect while scanning; scanning resumes
+        // once the connection attempt completes
+        ble_gap_disc_cancel();
 
-                ESP_LOGI(TAG, "FOUND %s, connecting...", name);
-                ble_gap_disc_cancel();
-
-                struct ble_gap_conn_params p = {
-                    .scan_itvl = 0x10,
-                    .scan_window = 0x10,
-                    .itvl_min = 0x10,
-                    .itvl_max = 0x10,
-                    .latency = 0,
-                    .supervision_timeout = 500};
-
-                ble_gap_connect(
-                    BLE_OWN_ADDR_PUBLIC,
-                    &ev->disc.addr,
-                    BLE_HS_FOREVER,
-                    &p,
-                    gap_cb,
-                    NULL);
-            }
+        struct ble_gap_conn_params p = {
+            .scan_itvl = 0x10,
+            .scan_window = 0x10,
+            .itvl_min = CONN_ITVL_MIN,
+            .itvl_max = CONN_ITVL_MAX,
+            .latency = 0,
+            .supervision_timeout = 500};
+
+        if (ble_gap_connect(
+                BLE_OWN_ADDR_PUBLIC,
+                &ev->disc.addr,
+                CONNECT_TIMEOUT_MS,
+                &p,
+                gap_cb,
+                NULL) == 0)
+        {
+            g_connecting = true;
+            g_connect_addr = ev->disc.addr;
         }
+        else
+            start_scan();
         break;
     }
 
     case BLE_GAP_EVENT_CONNECT:
+        g_connecting = false;
         if (ev->connect.status == 0)
         {
-            g_conn = ev->connect.conn_handle;
-            ESP_LOGI(TAG, "Connected.");
+            peer_t *p = peer_add(ev->connect.conn_handle);
+            if (p == NULL)
+            {
+                ESP_LOGW(TAG, "No free peer slot, dropping connection");
+                ble_gap_terminate(ev->connect.conn_handle, BLE_ERR_REM_USER_CONN_TERM);
+                break;
+            }
+            ESP_LOGI(TAG, "[%d] Connected (%d/%d peers).", p->conn_handle, g_num_peers, MAX_PEERS);
+            p->connect_us = esp_timer_get_time();
+#if SCAN_MEASUREMENT
+            ESP_LOGI(TAG, "[%d] Connected %lld ms after scan start (connect took %lld ms)", p->conn_handle,
+                     (long long)(p->connect_us - g_scan_burst_us) / 1000,
+                     (long long)(p->connect_us - g_connect_start_us) / 1000);
+#endif
+            log_conn_params(p);
 
-            ble_uuid16_t svc = BLE_UUID16_INIT(HID_SERVICE_UUID);
-            ble_gattc_disc_svc_by_uuid(g_conn, &svc.u, svc_disc_cb, NULL);
+            ble_uuid16_t hash = BLE_UUID16_INIT(DB_HASH_UUID);
+            ble_gattc_read_by_uuid(p->conn_handle, 1, 0xFFFF, &hash.u, hash_read_cb, NULL);
+        }
+        else if (ev->connect.status == BLE_HS_ETIMEOUT)
+        {
+            ESP_LOGW(TAG, "Connect timed out, skipping that keyboard for %d s", CONNECT_BACKOFF_MS / 1000);
+            g_backoff_addr = g_connect_addr;
+            g_backoff_until_us = esp_timer_get_time() + (int64_t)CONNECT_BACKOFF_MS * 1000;
         }
         else
         {
-            ESP_LOGE(TAG, "Connect failed");
+            ESP_LOGE(TAG, "Connect failed (%d)", ev->connect.status);
         }
+        start_scan();
         break;
 
     case BLE_GAP_EVENT_NOTIFY_RX:
     {
+        peer_t *p = peer_find(ev->notify_rx.conn_handle);
+        if (p == NULL)
+            break;
+
         uint8_t buf[32];
         int len = OS_MBUF_PKTLEN(ev->notify_rx.om);
         if (len > 32)
             len = 32;
 
         os_mbuf_copydata(ev->notify_rx.om, 0, len, buf);
-        dump_hex(buf, len);
+        dump_hex(p->conn_handle, buf, len);
+
+        if (p->stats.first_report_ms == 0)
+        {
+            p->stats.first_report_ms = (esp_timer_get_time() - p->connect_us) / 1000;
+            ESP_LOGI(TAG, "[%d] First report %lu ms after connect (%s)", p->conn_handle,
+                     (unsigned long)p->stats.first_report_ms, p->from_cache ? "cached handles" : "full discovery");
+        }
+
+        if (feed_report(p, ev->notify_rx.attr_handle, buf, len) > 0)
+            xTaskNotifyGive(g_event_task);
+        break;
+    }
+
+    case BLE_GAP_EVENT_CONN_UPDATE_REQ:
+    case BLE_GAP_EVENT_L2CAP_UPDATE_REQ:
+        /* the keyboard asks for its own interval (short while typing, long
+           when idle); accept anything it proposes */
+        ESP_LOGI(TAG, "[%d] Peer requests interval %u..%u, latency %u",
+                 ev->conn_update_req.conn_handle,
+                 ev->conn_update_req.peer_params->itvl_min,
+                 ev->conn_update_req.peer_params->itvl_max,
+                 ev->conn_update_req.peer_params->latency);
+        return 0;
+
+    case BLE_GAP_EVENT_CONN_UPDATE:
+    {
+        peer_t *p = peer_find(ev->conn_update.conn_handle);
+        if (p != NULL && ev->conn_update.status == 0)
+        {
+            p->stats.updates++;
+            log_conn_params(p);
+            if (p->kbd_val_handle)
+                measure_rtt(p);
+        }
         break;
     }
 
     case BLE_GAP_EVENT_DISCONNECT:
-        ESP_LOGW(TAG, "Disconnected");
-        g_conn = BLE_HS_CONN_HANDLE_NONE;
+    {
+        ESP_LOGW(TAG, "[%d] Disconnected", ev->disconnect.conn.conn_handle);
+
+        // keys held when the link went down would otherwise stay pressed
+        peer_t *p = peer_find(ev->disconnect.conn.conn_handle);
+        if (p != NULL && hid_decoder_release_all(&p->decoder, esp_timer_get_time() / 1000) > 0)
+            xTaskNotifyGive(g_event_task);
+
+        peer_remove(ev->disconnect.conn.conn_handle);
+        scan_burst();
+        break;
+    }
+
+    case BLE_GAP_EVENT_DISC_COMPLETE:
+        // the fast burst ran out
+        start_scan();
         break;
     }
     return 0;
 }
 
 /* ----------- SCANNING ----------- */
+/* keyboards are matched on the HID service in the advertised 16-bit UUID list */
+static bool adv_has_hid_uuid(const struct ble_hs_adv_fields *f)
+{
+    for (int i = 0; i < f->num_uuids16; i++)
+        if (ble_uuid_u16(&f->uuids16[i].u) == HID_SERVICE_UUID)
+            return true;
+    return false;
+}
+
+/* keeps scanning until every peer slot is taken: the fast profile until
+   the burst runs out, the slow one after that */
 static void start_scan(void)
 {
-    ESP_LOGI(TAG, "Scanning...");
+    if (g_num_peers >= MAX_PEERS || g_connecting || ble_gap_disc_active())
+        return;
+
+    int64_t left_ms = (g_scan_fast_until_us - esp_timer_get_time()) / 1000;
+    scan_profile_t profile = left_ms > 0 ? SCAN_PROFILE_FAST : SCAN_PROFILE_SLOW;
+
+    ESP_LOGI(TAG, "Scanning for %d more peer(s) (%s)...", MAX_PEERS - g_num_peers,
+             profile == SCAN_PROFILE_FAST ? "fast" : "slow");
     struct ble_gap_disc_params p = {0};
-    p.itvl = 0x10;
-    p.window = 0x10;
-    p.passive = 0;
+    p.itvl = profile == SCAN_PROFILE_FAST ? SCAN_FAST_ITVL : SCAN_SLOW_ITVL;
+    p.window = profile == SCAN_PROFILE_FAST ? SCAN_FAST_WINDOW : SCAN_SLOW_WINDOW;
+    p.passive = 1;
 
-    ble_gap_disc(BLE_OWN_ADDR_PUBLIC, BLE_HS_FOREVER, &p, gap_cb, NULL);
+    ble_gap_disc(BLE_OWN_ADDR_PUBLIC, profile == SCAN_PROFILE_FAST ? (int32_t)left_ms : BLE_HS_FOREVER,
+                 &p, gap_cb, NULL);
+}
+
+/* after boot or a lost peer, when a keyboard is most likely advertising fast */
+static void scan_burst(void)
+{
+    g_scan_burst_us = esp_timer_get_time();
+    g_scan_fast_until_us = g_scan_burst_us + (int64_t)SCAN_FAST_DURATION_MS * 1000;
+
+    // a running slow scan is cancelled; DISC_COMPLETE is not reported for that
+    if (ble_gap_disc_active())
+        ble_gap_disc_cancel();
+    start_scan();
 }
 
 /* ----------- SYNC ----------- */
@@ -192,7 +1020,7 @@ static void on_sync(void)
     ble_hs_id_infer_auto(0, &addr[0]);
     ble_hs_id_set_rnd(addr);
 
-    start_scan();
+    scan_burst();
 }
 
 void host_task(void *param)
@@ -205,8 +1033,13 @@ void app_main(void)
 {
     ESP_ERROR_CHECK(nvs_flash_init());
 
+    for (int i = 0; i < MAX_PEERS; i++)
+        g_peers[i].conn_handle = BLE_HS_CONN_HANDLE_NONE;
+
     nimble_port_init();
     ble_hs_cfg.sync_cb = on_sync;
 
+    xTaskCreate(key_event_task, "kbd_events", 3072, NULL, 5, &g_event_task);
+
     nimble_port_freertos_init(host_task);
 }
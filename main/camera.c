@@ -0,0 +1,213 @@
+#include <string.h>
+#include "camera.h"
+#include "esp_camera.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "link_budget.h"
+
+static const char *TAG = "CAMERA";
+
+/* frames the driver had queued at the old size when it was switched */
+#define STALE_FRAMES_MAX 2
+
+static frame_pool_t capture_pool;
+static int jpeg_quality = LINK_QUALITY_BEST;
+/* the preview task and captures share the sensor and its frame size */
+static SemaphoreHandle_t camera_lock;
+static framesize_t frame_size;
+
+/* AI-Thinker ESP32-CAM with an OV2640 */
+static const camera_config_t camera_config = {
+    .pin_pwdn = 32,
+    .pin_reset = -1,
+    .pin_xclk = 0,
+    .pin_sccb_sda = 26,
+    .pin_sccb_scl = 27,
+    .pin_d7 = 35, .pin_d6 = 34, .pin_d5 = 39, .pin_d4 = 36,
+    .pin_d3 = 21, .pin_d2 = 19, .pin_d1 = 18, .pin_d0 = 5,
+    .pin_vsync = 25,
+    .pin_href = 23,
+    .pin_pclk = 22,
+    .xclk_freq_hz = 20000000,
+    .ledc_timer = LEDC_TIMER_0,
+    .ledc_channel = LEDC_CHANNEL_0,
+    .pixel_format = PIXFORMAT_JPEG,
+    /* buffers are allocated for the largest size used */
+    .frame_size = CAMERA_FRAME_SIZE,
+    .jpeg_quality = LINK_QUALITY_BEST,
+    .fb_count = 2,
+    .fb_location = CAMERA_FB_IN_PSRAM,
+    .grab_mode = CAMERA_GRAB_LATEST,
+};
+
+/* stands in for the sensor until esp_camera_init() has run */
+static const uint8_t placeholder_image[75] = {
+    0,0,0,   255,255,255, 0,0,0,   255,255,255, 0,0,0,
+    255,255,255, 0,0,0,   255,255,255, 0,0,0,   255,255,255,
+    0,0,0,   255,255,255, 0,0,0,   255,255,255, 0,0,0,
+    255,255,255, 0,0,0,   255,255,255, 0,0,0,   255,255,255,
+    0,0,0,   255,255,255, 0,0,0,   255,255,255, 0,0,0
+};
+
+esp_err_t camera_init(void)
+{
+    esp_err_t err = frame_pool_init(&capture_pool, CAMERA_POOL_FRAMES, CAMERA_FRAME_MAX_BYTES);
+    if (err != ESP_OK) {
+        return err;
+    }
+    camera_lock = xSemaphoreCreateMutex();
+
+    err = esp_camera_init(&camera_config);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "No camera (%s), sending the placeholder", esp_err_to_name(err));
+        return ESP_OK;
+    }
+    frame_size = CAMERA_FRAME_SIZE;
+    ESP_LOGI(TAG, "Camera up, preview %dx%d", CAMERA_PREVIEW_WIDTH, CAMERA_PREVIEW_HEIGHT);
+    return ESP_OK;
+}
+
+static esp_err_t fill_placeholder(frame_t *fb)
+{
+    if (fb->capacity < sizeof(placeholder_image)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    memcpy(fb->buf, placeholder_image, sizeof(placeholder_image));
+    fb->len = sizeof(placeholder_image);
+    fb->width = 5;
+    fb->height = 5;
+    fb->format = FRAME_FORMAT_RGB888;
+    fb->timestamp_us = esp_timer_get_time();
+    return ESP_OK;
+}
+
+/* a sensor frame at size, width pixels wide, copied into fb */
+static esp_err_t fill(frame_t *fb, framesize_t size, size_t width)
+{
+    sensor_t *sensor = esp_camera_sensor_get();
+    if (sensor == NULL) {
+        return fill_placeholder(fb);
+    }
+
+    xSemaphoreTake(camera_lock, portMAX_DELAY);
+    if (size != frame_size) {
+        if (sensor->set_framesize(sensor, size) != 0) {
+            xSemaphoreGive(camera_lock);
+            return ESP_FAIL;
+        }
+        frame_size = size;
+    }
+    camera_fb_t *cam = esp_camera_fb_get();
+    for (int i = 0; cam != NULL && cam->width != width && i < STALE_FRAMES_MAX; i++) {
+        esp_camera_fb_return(cam);
+        cam = esp_camera_fb_get();
+    }
+    if (cam == NULL) {
+        xSemaphoreGive(camera_lock);
+        return ESP_FAIL;
+    }
+
+    esp_err_t err = cam->width == width ? ESP_OK : ESP_ERR_INVALID_STATE;
+    switch (cam->format) {
+        case PIXFORMAT_JPEG:      fb->format = FRAME_FORMAT_JPEG; break;
+        case PIXFORMAT_RGB888:    fb->format = FRAME_FORMAT_RGB888; break;
+        case PIXFORMAT_GRAYSCALE: fb->format = FRAME_FORMAT_GRAYSCALE; break;
+        default:                  err = ESP_ERR_NOT_SUPPORTED; break;
+    }
+    if (err == ESP_OK && cam->len > fb->capacity) {
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    if (err == ESP_OK) {
+        /* the driver's buffer goes back right away so it keeps capturing */
+        memcpy(fb->buf, cam->buf, cam->len);
+        fb->len = cam->len;
+        fb->width = cam->width;
+        fb->height = cam->height;
+        fb->timestamp_us = esp_timer_get_time();
+    }
+    esp_camera_fb_return(cam);
+    xSemaphoreGive(camera_lock);
+    return err;
+}
+
+esp_err_t camera_fill(frame_t *fb)
+{
+    return fill(fb, CAMERA_PREVIEW_SIZE, CAMERA_PREVIEW_WIDTH);
+}
+
+void camera_set_quality(int quality)
+{
+    if (quality == jpeg_quality) {
+        return;
+    }
+
+    sensor_t *sensor = esp_camera_sensor_get();
+    if (sensor == NULL) {
+        return;     /* the placeholder has no quality */
+    }
+    if (sensor->set_quality(sensor, quality) != 0) {
+        ESP_LOGW(TAG, "Sensor refused JPEG quality %d", quality);
+        return;
+    }
+    jpeg_quality = quality;
+    ESP_LOGI(TAG, "JPEG quality %d", quality);
+}
+
+frame_t *camera_capture(void)
+{
+    camera_set_quality(link_budget_quality());
+
+    frame_t *fb = frame_pool_acquire(&capture_pool);
+    if (fb == NULL) {
+        ESP_LOGW(TAG, "No free frame buffer, dropping capture");
+        return NULL;
+    }
+
+    if (fill(fb, CAMERA_FRAME_SIZE, CAMERA_FRAME_WIDTH) != ESP_OK) {
+        frame_release(fb);
+        return NULL;
+    }
+    return fb;
+}
+
+frame_t *camera_crop(const frame_t *src, const frame_roi_t *roi)
+{
+    size_t bpp;
+    switch (src->format) {
+        case FRAME_FORMAT_RGB888:    bpp = 3; break;
+        case FRAME_FORMAT_GRAYSCALE: bpp = 1; break;
+        default:                     return NULL;   /* JPEG, nothing to crop */
+    }
+    if (src->width <= 0 || src->height <= 0 ||
+        src->len < (size_t)src->width * src->height * bpp) {
+        return NULL;
+    }
+
+    int x0 = roi->x < 0 ? 0 : roi->x;
+    int y0 = roi->y < 0 ? 0 : roi->y;
+    int x1 = roi->x + roi->w > src->width ? src->width : roi->x + roi->w;
+    int y1 = roi->y + roi->h > src->height ? src->height : roi->y + roi->h;
+    if (x1 <= x0 || y1 <= y0) {
+        return NULL;
+    }
+
+    frame_t *dst = frame_pool_acquire(&capture_pool);
+    if (dst == NULL) {
+        return NULL;
+    }
+
+    size_t row = (size_t)(x1 - x0) * bpp;
+    for (int y = y0; y < y1; y++) {
+        memcpy(dst->buf + (y - y0) * row,
+               src->buf + ((size_t)y * src->width + x0) * bpp, row);
+    }
+    dst->len = row * (y1 - y0);
+    dst->width = x1 - x0;
+    dst->height = y1 - y0;
+    dst->format = src->format;
+    dst->timestamp_us = src->timestamp_us;
+    return dst;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include "esp_err.h"
+#include "esp_camera.h"
+#include "frame_pool.h"
+
+#define CAMERA_POOL_FRAMES     4
+#define CAMERA_FRAME_MAX_BYTES (64 * 1024)
+
+/* Captures are VGA JPEG; the preview between them drops the sensor to
+   QQVGA, which is what the pre-roll ring keeps and motion looks at. */
+#define CAMERA_FRAME_SIZE      FRAMESIZE_VGA
+#define CAMERA_FRAME_WIDTH     640
+#define CAMERA_PREVIEW_SIZE    FRAMESIZE_QQVGA
+#define CAMERA_PREVIEW_WIDTH   160
+#define CAMERA_PREVIEW_HEIGHT  120
+
+/* Starts the esp32-camera driver; without a sensor, frames come from a
+   small RGB placeholder instead and this still succeeds. */
+esp_err_t camera_init(void);
+
+/* Captures a full-size frame into a slab from the frame pool. The returned
+   frame holds one reference owned by the caller; NULL when the pool is
+   exhausted. */
+frame_t *camera_capture(void);
+
+/* Grabs a preview-size frame into a buffer the caller already owns */
+esp_err_t camera_fill(frame_t *fb);
+
+/* JPEG quality on the driver scale (lower is better), set on the sensor */
+void camera_set_quality(int quality);
+
+/* Copies the region of interest of an uncompressed frame into a new pooled
+   frame. Returns NULL for compressed frames or when the pool is empty; the
+   sensor's JPEGs are encoded before they reach us, so there is no cropping
+   them short of decoding. */
+frame_t *camera_crop(const frame_t *src, const frame_roi_t *roi);
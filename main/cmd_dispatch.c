@@ -0,0 +1,79 @@
+#include <string.h>
+#include "cmd_dispatch.h"
+#include "esp_log.h"
+
+static const char *TAG = "CMD";
+
+typedef struct {
+    const char *suffix;
+    int suffix_len;
+    cmd_prio_t prio;
+    uint32_t flags;
+    mqtt_cmd_handler_t handler;
+    void *ctx;
+    int next;               /* next command in the same length bucket */
+} cmd_entry_t;
+
+static cmd_entry_t commands[CMD_MAX_COMMANDS];
+static int command_count;
+
+/* first command of each suffix length, -1 when empty */
+static int buckets[CMD_MAX_SUFFIX_LEN + 1] = {
+    [0 ... CMD_MAX_SUFFIX_LEN] = -1
+};
+
+static const char *topic_prefix = "";
+static int prefix_len;
+
+esp_err_t mqtt_register_command(const char *suffix, cmd_prio_t prio, uint32_t flags,
+                                mqtt_cmd_handler_t handler, void *ctx)
+{
+    int len = strlen(suffix);
+    if (len == 0 || len > CMD_MAX_SUFFIX_LEN || handler == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (command_count == CMD_MAX_COMMANDS) {
+        ESP_LOGE(TAG, "Command table full, cannot register %s", suffix);
+        return ESP_ERR_NO_MEM;
+    }
+
+    cmd_entry_t *c = &commands[command_count];
+    c->suffix = suffix;
+    c->suffix_len = len;
+    c->prio = prio;
+    c->flags = flags;
+    c->handler = handler;
+    c->ctx = ctx;
+    c->next = buckets[len];
+    buckets[len] = command_count++;
+    return ESP_OK;
+}
+
+void cmd_dispatch_set_prefix(const char *prefix)
+{
+    topic_prefix = prefix;
+    prefix_len = strlen(prefix);
+}
+
+bool cmd_dispatch(const char *topic, int topic_len, const char *data, int data_len)
+{
+    int len = topic_len - prefix_len;
+    if (len <= 0 || len > CMD_MAX_SUFFIX_LEN ||
+        memcmp(topic, topic_prefix, prefix_len) != 0) {
+        return false;
+    }
+
+    const char *suffix = topic + prefix_len;
+    for (int i = buckets[len]; i >= 0; i = commands[i].next) {
+        if (memcmp(commands[i].suffix, suffix, len) == 0) {
+            const cmd_entry_t *c = &commands[i];
+            if (c->flags & CMD_FLAG_INLINE) {
+                c->handler(data, data_len, c->ctx);
+                return true;
+            }
+            cmd_exec_submit(c->prio, c->flags, c->handler, c->ctx, data, data_len);
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <stdbool.h>
+#include "esp_err.h"
+#include "cmd_exec.h"
+
+/* Incoming command table.
+
+   Commands are registered by topic suffix ("cmd/capture"). Every command
+   topic shares the device prefix and the client subscribes to all of them
+   with a single <prefix>cmd/# wildcard, so a lookup checks the prefix once
+   and then only the handful of suffixes of the same length. Matches are
+   exact: the topic length must equal prefix + suffix. Unless registered
+   with CMD_FLAG_INLINE, the handler is not run inline but submitted to the
+   command executor with the priority and flags given at registration. */
+
+#define CMD_MAX_COMMANDS    16
+#define CMD_MAX_SUFFIX_LEN  32
+
+typedef cmd_fn_t mqtt_cmd_handler_t;
+
+esp_err_t mqtt_register_command(const char *suffix, cmd_prio_t prio, uint32_t flags,
+                                mqtt_cmd_handler_t handler, void *ctx);
+
+void cmd_dispatch_set_prefix(const char *prefix);
+
+/* Returns false when no command matches the topic */
+bool cmd_dispatch(const char *topic, int topic_len, const char *data, int data_len);
@@ -0,0 +1,166 @@
+#include <string.h>
+#include "cmd_exec.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "trace.h"
+
+static const char *TAG = "CMD_EXEC";
+
+typedef struct {
+    cmd_fn_t fn;
+    void *ctx;
+    uint32_t flags;
+    int64_t enqueued_us;
+    int data_len;
+    char data[CMD_PAYLOAD_MAX];
+} cmd_desc_t;
+
+static QueueHandle_t queues[CMD_PRIO_COUNT];
+static SemaphoreHandle_t pending;
+
+static portMUX_TYPE exec_mux = portMUX_INITIALIZER_UNLOCKED;
+static cmd_fn_t coalesce_pending[CMD_MAX_COALESCE];
+static cmd_exec_stats_t stats;
+
+/* true if fn was not pending yet and is now marked */
+static bool coalesce_mark(cmd_fn_t fn)
+{
+    int free_slot = -1;
+
+    portENTER_CRITICAL(&exec_mux);
+    for (int i = 0; i < CMD_MAX_COALESCE; i++) {
+        if (coalesce_pending[i] == fn) {
+            stats.coalesced++;
+            portEXIT_CRITICAL(&exec_mux);
+            return false;
+        }
+        if (coalesce_pending[i] == NULL && free_slot < 0) {
+            free_slot = i;
+        }
+    }
+    /* table full: fall back to queueing without coalescing */
+    if (free_slot >= 0) {
+        coalesce_pending[free_slot] = fn;
+    }
+    portEXIT_CRITICAL(&exec_mux);
+    return true;
+}
+
+static void coalesce_clear(cmd_fn_t fn)
+{
+    portENTER_CRITICAL(&exec_mux);
+    for (int i = 0; i < CMD_MAX_COALESCE; i++) {
+        if (coalesce_pending[i] == fn) {
+            coalesce_pending[i] = NULL;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&exec_mux);
+}
+
+esp_err_t cmd_exec_submit(cmd_prio_t prio, uint32_t flags, cmd_fn_t fn, void *ctx,
+                          const char *data, int data_len)
+{
+    if (prio >= CMD_PRIO_COUNT || fn == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if ((flags & CMD_FLAG_COALESCE) && !coalesce_mark(fn)) {
+        return ESP_OK;
+    }
+
+    cmd_desc_t desc = {
+        .fn = fn,
+        .ctx = ctx,
+        .flags = flags,
+        .enqueued_us = esp_timer_get_time(),
+        .data_len = data_len,
+    };
+    if (desc.data_len > CMD_PAYLOAD_MAX) {
+        ESP_LOGW(TAG, "Payload of %d bytes truncated", data_len);
+        desc.data_len = CMD_PAYLOAD_MAX;
+    }
+    if (desc.data_len > 0) {
+        memcpy(desc.data, data, desc.data_len);
+    }
+
+    if (xQueueSend(queues[prio], &desc, 0) != pdTRUE) {
+        if (flags & CMD_FLAG_COALESCE) {
+            coalesce_clear(fn);
+        }
+        portENTER_CRITICAL(&exec_mux);
+        stats.dropped++;
+        portEXIT_CRITICAL(&exec_mux);
+        ESP_LOGW(TAG, "Queue %d full, command dropped", prio);
+        return ESP_ERR_NO_MEM;
+    }
+    xSemaphoreGive(pending);
+    return ESP_OK;
+}
+
+static void worker_task(void* arg)
+{
+    cmd_desc_t desc;
+
+    while (1) {
+        xSemaphoreTake(pending, portMAX_DELAY);
+
+        for (int p = 0; p < CMD_PRIO_COUNT; p++) {
+            if (xQueueReceive(queues[p], &desc, 0) != pdTRUE) {
+                continue;
+            }
+
+            if (desc.flags & CMD_FLAG_COALESCE) {
+                coalesce_clear(desc.fn);
+            }
+
+            uint32_t waited = esp_timer_get_time() - desc.enqueued_us;
+            portENTER_CRITICAL(&exec_mux);
+            stats.executed++;
+            stats.total_wait_us += waited;
+            if (waited > stats.max_wait_us) {
+                stats.max_wait_us = waited;
+            }
+            portEXIT_CRITICAL(&exec_mux);
+            trace_hist(TRACE_HIST_CMD_WAIT_US, waited);
+
+            trace_begin(TRACE_EV_CMD_EXEC, p);
+            desc.fn(desc.data, desc.data_len, desc.ctx);
+            trace_end(TRACE_EV_CMD_EXEC, p);
+            break;
+        }
+    }
+}
+
+esp_err_t cmd_exec_init(void)
+{
+    for (int p = 0; p < CMD_PRIO_COUNT; p++) {
+        queues[p] = xQueueCreate(CMD_QUEUE_LEN, sizeof(cmd_desc_t));
+        if (queues[p] == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    pending = xSemaphoreCreateCounting(CMD_PRIO_COUNT * CMD_QUEUE_LEN, 0);
+    if (pending == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (int i = 0; i < CMD_WORKERS; i++) {
+        xTaskCreate(worker_task, "cmd_worker", 4096, NULL, 2, NULL);
+    }
+    return ESP_OK;
+}
+
+void cmd_exec_get_stats(cmd_exec_stats_t *out)
+{
+    portENTER_CRITICAL(&exec_mux);
+    *out = stats;
+    portEXIT_CRITICAL(&exec_mux);
+
+    for (int p = 0; p < CMD_PRIO_COUNT; p++) {
+        out->depth[p] = uxQueueMessagesWaiting(queues[p]);
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/* Prioritized command executor.
+
+   Commands received on the MQTT event task are copied into fixed-size
+   descriptors and queued per priority; CMD_WORKERS worker tasks always
+   drain the highest non-empty priority first. Commands registered with
+   CMD_FLAG_COALESCE are queued at most once: a duplicate that arrives
+   while one is still pending is counted and dropped. */
+
+#define CMD_QUEUE_LEN      8
+#define CMD_PAYLOAD_MAX    96
+#define CMD_WORKERS        1
+#define CMD_MAX_COALESCE   8
+
+typedef enum {
+    CMD_PRIO_REBOOT = 0,
+    CMD_PRIO_CAPTURE,
+    CMD_PRIO_LCD,
+    CMD_PRIO_COUNT
+} cmd_prio_t;
+
+#define CMD_FLAG_COALESCE  (1 << 0)
+/* run on the MQTT event task with the whole payload; the handler must
+   only hand the data off */
+#define CMD_FLAG_INLINE    (1 << 1)
+
+typedef void (*cmd_fn_t)(const char *data, int data_len, void *ctx);
+
+typedef struct {
+    uint32_t depth[CMD_PRIO_COUNT];
+    uint32_t executed;
+    uint32_t coalesced;
+    uint32_t dropped;
+    uint32_t max_wait_us;
+    uint64_t total_wait_us;
+} cmd_exec_stats_t;
+
+esp_err_t cmd_exec_init(void);
+
+esp_err_t cmd_exec_submit(cmd_prio_t prio, uint32_t flags, cmd_fn_t fn, void *ctx,
+                          const char *data, int data_len);
+
+void cmd_exec_get_stats(cmd_exec_stats_t *out);
@@ -0,0 +1,82 @@
+#include <string.h>
+#include "frame_pool.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+static const char *TAG = "FRAME_POOL";
+
+static void *alloc_slab(size_t size)
+{
+    void *p = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (p == NULL) {
+        p = heap_caps_malloc(size, MALLOC_CAP_8BIT);
+    }
+    return p;
+}
+
+esp_err_t frame_pool_init(frame_pool_t *pool, size_t count, size_t slab_size)
+{
+    if (count == 0 || count > FRAME_POOL_MAX_SLABS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(pool, 0, sizeof(*pool));
+    pool->count = count;
+    pool->slab_size = slab_size;
+
+    for (size_t i = 0; i < count; i++) {
+        frame_t *fb = &pool->frames[i];
+        fb->buf = alloc_slab(slab_size);
+        if (fb->buf == NULL) {
+            ESP_LOGE(TAG, "Out of memory for slab %u (%u bytes)", (unsigned)i, (unsigned)slab_size);
+            return ESP_ERR_NO_MEM;
+        }
+        fb->capacity = slab_size;
+        fb->index = i;
+        fb->pool = pool;
+        atomic_init(&fb->refs, 0);
+    }
+
+    unsigned mask = count == 32 ? 0xFFFFFFFFu : ((1u << count) - 1);
+    atomic_init(&pool->free_mask, mask);
+
+    ESP_LOGI(TAG, "Pool ready: %u slabs of %u bytes", (unsigned)count, (unsigned)slab_size);
+    return ESP_OK;
+}
+
+frame_t *frame_pool_acquire(frame_pool_t *pool)
+{
+    unsigned mask = atomic_load(&pool->free_mask);
+
+    while (mask != 0) {
+        unsigned bit = mask & -mask;
+        if (atomic_compare_exchange_weak(&pool->free_mask, &mask, mask & ~bit)) {
+            frame_t *fb = &pool->frames[__builtin_ctz(bit)];
+            fb->len = 0;
+            fb->width = 0;
+            fb->height = 0;
+            fb->format = FRAME_FORMAT_JPEG;
+            fb->timestamp_us = 0;
+            atomic_store(&fb->refs, 1);
+            return fb;
+        }
+    }
+    return NULL;
+}
+
+size_t frame_pool_available(const frame_pool_t *pool)
+{
+    return __builtin_popcount(atomic_load(&pool->free_mask));
+}
+
+void frame_ref(frame_t *fb)
+{
+    atomic_fetch_add(&fb->refs, 1);
+}
+
+void frame_release(frame_t *fb)
+{
+    if (atomic_fetch_sub(&fb->refs, 1) == 1) {
+        atomic_fetch_or(&fb->pool->free_mask, 1u << fb->index);
+    }
+}
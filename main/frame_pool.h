@@ -0,0 +1,60 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "esp_err.h"
+
+/* Fixed-capacity pool of frame buffers.
+
+   All slabs are allocated once by frame_pool_init() (PSRAM when available)
+   and then handed around as refcounted frame_t handles. Acquire and release
+   are lock-free, so any task may take or drop a reference without blocking;
+   the slab returns to the pool when the last reference is released. */
+
+#define FRAME_POOL_MAX_SLABS 32
+
+struct frame_pool;
+
+typedef struct {
+    int x;
+    int y;
+    int w;
+    int h;
+} frame_roi_t;
+
+typedef enum {
+    FRAME_FORMAT_JPEG,          /* what the sensor delivers; nothing to crop or diff */
+    FRAME_FORMAT_RGB888,
+    FRAME_FORMAT_GRAYSCALE,
+} frame_format_t;
+
+typedef struct {
+    uint8_t *buf;
+    size_t capacity;
+    size_t len;
+    int width;
+    int height;
+    frame_format_t format;
+    int64_t timestamp_us;
+
+    atomic_uint refs;
+    uint8_t index;
+    struct frame_pool *pool;
+} frame_t;
+
+typedef struct frame_pool {
+    frame_t frames[FRAME_POOL_MAX_SLABS];
+    atomic_uint free_mask;
+    size_t count;
+    size_t slab_size;
+} frame_pool_t;
+
+esp_err_t frame_pool_init(frame_pool_t *pool, size_t count, size_t slab_size);
+
+/* Returns a frame holding one reference, or NULL if every slab is in use */
+frame_t *frame_pool_acquire(frame_pool_t *pool);
+
+size_t frame_pool_available(const frame_pool_t *pool);
+
+void frame_ref(frame_t *fb);
+void frame_release(frame_t *fb);
@@ -0,0 +1,325 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include "frame_stream.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "link_budget.h"
+#include "trace.h"
+#include "mqqt_client.h"
+#include "power.h"
+#include "sdkconfig.h"
+
+static const char *TAG = "FRAME_STREAM";
+
+/* one frame at a time; window of chunks waiting for PUBACK */
+static SemaphoreHandle_t stream_lock;
+static SemaphoreHandle_t inflight_sem;
+
+static portMUX_TYPE inflight_mux = portMUX_INITIALIZER_UNLOCKED;
+static struct {
+    int msg_id;
+    uint32_t frame_id;
+    uint32_t bytes;
+    int64_t sent_us;
+} inflight[FRAME_STREAM_MAX_INFLIGHT];
+/* PUBACKs that raced ahead of inflight_add(). Only collected while a chunk
+   is being published, so acknowledgements of other messages cannot pile up
+   here and match a later chunk. */
+#define EARLY_ACKS 8
+static int early_acks[EARLY_ACKS];
+static int early_next;
+static bool chunk_publishing;
+/* Set for the frame being sent only: chunks of an earlier, aborted frame
+   keep their window slot until acknowledged or deleted, but their fate no
+   longer decides anything. Under inflight_mux, like stats. */
+static uint32_t current_frame;
+static volatile bool stream_aborted;
+static const char *abort_reason;
+
+#if !CONFIG_DOORCAM_MQTT_V5
+/* header + chunk, without correlation data to carry the header */
+static uint8_t chunk_copy[sizeof(frame_chunk_hdr_t) + FRAME_STREAM_CHUNK_SIZE];
+#endif
+
+static uint32_t next_frame_id;
+static frame_stream_stats_t stats;     /* under inflight_mux */
+
+void frame_stream_init(void)
+{
+    stream_lock = xSemaphoreCreateMutex();
+    inflight_sem = xSemaphoreCreateCounting(FRAME_STREAM_MAX_INFLIGHT, FRAME_STREAM_MAX_INFLIGHT);
+    configASSERT(stream_lock != NULL && inflight_sem != NULL);
+
+    for (int i = 0; i < FRAME_STREAM_MAX_INFLIGHT; i++) {
+        inflight[i].msg_id = -1;
+    }
+    for (int i = 0; i < EARLY_ACKS; i++) {
+        early_acks[i] = -1;
+    }
+}
+
+/* lock held */
+static void early_acks_clear(void)
+{
+    chunk_publishing = false;
+    for (int i = 0; i < EARLY_ACKS; i++) {
+        early_acks[i] = -1;
+    }
+}
+
+/* inflight_mux held */
+static void abort_frame(const char *reason)
+{
+    if (!stream_aborted) {
+        stream_aborted = true;
+        abort_reason = reason;
+    }
+}
+
+static void inflight_add(int msg_id, uint32_t frame_id, size_t bytes, int64_t sent_us)
+{
+    portENTER_CRITICAL(&inflight_mux);
+    for (int i = 0; i < EARLY_ACKS; i++) {
+        if (early_acks[i] == msg_id) {
+            early_acks_clear();
+            portEXIT_CRITICAL(&inflight_mux);
+            trace_hist(TRACE_HIST_PUBACK_US, esp_timer_get_time() - sent_us);
+            link_budget_on_ack(bytes, sent_us);
+            xSemaphoreGive(inflight_sem);
+            return;
+        }
+    }
+    for (int i = 0; i < FRAME_STREAM_MAX_INFLIGHT; i++) {
+        if (inflight[i].msg_id < 0) {
+            inflight[i].msg_id = msg_id;
+            inflight[i].frame_id = frame_id;
+            inflight[i].bytes = bytes;
+            inflight[i].sent_us = sent_us;
+            break;
+        }
+    }
+    early_acks_clear();
+    portEXIT_CRITICAL(&inflight_mux);
+}
+
+void frame_stream_on_published(int msg_id)
+{
+    bool found = false;
+    uint32_t bytes = 0;
+    int64_t sent_us = 0;
+
+    portENTER_CRITICAL(&inflight_mux);
+    for (int i = 0; i < FRAME_STREAM_MAX_INFLIGHT; i++) {
+        if (inflight[i].msg_id == msg_id) {
+            inflight[i].msg_id = -1;
+            bytes = inflight[i].bytes;
+            sent_us = inflight[i].sent_us;
+            found = true;
+            break;
+        }
+    }
+    if (!found && chunk_publishing) {
+        early_acks[early_next] = msg_id;
+        early_next = (early_next + 1) % EARLY_ACKS;
+    }
+    portEXIT_CRITICAL(&inflight_mux);
+
+    if (found) {
+        trace_hist(TRACE_HIST_PUBACK_US, esp_timer_get_time() - sent_us);
+        link_budget_on_ack(bytes, sent_us);
+        xSemaphoreGive(inflight_sem);
+    }
+}
+
+/* the client gave up on a chunk, so its frame cannot be completed */
+void frame_stream_on_deleted(int msg_id)
+{
+    bool found = false;
+
+    portENTER_CRITICAL(&inflight_mux);
+    for (int i = 0; i < FRAME_STREAM_MAX_INFLIGHT; i++) {
+        if (inflight[i].msg_id == msg_id) {
+            inflight[i].msg_id = -1;
+            if (inflight[i].frame_id == current_frame) {
+                abort_frame("a chunk expired unacknowledged");
+            }
+            stats.chunks_deleted++;
+            found = true;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&inflight_mux);
+
+    if (found) {
+        xSemaphoreGive(inflight_sem);
+    }
+}
+
+void frame_stream_on_disconnected(void)
+{
+    int released = 0;
+
+    portENTER_CRITICAL(&inflight_mux);
+    for (int i = 0; i < FRAME_STREAM_MAX_INFLIGHT; i++) {
+        if (inflight[i].msg_id >= 0) {
+            inflight[i].msg_id = -1;
+            released++;
+        }
+    }
+    abort_frame("the connection dropped");
+    portEXIT_CRITICAL(&inflight_mux);
+
+    while (released--) {
+        xSemaphoreGive(inflight_sem);
+    }
+}
+
+/* stats are also written from the MQTT task */
+static void count_stat(uint32_t *counter)
+{
+    portENTER_CRITICAL(&inflight_mux);
+    (*counter)++;
+    portEXIT_CRITICAL(&inflight_mux);
+}
+
+/* wait until every chunk of the current frame is acknowledged */
+static bool wait_drained(void)
+{
+    int taken = 0;
+    bool ok = true;
+
+    while (taken < FRAME_STREAM_MAX_INFLIGHT) {
+        if (xSemaphoreTake(inflight_sem, pdMS_TO_TICKS(FRAME_STREAM_ACK_TIMEOUT_MS)) != pdTRUE) {
+            ok = false;
+            break;
+        }
+        taken++;
+    }
+    while (taken--) {
+        xSemaphoreGive(inflight_sem);
+    }
+    return ok;
+}
+
+static int publish_chunk(const frame_chunk_hdr_t *hdr, const uint8_t *data, size_t n)
+{
+#if CONFIG_DOORCAM_MQTT_V5
+    return mqtt_publish_tagged(TOPIC_CAM_IMAGE, hdr, sizeof(*hdr), (const char *)data, n, 1);
+#else
+    memcpy(chunk_copy, hdr, sizeof(*hdr));
+    memcpy(chunk_copy + sizeof(*hdr), data, n);
+    portENTER_CRITICAL(&inflight_mux);
+    stats.bytes_copied += n;
+    portEXIT_CRITICAL(&inflight_mux);
+    return mqtt_publish_topic(TOPIC_CAM_IMAGE, (const char *)chunk_copy, sizeof(*hdr) + n, 1, false);
+#endif
+}
+
+esp_err_t frame_stream_publish(const frame_t *fb)
+{
+    const uint8_t *buf = fb->buf;
+    size_t len = fb->len;
+    size_t chunks = (len + FRAME_STREAM_CHUNK_SIZE - 1) / FRAME_STREAM_CHUNK_SIZE;
+
+    if (buf == NULL || len == 0 || chunks > UINT16_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(stream_lock, portMAX_DELAY);
+    uint32_t frame_id = next_frame_id++;
+    portENTER_CRITICAL(&inflight_mux);
+    current_frame = frame_id;
+    stream_aborted = false;
+    portEXIT_CRITICAL(&inflight_mux);
+
+    char json[200];
+    int n = snprintf(json, sizeof(json),
+                     "{\"frame\":%lu,\"width\":%d,\"height\":%d,\"size\":%u,\"chunk_size\":%d,"
+                     "\"chunks\":%u,\"captured_ms\":%lu",
+                     (unsigned long)frame_id, fb->width, fb->height, (unsigned)len,
+                     FRAME_STREAM_CHUNK_SIZE, (unsigned)chunks, (unsigned long)(fb->timestamp_us / 1000));
+#if CONFIG_DOORCAM_LOW_POWER_MODE
+    n += snprintf(json + n, sizeof(json) - n, ",\"last_wake_to_publish_ms\":%lu",
+                  (unsigned long)power_rtc_state()->last_wake_to_publish_ms);
+#endif
+    snprintf(json + n, sizeof(json) - n, "}");
+
+    esp_err_t err = ESP_OK;
+    if (mqtt_publish_topic(TOPIC_CAM_META, json, 0, 1, false) < 0) {
+        ESP_LOGE(TAG, "Failed to publish metadata for frame %lu", (unsigned long)frame_id);
+        err = ESP_FAIL;
+        goto out;
+    }
+
+    for (size_t seq = 0; seq < chunks; seq++) {
+        if (xSemaphoreTake(inflight_sem, pdMS_TO_TICKS(FRAME_STREAM_ACK_TIMEOUT_MS)) != pdTRUE) {
+            ESP_LOGW(TAG, "Frame %lu: no PUBACK within %d ms, aborting at chunk %u/%u",
+                     (unsigned long)frame_id, FRAME_STREAM_ACK_TIMEOUT_MS,
+                     (unsigned)seq, (unsigned)chunks);
+            count_stat(&stats.ack_timeouts);
+            err = ESP_ERR_TIMEOUT;
+            goto out;
+        }
+        if (stream_aborted) {
+            xSemaphoreGive(inflight_sem);
+            ESP_LOGW(TAG, "Frame %lu: %s, aborting at chunk %u/%u", (unsigned long)frame_id,
+                     abort_reason, (unsigned)seq, (unsigned)chunks);
+            err = ESP_FAIL;
+            goto out;
+        }
+
+        size_t off = seq * FRAME_STREAM_CHUNK_SIZE;
+        size_t n = len - off < FRAME_STREAM_CHUNK_SIZE ? len - off : FRAME_STREAM_CHUNK_SIZE;
+
+        frame_chunk_hdr_t hdr = { .frame_id = frame_id, .chunk_idx = seq, .total = chunks };
+
+        portENTER_CRITICAL(&inflight_mux);
+        chunk_publishing = true;
+        portEXIT_CRITICAL(&inflight_mux);
+
+        int64_t sent_us = esp_timer_get_time();
+        int msg_id = publish_chunk(&hdr, buf + off, n);
+        if (msg_id < 0) {
+            portENTER_CRITICAL(&inflight_mux);
+            early_acks_clear();
+            portEXIT_CRITICAL(&inflight_mux);
+            xSemaphoreGive(inflight_sem);
+            ESP_LOGE(TAG, "Frame %lu: failed to publish chunk %u", (unsigned long)frame_id, (unsigned)seq);
+            err = ESP_FAIL;
+            goto out;
+        }
+        inflight_add(msg_id, frame_id, n, sent_us);
+        count_stat(&stats.chunks_sent);
+    }
+
+    if (!wait_drained()) {
+        ESP_LOGW(TAG, "Frame %lu: no PUBACK for the last chunks within %d ms",
+                 (unsigned long)frame_id, FRAME_STREAM_ACK_TIMEOUT_MS);
+        count_stat(&stats.ack_timeouts);
+        err = ESP_ERR_TIMEOUT;
+    } else if (stream_aborted) {
+        ESP_LOGW(TAG, "Frame %lu: %s after the last chunk", (unsigned long)frame_id, abort_reason);
+        err = ESP_FAIL;
+    }
+
+out:
+    if (err == ESP_OK) {
+        count_stat(&stats.frames_sent);
+        ESP_LOGI(TAG, "Frame %lu sent: %u bytes in %u chunks",
+                 (unsigned long)frame_id, (unsigned)len, (unsigned)chunks);
+    } else {
+        count_stat(&stats.frames_aborted);
+    }
+    xSemaphoreGive(stream_lock);
+    return err;
+}
+
+void frame_stream_get_stats(frame_stream_stats_t *out)
+{
+    portENTER_CRITICAL(&inflight_mux);
+    *out = stats;
+    portEXIT_CRITICAL(&inflight_mux);
+}
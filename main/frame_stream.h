@@ -0,0 +1,58 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "frame_pool.h"
+
+/* Chunked frame publisher.
+
+   A frame is announced on cam/img_metadata as
+   {"frame":<id>,"width":..,"height":..,"size":..,"chunk_size":..,"chunks":..,
+    "captured_ms":..}
+   and then sent as <chunks> ordered QoS 1 messages on cam/image. Every chunk
+   carries a frame_chunk_hdr_t, so a receiver can reassemble frames without
+   relying on message order and notice chunks that never arrived. With
+   MQTT 5 the header travels as the message's correlation data and the chunk
+   is published straight out of the caller's buffer; with MQTT 3.1.1 it is
+   prepended to a copy of the chunk. At most FRAME_STREAM_MAX_INFLIGHT chunks
+   wait for a PUBACK at any time, so the client outbox never holds more than
+   FRAME_STREAM_MAX_INFLIGHT * FRAME_STREAM_CHUNK_SIZE bytes of image data.
+   captured_ms is milliseconds since boot (or deep-sleep wake) at capture.
+   With CONFIG_DOORCAM_LOW_POWER_MODE the object also carries
+   last_wake_to_publish_ms, the previous duty cycle's wake-to-last-publish
+   time. */
+
+#define FRAME_STREAM_CHUNK_SIZE      4096
+#define FRAME_STREAM_MAX_INFLIGHT    4
+#define FRAME_STREAM_ACK_TIMEOUT_MS  5000
+
+/* little-endian */
+typedef struct __attribute__((packed)) {
+    uint32_t frame_id;
+    uint16_t chunk_idx;
+    uint16_t total;
+} frame_chunk_hdr_t;
+
+typedef struct {
+    uint32_t frames_sent;
+    uint32_t frames_aborted;
+    uint32_t chunks_sent;
+    uint32_t chunks_deleted;    /* expired from the client outbox unacknowledged */
+    uint32_t ack_timeouts;
+    uint64_t bytes_copied;      /* image bytes copied before handing them to the client */
+} frame_stream_stats_t;
+
+void frame_stream_init(void);
+
+/* Blocks until every chunk of the frame is acknowledged, so the frame may be
+   released as soon as this returns. Must not be called from the MQTT event
+   task, since acknowledgements are delivered there. */
+esp_err_t frame_stream_publish(const frame_t *fb);
+
+/* Called from mqtt_event_handler; PUBACKs and deletions of other messages
+   are ignored */
+void frame_stream_on_published(int msg_id);
+void frame_stream_on_deleted(int msg_id);
+void frame_stream_on_disconnected(void);
+
+void frame_stream_get_stats(frame_stream_stats_t *out);
@@ -0,0 +1,143 @@
+#include <string.h>
+#include "link_budget.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+static const char *TAG = "LINK";
+
+static portMUX_TYPE link_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/* acks are handled in bursts, so the rate is taken over a span of them */
+#define RATE_SPAN_US    200000
+
+static uint32_t throughput_bps;
+static int64_t span_start_us;
+static int64_t last_ack_us;
+static uint32_t span_bytes;
+static uint32_t snapshot_ms[LINK_WINDOW];
+static int snapshot_count;
+static int snapshot_next;
+static uint32_t p95_ms;
+static int quality = LINK_QUALITY_BEST;
+
+/* called with link_mux held */
+static void rate_sample(int64_t end_us)
+{
+    int64_t span = end_us - span_start_us;
+    if (span_bytes > 0 && span > 0) {
+        uint32_t sample = (uint64_t)span_bytes * 1000000 / span;
+        /* EWMA, alpha = 1/4 */
+        throughput_bps = throughput_bps ? throughput_bps - (throughput_bps >> 2) + (sample >> 2) : sample;
+    }
+    span_bytes = 0;
+}
+
+void link_budget_on_ack(size_t bytes, int64_t sent_us)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&link_mux);
+    /* sent after the previous ack: the link sat idle in between, which is
+       no part of its rate */
+    if (sent_us >= last_ack_us) {
+        rate_sample(last_ack_us);
+        span_start_us = sent_us;
+    }
+    span_bytes += bytes;
+    last_ack_us = now;
+    if (now - span_start_us >= RATE_SPAN_US) {
+        rate_sample(now);
+        span_start_us = now;
+    }
+    portEXIT_CRITICAL(&link_mux);
+}
+
+static uint32_t window_p95(void)
+{
+    uint32_t sorted[LINK_WINDOW];
+    int n = snapshot_count;
+
+    memcpy(sorted, snapshot_ms, n * sizeof(sorted[0]));
+    for (int i = 1; i < n; i++) {
+        uint32_t v = sorted[i];
+        int j = i;
+        while (j > 0 && sorted[j - 1] > v) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = v;
+    }
+    return sorted[(n * 95 + 99) / 100 - 1];
+}
+
+/* the quality at which a snapshot of bytes, taken at the current quality,
+   goes out in half the target at the measured delivery rate */
+static int quality_that_fits(size_t bytes)
+{
+    portENTER_CRITICAL(&link_mux);
+    uint32_t bps = throughput_bps;
+    portEXIT_CRITICAL(&link_mux);
+
+    if (bps == 0) {
+        return LINK_QUALITY_BEST;       /* nothing measured yet */
+    }
+    uint64_t budget = (uint64_t)bps * LINK_TARGET_P95_MS / 2 / 1000;
+    return (uint64_t)bytes * quality / budget + 1;
+}
+
+void link_budget_on_snapshot(size_t bytes, int64_t latency_us)
+{
+    snapshot_ms[snapshot_next] = latency_us / 1000;
+    snapshot_next = (snapshot_next + 1) % LINK_WINDOW;
+    if (snapshot_count < LINK_WINDOW) {
+        snapshot_count++;
+    }
+
+    p95_ms = window_p95();
+    if (snapshot_count < LINK_MIN_SAMPLES) {
+        return;
+    }
+
+    int fit = quality_that_fits(bytes);
+    int next = quality;
+    if (p95_ms > LINK_TARGET_P95_MS) {
+        next = quality + LINK_QUALITY_STEP_DOWN;
+        if (fit > next) {
+            next = fit;
+        }
+    } else if (p95_ms < LINK_TARGET_P95_MS / 2) {
+        next = quality - LINK_QUALITY_STEP_UP;
+        if (fit < next) {
+            next = fit;
+        } else if (fit > next) {
+            next = fit < quality ? fit : quality;
+        }
+    }
+    if (next < LINK_QUALITY_BEST) next = LINK_QUALITY_BEST;
+    if (next > LINK_QUALITY_WORST) next = LINK_QUALITY_WORST;
+
+    if (next != quality) {
+        ESP_LOGI(TAG, "p95 %lu ms, %lu B/s -> quality %d",
+                 (unsigned long)p95_ms, (unsigned long)throughput_bps, next);
+        quality = next;
+        /* the window so far says nothing about the new quality */
+        snapshot_count = 0;
+        snapshot_next = 0;
+    }
+}
+
+int link_budget_quality(void)
+{
+    return quality;
+}
+
+uint32_t link_budget_throughput(void)
+{
+    return throughput_bps;
+}
+
+uint32_t link_budget_p95_ms(void)
+{
+    return p95_ms;
+}
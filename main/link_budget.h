@@ -0,0 +1,33 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/* Uplink feedback loop for snapshot quality.
+
+   frame_stream reports every acknowledged chunk, from which the delivery
+   rate of the link is estimated, and the image publisher reports the size
+   and publish-start-to-acknowledged time of every snapshot. Once
+   LINK_MIN_SAMPLES snapshots were sent at the current quality, quality
+   moves towards the one at which, by the delivery rate, a snapshot takes
+   half of LINK_TARGET_P95_MS: down by at least a step when their p95
+   exceeds the target, up when it is under half the target, by a step
+   when the rate does not allow more. In between it stays put. Every
+   change starts a new window, so one slow spell moves it once rather
+   than on every snapshot that still has it in its window. Quality uses the camera driver scale: lower is
+   better, and JPEG size goes roughly as 1 / quality. */
+
+#define LINK_TARGET_P95_MS     2000
+#define LINK_WINDOW            16
+#define LINK_MIN_SAMPLES       4
+#define LINK_QUALITY_BEST      10
+#define LINK_QUALITY_WORST     50
+#define LINK_QUALITY_STEP_UP   2
+#define LINK_QUALITY_STEP_DOWN 6
+
+/* a chunk of bytes, sent at sent_us, was acknowledged just now */
+void link_budget_on_ack(size_t bytes, int64_t sent_us);
+void link_budget_on_snapshot(size_t bytes, int64_t latency_us);
+
+int link_budget_quality(void);
+uint32_t link_budget_throughput(void);   /* delivery rate, bytes per second, smoothed */
+uint32_t link_budget_p95_ms(void);
@@ -1,6 +1,11 @@
 #include "mqqt_client.h"
+#include "camera.h"
+#include "preroll.h"
+#include "outbox.h"
+#include "power.h"
 #include "nvs_flash.h"
 #include "esp_log.h"
+#include "sdkconfig.h"
 
 void app_main(void) {
     esp_err_t ret = nvs_flash_init();
@@ -12,11 +17,22 @@ void app_main(void) {
     esp_log_level_set("*", ESP_LOG_INFO);
     ESP_ERROR_CHECK(ret);
 
+    ESP_ERROR_CHECK(camera_init());
+    outbox_init();
+
+#if CONFIG_DOORCAM_LOW_POWER_MODE
+    power_run_duty_cycle();
+#else
+    ESP_ERROR_CHECK(preroll_init());
+
     wifi_init();
 
     mqtt_init();
 
+    doorbell_init();
+
     while (true) {
         vTaskDelay(pdMS_TO_TICKS(1000));
     }
+#endif
 }
\ No newline at end of file
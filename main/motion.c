@@ -0,0 +1,162 @@
+#include <string.h>
+#include "motion.h"
+#include "esp_log.h"
+
+static const char *TAG = "MOTION";
+
+_Static_assert(MOTION_WIDTH % MOTION_BLOCK == 0 && MOTION_HEIGHT % MOTION_BLOCK == 0,
+               "the block grid must cover the whole image");
+_Static_assert(MOTION_BLOCK % 4 == 0, "the SAD kernel reads whole words");
+
+/* word loads through memcpy: any alignment, no aliasing of the byte arrays */
+static inline uint32_t load32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint8_t gray[MOTION_WIDTH * MOTION_HEIGHT] __attribute__((aligned(4)));
+static uint8_t background[MOTION_WIDTH * MOTION_HEIGHT] __attribute__((aligned(4)));
+static bool have_background;
+static uint32_t frame_count;
+
+uint32_t motion_sad_block_ref(const uint8_t *a, const uint8_t *b, int stride)
+{
+    uint32_t sad = 0;
+    for (int y = 0; y < MOTION_BLOCK; y++) {
+        for (int x = 0; x < MOTION_BLOCK; x++) {
+            int d = a[x] - b[x];
+            sad += d < 0 ? -d : d;
+        }
+        a += stride;
+        b += stride;
+    }
+    return sad;
+}
+
+/* |a - b| for the two bytes held in the low half of each 16-bit lane */
+static inline uint32_t absdiff_lanes(uint32_t a, uint32_t b)
+{
+    uint32_t d = (a + 0x01000100u) - b;              /* 256 + a - b, no borrow */
+    uint32_t neg = ((d >> 8) & 0x00010001u) ^ 0x00010001u;  /* 1 where a < b */
+    uint32_t low = d & 0x00FF00FFu;
+    uint32_t m = neg * 0xFFu;
+    return (low ^ m) + neg;
+}
+
+uint32_t motion_sad_block(const uint8_t *a, const uint8_t *b, int stride)
+{
+    /* two 16-bit lane sums; 64 pixels * 255 fits easily */
+    uint32_t acc = 0;
+
+    for (int y = 0; y < MOTION_BLOCK; y++) {
+        for (int w = 0; w < MOTION_BLOCK / 4; w++) {
+            uint32_t va = load32(a + 4 * w);
+            uint32_t vb = load32(b + 4 * w);
+            acc += absdiff_lanes(va & 0x00FF00FFu, vb & 0x00FF00FFu);
+            acc += absdiff_lanes((va >> 8) & 0x00FF00FFu, (vb >> 8) & 0x00FF00FFu);
+        }
+        a += stride;
+        b += stride;
+    }
+    return (acc & 0xFFFFu) + (acc >> 16);
+}
+
+/* per-byte rounding-down average of two words */
+static inline uint32_t avg4(uint32_t a, uint32_t b)
+{
+    return (a & b) + (((a ^ b) & 0xFEFEFEFEu) >> 1);
+}
+
+static void update_background(void)
+{
+    for (size_t i = 0; i < sizeof(gray); i += 4) {
+        uint32_t v = avg4(load32(&background[i]), load32(&gray[i]));
+        memcpy(&background[i], &v, sizeof(v));
+    }
+}
+
+/* nearest-neighbour RGB888 or grayscale -> luma into the working buffer */
+static void downscale(const frame_t *fb, int bpp)
+{
+    for (int y = 0; y < MOTION_HEIGHT; y++) {
+        const uint8_t *row = fb->buf + (size_t)(y * fb->height / MOTION_HEIGHT) * fb->width * bpp;
+        uint8_t *out = &gray[y * MOTION_WIDTH];
+
+        for (int x = 0; x < MOTION_WIDTH; x++) {
+            const uint8_t *px = row + (x * fb->width / MOTION_WIDTH) * bpp;
+            out[x] = bpp == 1 ? px[0] : (77 * px[0] + 150 * px[1] + 29 * px[2]) >> 8;
+        }
+    }
+}
+
+void motion_init(void)
+{
+    have_background = false;
+    frame_count = 0;
+}
+
+bool motion_process(const frame_t *fb, motion_result_t *res)
+{
+    int bpp;
+    switch (fb->format) {
+        case FRAME_FORMAT_RGB888:    bpp = 3; break;
+        case FRAME_FORMAT_GRAYSCALE: bpp = 1; break;
+        default:                     return false;
+    }
+    if (fb->width <= 0 || fb->height <= 0 || fb->len < (size_t)fb->width * fb->height * bpp) {
+        return false;
+    }
+
+    downscale(fb, bpp);
+
+    if (!have_background) {
+        memcpy(background, gray, sizeof(gray));
+        have_background = true;
+        return false;
+    }
+
+    const uint32_t threshold = MOTION_PIXEL_THRESHOLD * MOTION_BLOCK * MOTION_BLOCK;
+    int changed = 0;
+    int bx_min = MOTION_BLOCKS_X, bx_max = -1;
+    int by_min = MOTION_BLOCKS_Y, by_max = -1;
+
+    for (int by = 0; by < MOTION_BLOCKS_Y; by++) {
+        for (int bx = 0; bx < MOTION_BLOCKS_X; bx++) {
+            size_t off = (size_t)by * MOTION_BLOCK * MOTION_WIDTH + bx * MOTION_BLOCK;
+#if MOTION_USE_SWAR
+            uint32_t sad = motion_sad_block(&gray[off], &background[off], MOTION_WIDTH);
+#else
+            uint32_t sad = motion_sad_block_ref(&gray[off], &background[off], MOTION_WIDTH);
+#endif
+            if (sad > threshold) {
+                changed++;
+                if (bx < bx_min) bx_min = bx;
+                if (bx > bx_max) bx_max = bx;
+                if (by < by_min) by_min = by;
+                if (by > by_max) by_max = by;
+            }
+        }
+    }
+
+    if (++frame_count % MOTION_BG_UPDATE_EVERY == 0) {
+        update_background();
+    }
+
+    if (changed < MOTION_MIN_BLOCKS) {
+        return false;
+    }
+
+    res->changed_blocks = changed;
+    res->src_width = fb->width;
+    res->src_height = fb->height;
+    res->roi.x = bx_min * MOTION_BLOCK * fb->width / MOTION_WIDTH;
+    res->roi.y = by_min * MOTION_BLOCK * fb->height / MOTION_HEIGHT;
+    res->roi.w = (bx_max + 1) * MOTION_BLOCK * fb->width / MOTION_WIDTH - res->roi.x;
+    res->roi.h = (by_max + 1) * MOTION_BLOCK * fb->height / MOTION_HEIGHT - res->roi.y;
+
+    ESP_LOGD(TAG, "%d blocks changed, roi %d,%d %dx%d", changed,
+             res->roi.x, res->roi.y, res->roi.w, res->roi.h);
+    return true;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "frame_pool.h"
+
+/* Block based motion detector on a downscaled grayscale image.
+
+   Every RGB888 or grayscale preview frame is reduced to MOTION_WIDTH x
+   MOTION_HEIGHT luma and compared block by block (sum of absolute
+   differences) against a slowly adapting background. The SAD kernel works on four pixels per 32-bit word;
+   motion_sad_block_ref() is the plain scalar version it must agree with. */
+
+/* whole blocks both ways, so no edge of the picture goes unchecked */
+#define MOTION_WIDTH             80
+#define MOTION_HEIGHT            64
+#define MOTION_BLOCK             8
+#define MOTION_BLOCKS_X          (MOTION_WIDTH / MOTION_BLOCK)
+#define MOTION_BLOCKS_Y          (MOTION_HEIGHT / MOTION_BLOCK)
+
+/* mean absolute difference per pixel that marks a block as changed */
+#define MOTION_PIXEL_THRESHOLD   20
+#define MOTION_MIN_BLOCKS        3
+/* background moves halfway towards the current frame every N frames */
+#define MOTION_BG_UPDATE_EVERY   4
+#define MOTION_COOLDOWN_MS       5000
+
+#define MOTION_USE_SWAR          1
+
+typedef struct {
+    int changed_blocks;
+    frame_roi_t roi;      /* bounding box in source frame pixels */
+    int src_width;
+    int src_height;
+} motion_result_t;
+
+void motion_init(void);
+
+/* Returns true when enough blocks changed; res describes the motion */
+bool motion_process(const frame_t *fb, motion_result_t *res);
+
+uint32_t motion_sad_block(const uint8_t *a, const uint8_t *b, int stride);
+uint32_t motion_sad_block_ref(const uint8_t *a, const uint8_t *b, int stride);
@@ -1,22 +1,42 @@
 #include <stdint.h>    
 #include <sys/types.h>  
 #include <sys/select.h> 
+#include <stdlib.h>
+#include <string.h>
 #include "mqtt_client.h"
+#include "mqqt_client.h"
 #include "wifi.h"
 #include "freertos/event_groups.h"
 #include "esp_log.h"
+#include "frame_stream.h"
+#include "camera.h"
+#include "preroll.h"
+#include "link_budget.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "esp_system.h"
+#include "telemetry.h"
+#include "cmd_dispatch.h"
+#include "outbox.h"
+#include "power.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "trace.h"
+#include "topics.h"
+#include "provision.h"
+#include "esp_crt_bundle.h"
+#include "sdkconfig.h"
 
 static const char *TAG = "MQTT";
 
-static const char *user_id   = "user123";
-static const char *device_id = "device01";
-
-/* TOPICS
+/* TOPICS (see topics.h)
 
     home/user<id>/device<id>/data/temperature
     home/user<id>/device<id>/data/battery
+    home/user<id>/device<id>/data/telemetry
 
     home/user<id>/device<id>/doorbell
+    home/user<id>/device<id>/motion
 
     home/user<id>/device<id>/cam/image
     home/user<id>/device<id>/cam/img_metadata
@@ -27,85 +47,248 @@ static const char *device_id = "device01";
     home/user<id>/device<id>/cmd/lcd/text
     home/user<id>/device<id>/cmd/lcd/clear
 
+    home/user<id>/device<id>/cmd/diag
+    home/user<id>/device<id>/diag
+
 */
 
 static esp_mqtt_client_handle_t client;
 
-static void make_topic(char *buf, size_t buf_len, const char *suffix)
-{
-    snprintf(buf, buf_len,
-             "home/user%s/device%s/%s",
-             user_id, device_id, suffix);
-    ESP_LOGI(TAG, "Topic %s created.\n", buf);
-}
+#define IMAGE_QUEUE_LEN (CAMERA_POOL_FRAMES + PREROLL_FRAMES)
+
+typedef struct {
+    frame_t *fb;
+    frame_roi_t roi;
+    bool has_roi;
+} image_job_t;
+
+static int64_t reconfig_start_us;
+static int64_t connect_start_us;
+static int cmd_sub_msg_id = -1;
+static char client_id[64];
+
+/* With MQTT 5 the alias set by esp_mqtt5_client_set_publish_property() is
+   used by whichever publish comes next on the client, so every publish
+   takes this lock. It also covers the topic strings, which
+   topics_set_ids() rewrites in place. */
+static SemaphoreHandle_t publish_lock;
+
+#if CONFIG_DOORCAM_MQTT_V5
+/* per connection, under publish_lock: the highest alias the broker takes,
+   and the aliases it has seen with their topic. alias_sent is stale once
+   alias_conn, counted up at every DISCONNECTED, has moved on. */
+static int alias_max;
+static uint32_t alias_sent;
+static uint32_t alias_sent_conn;
+_Static_assert(TOPIC_COUNT <= 32, "alias_sent has a bit per topic");
+static volatile uint32_t alias_conn;
+#endif
+
+static QueueHandle_t image_queue;
+static volatile bool image_busy;
+static volatile uint32_t last_publish_ms;
 
 #define TOPIC_LEN 128
 
-static char topic_temperature[TOPIC_LEN];
-static char topic_doorbell[TOPIC_LEN];
-static char topic_battery[TOPIC_LEN];
+static void cmd_capture(const char *data, int data_len, void *ctx)
+{
+    ESP_LOGI(TAG, "Command received: Capture");
+    frame_t *fb = camera_capture();
+    if (fb) {
+        publish_image(fb);
+        frame_release(fb);
+    }
+}
 
-static char topic_cam_image[TOPIC_LEN];
-static char topic_cam_meta[TOPIC_LEN];
+static void cmd_reboot(const char *data, int data_len, void *ctx)
+{
+    ESP_LOGI(TAG, "Command received: Reboot");
+    esp_restart();
+}
 
-static char topic_lcd_cmd_text[TOPIC_LEN];
-static char topic_lcd_cmd_clear[TOPIC_LEN];
+static void cmd_lcd_text(const char *data, int data_len, void *ctx)
+{
+    ESP_LOGI(TAG, "Command received: Display text");
+}
 
-static char topic_cmd_capture[TOPIC_LEN];
-static char topic_cmd_reboot[TOPIC_LEN];
+static void cmd_lcd_clear(const char *data, int data_len, void *ctx)
+{
+    ESP_LOGI(TAG, "Command received: Clear text on LCD");
+}
 
-static void init_topics(void)
+/* publishes the trace rings, counters and histograms as one binary message */
+static void cmd_diag(const char *data, int data_len, void *ctx)
 {
-    make_topic(topic_temperature,     TOPIC_LEN, "data/temperature");
-    make_topic(topic_battery,         TOPIC_LEN, "data/battery");
+    size_t cap = trace_snapshot_size();
+    uint8_t *buf = malloc(cap);
+    if (buf == NULL) {
+        ESP_LOGE(TAG, "No memory for a %u byte trace dump", (unsigned)cap);
+        return;
+    }
 
-    make_topic(topic_doorbell,        TOPIC_LEN, "doorbell");
+    size_t len = trace_snapshot(buf, cap);
+    /* copied into the client outbox, so buf can go right away */
+    if (mqtt_publish_topic(TOPIC_DIAG, (const char *)buf, len, 0, true) < 0) {
+        ESP_LOGE(TAG, "Failed to queue trace dump");
+    } else {
+        ESP_LOGI(TAG, "Trace dump of %u bytes queued", (unsigned)len);
+    }
+    free(buf);
+}
 
-    make_topic(topic_cam_image,       TOPIC_LEN, "cam/image");
-    make_topic(topic_cam_meta,        TOPIC_LEN, "cam/img_metadata");
+/* registered without a key too, so a stray config message is not logged
+   as an unknown command; there is nothing to verify it against */
+static void cmd_config(const char *data, int data_len, void *ctx)
+{
+    if (CONFIG_DOORCAM_PROVISION_KEY[0] == 0) {
+        return;
+    }
+    char topic[TOPIC_LEN];
+    xSemaphoreTake(publish_lock, portMAX_DELAY);
+    snprintf(topic, sizeof(topic), "%scmd/config", topic_get(TOPIC_PREFIX));
+    xSemaphoreGive(publish_lock);
+    if (!provision_submit(topic, data, data_len)) {
+        ESP_LOGW(TAG, "Config message ignored (%d bytes)", data_len);
+    }
+}
 
-    make_topic(topic_cmd_capture,     TOPIC_LEN, "cmd/capture");
-    make_topic(topic_cmd_reboot,      TOPIC_LEN, "cmd/reboot");
+/* an empty ID falls back to the Kconfig one */
+static void apply_identity(const provision_config_t *p)
+{
+    const char *user = p->user_id[0] ? p->user_id : CONFIG_DOORCAM_USER_ID;
+    const char *device = p->device_id[0] ? p->device_id : CONFIG_DOORCAM_DEVICE_ID;
+
+    xSemaphoreTake(publish_lock, portMAX_DELAY);
+    if (p->user_id[0] == 0 && p->device_id[0] == 0) {
+        topics_set_ids(NULL, NULL);
+    } else if (topics_set_ids(user, device) != ESP_OK) {
+        ESP_LOGE(TAG, "Invalid device identity, keeping %s", topic_get(TOPIC_PREFIX));
+    }
+    cmd_dispatch_set_prefix(topic_get(TOPIC_PREFIX));
+    xSemaphoreGive(publish_lock);
 
-    make_topic(topic_lcd_cmd_text,    TOPIC_LEN, "cmd/lcd/text");
-    make_topic(topic_lcd_cmd_clear,   TOPIC_LEN, "cmd/lcd/clear");
+    /* the persistent session belongs to the identity, not to the board */
+    snprintf(client_id, sizeof(client_id), "doorcam-%s-%s", user, device);
+}
 
-    ESP_LOGI(TAG, "Finished initializing topics.");
+static void client_config(const provision_config_t *p, esp_mqtt_client_config_t *cfg)
+{
+    *cfg = (esp_mqtt_client_config_t){
+        .broker.address.uri = p->uri,
+        .credentials.username = p->username,
+        .credentials.authentication.password = p->password,
+        .credentials.client_id = client_id,
+#if CONFIG_DOORCAM_MQTT_PERSISTENT_SESSION
+        .session.disable_clean_session = true,
+#endif
+#if CONFIG_DOORCAM_MQTT_V5
+        .session.protocol_ver = MQTT_PROTOCOL_V_5,
+#endif
+    };
+    /* mqtts:// brokers are verified against the IDF root CA bundle */
+    if (strncmp(p->uri, "mqtts://", 8) == 0) {
+        cfg->broker.verification.crt_bundle_attach = esp_crt_bundle_attach;
+    }
 }
 
-static void subscribe_to_commands(void)
+/* connect properties are kept by the client, but reset by esp_mqtt_set_config() */
+static void client_set_properties(void)
+{
+#if CONFIG_DOORCAM_MQTT_V5 && CONFIG_DOORCAM_MQTT_PERSISTENT_SESSION
+    esp_mqtt5_connection_property_config_t prop = {
+        .session_expiry_interval = CONFIG_DOORCAM_MQTT_SESSION_EXPIRY_S,
+    };
+    esp_mqtt5_client_set_connect_property(client, &prop);
+#endif
+}
+
+/* runs on the provisioning task: swap broker and identity without a reboot */
+static void apply_config(const provision_config_t *p)
 {
-    int msg_id;
+    reconfig_start_us = esp_timer_get_time();
 
-    msg_id = esp_mqtt_client_subscribe(client, topic_lcd_cmd_text, 1);
-    if (msg_id < 0) {
-        ESP_LOGE(TAG, "Failed to subscribe to %s", topic_lcd_cmd_text);
-    } else {
-        ESP_LOGI(TAG, "Subscribed to %s, msg_id=%d", topic_lcd_cmd_text, msg_id);
-    }
+    esp_mqtt_client_stop(client);
+    xEventGroupClearBits(wifi_eventgroup, MQTT_CONNECTED_BIT);
+    frame_stream_on_disconnected();
 
-    msg_id = esp_mqtt_client_subscribe(client, topic_lcd_cmd_clear, 1);
-    if (msg_id < 0) {
-        ESP_LOGE(TAG, "Failed to subscribe to %s", topic_lcd_cmd_clear);
-    } else {
-        ESP_LOGI(TAG, "Subscribed to %s, msg_id=%d", topic_lcd_cmd_clear, msg_id);
+    apply_identity(p);
+    esp_mqtt_client_config_t cfg;
+    client_config(p, &cfg);
+    if (esp_mqtt_set_config(client, &cfg) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to apply client config");
     }
+    client_set_properties();
+    esp_mqtt_client_start(client);
+}
 
-    msg_id = esp_mqtt_client_subscribe(client, topic_cmd_capture, 1);
-    if (msg_id < 0) {
-        ESP_LOGE(TAG, "Failed to subscribe to %s", topic_cmd_capture);
+static void init_topics(void)
+{
+    apply_identity(provision_get());
+
+    mqtt_register_command("cmd/capture",   CMD_PRIO_CAPTURE, CMD_FLAG_COALESCE, cmd_capture,   NULL);
+    mqtt_register_command("cmd/reboot",    CMD_PRIO_REBOOT,  0,                 cmd_reboot,    NULL);
+
+    mqtt_register_command("cmd/lcd/text",  CMD_PRIO_LCD,     0,                 cmd_lcd_text,  NULL);
+    mqtt_register_command("cmd/lcd/clear", CMD_PRIO_LCD,     0,                 cmd_lcd_clear, NULL);
+
+    mqtt_register_command("cmd/diag",      CMD_PRIO_LCD,     CMD_FLAG_COALESCE, cmd_diag,      NULL);
+    mqtt_register_command("cmd/config",    CMD_PRIO_REBOOT,  CMD_FLAG_INLINE,   cmd_config,    NULL);
+
+    ESP_LOGI(TAG, "Finished initializing topics.");
+}
+
+/* One wildcard SUBSCRIBE; cmd_dispatch() picks the handler locally. QoS 0,
+   so the persistent session never queues a command while the device is
+   away: a cmd/reboot or cmd/config replayed on reconnect would act on a
+   request that may be hours old. */
+static void subscribe_to_commands(void)
+{
+    char topic[TOPIC_LEN];
+    xSemaphoreTake(publish_lock, portMAX_DELAY);
+    snprintf(topic, sizeof(topic), "%scmd/#", topic_get(TOPIC_PREFIX));
+    xSemaphoreGive(publish_lock);
+
+    cmd_sub_msg_id = esp_mqtt_client_subscribe(client, topic, 0);
+    if (cmd_sub_msg_id < 0) {
+        ESP_LOGE(TAG, "Failed to subscribe to %s", topic);
     } else {
-        ESP_LOGI(TAG, "Subscribed to %s, msg_id=%d", topic_cmd_capture, msg_id);
+        ESP_LOGI(TAG, "Subscribed to %s, msg_id=%d", topic, cmd_sub_msg_id);
     }
+}
 
-    msg_id = esp_mqtt_client_subscribe(client, topic_cmd_reboot, 1);
-    if (msg_id < 0) {
-        ESP_LOGE(TAG, "Failed to subscribe to %s", topic_cmd_reboot);
-    } else {
-        ESP_LOGI(TAG, "Subscribed to %s, msg_id=%d", topic_cmd_reboot, msg_id);
+#if CONFIG_DOORCAM_MQTT_V5
+/* Runs on every CONNECTED. esp-mqtt keeps the CONNACK Topic Alias Maximum
+   to itself but refuses a larger alias in
+   esp_mqtt5_client_set_publish_property(), so the highest one it takes is
+   looked for there; 0 leaves aliases off. */
+static void alias_max_update(void)
+{
+    xSemaphoreTake(publish_lock, portMAX_DELAY);
+    int lo = 0, hi = CONFIG_DOORCAM_MQTT_TOPIC_ALIAS_MAX;
+    esp_mqtt5_publish_property_config_t prop = { 0 };
+    while (lo < hi) {
+        prop.topic_alias = (lo + hi + 1) / 2;
+        if (esp_mqtt5_client_set_publish_property(client, &prop) == ESP_OK) {
+            lo = prop.topic_alias;
+        } else {
+            hi = prop.topic_alias - 1;
+        }
     }
+    /* nothing left over for the next publish */
+    prop.topic_alias = 0;
+    esp_mqtt5_client_set_publish_property(client, &prop);
+    alias_max = lo;
+    xSemaphoreGive(publish_lock);
+}
+#endif
 
-    ESP_LOGI(TAG, "Subscription attempts finished.");
+static void log_ready(void)
+{
+    if (connect_start_us) {
+        ESP_LOGI(TAG, "Ready %lld ms after connect start",
+                 (long long)(esp_timer_get_time() - connect_start_us) / 1000);
+        connect_start_us = 0;
+    }
 }
 
 static void mqtt_event_handler(void *handler_args,
@@ -116,24 +299,71 @@ static void mqtt_event_handler(void *handler_args,
     esp_mqtt_event_handle_t event = event_data;
 
     switch (event_id) {
-        case MQTT_EVENT_CONNECTED:
-            ESP_LOGI(TAG, "MQQT Connected.");
-            subscribe_to_commands();
+        case MQTT_EVENT_BEFORE_CONNECT:
+            connect_start_us = esp_timer_get_time();
             break;
 
-        case MQTT_EVENT_DATA:
-            if (strncmp(event->topic, topic_cmd_capture, event->topic_len) == 0) {
-                ESP_LOGI(TAG, "Command received: Capture");
+        case MQTT_EVENT_CONNECTED:
+            ESP_LOGI(TAG, "MQQT Connected.");
+#if CONFIG_DOORCAM_MQTT_V5
+            alias_max_update();
+#endif
+            if (connect_start_us) {
+                /* TCP (+TLS) and CONNECT/CONNACK */
+                int64_t handshake_us = esp_timer_get_time() - connect_start_us;
+                trace_hist(TRACE_HIST_MQTT_CONNECT_US, handshake_us);
+                ESP_LOGI(TAG, "Handshake %lld ms, session %s", (long long)handshake_us / 1000,
+                         event->session_present ? "resumed" : "new");
+            }
+            xEventGroupSetBits(wifi_eventgroup, MQTT_CONNECTED_BIT);
+            conn_stage_mark(CONN_STAGE_MQTT);
+            trace_instant(TRACE_EV_MQTT_CONNECTED, 0);
+            if (reconfig_start_us) {
+                ESP_LOGI(TAG, "Reconnected with the new config %lld ms after applying it",
+                         (long long)(esp_timer_get_time() - reconfig_start_us) / 1000);
+                reconfig_start_us = 0;
             }
-            else if (strncmp(event->topic, topic_cmd_reboot, event->topic_len) == 0) {
-                ESP_LOGI(TAG, "Command received: Reboot");
-                esp_restart();
+            /* the wildcard covers every command, so a kept session is enough */
+            if (event->session_present) {
+                ESP_LOGI(TAG, "Broker kept the session, not resubscribing");
+                log_ready();
+            } else {
+                subscribe_to_commands();
             }
-            else if (strncmp(event->topic, topic_lcd_cmd_text, event->topic_len) == 0) {
-                ESP_LOGI(TAG, "Command received: Display text");
+            break;
+
+        case MQTT_EVENT_SUBSCRIBED:
+            if (event->msg_id == cmd_sub_msg_id) {
+                log_ready();
             }
-            else if (strncmp(event->topic, topic_lcd_cmd_clear, event->topic_len) == 0) {
-                ESP_LOGI(TAG, "Command received: Clear text on LCD");
+            break;
+
+        case MQTT_EVENT_DISCONNECTED:
+            ESP_LOGI(TAG, "MQQT Disconnected.");
+            xEventGroupClearBits(wifi_eventgroup, MQTT_CONNECTED_BIT);
+#if CONFIG_DOORCAM_MQTT_V5
+            /* not under publish_lock: esp-mqtt can dispatch this from inside
+               a failed publish that holds it */
+            alias_conn++;
+#endif
+            trace_instant(TRACE_EV_MQTT_DISCONNECT, 0);
+            trace_count(TRACE_CNT_MQTT_DROP);
+            frame_stream_on_disconnected();
+            break;
+
+        case MQTT_EVENT_PUBLISHED:
+            frame_stream_on_published(event->msg_id);
+            outbox_on_published(event->msg_id);
+            break;
+
+        case MQTT_EVENT_DELETED:
+            /* expired from the client outbox before it was acknowledged */
+            frame_stream_on_deleted(event->msg_id);
+            break;
+
+        case MQTT_EVENT_DATA:
+            if (!cmd_dispatch(event->topic, event->topic_len, event->data, event->data_len)) {
+                ESP_LOGW(TAG, "No handler for topic %.*s", event->topic_len, event->topic);
             }
             break;
 
@@ -142,12 +372,100 @@ static void mqtt_event_handler(void *handler_args,
     }
 }
 
+/* topic NULL: the one of id, looked up under the lock and sent with its alias */
+static int publish_locked(topic_id_t id, const char *topic, const void *tag, int tag_len,
+                          const char *data, int len, int qos, bool enqueue)
+{
+    xSemaphoreTake(publish_lock, portMAX_DELAY);
+    int alias = 0;
+    if (topic == NULL) {
+        topic = topic_get(id);
+        alias = id;
+    }
+#if CONFIG_DOORCAM_MQTT_V5
+    esp_mqtt5_publish_property_config_t prop = {
+        .correlation_data = tag,
+        .correlation_data_len = tag_len,
+    };
+    if (alias > 0 && alias <= alias_max) {
+        prop.topic_alias = alias;
+    }
+    if ((prop.topic_alias || tag_len) &&
+        esp_mqtt5_client_set_publish_property(client, &prop) != ESP_OK && tag_len) {
+        /* the tag has to go out regardless */
+        prop.topic_alias = 0;
+        esp_mqtt5_client_set_publish_property(client, &prop);
+    }
+    /* Only a QoS 0 publish goes out with the alias alone: esp-mqtt resends
+       unacknowledged QoS 1 messages as they were, on what may be a new
+       connection without the alias, and enqueued ones leave after anything
+       published directly. */
+    bool direct = !enqueue && prop.topic_alias;
+    if (alias_sent_conn != alias_conn) {
+        alias_sent_conn = alias_conn;
+        alias_sent = 0;
+    }
+    if (direct && qos == 0 && (alias_sent & (1u << alias))) {
+        topic = "";
+    }
+#endif
+    int msg_id = enqueue ? esp_mqtt_client_enqueue(client, topic, data, len, qos, false, true)
+                         : esp_mqtt_client_publish(client, topic, data, len, qos, false);
+#if CONFIG_DOORCAM_MQTT_V5
+    if (direct && msg_id >= 0) {
+        alias_sent |= 1u << alias;
+    }
+#endif
+    xSemaphoreGive(publish_lock);
+    return msg_id;
+}
+
+int mqtt_publish_topic(topic_id_t id, const char *data, int len, int qos, bool enqueue)
+{
+    return publish_locked(id, NULL, NULL, 0, data, len, qos, enqueue);
+}
+
+int mqtt_publish_string(const char *topic, const char *data, int len, int qos)
+{
+    return publish_locked(TOPIC_PREFIX, topic, NULL, 0, data, len, qos, false);
+}
+
+int mqtt_publish_tagged(topic_id_t id, const void *tag, int tag_len, const char *data, int len, int qos)
+{
+#if CONFIG_DOORCAM_MQTT_V5
+    return publish_locked(id, NULL, tag, tag_len, data, len, qos, false);
+#else
+    return -1;
+#endif
+}
+
+int mqtt_publish_or_store(topic_id_t id, const char *data, int len, int qos)
+{
+    /* once anything is stored, later messages queue behind it to keep order */
+    bool online = xEventGroupGetBits(wifi_eventgroup) & MQTT_CONNECTED_BIT;
+    if (!online || outbox_pending()) {
+        char topic[TOPIC_LEN];
+        xSemaphoreTake(publish_lock, portMAX_DELAY);
+        snprintf(topic, sizeof(topic), "%s", topic_get(id));
+        xSemaphoreGive(publish_lock);
+        if (outbox_append(topic, data, len, qos) == ESP_OK) {
+            trace_instant(TRACE_EV_MQTT_STORED, len);
+            trace_count(TRACE_CNT_STORED);
+            return 0;
+        }
+    }
+    int msg_id = mqtt_publish_topic(id, data, len, qos, false);
+    trace_instant(TRACE_EV_MQTT_PUBLISH, len);
+    trace_count(msg_id < 0 ? TRACE_CNT_PUBLISH_FAIL : TRACE_CNT_PUBLISH);
+    return msg_id;
+}
+
 void publish_temperature(float temp)
 {
     char msg[32];
     snprintf(msg, sizeof(msg), "%.2f", temp);
 
-    int msg_id = esp_mqtt_client_publish(client, topic_temperature, msg, 0, 1, false);
+    int msg_id = mqtt_publish_or_store(TOPIC_TEMPERATURE, msg, 0, 1);
     if (msg_id < 0) {
         ESP_LOGE(TAG, "Failed to publish temperature");
     } else {
@@ -157,70 +475,238 @@ void publish_temperature(float temp)
     ESP_LOGI(TAG, "Send temperature %.2f", temp);
 }
 
-void publish_doorbell_event(void)
+void publish_doorbell_event(frame_t *live)
+{
+    mqtt_publish_or_store(TOPIC_DOORBELL, "pressed", 0, 1);
+
+    /* pre-roll frames followed by the live one, queued back to back */
+    frame_t *burst[PREROLL_FRAMES];
+    size_t n = preroll_take(burst, PREROLL_FRAMES);
+
+    for (size_t i = 0; i < n; i++) {
+        publish_image(burst[i]);
+        frame_release(burst[i]);
+    }
+
+    if (live) {
+        publish_image(live);
+    } else {
+        frame_t *fb = camera_capture();
+        if (fb) {
+            publish_image(fb);
+            frame_release(fb);
+        }
+    }
+    ESP_LOGI(TAG, "Doorbell burst: %u pre-roll frames + live frame", (unsigned)n);
+}
+
+void publish_motion_event(const motion_result_t *res)
 {
-    esp_mqtt_client_publish(client, topic_doorbell, "pressed", 0, 1, false);
+    if (client == NULL) {
+        return;
+    }
+
+    char json[96];
+    snprintf(json, sizeof(json),
+             "{\"blocks\":%d,\"x\":%d,\"y\":%d,\"w\":%d,\"h\":%d}",
+             res->changed_blocks, res->roi.x, res->roi.y, res->roi.w, res->roi.h);
+
+    /* called from the preview task, so enqueue instead of waiting on the client */
+    mqtt_publish_topic(TOPIC_MOTION, json, 0, 1, true);
+
+    frame_t *fb = camera_capture();
+    if (fb) {
+        /* motion ran on the preview stream; map the box onto the live frame */
+        frame_roi_t roi = {
+            .x = res->roi.x * fb->width / res->src_width,
+            .y = res->roi.y * fb->height / res->src_height,
+            .w = res->roi.w * fb->width / res->src_width,
+            .h = res->roi.h * fb->height / res->src_height,
+        };
+        publish_image_roi(fb, &roi);
+        frame_release(fb);
+    }
 }
 
 void publish_battery(int percent)
 {
     char msg[16];
     snprintf(msg, sizeof(msg), "%d", percent);
-    esp_mqtt_client_publish(client, topic_battery, msg, 0, 1, false);
+    mqtt_publish_or_store(TOPIC_BATTERY, msg, 0, 1);
 }
 
-void publish_image(/*camera_fb_t *fb*/)
+static void queue_image(frame_t *fb, const frame_roi_t *roi)
 {
-    uint8_t placeholder_image[75] = {
-        0,0,0,   255,255,255, 0,0,0,   255,255,255, 0,0,0,
-        255,255,255, 0,0,0,   255,255,255, 0,0,0,   255,255,255,
-        0,0,0,   255,255,255, 0,0,0,   255,255,255, 0,0,0,
-        255,255,255, 0,0,0,   255,255,255, 0,0,0,   255,255,255,
-        0,0,0,   255,255,255, 0,0,0,   255,255,255, 0,0,0
-    };
-    esp_mqtt_client_publish(client,
-                        topic_cam_image,
-                        (const char *)placeholder_image,
-                        sizeof(placeholder_image),
-                        0,
-                        false);
-                        
-    publish_image_meta(5, 5, sizeof(tiny_image));
+    if (image_queue == NULL) {
+        return;
+    }
+
+    image_job_t job = { .fb = fb, .has_roi = roi != NULL };
+    if (roi) {
+        job.roi = *roi;
+    }
+
+    frame_ref(fb);
+    if (xQueueSend(image_queue, &job, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Image queue full, dropping frame");
+        trace_count(TRACE_CNT_IMAGE_DROP);
+        frame_release(fb);
+    }
+    trace_value(TRACE_EV_IMAGE_QUEUE, uxQueueMessagesWaiting(image_queue));
 }
 
-void publish_image_meta(int width, int height, int size_bytes)
+void publish_image(frame_t *fb)
 {
-    char json[128];
-    snprintf(json, sizeof(json),
-             "{\"width\":%d,\"height\":%d,\"size\":%d}",
-             width, height, size_bytes);
+    queue_image(fb, NULL);
+}
 
-    esp_mqtt_client_publish(client, topic_cam_meta, json, 0, 1, false);
+void publish_image_roi(frame_t *fb, const frame_roi_t *roi)
+{
+    queue_image(fb, roi);
+}
+
+static void image_publish_task(void* arg)
+{
+    image_job_t job;
+    while (1) {
+        xQueueReceive(image_queue, &job, portMAX_DELAY);
+        image_busy = true;
+
+        frame_t *fb = job.fb;
+        if (job.has_roi) {
+            frame_t *cropped = camera_crop(fb, &job.roi);
+            if (cropped) {
+                frame_release(fb);
+                fb = cropped;
+            }
+        }
+
+        trace_begin(TRACE_EV_FRAME_PUBLISH, fb->len);
+        int64_t start = esp_timer_get_time();
+        esp_err_t err = frame_stream_publish(fb);
+        trace_end(TRACE_EV_FRAME_PUBLISH, err);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to publish image: %s", esp_err_to_name(err));
+        } else {
+            int64_t now = esp_timer_get_time();
+            trace_hist(TRACE_HIST_FRAME_US, now - fb->timestamp_us);
+            /* pre-roll frames were captured long before they are sent; only
+               the time on the link says anything about the link */
+            link_budget_on_snapshot(fb->len, now - start);
+            last_publish_ms = now / 1000;
+        }
+        frame_release(fb);
+        image_busy = false;
+    }
+}
+
+static float read_temperature(void)
+{
+    return 10.2;
+}
+
+static int read_battery(void)
+{
+    return 100;
+}
+
+static void take_sample(void)
+{
+    float temp = read_temperature();
+    int battery = read_battery();
+
+    wifi_ap_record_t ap;
+    int8_t rssi = esp_wifi_sta_get_ap_info(&ap) == ESP_OK ? ap.rssi : 0;
+
+    telemetry_sample_t sample = {
+        .uptime_s = esp_timer_get_time() / 1000000,
+        .free_heap = esp_get_free_heap_size(),
+        .temp_centi = temp * 100,
+        .battery = battery,
+        .rssi = rssi,
+    };
+    telemetry_add(&sample);
+
+#if TELEMETRY_COMPAT_TOPICS
+    publish_temperature(temp);
+    publish_battery(battery);
+#endif
+}
+
+void publish_telemetry_now(void)
+{
+    take_sample();
+    telemetry_flush();
 }
 
-static void temperature_task(void* arg)
+static void telemetry_task(void* arg)
 {
     while (1){
-        publish_temperature(10.2);
-        vTaskDelay(pdMS_TO_TICKS(10000)); 
+        take_sample();
+        vTaskDelay(pdMS_TO_TICKS(TELEMETRY_SAMPLE_MS));
     }
 }
 
+void mqtt_topics_lock(void)
+{
+    xSemaphoreTake(publish_lock, portMAX_DELAY);
+}
+
+void mqtt_topics_unlock(void)
+{
+    xSemaphoreGive(publish_lock);
+}
+
+bool mqtt_wait_idle(uint32_t timeout_ms)
+{
+    int64_t deadline = esp_timer_get_time() + timeout_ms * 1000LL;
+
+    while (esp_timer_get_time() < deadline) {
+        if (uxQueueMessagesWaiting(image_queue) == 0 && !image_busy && !outbox_pending() &&
+            esp_mqtt_client_get_outbox_size(client) == 0) {
+            return true;
+        }
+        vTaskDelay(pdMS_TO_TICKS(20));
+    }
+    return false;
+}
+
+uint32_t mqtt_last_publish_ms(void)
+{
+    return last_publish_ms;
+}
+
 void mqtt_init(void)
 {
-    xEventGroupWaitBits(wifi_eventgroup, WIFI_CONNECTED_BIT, false, true, portMAX_DELAY);
+    mqtt_start(portMAX_DELAY);
+}
+
+bool mqtt_start(TickType_t wifi_wait)
+{
+    /* starting before the station has an IP costs a full reconnect_timeout */
+    EventBits_t bits = xEventGroupWaitBits(wifi_eventgroup, WIFI_CONNECTED_BIT, false, true, wifi_wait);
+    publish_lock = xSemaphoreCreateMutex();
+    configASSERT(publish_lock != NULL);
+
+    ESP_ERROR_CHECK(provision_init(apply_config));
     init_topics();
+    ESP_ERROR_CHECK(cmd_exec_init());
 
-    esp_mqtt_client_config_t cfg = {
-        .broker.address.uri = "mqtt://10.237.191.186",
-        .credentials.username = "esp1",
-        .credentials.authentication.password = "password",
-    };
+    esp_mqtt_client_config_t cfg;
+    client_config(provision_get(), &cfg);
 
     client = esp_mqtt_client_init(&cfg);
+    client_set_properties();
     esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
+    frame_stream_init();
+    telemetry_init();
     esp_mqtt_client_start(client);
-
-    xTaskCreate(temperature_task, "temperature_task", 2048, NULL, 0, NULL);
-
+    outbox_start_drain();
+
+    image_queue = xQueueCreate(IMAGE_QUEUE_LEN, sizeof(image_job_t));
+    xTaskCreate(image_publish_task, "image_publish_task", 4096, NULL, 1, NULL);
+#if !CONFIG_DOORCAM_LOW_POWER_MODE
+    xTaskCreate(telemetry_task, "telemetry_task", 3072, NULL, 0, NULL);
+#endif
+    return bits & WIFI_CONNECTED_BIT;
 }
\ No newline at end of file
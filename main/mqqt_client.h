@@ -1,6 +1,58 @@
 #pragma once
 #include "esp_err.h"
 #include "wifi.h"
+#include "frame_pool.h"
+#include "motion.h"
+#include "topics.h"
 
 
 void mqtt_init(void);
+
+/* mqtt_init() waiting at most wifi_wait for the station to get an IP. The
+   client is started either way and keeps retrying on its own; returns
+   whether Wi-Fi was up in time. */
+bool mqtt_start(TickType_t wifi_wait);
+
+/* Publishes directly when the broker is reachable, otherwise appends to the
+   flash outbox for replay. Returns the msg_id, 0 when stored, -1 on error. */
+int mqtt_publish_or_store(topic_id_t id, const char *data, int len, int qos);
+
+/* Every publish on the client goes through one of these. Table topics go
+   out as MQTT 5 topic aliases; enqueue copies the message into the client
+   outbox instead of waiting for the socket. */
+int mqtt_publish_topic(topic_id_t id, const char *data, int len, int qos, bool enqueue);
+int mqtt_publish_string(const char *topic, const char *data, int len, int qos);
+
+/* MQTT 5 only: publishes with tag as the correlation data property, so a
+   small binary header travels with the message without copying data */
+int mqtt_publish_tagged(topic_id_t id, const void *tag, int tag_len, const char *data, int len, int qos);
+
+/* topics_set_ids() rewrites the topic strings in place: hold this around
+   it, and around reading them, while the client is running */
+void mqtt_topics_lock(void);
+void mqtt_topics_unlock(void);
+
+void publish_temperature(float temp);
+void publish_battery(int percent);
+/* Publishes the event followed by the pre-roll frames and a live frame;
+   live may be a frame captured earlier, otherwise one is taken now. */
+void publish_doorbell_event(frame_t *live);
+void publish_motion_event(const motion_result_t *res);
+
+/* Queues the frame for streaming; takes its own reference, so the caller
+   keeps (and must release) the one it holds. */
+void publish_image(frame_t *fb);
+/* Same, but crops to roi (motion or face box) before streaming. Only
+   uncompressed frames can be cropped: the sensor encodes JPEG itself, so
+   its frames go out whole and the box only travels in the motion event. */
+void publish_image_roi(frame_t *fb, const frame_roi_t *roi);
+
+/* Takes one telemetry sample and flushes the batch immediately */
+void publish_telemetry_now(void);
+
+/* Waits until queued images, the flash outbox and the client outbox are
+   empty. Returns false on timeout. */
+bool mqtt_wait_idle(uint32_t timeout_ms);
+
+/* Milliseconds since boot at which the last snapshot was acknowledged */
+uint32_t mqtt_last_publish_ms(void);
@@ -0,0 +1,374 @@
+#include <stddef.h>
+#include <string.h>
+#include "outbox.h"
+#include "wifi.h"
+#include "mqqt_client.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "esp_log.h"
+
+static const char *TAG = "OUTBOX";
+
+#define SECTOR_SIZE      4096
+#define RECORD_MAGIC     0x0B5E
+#define STATE_VALID      0xFE
+#define STATE_CONSUMED   0x00
+#define ALIGN4(x)        (((x) + 3) & ~3u)
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;
+    uint8_t state;
+    uint8_t qos;
+    uint32_t seq;
+    uint16_t topic_len;
+    uint16_t data_len;
+    uint32_t crc;           /* over seq..data_len, topic and data */
+} record_hdr_t;
+
+static const esp_partition_t *part;
+static SemaphoreHandle_t outbox_lock;
+static uint32_t sector_count;
+
+/* write position and oldest unconsumed record */
+static uint32_t head;
+static uint32_t tail;
+static uint32_t next_seq;
+static uint32_t pending_count;
+
+static uint8_t record_buf[OUTBOX_MAX_RECORD];
+/* the drain task's copy of the record it is publishing */
+static uint8_t drain_buf[OUTBOX_MAX_RECORD];
+
+/* recent PUBACKs: the one for a replayed record may come in before
+   the publish call has even returned its msg_id */
+#define ACKED_MAX 8
+static portMUX_TYPE acked_mux = portMUX_INITIALIZER_UNLOCKED;
+static int acked[ACKED_MAX];
+static int acked_next;
+static TaskHandle_t drain_task_handle;
+
+/* offsets run over the whole partition and wrap to its start */
+static uint32_t wrap(uint32_t off)
+{
+    return off % (sector_count * SECTOR_SIZE);
+}
+
+static uint32_t next_sector(uint32_t off)
+{
+    return wrap((off / SECTOR_SIZE + 1) * SECTOR_SIZE);
+}
+
+static uint32_t record_crc(const record_hdr_t *h, const void *body)
+{
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)&h->seq,
+                                    sizeof(h->seq) + sizeof(h->topic_len) + sizeof(h->data_len));
+    return esp_rom_crc32_le(crc, body, h->topic_len + h->data_len);
+}
+
+/* Reads the record at off. Returns its padded size, 0 at the end of the
+   sector's data, or -1 for a torn or corrupt record. */
+static int read_record(uint32_t off, record_hdr_t *h, uint8_t *body)
+{
+    if (off % SECTOR_SIZE + sizeof(*h) > SECTOR_SIZE ||
+        esp_partition_read(part, off, h, sizeof(*h)) != ESP_OK) {
+        return 0;
+    }
+    if (h->magic == 0xFFFF) {
+        return 0;
+    }
+
+    uint32_t body_len = h->topic_len + h->data_len;
+    uint32_t size = ALIGN4(sizeof(*h) + body_len);
+    if (h->magic != RECORD_MAGIC || body_len > sizeof(record_buf) ||
+        off % SECTOR_SIZE + size > SECTOR_SIZE) {
+        return -1;
+    }
+    if (body && (esp_partition_read(part, off + sizeof(*h), body, body_len) != ESP_OK ||
+                 record_crc(h, body) != h->crc)) {
+        return -1;
+    }
+    return size;
+}
+
+static bool erased_from(uint32_t off)
+{
+    uint32_t end = (off / SECTOR_SIZE + 1) * SECTOR_SIZE;
+
+    while (off < end) {
+        uint32_t n = end - off < sizeof(record_buf) ? end - off : sizeof(record_buf);
+        if (esp_partition_read(part, off, record_buf, n) != ESP_OK) {
+            return false;
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            if (record_buf[i] != 0xFF) {
+                return false;
+            }
+        }
+        off += n;
+    }
+    return true;
+}
+
+static void recover(void)
+{
+    uint32_t max_seq = 0, min_seq = UINT32_MAX;
+    bool any = false;
+
+    head = 0;
+    tail = UINT32_MAX;
+    pending_count = 0;
+
+    for (uint32_t s = 0; s < sector_count; s++) {
+        uint32_t off = s * SECTOR_SIZE;
+        record_hdr_t h;
+        int size;
+
+        while ((size = read_record(off, &h, record_buf)) > 0) {
+            if (!any || h.seq > max_seq) {
+                max_seq = h.seq;
+                head = wrap(off + size);
+                any = true;
+            }
+            if (h.state == STATE_VALID) {
+                pending_count++;
+                if (h.seq < min_seq) {
+                    min_seq = h.seq;
+                    tail = off;
+                }
+            }
+            off += size;
+        }
+    }
+
+    /* a write cut short leaves programmed bytes past the last good record */
+    if (head % SECTOR_SIZE != 0 && !erased_from(head)) {
+        head = next_sector(head);
+    }
+
+    next_seq = any ? max_seq + 1 : 0;
+    if (tail == UINT32_MAX) {
+        tail = head;
+    }
+    ESP_LOGI(TAG, "Recovered %lu pending records, next seq %lu",
+             (unsigned long)pending_count, (unsigned long)next_seq);
+}
+
+esp_err_t outbox_init(void)
+{
+    part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+                                    OUTBOX_PARTITION_LABEL);
+    if (part == NULL) {
+        ESP_LOGW(TAG, "No '%s' partition, store-and-forward disabled", OUTBOX_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    sector_count = part->size / SECTOR_SIZE;
+    if (sector_count < 2) {
+        part = NULL;
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    outbox_lock = xSemaphoreCreateMutex();
+    recover();
+    return ESP_OK;
+}
+
+/* drops every pending record in the sector about to be erased */
+static void evict_sector(uint32_t sector_off)
+{
+    uint32_t off = sector_off;
+    record_hdr_t h;
+    int size;
+
+    while ((size = read_record(off, &h, NULL)) > 0) {
+        if (h.state == STATE_VALID && pending_count > 0) {
+            pending_count--;
+            ESP_LOGW(TAG, "Outbox full, dropping record %lu", (unsigned long)h.seq);
+        }
+        off += size;
+    }
+    if (tail / SECTOR_SIZE == sector_off / SECTOR_SIZE) {
+        tail = next_sector(sector_off);
+    }
+    esp_partition_erase_range(part, sector_off, SECTOR_SIZE);
+}
+
+esp_err_t outbox_append(const char *topic, const void *data, int len, int qos)
+{
+    if (part == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (len <= 0) {
+        len = data ? strlen(data) : 0;
+    }
+
+    record_hdr_t h = {
+        .magic = RECORD_MAGIC,
+        .state = STATE_VALID,
+        .qos = qos,
+        .topic_len = strlen(topic),
+        .data_len = len,
+    };
+    uint32_t size = ALIGN4(sizeof(h) + h.topic_len + h.data_len);
+    if (size > sizeof(h) + sizeof(record_buf)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    xSemaphoreTake(outbox_lock, portMAX_DELAY);
+
+    if (head % SECTOR_SIZE + size > SECTOR_SIZE) {
+        head = next_sector(head);
+    }
+    if (head % SECTOR_SIZE == 0) {
+        evict_sector(head);
+    }
+
+    h.seq = next_seq++;
+    memcpy(record_buf, topic, h.topic_len);
+    memcpy(record_buf + h.topic_len, data, h.data_len);
+    h.crc = record_crc(&h, record_buf);
+
+    /* body first, header last: a cut before the header leaves erased flash */
+    memset(record_buf + h.topic_len + h.data_len, 0xFF, size - sizeof(h) - h.topic_len - h.data_len);
+    esp_err_t err = esp_partition_write(part, head + sizeof(h), record_buf, size - sizeof(h));
+    if (err == ESP_OK) {
+        err = esp_partition_write(part, head, &h, sizeof(h));
+    }
+    if (err == ESP_OK) {
+        if (pending_count++ == 0) {
+            tail = head;
+        }
+        head = wrap(head + size);
+    }
+
+    xSemaphoreGive(outbox_lock);
+    return err;
+}
+
+bool outbox_pending(void)
+{
+    return pending_count > 0;
+}
+
+void outbox_on_published(int msg_id)
+{
+    portENTER_CRITICAL(&acked_mux);
+    acked[acked_next] = msg_id;
+    acked_next = (acked_next + 1) % ACKED_MAX;
+    portEXIT_CRITICAL(&acked_mux);
+
+    if (drain_task_handle) {
+        xTaskNotifyGive(drain_task_handle);
+    }
+}
+
+static void acked_clear(void)
+{
+    portENTER_CRITICAL(&acked_mux);
+    for (int i = 0; i < ACKED_MAX; i++) {
+        acked[i] = -1;
+    }
+    portEXIT_CRITICAL(&acked_mux);
+}
+
+static bool was_acked(int msg_id)
+{
+    bool found = false;
+    portENTER_CRITICAL(&acked_mux);
+    for (int i = 0; i < ACKED_MAX && !found; i++) {
+        found = acked[i] == msg_id;
+    }
+    portEXIT_CRITICAL(&acked_mux);
+    return found;
+}
+
+/* QoS 0 has no acknowledgement: the client taking it is all there is */
+static bool wait_acked(int msg_id, int qos)
+{
+    if (qos == 0) {
+        return true;
+    }
+    TickType_t start = xTaskGetTickCount();
+    TickType_t timeout = pdMS_TO_TICKS(OUTBOX_ACK_TIMEOUT_MS);
+    while (!was_acked(msg_id)) {
+        TickType_t waited = xTaskGetTickCount() - start;
+        if (waited >= timeout) {
+            return false;
+        }
+        ulTaskNotifyTake(pdTRUE, timeout - waited);
+    }
+    return true;
+}
+
+static void drain_task(void* arg)
+{
+    record_hdr_t h;
+    char topic[128];
+
+    while (1) {
+        xEventGroupWaitBits(wifi_eventgroup, WIFI_CONNECTED_BIT | MQTT_CONNECTED_BIT,
+                            pdFALSE, pdTRUE, portMAX_DELAY);
+        if (pending_count == 0) {
+            vTaskDelay(pdMS_TO_TICKS(1000));
+            continue;
+        }
+
+        xSemaphoreTake(outbox_lock, portMAX_DELAY);
+        uint32_t off = tail;
+        int size = tail == head ? 0 : read_record(tail, &h, drain_buf);
+        bool publish = false;
+
+        if (tail == head) {
+            pending_count = 0;
+        } else if (size <= 0) {
+            /* end of this sector's data or a torn record: continue in the next one */
+            tail = next_sector(tail);
+        } else if (h.state != STATE_VALID) {
+            tail = wrap(tail + size);
+        } else {
+            publish = true;
+        }
+        xSemaphoreGive(outbox_lock);
+
+        if (publish) {
+            int topic_len = h.topic_len < sizeof(topic) ? h.topic_len : sizeof(topic) - 1;
+            memcpy(topic, drain_buf, topic_len);
+            topic[topic_len] = 0;
+
+            /* unlocked: publishing can block on the uplink, appends must not */
+            acked_clear();
+            int msg_id = mqtt_publish_string(topic, (const char *)drain_buf + h.topic_len,
+                                             h.data_len, h.qos);
+            bool delivered = msg_id >= 0 && wait_acked(msg_id, h.qos);
+            if (msg_id >= 0 && !delivered) {
+                ESP_LOGW(TAG, "Record %lu not acknowledged, sending it again",
+                         (unsigned long)h.seq);
+            }
+            if (delivered) {
+                record_hdr_t now;
+                xSemaphoreTake(outbox_lock, portMAX_DELAY);
+                /* a full log may have evicted the sector in the meantime */
+                if (tail == off && read_record(off, &now, NULL) > 0 && now.seq == h.seq) {
+                    uint8_t consumed = STATE_CONSUMED;
+                    esp_partition_write(part, off + offsetof(record_hdr_t, state), &consumed, 1);
+                    tail = wrap(off + size);
+                    pending_count--;
+                }
+                xSemaphoreGive(outbox_lock);
+            }
+        }
+
+        vTaskDelay(pdMS_TO_TICKS(OUTBOX_DRAIN_INTERVAL_MS));
+    }
+}
+
+void outbox_start_drain(void)
+{
+    if (part == NULL) {
+        return;
+    }
+    xTaskCreate(drain_task, "outbox_drain", 4096, NULL, 1, &drain_task_handle);
+}
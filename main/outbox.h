@@ -0,0 +1,36 @@
+#pragma once
+#include <stdbool.h>
+#include "esp_err.h"
+
+/* Flash-backed store-and-forward outbox.
+
+   Messages published while the broker is unreachable are appended to a
+   log on a raw data partition, e.g. in partitions.csv:
+
+       outbox, data, 0x40, , 64K
+
+   The partition is used as a ring of flash sectors, so erases rotate over
+   the whole partition. Each record carries a sequence number and a CRC;
+   a record torn by a power cut fails its CRC and is skipped on the next
+   boot. Replayed records are marked consumed in place by clearing bits of
+   their state byte, which needs no erase, once the broker acknowledged
+   them (QoS 1) or the client took them (QoS 0); a record whose PUBACK
+   does not come within OUTBOX_ACK_TIMEOUT_MS is published again. When the log is full the oldest
+   sector is erased and its records are lost. */
+
+#define OUTBOX_PARTITION_LABEL    "outbox"
+#define OUTBOX_MAX_RECORD         512
+#define OUTBOX_DRAIN_INTERVAL_MS  50
+#define OUTBOX_ACK_TIMEOUT_MS     5000
+
+esp_err_t outbox_init(void);
+
+esp_err_t outbox_append(const char *topic, const void *data, int len, int qos);
+
+bool outbox_pending(void);
+
+/* Starts the task that replays the log once Wi-Fi and MQTT are up */
+void outbox_start_drain(void);
+
+/* MQTT_EVENT_PUBLISHED, for any message */
+void outbox_on_published(int msg_id);
@@ -0,0 +1,129 @@
+#include "power.h"
+#include "mqqt_client.h"
+#include "camera.h"
+#include "wifi.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+static const char *TAG = "POWER";
+
+static RTC_DATA_ATTR power_rtc_state_t rtc_state;
+static TaskHandle_t doorbell_task_handle;
+
+wake_reason_t power_wake_reason(void)
+{
+    switch (esp_sleep_get_wakeup_cause()) {
+        case ESP_SLEEP_WAKEUP_EXT1: {
+            uint64_t pins = esp_sleep_get_ext1_wakeup_status();
+            return (pins & (1ULL << DOORBELL_GPIO)) ? WAKE_DOORBELL : WAKE_PIR;
+        }
+        case ESP_SLEEP_WAKEUP_TIMER:
+            return WAKE_TIMER;
+        default:
+            return WAKE_POWER_ON;
+    }
+}
+
+const power_rtc_state_t *power_rtc_state(void)
+{
+    return &rtc_state;
+}
+
+static void IRAM_ATTR doorbell_isr(void* arg)
+{
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(doorbell_task_handle, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+static void doorbell_task(void* arg)
+{
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        vTaskDelay(pdMS_TO_TICKS(DOORBELL_DEBOUNCE_MS));
+        if (gpio_get_level(DOORBELL_GPIO)) {
+            ESP_LOGI(TAG, "Doorbell pressed");
+            publish_doorbell_event(NULL);
+        }
+        ulTaskNotifyTake(pdTRUE, 0);    /* drop bounces seen meanwhile */
+    }
+}
+
+void doorbell_init(void)
+{
+    gpio_reset_pin(DOORBELL_GPIO);
+    gpio_set_direction(DOORBELL_GPIO, GPIO_MODE_INPUT);
+    gpio_set_pull_mode(DOORBELL_GPIO, GPIO_PULLDOWN_ONLY);
+    gpio_set_intr_type(DOORBELL_GPIO, GPIO_INTR_POSEDGE);
+
+    xTaskCreate(doorbell_task, "doorbell_task", 3072, NULL, 3, &doorbell_task_handle);
+
+    gpio_install_isr_service(0);
+    gpio_isr_handler_add(DOORBELL_GPIO, doorbell_isr, NULL);
+}
+
+static void enter_deep_sleep(void)
+{
+    esp_sleep_enable_ext1_wakeup((1ULL << DOORBELL_GPIO) | (1ULL << PIR_GPIO),
+                                 ESP_EXT1_WAKEUP_ANY_HIGH);
+    esp_sleep_enable_timer_wakeup(POWER_TELEMETRY_WAKE_S * 1000000ULL);
+
+    ESP_LOGI(TAG, "Deep sleep after %lld ms awake", (long long)esp_timer_get_time() / 1000);
+    esp_deep_sleep_start();
+}
+
+void power_run_duty_cycle(void)
+{
+    wake_reason_t reason = power_wake_reason();
+    rtc_state.wake_count++;
+
+    /* association runs in the background while the sensor captures */
+    wifi_init();
+    frame_t *fb = NULL;
+    if (reason == WAKE_DOORBELL || reason == WAKE_PIR) {
+        fb = camera_capture();
+    }
+
+    /* bounded: with the AP gone the event still goes to the outbox and the
+       device goes back to sleep */
+    int64_t deadline_ms = esp_timer_get_time() / 1000 + POWER_CONNECT_TIMEOUT_MS;
+    mqtt_start(pdMS_TO_TICKS(POWER_CONNECT_TIMEOUT_MS));
+    int64_t left_ms = deadline_ms - esp_timer_get_time() / 1000;
+    EventBits_t bits = xEventGroupWaitBits(wifi_eventgroup, MQTT_CONNECTED_BIT, pdFALSE, pdTRUE,
+                                           pdMS_TO_TICKS(left_ms > 0 ? left_ms : 0));
+    if (!(bits & MQTT_CONNECTED_BIT)) {
+        ESP_LOGW(TAG, "Broker not reached, event goes to the outbox");
+    }
+
+    switch (reason) {
+        case WAKE_DOORBELL:
+            rtc_state.doorbell_wakes++;
+            publish_doorbell_event(fb);
+            break;
+        case WAKE_PIR:
+            rtc_state.pir_wakes++;
+            if (fb) {
+                publish_image(fb);
+            }
+            break;
+        default:
+            break;
+    }
+    if (fb) {
+        frame_release(fb);
+    }
+    publish_telemetry_now();
+
+    /* offline, everything that survives the sleep is already in the outbox */
+    if ((bits & MQTT_CONNECTED_BIT) && !mqtt_wait_idle(POWER_PUBLISH_TIMEOUT_MS)) {
+        ESP_LOGW(TAG, "Publish did not finish before the sleep deadline");
+    }
+    rtc_state.last_wake_to_publish_ms = mqtt_last_publish_ms();
+
+    enter_deep_sleep();
+}
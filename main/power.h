@@ -0,0 +1,42 @@
+#pragma once
+#include <stdint.h>
+
+/* Doorbell input and the deep-sleep duty cycle.
+
+   In the default always-on mode the doorbell GPIO raises an interrupt and
+   a small task publishes the event. With CONFIG_DOORCAM_LOW_POWER_MODE the
+   device sleeps between events: it wakes on the doorbell or PIR input (or
+   the telemetry timer), captures while Wi-Fi associates, publishes the
+   event and snapshot in one burst and goes straight back to sleep. */
+
+#define DOORBELL_GPIO             13
+#define PIR_GPIO                  14
+#define DOORBELL_DEBOUNCE_MS      50
+
+#define POWER_TELEMETRY_WAKE_S    3600
+#define POWER_CONNECT_TIMEOUT_MS  8000
+#define POWER_PUBLISH_TIMEOUT_MS  8000
+
+typedef enum {
+    WAKE_POWER_ON = 0,
+    WAKE_DOORBELL,
+    WAKE_PIR,
+    WAKE_TIMER
+} wake_reason_t;
+
+/* kept in RTC slow memory across deep sleep */
+typedef struct {
+    uint32_t wake_count;
+    uint32_t doorbell_wakes;
+    uint32_t pir_wakes;
+    uint32_t last_wake_to_publish_ms;
+} power_rtc_state_t;
+
+wake_reason_t power_wake_reason(void);
+const power_rtc_state_t *power_rtc_state(void);
+
+/* always-on mode: doorbell presses publish via interrupt */
+void doorbell_init(void);
+
+/* low-power mode: handle the wake event, then deep sleep; never returns */
+void power_run_duty_cycle(void);
@@ -0,0 +1,93 @@
+#include <stdatomic.h>
+#include "preroll.h"
+#include "camera.h"
+#include "motion.h"
+#include "mqqt_client.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+
+static const char *TAG = "PREROLL";
+
+/* one spare slab for the frame being captured while the ring is full */
+#define PREROLL_ARENA_FRAMES (PREROLL_FRAMES + 1)
+
+static frame_pool_t preroll_arena;
+
+static _Atomic(frame_t *) slots[PREROLL_FRAMES];
+static atomic_uint head;
+
+void preroll_push(frame_t *fb)
+{
+    unsigned i = atomic_load_explicit(&head, memory_order_relaxed) % PREROLL_FRAMES;
+
+    frame_t *old = atomic_exchange(&slots[i], fb);
+    atomic_store_explicit(&head, i + 1, memory_order_release);
+
+    if (old) {
+        frame_release(old);
+    }
+}
+
+size_t preroll_take(frame_t **out, size_t max)
+{
+    unsigned start = atomic_load_explicit(&head, memory_order_acquire);
+    size_t n = 0;
+
+    for (unsigned k = 0; k < PREROLL_FRAMES && n < max; k++) {
+        frame_t *fb = atomic_exchange(&slots[(start + k) % PREROLL_FRAMES], NULL);
+        if (fb) {
+            out[n++] = fb;
+        }
+    }
+
+    /* the producer may have overtaken us while we walked the ring */
+    for (size_t i = 1; i < n; i++) {
+        frame_t *fb = out[i];
+        size_t j = i;
+        while (j > 0 && out[j - 1]->timestamp_us > fb->timestamp_us) {
+            out[j] = out[j - 1];
+            j--;
+        }
+        out[j] = fb;
+    }
+    return n;
+}
+
+static void preview_task(void* arg)
+{
+    TickType_t last_wake = xTaskGetTickCount();
+    int64_t last_motion_us = -MOTION_COOLDOWN_MS * 1000LL;
+
+    while (1) {
+        frame_t *fb = frame_pool_acquire(&preroll_arena);
+        if (fb) {
+            if (camera_fill(fb) == ESP_OK) {
+                motion_result_t motion;
+                if (motion_process(fb, &motion) &&
+                    fb->timestamp_us - last_motion_us > MOTION_COOLDOWN_MS * 1000LL) {
+                    last_motion_us = fb->timestamp_us;
+                    publish_motion_event(&motion);
+                }
+                preroll_push(fb);
+            } else {
+                frame_release(fb);
+            }
+        }
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(PREROLL_INTERVAL_MS));
+    }
+}
+
+esp_err_t preroll_init(void)
+{
+    esp_err_t err = frame_pool_init(&preroll_arena, PREROLL_ARENA_FRAMES, PREROLL_FRAME_MAX_BYTES);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    motion_init();
+    xTaskCreate(preview_task, "preview_task", 3072, NULL, 2, NULL);
+    ESP_LOGI(TAG, "Pre-roll of %d frames every %d ms", PREROLL_FRAMES, PREROLL_INTERVAL_MS);
+    return ESP_OK;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <stddef.h>
+#include "esp_err.h"
+#include "frame_pool.h"
+#include "camera.h"
+
+/* Pre-roll ring of the most recent low resolution frames.
+
+   The preview task is the only producer and the doorbell path the only
+   consumer. Slots are swapped atomically, so the producer overwrites the
+   oldest frame without ever waiting and the consumer takes frames without
+   copying them. Frames come from their own small arena, separate from the
+   full-size capture pool. */
+
+#define PREROLL_FRAMES           4
+/* a preview JPEG stays well under half a byte per pixel; a bigger one is
+   dropped by camera_fill() rather than overrunning the slab */
+#define PREROLL_FRAME_MAX_BYTES  (CAMERA_PREVIEW_WIDTH * CAMERA_PREVIEW_HEIGHT / 2)
+#define PREROLL_INTERVAL_MS      250
+
+esp_err_t preroll_init(void);
+
+/* Producer side. Takes ownership of the caller's reference. */
+void preroll_push(frame_t *fb);
+
+/* Consumer side. Moves up to max frames, oldest first, into out and returns
+   how many were taken; the caller owns (and must release) each of them. */
+size_t preroll_take(frame_t **out, size_t max);
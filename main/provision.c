@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "provision.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "nvs.h"
+#include "mbedtls/md.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+static const char *TAG = "PROVISION";
+
+#define PROVISION_NS        "provision"
+#define PROVISION_NVS_KEY   "cfg"
+#define PROVISION_VERSION   1
+#define HMAC_LEN            32
+#define SIG_FIELD_LEN       (4 + 2 * HMAC_LEN)      /* "sig=" and the hex */
+#define TOPIC_MAX           128
+
+typedef struct {
+    uint8_t version;
+    provision_config_t cfg;
+} provision_blob_t;
+
+static provision_config_t current;
+static provision_apply_fn_t apply_fn;
+static TaskHandle_t provision_task_handle;
+
+/* one message at a time, handed over from the MQTT event task, behind the
+   device ID and topic it is signed for: "<device_id>\n<topic>\n<body>sig=..." */
+static char msg[PROVISION_ID_LEN + TOPIC_MAX + PROVISION_MAX_MSG + 3];
+static size_t msg_len;
+static size_t body_start;
+static int64_t msg_received_us;
+static volatile bool msg_busy;
+static provision_timing_t last_timing;
+
+static void load(void)
+{
+    strlcpy(current.uri, CONFIG_DOORCAM_BROKER_URI, sizeof(current.uri));
+    strlcpy(current.username, CONFIG_DOORCAM_MQTT_USERNAME, sizeof(current.username));
+    strlcpy(current.password, CONFIG_DOORCAM_MQTT_PASSWORD, sizeof(current.password));
+
+    nvs_handle_t h;
+    provision_blob_t blob;
+    size_t len = sizeof(blob);
+
+    if (nvs_open(PROVISION_NS, NVS_READONLY, &h) != ESP_OK) {
+        return;
+    }
+    if (nvs_get_blob(h, PROVISION_NVS_KEY, &blob, &len) == ESP_OK &&
+        len == sizeof(blob) && blob.version == PROVISION_VERSION) {
+        current = blob.cfg;
+        ESP_LOGI(TAG, "Loaded config %lu: %s", (unsigned long)current.seq, current.uri);
+    }
+    nvs_close(h);
+}
+
+static esp_err_t store(const provision_config_t *cfg)
+{
+    nvs_handle_t h;
+    provision_blob_t blob = { .version = PROVISION_VERSION, .cfg = *cfg };
+
+    esp_err_t err = nvs_open(PROVISION_NS, NVS_READWRITE, &h);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_blob(h, PROVISION_NVS_KEY, &blob, sizeof(blob));
+    if (err == ESP_OK) {
+        err = nvs_commit(h);
+    }
+    nvs_close(h);
+    return err;
+}
+
+static int hex_nibble(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/* signature over msg[0..signed_len), hex in sig */
+static bool signature_ok(size_t signed_len, const char *sig)
+{
+    const char *key = CONFIG_DOORCAM_PROVISION_KEY;
+    uint8_t mac[HMAC_LEN];
+    uint8_t diff = 0;
+
+    if (key[0] == 0) {
+        return false;
+    }
+    if (mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256),
+                        (const uint8_t *)key, strlen(key),
+                        (const uint8_t *)msg, signed_len, mac) != 0) {
+        return false;
+    }
+    for (int i = 0; i < HMAC_LEN; i++) {
+        int hi = hex_nibble(sig[2 * i]);
+        int lo = hi < 0 ? -1 : hex_nibble(sig[2 * i + 1]);
+        if (lo < 0) {
+            return false;
+        }
+        diff |= mac[i] ^ (hi << 4 | lo);     /* no early exit on a mismatch */
+    }
+    return diff == 0;
+}
+
+static bool copy_value(char *dst, size_t size, const char *val, size_t len)
+{
+    if (len >= size) {
+        return false;
+    }
+    memcpy(dst, val, len);
+    dst[len] = 0;
+    return true;
+}
+
+/* verifies msg and merges it over the current configuration */
+static esp_err_t parse(provision_config_t *out)
+{
+    /* the last line, found by position: "sig=" may well occur in a value */
+    size_t end = msg_len;
+    if (end > body_start && msg[end - 1] == '\n') {
+        end--;
+    }
+    if (end < body_start + SIG_FIELD_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    char *sig = msg + end - SIG_FIELD_LEN;
+    if ((sig != msg + body_start && sig[-1] != '\n') || memcmp(sig, "sig=", 4) != 0 ||
+        strspn(sig + 4, "0123456789abcdefABCDEF") < 2 * HMAC_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!signature_ok(sig - msg, sig + 4)) {
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    *out = current;
+    bool have_seq = false;
+    for (char *line = msg + body_start; line < sig; ) {
+        char *end = memchr(line, '\n', sig - line);
+        size_t len = end ? (size_t)(end - line) : (size_t)(sig - line);
+        char *eq = memchr(line, '=', len);
+        bool ok = true;
+
+        if (eq != NULL) {
+            size_t klen = eq - line;
+            const char *val = eq + 1;
+            size_t vlen = len - klen - 1;
+
+            if (klen == 3 && memcmp(line, "seq", 3) == 0) {
+                out->seq = strtoul(val, NULL, 10);
+                have_seq = true;
+            } else if (klen == 3 && memcmp(line, "uri", 3) == 0) {
+                ok = copy_value(out->uri, sizeof(out->uri), val, vlen);
+            } else if (klen == 4 && memcmp(line, "user", 4) == 0) {
+                ok = copy_value(out->username, sizeof(out->username), val, vlen);
+            } else if (klen == 4 && memcmp(line, "pass", 4) == 0) {
+                ok = copy_value(out->password, sizeof(out->password), val, vlen);
+            } else if (klen == 7 && memcmp(line, "user_id", 7) == 0) {
+                ok = copy_value(out->user_id, sizeof(out->user_id), val, vlen);
+            } else if (klen == 9 && memcmp(line, "device_id", 9) == 0) {
+                ok = copy_value(out->device_id, sizeof(out->device_id), val, vlen);
+            }
+        }
+        if (!ok) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        line += len + 1;
+    }
+
+    if (!have_seq || out->seq <= current.seq) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (out->uri[0] == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+static void provision_task(void *arg)
+{
+    provision_config_t cfg;
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        int64_t start = msg_received_us;
+        esp_err_t err = parse(&cfg);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Config rejected: %s", esp_err_to_name(err));
+            msg_busy = false;
+            continue;
+        }
+
+        int64_t verified = esp_timer_get_time();
+        err = store(&cfg);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to store config: %s", esp_err_to_name(err));
+            msg_busy = false;
+            continue;
+        }
+        current = cfg;
+
+        int64_t stored = esp_timer_get_time();
+        apply_fn(&current);
+        int64_t applied = esp_timer_get_time();
+        last_timing = (provision_timing_t){
+            .seq = current.seq,
+            .verify_us = verified - start,
+            .store_us = stored - verified,
+            .apply_us = applied - stored,
+        };
+        ESP_LOGI(TAG, "Config %lu applied: verify %lld ms, NVS %lld ms, apply %lld ms",
+                 (unsigned long)current.seq, (long long)(verified - start) / 1000,
+                 (long long)(stored - verified) / 1000, (long long)(applied - stored) / 1000);
+        /* current, which submit reads the device ID from, is settled */
+        msg_busy = false;
+    }
+}
+
+esp_err_t provision_init(provision_apply_fn_t apply)
+{
+    apply_fn = apply;
+    load();
+
+    if (xTaskCreate(provision_task, "provision_task", 4096, NULL, 2, &provision_task_handle) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+const provision_config_t *provision_get(void)
+{
+    return &current;
+}
+
+void provision_get_timing(provision_timing_t *out)
+{
+    *out = last_timing;
+}
+
+bool provision_submit(const char *topic, const char *data, int len)
+{
+    if (msg_busy || len <= 0 || len > PROVISION_MAX_MSG || strlen(topic) >= TOPIC_MAX ||
+        provision_task_handle == NULL) {
+        return false;
+    }
+
+    const char *device_id = current.device_id[0] ? current.device_id : CONFIG_DOORCAM_DEVICE_ID;
+    body_start = snprintf(msg, sizeof(msg), "%s\n%s\n", device_id, topic);
+    memcpy(msg + body_start, data, len);
+    msg_len = body_start + len;
+    msg[msg_len] = 0;
+    msg_received_us = esp_timer_get_time();
+    msg_busy = true;
+    xTaskNotifyGive(provision_task_handle);
+    return true;
+}
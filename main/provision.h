@@ -0,0 +1,62 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/* Broker, credentials and device identity, kept in NVS.
+
+   Defaults come from Kconfig; a stored configuration replaces them on the
+   next boot. A new configuration arrives as a text message on cmd/config:
+
+       seq=<n>
+       uri=mqtts://broker.example:8883
+       user=<username>
+       pass=<password>
+       user_id=<id>
+       device_id=<id>
+       sig=<hex HMAC-SHA256 of "<device_id>\n<topic>\n" and every byte before "sig=">
+
+   Every line except seq and sig is optional and keeps the current value
+   when left out; an empty user_id/device_id means the Kconfig one. sig
+   is the last line. The signature covers the device's current ID and
+   the topic the message arrived on, so one signed for a device cannot be
+   replayed to another sharing the key; seq must be higher than the
+   stored one, so it cannot be replayed to the same device either. The
+   key is CONFIG_DOORCAM_PROVISION_KEY; without it every message is
+   rejected. A verified configuration is written to NVS and
+   handed to the apply callback on the provisioning task. */
+
+#define PROVISION_MAX_MSG     512
+#define PROVISION_URI_LEN     96
+#define PROVISION_CRED_LEN    64
+#define PROVISION_ID_LEN      24
+
+typedef struct {
+    uint32_t seq;
+    char uri[PROVISION_URI_LEN];
+    char username[PROVISION_CRED_LEN];
+    char password[PROVISION_CRED_LEN];
+    char user_id[PROVISION_ID_LEN];
+    char device_id[PROVISION_ID_LEN];
+} provision_config_t;
+
+/* the phases of the last configuration applied, from its arrival */
+typedef struct {
+    uint32_t seq;               /* 0 until one was applied */
+    int64_t verify_us;          /* parse and signature check */
+    int64_t store_us;           /* NVS write and commit */
+    int64_t apply_us;           /* the apply callback: client stopped, reconfigured, restarted */
+} provision_timing_t;
+
+typedef void (*provision_apply_fn_t)(const provision_config_t *cfg);
+
+/* Loads the stored configuration and starts the provisioning task */
+esp_err_t provision_init(provision_apply_fn_t apply);
+
+const provision_config_t *provision_get(void);
+void provision_get_timing(provision_timing_t *out);
+
+/* Copies a cmd/config payload, and the topic it arrived on, for the
+   provisioning task. Called from the MQTT event task; returns false if
+   one is still being processed. */
+bool provision_submit(const char *topic, const char *data, int len);
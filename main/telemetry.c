@@ -0,0 +1,66 @@
+#include <stdlib.h>
+#include "telemetry.h"
+#include "esp_log.h"
+#include "mqqt_client.h"
+#include "topics.h"
+
+static const char *TAG = "TELEMETRY";
+
+static telemetry_record_t record;
+static int16_t last_flushed_temp;
+static bool last_flushed_battery_low;
+static bool have_flushed;
+
+void telemetry_init(void)
+{
+    record.version = TELEMETRY_RECORD_VERSION;
+    record.count = 0;
+    record.sample_period_s = TELEMETRY_SAMPLE_MS / 1000;
+}
+
+void telemetry_flush(void)
+{
+    if (record.count == 0) {
+        return;
+    }
+
+    int len = sizeof(record) - sizeof(record.samples) + record.count * sizeof(telemetry_sample_t);
+    int msg_id = mqtt_publish_or_store(TOPIC_TELEMETRY, (const char *)&record, len, 1);
+    if (msg_id < 0) {
+        ESP_LOGE(TAG, "Failed to publish telemetry batch");
+        return;     /* keep the samples, retry on the next add */
+    }
+
+    ESP_LOGI(TAG, "Batch of %d samples published (%d bytes), msg_id=%d", record.count, len, msg_id);
+    last_flushed_temp = record.samples[record.count - 1].temp_centi;
+    last_flushed_battery_low = record.samples[record.count - 1].battery <= TELEMETRY_BATTERY_LOW;
+    have_flushed = true;
+    record.count = 0;
+}
+
+/* crossings only: a battery that stays low does not flush every sample */
+static bool crossed_threshold(const telemetry_sample_t *s)
+{
+    if ((s->battery <= TELEMETRY_BATTERY_LOW) != last_flushed_battery_low) {
+        return true;
+    }
+    return have_flushed && abs(s->temp_centi - last_flushed_temp) >= TELEMETRY_TEMP_DELTA_CENTI;
+}
+
+bool telemetry_add(const telemetry_sample_t *sample)
+{
+    if (record.count == TELEMETRY_MAX_SAMPLES) {
+        /* last flush failed and the window is full: drop the oldest */
+        for (int i = 1; i < TELEMETRY_MAX_SAMPLES; i++) {
+            record.samples[i - 1] = record.samples[i];
+        }
+        record.count--;
+    }
+    record.samples[record.count++] = *sample;
+
+    if (record.count == TELEMETRY_MAX_SAMPLES || crossed_threshold(sample)) {
+        telemetry_flush();
+        return record.count == 0;
+    }
+    return false;
+}
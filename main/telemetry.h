@@ -0,0 +1,42 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Batched telemetry.
+
+   Samples are packed into a fixed little-endian record and sent as one
+   QoS 1 message on data/telemetry per TELEMETRY_WINDOW_S, or as soon as a
+   sample crosses one of the thresholds below. With TELEMETRY_COMPAT_TOPICS
+   every sample is also published on the old per-value text topics. */
+
+#define TELEMETRY_SAMPLE_MS          10000
+#define TELEMETRY_WINDOW_S           300
+#define TELEMETRY_MAX_SAMPLES        (TELEMETRY_WINDOW_S * 1000 / TELEMETRY_SAMPLE_MS)
+#define TELEMETRY_TEMP_DELTA_CENTI   200     /* 2.00 C since last flush */
+#define TELEMETRY_BATTERY_LOW        15      /* going below or back above */
+#define TELEMETRY_COMPAT_TOPICS      0
+
+#define TELEMETRY_RECORD_VERSION     1
+
+typedef struct __attribute__((packed)) {
+    uint32_t uptime_s;
+    uint32_t free_heap;
+    int16_t temp_centi;
+    uint8_t battery;
+    int8_t rssi;
+} telemetry_sample_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t version;
+    uint8_t count;
+    uint16_t sample_period_s;
+    telemetry_sample_t samples[TELEMETRY_MAX_SAMPLES];
+} telemetry_record_t;
+
+void telemetry_init(void);
+
+/* Adds a sample and flushes the batch when the window is full or a
+   threshold was crossed. Returns true if a message was sent. */
+bool telemetry_add(const telemetry_sample_t *sample);
+
+void telemetry_flush(void);
@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <string.h>
+#include "topics.h"
+#include "esp_log.h"
+
+static const char *TAG = "TOPICS";
+
+typedef struct {
+    const char *str;
+    size_t len;
+} topic_t;
+
+#define TOPIC_DEFAULT(id, suffix) { TOPIC_BASE suffix, sizeof(TOPIC_BASE suffix) - 1 },
+static const topic_t defaults[TOPIC_COUNT] = { MQTT_TOPICS(TOPIC_DEFAULT) };
+#undef TOPIC_DEFAULT
+
+#define TOPIC_SUFFIX(id, suffix) suffix,
+static const char *const suffixes[TOPIC_COUNT] = { MQTT_TOPICS(TOPIC_SUFFIX) };
+#undef TOPIC_SUFFIX
+
+/* one buffer per topic, with room for the longest IDs */
+#define TOPIC_BUF(id, suffix) char id##_buf[sizeof("home/user/device/" suffix) + 2 * TOPIC_ID_MAX];
+static struct { MQTT_TOPICS(TOPIC_BUF) } bufs;
+#undef TOPIC_BUF
+
+#define TOPIC_OVERRIDE(id, suffix) { bufs.id##_buf, 0 },
+static topic_t overrides[TOPIC_COUNT] = { MQTT_TOPICS(TOPIC_OVERRIDE) };
+#undef TOPIC_OVERRIDE
+
+/* NULL while the Kconfig IDs are in use */
+static const topic_t *active;
+
+const char *topic_get(topic_id_t id)
+{
+    const topic_t *t = active;
+    return t ? t[id].str : defaults[id].str;
+}
+
+size_t topic_len(topic_id_t id)
+{
+    const topic_t *t = active;
+    return t ? t[id].len : defaults[id].len;
+}
+
+esp_err_t topics_set_ids(const char *user_id, const char *device_id)
+{
+    if (user_id == NULL && device_id == NULL) {
+        active = NULL;
+        ESP_LOGI(TAG, "Using built-in topics %s...", defaults[TOPIC_PREFIX].str);
+        return ESP_OK;
+    }
+    if (user_id == NULL || device_id == NULL || !*user_id || !*device_id ||
+        strpbrk(user_id, "/+#") || strpbrk(device_id, "/+#")) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (strlen(user_id) > TOPIC_ID_MAX || strlen(device_id) > TOPIC_ID_MAX) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    /* the buffers fit these lengths */
+    for (int i = 0; i < TOPIC_COUNT; i++) {
+        char *buf = (char *)overrides[i].str;
+        overrides[i].len = sprintf(buf, "home/user%s/device%s/%s", user_id, device_id, suffixes[i]);
+    }
+    active = overrides;
+
+    ESP_LOGI(TAG, "Using topics %s...", overrides[TOPIC_PREFIX].str);
+    return ESP_OK;
+}
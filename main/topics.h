@@ -0,0 +1,43 @@
+#pragma once
+#include <stddef.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+/* MQTT topic table.
+
+   Every topic is home/user<USER_ID>/device<DEVICE_ID>/<suffix>, with the
+   IDs from Kconfig, so by default the full strings and their lengths are
+   compile-time constants in flash. topics_set_ids() switches to IDs given
+   at run time (provisioning); the strings are then built into static
+   buffers sized from the same table. Command topics are not listed: they
+   are the prefix followed by the suffix a command is registered with. */
+
+#define TOPIC_BASE  "home/user" CONFIG_DOORCAM_USER_ID "/device" CONFIG_DOORCAM_DEVICE_ID "/"
+
+/* longest run-time user or device ID; provisioning allows PROVISION_ID_LEN - 1 */
+#define TOPIC_ID_MAX 23
+
+/* X(id, suffix) */
+#define MQTT_TOPICS(X) \
+    X(TOPIC_PREFIX,       "")                  \
+    X(TOPIC_TEMPERATURE,  "data/temperature")  \
+    X(TOPIC_BATTERY,      "data/battery")      \
+    X(TOPIC_TELEMETRY,    "data/telemetry")    \
+    X(TOPIC_DOORBELL,     "doorbell")          \
+    X(TOPIC_MOTION,       "motion")            \
+    X(TOPIC_CAM_IMAGE,    "cam/image")         \
+    X(TOPIC_CAM_META,     "cam/img_metadata")  \
+    X(TOPIC_DIAG,         "diag")
+
+#define TOPIC_ENUM(id, suffix) id,
+typedef enum { MQTT_TOPICS(TOPIC_ENUM) TOPIC_COUNT } topic_id_t;
+#undef TOPIC_ENUM
+
+const char *topic_get(topic_id_t id);
+size_t topic_len(topic_id_t id);
+
+/* Rebuilds every topic from the given IDs, or back to the Kconfig ones
+   when both are NULL. The strings are rewritten in place: a caller must
+   not run this while another task uses a string from topic_get() (the
+   MQTT client does both under its publish lock). */
+esp_err_t topics_set_ids(const char *user_id, const char *device_id);
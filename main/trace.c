@@ -0,0 +1,161 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include "trace.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+#define TRACE_MAGIC      0x31435254u     /* "TRC1" */
+#define TRACE_NAME_LEN   16
+
+typedef struct {
+    char name[TRACE_NAME_LEN];
+    atomic_uint head;           /* written by the owning task only */
+    trace_event_t events[TRACE_RING_EVENTS];
+} trace_ring_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t tasks;
+    uint8_t counters;
+    uint8_t histograms;
+    uint8_t hist_buckets;
+    uint8_t reserved[3];
+    uint64_t now_us;
+} trace_dump_header_t;
+
+static trace_ring_t rings[TRACE_MAX_TASKS];
+static atomic_uint rings_claimed;
+static atomic_uint rings_ready;         /* bit per ring whose name is set */
+static atomic_uint counters[TRACE_CNT_COUNT];
+static atomic_uint hist[TRACE_HIST_COUNT][TRACE_HIST_BUCKETS];
+
+static __thread trace_ring_t *task_ring;
+static __thread bool task_untraced;     /* no ring left for this task */
+
+static trace_ring_t *ring_claim(void)
+{
+    unsigned i = atomic_fetch_add_explicit(&rings_claimed, 1, memory_order_relaxed);
+    if (i >= TRACE_MAX_TASKS) {
+        task_untraced = true;
+        trace_count(TRACE_CNT_UNTRACED_TASKS);
+        return NULL;
+    }
+
+    trace_ring_t *r = &rings[i];
+    strncpy(r->name, pcTaskGetName(NULL), TRACE_NAME_LEN - 1);
+    atomic_fetch_or_explicit(&rings_ready, 1u << i, memory_order_release);
+    task_ring = r;
+    return r;
+}
+
+void trace_event(trace_event_id_t id, trace_phase_t phase, uint32_t arg)
+{
+    trace_ring_t *r = task_ring;
+    if (r == NULL) {
+        if (task_untraced || (r = ring_claim()) == NULL) {
+            return;
+        }
+    }
+
+    unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    trace_event_t *e = &r->events[head & (TRACE_RING_EVENTS - 1)];
+    e->ts_us = (uint32_t)esp_timer_get_time();
+    e->id = id;
+    e->phase = phase;
+    e->arg = arg;
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+void trace_count(trace_counter_id_t id)
+{
+    atomic_fetch_add_explicit(&counters[id], 1, memory_order_relaxed);
+}
+
+void trace_hist(trace_hist_id_t id, uint32_t value_us)
+{
+    int b = value_us ? 32 - __builtin_clz(value_us) : 0;
+    if (b >= TRACE_HIST_BUCKETS) {
+        b = TRACE_HIST_BUCKETS - 1;
+    }
+    atomic_fetch_add_explicit(&hist[id][b], 1, memory_order_relaxed);
+}
+
+size_t trace_snapshot_size(void)
+{
+    return sizeof(trace_dump_header_t) +
+           sizeof(uint32_t) * (TRACE_CNT_COUNT + TRACE_HIST_COUNT * TRACE_HIST_BUCKETS) +
+           TRACE_MAX_TASKS * (TRACE_NAME_LEN + sizeof(uint32_t) + sizeof(trace_event_t) * TRACE_RING_EVENTS);
+}
+
+static uint8_t *put_u32(uint8_t *p, uint32_t v)
+{
+    memcpy(p, &v, sizeof(v));
+    return p + sizeof(v);
+}
+
+/* copies the surviving records of one ring; returns where the next ring starts */
+static uint8_t *snapshot_ring(uint8_t *p, trace_ring_t *r)
+{
+    memcpy(p, r->name, TRACE_NAME_LEN);
+    uint8_t *count_at = p + TRACE_NAME_LEN;
+    uint8_t *ev = count_at + sizeof(uint32_t);
+
+    unsigned head = atomic_load_explicit(&r->head, memory_order_acquire);
+    unsigned first = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+    for (unsigned i = first; i != head; i++) {
+        memcpy(ev + (i - first) * sizeof(trace_event_t),
+               &r->events[i & (TRACE_RING_EVENTS - 1)], sizeof(trace_event_t));
+    }
+
+    /* the writer may have lapped us; the slot of record `after` is being
+       rewritten, so only records newer than after - RING survive */
+    atomic_thread_fence(memory_order_acquire);
+    unsigned after = atomic_load_explicit(&r->head, memory_order_relaxed);
+    unsigned stale = after - first >= TRACE_RING_EVENTS ? after - first - TRACE_RING_EVENTS + 1 : 0;
+    if (stale > head - first) {
+        stale = head - first;
+    }
+    unsigned n = head - first - stale;
+    memmove(ev, ev + stale * sizeof(trace_event_t), n * sizeof(trace_event_t));
+
+    put_u32(count_at, n);
+    return ev + n * sizeof(trace_event_t);
+}
+
+size_t trace_snapshot(uint8_t *buf, size_t len)
+{
+    if (len < trace_snapshot_size()) {
+        return 0;
+    }
+
+    unsigned ready = atomic_load_explicit(&rings_ready, memory_order_acquire);
+    trace_dump_header_t h = {
+        .magic = TRACE_MAGIC,
+        .version = TRACE_DUMP_VERSION,
+        .tasks = __builtin_popcount(ready),
+        .counters = TRACE_CNT_COUNT,
+        .histograms = TRACE_HIST_COUNT,
+        .hist_buckets = TRACE_HIST_BUCKETS,
+        .now_us = esp_timer_get_time(),
+    };
+    memcpy(buf, &h, sizeof(h));
+    uint8_t *p = buf + sizeof(h);
+
+    for (int i = 0; i < TRACE_CNT_COUNT; i++) {
+        p = put_u32(p, atomic_load_explicit(&counters[i], memory_order_relaxed));
+    }
+    for (int i = 0; i < TRACE_HIST_COUNT; i++) {
+        for (int b = 0; b < TRACE_HIST_BUCKETS; b++) {
+            p = put_u32(p, atomic_load_explicit(&hist[i][b], memory_order_relaxed));
+        }
+    }
+    for (int i = 0; i < TRACE_MAX_TASKS; i++) {
+        if (ready & (1u << i)) {
+            p = snapshot_ring(p, &rings[i]);
+        }
+    }
+    return p - buf;
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/* Binary event trace, counters and latency histograms.
+
+   Every task that records an event gets its own ring of TRACE_RING_EVENTS
+   fixed 12-byte records on first use, so writers never share a cache line
+   or take a lock; the oldest records are overwritten. Tasks beyond
+   TRACE_MAX_TASKS record nothing and are counted in "untraced_tasks". Events carry a
+   compact ID from the table below, the low 32 bits of esp_timer_get_time()
+   and one 32-bit argument. Counters and histograms are global and updated
+   with atomic adds. Histogram buckets are powers of two of microseconds:
+   bucket b counts values in [2^(b-1), 2^b), bucket 0 counts zero.
+
+   trace_snapshot() serializes everything into the TRACE_DUMP_VERSION
+   format decoded by tools/trace_decode.py, which reads the ID names from
+   this header. */
+
+#define TRACE_RING_EVENTS    128     /* per task, power of two */
+#define TRACE_MAX_TASKS      8
+#define TRACE_HIST_BUCKETS   24      /* up to ~8 s */
+#define TRACE_DUMP_VERSION   1
+
+/* X(id, name): spans (B/E), instants (I) and sampled values (C) */
+#define TRACE_EVENTS(X) \
+    X(TRACE_EV_WIFI_STAGE,      "wifi_stage")       \
+    X(TRACE_EV_WIFI_DISCONNECT, "wifi_disconnect")  \
+    X(TRACE_EV_MQTT_CONNECTED,  "mqtt_connected")   \
+    X(TRACE_EV_MQTT_DISCONNECT, "mqtt_disconnect")  \
+    X(TRACE_EV_MQTT_PUBLISH,    "mqtt_publish")     \
+    X(TRACE_EV_MQTT_STORED,     "mqtt_stored")      \
+    X(TRACE_EV_FRAME_PUBLISH,   "frame_publish")    \
+    X(TRACE_EV_IMAGE_QUEUE,     "image_queue")      \
+    X(TRACE_EV_CMD_EXEC,        "cmd_exec")
+
+#define TRACE_COUNTERS(X) \
+    X(TRACE_CNT_PUBLISH,        "publish")          \
+    X(TRACE_CNT_PUBLISH_FAIL,   "publish_fail")     \
+    X(TRACE_CNT_STORED,         "stored")           \
+    X(TRACE_CNT_IMAGE_DROP,     "image_drop")       \
+    X(TRACE_CNT_WIFI_DROP,      "wifi_drop")        \
+    X(TRACE_CNT_MQTT_DROP,      "mqtt_drop")        \
+    X(TRACE_CNT_UNTRACED_TASKS, "untraced_tasks")   /* found every ring taken */
+
+#define TRACE_HISTOGRAMS(X) \
+    X(TRACE_HIST_PUBACK_US,     "puback_us")        \
+    X(TRACE_HIST_FRAME_US,      "frame_us")         \
+    X(TRACE_HIST_CMD_WAIT_US,   "cmd_wait_us")      \
+    X(TRACE_HIST_MQTT_CONNECT_US, "mqtt_connect_us")
+
+#define TRACE_ENUM(id, name) id,
+typedef enum { TRACE_EVENTS(TRACE_ENUM) TRACE_EV_COUNT } trace_event_id_t;
+typedef enum { TRACE_COUNTERS(TRACE_ENUM) TRACE_CNT_COUNT } trace_counter_id_t;
+typedef enum { TRACE_HISTOGRAMS(TRACE_ENUM) TRACE_HIST_COUNT } trace_hist_id_t;
+#undef TRACE_ENUM
+
+typedef enum {
+    TRACE_PH_BEGIN = 'B',
+    TRACE_PH_END = 'E',
+    TRACE_PH_INSTANT = 'I',
+    TRACE_PH_VALUE = 'C',
+} trace_phase_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t ts_us;
+    uint16_t id;
+    uint8_t phase;
+    uint8_t reserved;
+    uint32_t arg;
+} trace_event_t;
+
+void trace_event(trace_event_id_t id, trace_phase_t phase, uint32_t arg);
+
+static inline void trace_begin(trace_event_id_t id, uint32_t arg)   { trace_event(id, TRACE_PH_BEGIN, arg); }
+static inline void trace_end(trace_event_id_t id, uint32_t arg)     { trace_event(id, TRACE_PH_END, arg); }
+static inline void trace_instant(trace_event_id_t id, uint32_t arg) { trace_event(id, TRACE_PH_INSTANT, arg); }
+static inline void trace_value(trace_event_id_t id, uint32_t value) { trace_event(id, TRACE_PH_VALUE, value); }
+
+void trace_count(trace_counter_id_t id);
+void trace_hist(trace_hist_id_t id, uint32_t value_us);
+
+/* Upper bound for the trace_snapshot() buffer */
+size_t trace_snapshot_size(void);
+
+/* Serializes counters, histograms and every task's ring into buf. Writers
+   are not stopped; records overwritten during the copy are left out.
+   Returns the number of bytes written, 0 if buf is too small. */
+size_t trace_snapshot(uint8_t *buf, size_t len);
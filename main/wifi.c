@@ -14,6 +14,9 @@
 #include <sys/socket.h>
 #include <netdb.h>
 #include "esp_wifi.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "trace.h"
 #include "sdkconfig.h"
 
 #define WIFI_SSID      CONFIG_WIFI_SSID
@@ -25,12 +28,112 @@ static const char *TAG = "wifi_station";
 
 #define LED_GPIO 33
 
+/* reconnect policy */
+#define WIFI_BACKOFF_BASE_MS   100
+#define WIFI_BACKOFF_MAX_MS    30000
+#define WIFI_FAST_ATTEMPTS     2      /* targeted tries before a full scan */
+#define WIFI_USE_STATIC_IP     0      /* reuse the cached lease instead of DHCP */
+#define WIFI_HTTP_PROBE        0
+
+#define WIFI_CACHE_NS   "wifi_cache"
+#define WIFI_CACHE_KEY  "last_ap"
+
+typedef struct {
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t valid;
+    esp_netif_ip_info_t ip;
+} wifi_cache_t;
+
+/* survives deep sleep, so a wake skips the NVS read */
+static RTC_DATA_ATTR wifi_cache_t cache;
+static esp_netif_t *sta_netif;
+static esp_timer_handle_t reconnect_timer;
+static int reconnect_attempts;
+static int64_t stage_time[CONN_STAGE_COUNT];
+
 EventGroupHandle_t wifi_eventgroup; 
 const EventBits_t WF1_BIT = BIT0;
 
 static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data);
 static void blink_task(void* arg);
 
+void conn_stage_mark(conn_stage_t stage)
+{
+    stage_time[stage] = esp_timer_get_time();
+    trace_instant(TRACE_EV_WIFI_STAGE, stage);
+
+    if (stage == CONN_STAGE_MQTT) {
+        ESP_LOGI(TAG, "Connect stages (ms from start): assoc %lld, ip %lld, mqtt %lld",
+                 (long long)(stage_time[CONN_STAGE_ASSOC] - stage_time[CONN_STAGE_START]) / 1000,
+                 (long long)(stage_time[CONN_STAGE_GOT_IP] - stage_time[CONN_STAGE_START]) / 1000,
+                 (long long)(stage_time[CONN_STAGE_MQTT] - stage_time[CONN_STAGE_START]) / 1000);
+    }
+}
+
+int64_t conn_stage_time(conn_stage_t stage)
+{
+    return stage_time[stage];
+}
+
+static void cache_load(void)
+{
+    nvs_handle_t h;
+    size_t len = sizeof(cache);
+
+    if (cache.valid) {
+        return;
+    }
+    if (nvs_open(WIFI_CACHE_NS, NVS_READONLY, &h) != ESP_OK) {
+        return;
+    }
+    if (nvs_get_blob(h, WIFI_CACHE_KEY, &cache, &len) != ESP_OK || len != sizeof(cache)) {
+        memset(&cache, 0, sizeof(cache));
+    }
+    nvs_close(h);
+}
+
+static void cache_store(void)
+{
+    nvs_handle_t h;
+
+    if (nvs_open(WIFI_CACHE_NS, NVS_READWRITE, &h) != ESP_OK) {
+        return;
+    }
+    nvs_set_blob(h, WIFI_CACHE_KEY, &cache, sizeof(cache));
+    nvs_commit(h);
+    nvs_close(h);
+}
+
+/* targeted association to the cached AP, or a normal scan */
+static void apply_sta_config(bool fast)
+{
+    wifi_config_t wifi_config = { //konfiguracja polaczenia
+        .sta = {
+            .ssid = WIFI_SSID,
+            .password = WIFI_PASS,
+            .threshold.authmode = WIFI_AUTH_WPA2_PSK,
+        },
+    };
+
+    if (fast && cache.valid) {
+        wifi_config.sta.bssid_set = true;
+        memcpy(wifi_config.sta.bssid, cache.bssid, sizeof(cache.bssid));
+        wifi_config.sta.channel = cache.channel;
+        wifi_config.sta.scan_method = WIFI_FAST_SCAN;
+    } else {
+        wifi_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+        wifi_config.sta.sort_method = WIFI_CONNECT_AP_BY_SIGNAL;
+    }
+    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+}
+
+static void reconnect_cb(void* arg)
+{
+    conn_stage_mark(CONN_STAGE_START);
+    esp_wifi_connect();
+}
+
 
 void wifi_init(void)
 {
@@ -41,7 +144,7 @@ void wifi_init(void)
 
     ESP_ERROR_CHECK(esp_netif_init());
     ESP_ERROR_CHECK(esp_event_loop_create_default());
-    esp_netif_create_default_wifi_sta();
+    sta_netif = esp_netif_create_default_wifi_sta();
 
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
@@ -57,30 +160,35 @@ void wifi_init(void)
                                                         NULL,
                                                         NULL));
 
-    wifi_config_t wifi_config = { //konfiguracja polaczenia
-        .sta = {
-            .ssid = WIFI_SSID,
-            .password = WIFI_PASS,
-            .threshold.authmode = WIFI_AUTH_WPA2_PSK,
-        },
+    const esp_timer_create_args_t timer_args = {
+        .callback = reconnect_cb,
+        .name = "wifi_reconnect",
     };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &reconnect_timer));
+
+    cache_load();
+#if WIFI_USE_STATIC_IP
+    if (cache.valid && cache.ip.ip.addr != 0) {
+        esp_netif_dhcpc_stop(sta_netif);
+        esp_netif_set_ip_info(sta_netif, &cache.ip);
+    }
+#endif
 
     xTaskCreate(blink_task, "blink_task", 2048, NULL, 1, NULL);
 
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+    apply_sta_config(true);
     ESP_ERROR_CHECK(esp_wifi_start());
 
-    ESP_LOGI(TAG, "wifi_init_sta finished.");
+    ESP_LOGI(TAG, "wifi_init_sta finished (%s).", cache.valid ? "fast connect" : "full scan");
 
 }
 
 static void blink_task(void* arg)
 {
-    EventBits_t wifi;
     bool led_on = false;
     while (1){
-        wifi = xEventGroupWaitBits(wifi_eventgroup, WF1_BIT, pdFALSE, pdFALSE, portMAX_DELAY);
+        xEventGroupWaitBits(wifi_eventgroup, WF1_BIT, pdFALSE, pdFALSE, portMAX_DELAY);
 
         while (xEventGroupGetBits(wifi_eventgroup) & WF1_BIT) {
             led_on = !led_on;
@@ -92,6 +200,7 @@ static void blink_task(void* arg)
     }
 }
 
+#if WIFI_HTTP_PROBE
 static void htttp_request(){ 
     struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM }; 
     struct addrinfo *res;
@@ -139,23 +248,61 @@ static void htttp_request(){
     freeaddrinfo(res);
     ESP_LOGI(TAG, "Done!");
 }
+#endif
 
 static void event_handler(void* arg, esp_event_base_t event_base,
                           int32_t event_id, void* event_data)
 {
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
+        conn_stage_mark(CONN_STAGE_START);
         esp_wifi_connect();
         gpio_set_level(LED_GPIO, 0); 
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+        conn_stage_mark(CONN_STAGE_ASSOC);
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
         ESP_LOGI("wifi", "Disconnected...");
+        trace_instant(TRACE_EV_WIFI_DISCONNECT, ((wifi_event_sta_disconnected_t *)event_data)->reason);
+        trace_count(TRACE_CNT_WIFI_DROP);
         xEventGroupSetBits(wifi_eventgroup, WF1_BIT);
         xEventGroupClearBits(wifi_eventgroup, WIFI_CONNECTED_BIT);
-        esp_wifi_connect();
+
+        reconnect_attempts++;
+        if (reconnect_attempts == WIFI_FAST_ATTEMPTS && cache.valid) {
+            ESP_LOGI(TAG, "Cached AP unreachable, falling back to full scan");
+            apply_sta_config(false);
+        }
+
+        int shift = reconnect_attempts - 1 < 10 ? reconnect_attempts - 1 : 10;
+        uint32_t delay_ms = WIFI_BACKOFF_BASE_MS << shift;
+        if (delay_ms > WIFI_BACKOFF_MAX_MS) {
+            delay_ms = WIFI_BACKOFF_MAX_MS;
+        }
+        esp_timer_stop(reconnect_timer);
+        esp_timer_start_once(reconnect_timer, delay_ms * 1000ULL);
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
         ESP_LOGI("wifi", "Got IP: " IPSTR, IP2STR(&event->ip_info.ip));
+        conn_stage_mark(CONN_STAGE_GOT_IP);
         xEventGroupClearBits(wifi_eventgroup, WF1_BIT);
         xEventGroupSetBits(wifi_eventgroup, WIFI_CONNECTED_BIT);
+
+        if (reconnect_attempts >= WIFI_FAST_ATTEMPTS) {
+            apply_sta_config(true);     /* next drop starts with the fast path again */
+        }
+        reconnect_attempts = 0;
+
+        wifi_ap_record_t ap;
+        if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK &&
+            (!cache.valid || memcmp(cache.bssid, ap.bssid, sizeof(cache.bssid)) != 0 ||
+             cache.channel != ap.primary || cache.ip.ip.addr != event->ip_info.ip.addr)) {
+            memcpy(cache.bssid, ap.bssid, sizeof(cache.bssid));
+            cache.channel = ap.primary;
+            cache.ip = event->ip_info;
+            cache.valid = 1;
+            cache_store();
+        }
+#if WIFI_HTTP_PROBE
         htttp_request();
+#endif
     }
-}
\ No newline at end of file
+}
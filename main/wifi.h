@@ -7,7 +7,20 @@
 extern EventGroupHandle_t wifi_eventgroup;
 
 #define WIFI_CONNECTED_BIT BIT1
+#define MQTT_CONNECTED_BIT BIT2
+
+/* Connection stages, timestamped with esp_timer_get_time() */
+typedef enum {
+    CONN_STAGE_START = 0,
+    CONN_STAGE_ASSOC,
+    CONN_STAGE_GOT_IP,
+    CONN_STAGE_MQTT,
+    CONN_STAGE_COUNT
+} conn_stage_t;
 
 void wifi_init(void);
 
+void conn_stage_mark(conn_stage_t stage);
+int64_t conn_stage_time(conn_stage_t stage);
+
 #endif
\ No newline at end of file
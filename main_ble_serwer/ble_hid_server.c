@@ -4,6 +4,8 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "esp_log.h"
 #include "nvs_flash.h"
 #include "esp_system.h"
@@ -28,7 +30,6 @@ static const char *TAG = "LAB31_HID";
 #define REPORT_REF_DESC_UUID       0x2908
 #define CLIENT_CHAR_CFG_UUID       0x2902
 
-#define GATTS_NUM_HANDLE 40
 #define PROFILE_APP_ID 0
 
 /* EventGroup bits */
@@ -116,18 +117,18 @@ static uint8_t report_map[] = {
 /* Boot input (modifier + reserved + 6 keycodes) */
 static uint8_t boot_input[8] = {0};
 
-/* advertising data */
+/* advertising data: the HID service UUID (0x1812, in its 128-bit base-UUID
+   form so the stack advertises it as a 16-bit UUID) goes into the
+   advertisement so scanners can filter without a scan request; the name
+   goes into the scan response */
 static uint8_t adv_service_uuid128[16] = {
-    0x12,0x34,0x56,0x78,0x9a,0xbc,0xde,0xf0,
-    0x12,0x34,0x56,0x78,0x12,0x12,0x12,0x12
+    0xfb,0x34,0x9b,0x5f,0x80,0x00,0x00,0x80,
+    0x00,0x10,0x00,0x00,0x12,0x18,0x00,0x00
 };
 
-//static uint16_t adv_service_uuid16 = 0x1812;
-
-
 static esp_ble_adv_data_t adv_data = {
     .set_scan_rsp = false,
-    .include_name = true,
+    .include_name = false,
     .include_txpower = true,
     .appearance = 0x03C1,
     .service_uuid_len = sizeof(adv_service_uuid128),
@@ -135,87 +136,741 @@ static esp_ble_adv_data_t adv_data = {
     .flag = (ESP_BLE_ADV_FLAG_GEN_DISC | ESP_BLE_ADV_FLAG_BREDR_NOT_SPT)
 };
 
+static esp_ble_adv_data_t scan_rsp_data = {
+    .set_scan_rsp = true,
+    .include_name = true,
+};
+
+#define ADV_CONFIG_FLAG      (1 << 0)
+#define SCAN_RSP_CONFIG_FLAG (1 << 1)
+static uint8_t adv_config_pending = ADV_CONFIG_FLAG | SCAN_RSP_CONFIG_FLAG;
+
+/* advertising profiles: a fast burst after boot or disconnect so a scanning
+   central finds us quickly, then a slow low-power interval. Intervals are in
+   0.625 ms units. */
+typedef enum {
+    ADV_PROFILE_FAST,
+    ADV_PROFILE_SLOW,
+} adv_profile_t;
+
+#define ADV_FAST_ITVL_MIN    0x20    // 20 ms
+#define ADV_FAST_ITVL_MAX    0x30    // 30 ms
+#define ADV_SLOW_ITVL_MIN    0x0660  // 1020 ms
+#define ADV_SLOW_ITVL_MAX    0x0668  // 1022.5 ms
+#define ADV_FAST_DURATION_MS 30000
+
+/* log advertising-to-connect time for comparing profiles */
+#define ADV_MEASUREMENT      1
+
 static esp_ble_adv_params_t adv_params = {
-    .adv_int_min        = 0x20,
-    .adv_int_max        = 0x40,
+    .adv_int_min        = ADV_FAST_ITVL_MIN,
+    .adv_int_max        = ADV_FAST_ITVL_MAX,
     .adv_type           = ADV_TYPE_IND,
     .own_addr_type      = BLE_ADDR_TYPE_PUBLIC,
     .channel_map        = ADV_CHNL_ALL,
     .adv_filter_policy  = ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY,
 };
 
-/* handles storage */
-struct hid_handles_t {
-    uint16_t service_handle;
-    uint16_t hid_info_handle;
-    uint16_t protocol_mode_handle;
-    uint16_t report_map_handle;
+static adv_profile_t adv_profile;
+static esp_timer_handle_t adv_profile_timer;
+static int64_t adv_burst_start_us;
+
+/* attribute table indices; handle = hid.handles[0] + index */
+enum {
+    IDX_SVC,
+
+    IDX_HID_INFO_CHAR,
+    IDX_HID_INFO_VAL,
+
+    IDX_PROTO_MODE_CHAR,
+    IDX_PROTO_MODE_VAL,
+
+    IDX_REPORT_MAP_CHAR,
+    IDX_REPORT_MAP_VAL,
 
-    uint16_t report1_handle;
-    uint16_t report1_cccd_handle;
-    uint16_t report1_report_ref_handle;
+    IDX_REPORT1_CHAR,
+    IDX_REPORT1_VAL,
+    IDX_REPORT1_CCCD,
+    IDX_REPORT1_REF,
 
-    uint16_t report2_handle;
-    uint16_t report2_cccd_handle;
-    uint16_t report2_report_ref_handle;
+    IDX_REPORT2_CHAR,
+    IDX_REPORT2_VAL,
+    IDX_REPORT2_CCCD,
+    IDX_REPORT2_REF,
 
-    uint16_t report3_handle;
-    uint16_t report3_report_ref_handle;
+    IDX_REPORT3_CHAR,
+    IDX_REPORT3_VAL,
+    IDX_REPORT3_REF,
 
-    uint16_t boot_input_handle;
-    uint16_t boot_input_cccd_handle;
+    IDX_BOOT_INPUT_CHAR,
+    IDX_BOOT_INPUT_VAL,
+    IDX_BOOT_INPUT_CCCD,
 
-    uint16_t boot_output_handle;
+    IDX_BOOT_OUTPUT_CHAR,
+    IDX_BOOT_OUTPUT_VAL,
+
+    HID_IDX_NB,
+};
+
+/* handles storage */
+struct hid_handles_t {
+    uint16_t handles[HID_IDX_NB];
 
     uint16_t gatts_if;
     uint16_t conn_id;
-
-    int added_chars;
-    int added_descr;
+    esp_bd_addr_t remote_bda;
 } hid = {0};
 
-/* helper */
-static inline esp_bt_uuid_t mk_uuid16(uint16_t u) {
-    esp_bt_uuid_t id;
-    id.len = ESP_UUID_LEN_16;
-    id.uuid.uuid16 = u;
-    return id;
+/* attribute table */
+static const uint16_t primary_service_uuid = ESP_GATT_UUID_PRI_SERVICE;
+static const uint16_t char_decl_uuid       = ESP_GATT_UUID_CHAR_DECLARE;
+static const uint16_t cccd_uuid            = CLIENT_CHAR_CFG_UUID;
+static const uint16_t report_ref_uuid      = REPORT_REF_DESC_UUID;
+
+static const uint16_t hid_service_uuid     = HID_SERVICE_UUID;
+static const uint16_t hid_info_uuid        = HID_INFO_CHAR_UUID;
+static const uint16_t protocol_mode_uuid   = PROTOCOL_MODE_UUID;
+static const uint16_t report_map_uuid      = REPORT_MAP_UUID;
+static const uint16_t report_uuid          = REPORT_CHAR_UUID;
+static const uint16_t boot_input_uuid      = BOOT_KEYBOARD_INPUT_UUID;
+static const uint16_t boot_output_uuid     = BOOT_KEYBOARD_OUTPUT_UUID;
+
+static const uint8_t prop_read        = ESP_GATT_CHAR_PROP_BIT_READ;
+static const uint8_t prop_read_wnr    = ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_WRITE_NR;
+static const uint8_t prop_read_notify = ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_NOTIFY;
+static const uint8_t prop_read_write  = ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_WRITE | ESP_GATT_CHAR_PROP_BIT_WRITE_NR;
+
+static uint8_t report1_cccd[2], report2_cccd[2], boot_input_cccd[2];
+static const uint8_t report1_ref[2] = { 0x01, 0x01 };   // ID 1, input
+static const uint8_t report2_ref[2] = { 0x02, 0x01 };   // ID 2, input
+static const uint8_t report3_ref[2] = { 0x03, 0x02 };   // ID 3, output
+static uint8_t boot_output[1] = { 0 };
+
+/* constant values: the stack answers reads itself, long reads included */
+#define ATTR_CONST(uuid, perm, max, len, val) \
+    { { ESP_GATT_AUTO_RSP }, { ESP_UUID_LEN_16, (uint8_t *)&(uuid), (perm), (max), (len), (uint8_t *)(val) } }
+/* state the app owns: reads and writes are answered in gatts_profile_event_handler */
+#define ATTR(uuid, perm, max, len, val) \
+    { { ESP_GATT_RSP_BY_APP }, { ESP_UUID_LEN_16, (uint8_t *)&(uuid), (perm), (max), (len), (uint8_t *)(val) } }
+#define CHAR_DECL(prop) \
+    ATTR_CONST(char_decl_uuid, ESP_GATT_PERM_READ, sizeof(uint8_t), sizeof(uint8_t), &(prop))
+
+/* Protocol Mode, the CCCDs and the input values stay with the app: a write
+   must change what it sends (report format, which reports it notifies), and
+   a read must see the app's current key state, not a copy in the stack. */
+static const esp_gatts_attr_db_t hid_attr_tab[HID_IDX_NB] = {
+    [IDX_SVC]              = ATTR_CONST(primary_service_uuid, ESP_GATT_PERM_READ, sizeof(uint16_t), sizeof(uint16_t), &hid_service_uuid),
+
+    [IDX_HID_INFO_CHAR]    = CHAR_DECL(prop_read),
+    [IDX_HID_INFO_VAL]     = ATTR_CONST(hid_info_uuid, ESP_GATT_PERM_READ, sizeof(hid_info_value), sizeof(hid_info_value), hid_info_value),
+
+    [IDX_PROTO_MODE_CHAR]  = CHAR_DECL(prop_read_wnr),
+    [IDX_PROTO_MODE_VAL]   = ATTR(protocol_mode_uuid, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE, 1, 1, &protocol_mode),
+
+    [IDX_REPORT_MAP_CHAR]  = CHAR_DECL(prop_read),
+    [IDX_REPORT_MAP_VAL]   = ATTR_CONST(report_map_uuid, ESP_GATT_PERM_READ, sizeof(report_map), sizeof(report_map), report_map),
+
+    [IDX_REPORT1_CHAR]     = CHAR_DECL(prop_read_notify),
+    [IDX_REPORT1_VAL]      = ATTR(report_uuid, ESP_GATT_PERM_READ, 8, 0, NULL),
+    [IDX_REPORT1_CCCD]     = ATTR(cccd_uuid, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE, 2, 2, report1_cccd),
+    [IDX_REPORT1_REF]      = ATTR_CONST(report_ref_uuid, ESP_GATT_PERM_READ, 2, 2, report1_ref),
+
+    [IDX_REPORT2_CHAR]     = CHAR_DECL(prop_read_notify),
+    [IDX_REPORT2_VAL]      = ATTR(report_uuid, ESP_GATT_PERM_READ, 4, 0, NULL),
+    [IDX_REPORT2_CCCD]     = ATTR(cccd_uuid, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE, 2, 2, report2_cccd),
+    [IDX_REPORT2_REF]      = ATTR_CONST(report_ref_uuid, ESP_GATT_PERM_READ, 2, 2, report2_ref),
+
+    [IDX_REPORT3_CHAR]     = CHAR_DECL(prop_read_write),
+    [IDX_REPORT3_VAL]      = ATTR(report_uuid, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE, 16, 0, NULL),
+    [IDX_REPORT3_REF]      = ATTR_CONST(report_ref_uuid, ESP_GATT_PERM_READ, 2, 2, report3_ref),
+
+    [IDX_BOOT_INPUT_CHAR]  = CHAR_DECL(prop_read_notify),
+    [IDX_BOOT_INPUT_VAL]   = ATTR(boot_input_uuid, ESP_GATT_PERM_READ, sizeof(boot_input), sizeof(boot_input), boot_input),
+    [IDX_BOOT_INPUT_CCCD]  = ATTR(cccd_uuid, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE, 2, 2, boot_input_cccd),
+
+    [IDX_BOOT_OUTPUT_CHAR] = CHAR_DECL(prop_read_write),
+    [IDX_BOOT_OUTPUT_VAL]  = ATTR(boot_output_uuid, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE, 1, 1, boot_output),
+};
+
+/* table index of an attribute handle, or HID_IDX_NB if it is not ours */
+static inline int hid_attr_index(uint16_t handle)
+{
+    uint16_t base = hid.handles[IDX_SVC];
+    if (base == 0 || handle < base || handle - base >= HID_IDX_NB) {
+        return HID_IDX_NB;
+    }
+    return handle - base;
 }
 
+/* startup timing: app_main entry to the first advertisement */
+static int64_t app_start_us;
+static bool first_adv_logged;
+
 /* forward */
 static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param);
 
-/* safe send: check event bits before send */
-/* safe send: check event bits before send */
-static void safe_send_indicate(uint16_t handle, const void *data, uint16_t len)
+/* connection parameters: ask for a short interval once the link is
+   encrypted and while keys are being sent, and a long one with slave latency
+   once the link has been idle for HID_IDLE_TIMEOUT_MS. The idle check only
+   runs while connected. Intervals are in 1.25 ms units. */
+
+#define HID_FAST_ITVL_MIN     6     // 7.5 ms
+#define HID_FAST_ITVL_MAX     12    // 15 ms
+#define HID_IDLE_ITVL_MIN     40    // 50 ms
+#define HID_IDLE_ITVL_MAX     80    // 100 ms
+#define HID_IDLE_LATENCY      4
+#define HID_SUPERVISION_TMO   400   // 4 s, in 10 ms units
+#define HID_IDLE_TIMEOUT_MS   5000
+
+static struct {
+    uint16_t interval;          // effective, 1.25 ms units
+    uint16_t latency;
+    uint16_t timeout;
+    uint32_t updates;
+    uint32_t requests;
+    // notification hand-off to CONF_EVT; not a round trip, the peripheral
+    // only sees the link-layer acknowledgement
+    uint32_t conf_latency_max_us;
+    uint64_t conf_latency_total_us;
+    uint32_t conf_samples;
+} hid_conn_stats;
+
+static bool hid_conn_idle;
+static int64_t hid_last_activity_us;
+static esp_timer_handle_t hid_idle_timer;
+
+static void hid_conn_request(bool idle)
+{
+    if (hid.conn_id == 0xFFFF) {
+        return;
+    }
+
+    esp_ble_conn_update_params_t p = {
+        .min_int = idle ? HID_IDLE_ITVL_MIN : HID_FAST_ITVL_MIN,
+        .max_int = idle ? HID_IDLE_ITVL_MAX : HID_FAST_ITVL_MAX,
+        .latency = idle ? HID_IDLE_LATENCY : 0,
+        .timeout = HID_SUPERVISION_TMO,
+    };
+    memcpy(p.bda, hid.remote_bda, sizeof(esp_bd_addr_t));
+
+    hid_conn_idle = idle;
+    hid_conn_stats.requests++;
+    esp_err_t err = esp_ble_gap_update_conn_params(&p);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Conn param update failed: %s", esp_err_to_name(err));
+    }
+}
+
+/* called for every outgoing report; leaves idle mode */
+static void hid_conn_note_activity(void)
+{
+    hid_last_activity_us = esp_timer_get_time();
+    if (hid_conn_idle) {
+        ESP_LOGI(TAG, "Input active, requesting fast interval");
+        hid_conn_request(false);
+    }
+}
+
+static void hid_idle_check(void *arg)
+{
+    if (!hid_conn_idle && hid.conn_id != 0xFFFF &&
+        esp_timer_get_time() - hid_last_activity_us > HID_IDLE_TIMEOUT_MS * 1000LL) {
+        ESP_LOGI(TAG, "Link idle, requesting slow interval");
+        hid_conn_request(true);
+    }
+}
+
+static void hid_conn_on_update(const esp_ble_gap_cb_param_t *param)
+{
+    hid_conn_stats.interval = param->update_conn_params.conn_int;
+    hid_conn_stats.latency = param->update_conn_params.latency;
+    hid_conn_stats.timeout = param->update_conn_params.timeout;
+    hid_conn_stats.updates++;
+}
+
+static void hid_conn_init(void)
+{
+    const esp_timer_create_args_t args = {
+        .callback = hid_idle_check,
+        .name = "hid_idle",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&args, &hid_idle_timer));
+}
+
+static void hid_conn_on_connect(void)
+{
+    hid_last_activity_us = esp_timer_get_time();
+    esp_timer_stop(hid_idle_timer);
+    ESP_ERROR_CHECK(esp_timer_start_periodic(hid_idle_timer, 1000 * 1000));
+}
+
+static void hid_conn_on_disconnect(void)
+{
+    esp_timer_stop(hid_idle_timer);
+    hid_conn_idle = false;
+}
+
+/* notification TX queue: reports are handed to the stack one at a time and
+   held back while the link is congested (ESP_GATTS_CONGEST_EVT) or while
+   HID_TX_MAX_INFLIGHT notifications await ESP_GATTS_CONF_EVT. When the queue
+   is full, a new report replaces the newest pending one for the same handle,
+   so the host always ends up with the latest key state; with no such report
+   the caller gets ESP_ERR_NO_MEM and keeps its own copy to retry. A full
+   in-flight window arms a watchdog so a lost CONF_EVT cannot stall it. */
+
+#define HID_TX_QUEUE_LEN        16
+#define HID_TX_MAX_INFLIGHT     2
+#define HID_TX_RETRY_MS         10
+#define HID_TX_CONF_TIMEOUT_MS  500
+
+typedef struct {
+    uint16_t handle;
+    uint8_t len;
+    uint8_t data[8];
+} hid_tx_entry_t;
+
+static struct {
+    hid_tx_entry_t ring[HID_TX_QUEUE_LEN];
+    uint8_t head;
+    uint8_t count;
+    uint8_t inflight;
+    bool congested;
+    bool pumping;
+    int64_t last_conf_us;
+    int64_t sent_us[HID_TX_MAX_INFLIGHT];   // oldest first, one per in-flight
+} hid_tx;
+
+static struct {
+    uint32_t queued;
+    uint32_t sent;
+    uint32_t coalesced;
+    uint32_t refused;           /* ESP_ERR_NO_MEM, left to the caller */
+    uint32_t dropped;           /* flushed on disconnect */
+    uint32_t conf_timeouts;
+    uint32_t congest_events;
+} hid_tx_stats;
+
+static portMUX_TYPE hid_tx_mux = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t hid_tx_retry_timer;
+
+/* send queued reports until the queue is empty or the link pushes back */
+static void hid_tx_pump(void)
+{
+    for (;;) {
+        hid_tx_entry_t e;
+
+        portENTER_CRITICAL(&hid_tx_mux);
+        bool window_full = hid_tx.inflight >= HID_TX_MAX_INFLIGHT;
+        if (hid_tx.pumping || hid_tx.congested || hid_tx.count == 0 || window_full) {
+            portEXIT_CRITICAL(&hid_tx_mux);
+            // waiting on CONF_EVT: make sure a lost one is noticed
+            if (window_full && !esp_timer_is_active(hid_tx_retry_timer)) {
+                esp_timer_start_once(hid_tx_retry_timer, HID_TX_CONF_TIMEOUT_MS * 1000);
+            }
+            return;
+        }
+        e = hid_tx.ring[hid_tx.head];
+        hid_tx.pumping = true;
+        portEXIT_CRITICAL(&hid_tx_mux);
+
+        esp_err_t err = ESP_FAIL;
+        if (hid.gatts_if != ESP_GATT_IF_NONE && hid.conn_id != 0xFFFF) {
+            err = esp_ble_gatts_send_indicate(hid.gatts_if, hid.conn_id, e.handle, e.len, e.data, false);
+        }
+
+        portENTER_CRITICAL(&hid_tx_mux);
+        hid_tx.pumping = false;
+        if (err == ESP_OK) {
+            hid_tx.head = (hid_tx.head + 1) % HID_TX_QUEUE_LEN;
+            hid_tx.count--;
+            hid_tx.sent_us[hid_tx.inflight] = esp_timer_get_time();
+            if (hid_tx.inflight++ == 0) {
+                hid_tx.last_conf_us = hid_tx.sent_us[0];
+            }
+            hid_tx_stats.sent++;
+        }
+        portEXIT_CRITICAL(&hid_tx_mux);
+
+        if (err != ESP_OK) {
+            // keep the report at the head and try again shortly
+            ESP_LOGW(TAG, "Send failed: %s, retrying", esp_err_to_name(err));
+            esp_timer_stop(hid_tx_retry_timer);
+            esp_timer_start_once(hid_tx_retry_timer, HID_TX_RETRY_MS * 1000);
+            return;
+        }
+    }
+}
+
+static void hid_tx_retry(void *arg)
+{
+    portENTER_CRITICAL(&hid_tx_mux);
+    // a confirmation went missing; do not stall the queue forever
+    if (hid_tx.inflight >= HID_TX_MAX_INFLIGHT &&
+        esp_timer_get_time() - hid_tx.last_conf_us >= HID_TX_CONF_TIMEOUT_MS * 1000) {
+        hid_tx.inflight = 0;
+        hid_tx_stats.conf_timeouts++;
+    }
+    portEXIT_CRITICAL(&hid_tx_mux);
+
+    hid_tx_pump();
+}
+
+/* safe send: check event bits, then queue the report. ESP_ERR_NO_MEM when
+   the queue is full and the report could not be folded into a pending one. */
+static esp_err_t safe_send_indicate(uint16_t handle, const void *data, uint16_t len)
 {
     EventBits_t bits = xEventGroupGetBits(hid_evt_group);
     // Only check for GATT ready and connected (remove PAIRED_READY)
     if ((bits & (EVT_GATTS_READY | EVT_CONNECTED)) != (EVT_GATTS_READY | EVT_CONNECTED)) {
         ESP_LOGW(TAG, "Cannot send: GATT not ready or not connected. Bits: 0x%x", bits);
-        return;
+        return ESP_ERR_INVALID_STATE;
     }
     
     if (hid.gatts_if == ESP_GATT_IF_NONE || hid.conn_id == 0xFFFF) {
         ESP_LOGW(TAG, "Cannot send: Invalid gatts_if=%d or conn_id=%d", hid.gatts_if, hid.conn_id);
-        return;
+        return ESP_ERR_INVALID_STATE;
     }
 
-    ESP_LOGI(TAG, "Sending to handle %d, len=%d, gatts_if=%d, conn_id=%d", 
-             handle, len, hid.gatts_if, hid.conn_id);
-    
-    esp_err_t err;
-    if (handle == hid.boot_input_handle || handle == hid.report1_handle) {
-        err = esp_ble_gatts_send_indicate(hid.gatts_if, hid.conn_id, handle, len, (uint8_t*)data, false);
+    if (len > sizeof(hid_tx.ring[0].data)) {
+        len = sizeof(hid_tx.ring[0].data);
+    }
+
+    ESP_LOGD(TAG, "Queueing to handle %d, len=%d", handle, len);
+    hid_conn_note_activity();
+
+    bool queued = true;
+    portENTER_CRITICAL(&hid_tx_mux);
+    if (hid_tx.count < HID_TX_QUEUE_LEN) {
+        hid_tx_entry_t *e = &hid_tx.ring[(hid_tx.head + hid_tx.count) % HID_TX_QUEUE_LEN];
+        e->handle = handle;
+        e->len = len;
+        memcpy(e->data, data, len);
+        hid_tx.count++;
+        hid_tx_stats.queued++;
     } else {
-        err = esp_ble_gatts_send_indicate(hid.gatts_if, hid.conn_id, handle, len, (uint8_t*)data, false);
+        // full: fold into the newest pending report for this handle,
+        // unless that is the one being handed to the stack right now
+        bool folded = false;
+        for (int i = hid_tx.count - 1; i >= (hid_tx.pumping ? 1 : 0); i--) {
+            hid_tx_entry_t *e = &hid_tx.ring[(hid_tx.head + i) % HID_TX_QUEUE_LEN];
+            if (e->handle == handle) {
+                e->len = len;
+                memcpy(e->data, data, len);
+                folded = true;
+                break;
+            }
+        }
+        if (folded) {
+            hid_tx_stats.coalesced++;
+        } else {
+            hid_tx_stats.refused++;
+            queued = false;
+        }
     }
-    
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Send failed: %s", esp_err_to_name(err));
+    portEXIT_CRITICAL(&hid_tx_mux);
+
+    hid_tx_pump();
+    return queued ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+/* called from the GATTS handler */
+static void hid_tx_on_conf(void)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&hid_tx_mux);
+    if (hid_tx.inflight > 0) {
+        uint32_t lat = now - hid_tx.sent_us[0];
+        hid_conn_stats.conf_latency_total_us += lat;
+        hid_conn_stats.conf_samples++;
+        if (lat > hid_conn_stats.conf_latency_max_us) {
+            hid_conn_stats.conf_latency_max_us = lat;
+        }
+        hid_tx.inflight--;
+        memmove(&hid_tx.sent_us[0], &hid_tx.sent_us[1], hid_tx.inflight * sizeof(hid_tx.sent_us[0]));
+    }
+    hid_tx.last_conf_us = now;
+    portEXIT_CRITICAL(&hid_tx_mux);
+
+    hid_tx_pump();
+}
+
+static void hid_tx_on_congest(bool congested)
+{
+    portENTER_CRITICAL(&hid_tx_mux);
+    hid_tx.congested = congested;
+    if (congested) {
+        hid_tx_stats.congest_events++;
+    }
+    portEXIT_CRITICAL(&hid_tx_mux);
+
+    if (!congested) {
+        hid_tx_pump();
+    }
+}
+
+static void hid_tx_reset(void)
+{
+    portENTER_CRITICAL(&hid_tx_mux);
+    hid_tx_stats.dropped += hid_tx.count;
+    hid_tx.head = 0;
+    hid_tx.count = 0;
+    hid_tx.inflight = 0;
+    hid_tx.congested = false;
+    portEXIT_CRITICAL(&hid_tx_mux);
+}
+
+static bool hid_tx_backlogged(void)
+{
+    portENTER_CRITICAL(&hid_tx_mux);
+    bool backlogged = hid_tx.congested || hid_tx.count >= HID_TX_QUEUE_LEN / 2;
+    portEXIT_CRITICAL(&hid_tx_mux);
+    return backlogged;
+}
+
+static void hid_tx_init(void)
+{
+    const esp_timer_create_args_t args = {
+        .callback = hid_tx_retry,
+        .name = "hid_tx_retry",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&args, &hid_tx_retry_timer));
+}
+
+/* keystroke scheduler: reports are queued and sent by hid_sched_task, woken
+   by a one-shot esp_timer, so typing never blocks the caller and the shared
+   esp_timer task never waits on the queue or the stack. The gap between
+   reports should be about one connection interval. */
+
+#define HID_SCHED_QUEUE_LEN       64
+#define HID_KEY_HOLD_MS           30
+#define HID_DEFAULT_REPORT_GAP_MS 15
+#define HID_RANDOM_KEY_PERIOD_MS  1000
+
+typedef struct {
+    uint8_t report[8];
+    uint32_t delay_after_us;    /* wait before the next entry fires */
+} hid_sched_entry_t;
+
+static QueueHandle_t hid_sched_queue;
+/* held by producers so a press and its release land back to back */
+static SemaphoreHandle_t hid_type_lock;
+static esp_timer_handle_t hid_sched_timer;
+static TaskHandle_t hid_sched_task_handle;
+static portMUX_TYPE hid_sched_mux = portMUX_INITIALIZER_UNLOCKED;
+static bool hid_sched_running;
+static int64_t hid_sched_due_us;
+static uint32_t hid_report_gap_us = HID_DEFAULT_REPORT_GAP_MS * 1000;
+
+typedef struct {
+    uint32_t reports_sent;
+    uint32_t keys_typed;
+    uint32_t max_jitter_us;     /* due time to hid_sched_task running */
+    uint64_t total_jitter_us;
+} hid_sched_stats_t;
+
+/* written from the typing tasks and hid_sched_task, under hid_sched_mux */
+static hid_sched_stats_t hid_sched_stats;
+
+static void hid_sched_get_stats(hid_sched_stats_t *out)
+{
+    portENTER_CRITICAL(&hid_sched_mux);
+    *out = hid_sched_stats;
+    portEXIT_CRITICAL(&hid_sched_mux);
+}
+
+/* arms the timer for delay_us from now */
+static void hid_sched_arm(int64_t now, uint32_t delay_us)
+{
+    portENTER_CRITICAL(&hid_sched_mux);
+    hid_sched_due_us = now + delay_us;
+    portEXIT_CRITICAL(&hid_sched_mux);
+    esp_timer_start_once(hid_sched_timer, delay_us);
+}
+
+/* one scheduler step, on hid_sched_task */
+static void hid_sched_step(void)
+{
+    hid_sched_entry_t e;
+
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&hid_sched_mux);
+    uint32_t jitter = now > hid_sched_due_us ? now - hid_sched_due_us : 0;
+    hid_sched_stats.total_jitter_us += jitter;
+    if (jitter > hid_sched_stats.max_jitter_us) {
+        hid_sched_stats.max_jitter_us = jitter;
+    }
+    portEXIT_CRITICAL(&hid_sched_mux);
+
+    /* the link is pushing back: hold the keystrokes here rather than
+       letting the TX queue coalesce them away */
+    if (hid_tx_backlogged()) {
+        hid_sched_arm(now, hid_report_gap_us);
+        return;
+    }
+
+    if (xQueuePeek(hid_sched_queue, &e, 0) != pdTRUE) {
+        portENTER_CRITICAL(&hid_sched_mux);
+        hid_sched_running = false;
+        portEXIT_CRITICAL(&hid_sched_mux);
+        return;
+    }
+
+    /* another sender filled the TX queue since the check: keep the entry */
+    if (safe_send_indicate(hid.handles[IDX_BOOT_INPUT_VAL], e.report, sizeof(e.report)) == ESP_ERR_NO_MEM) {
+        hid_sched_arm(now, hid_report_gap_us);
+        return;
+    }
+    xQueueReceive(hid_sched_queue, &e, 0);
+    memcpy(boot_input, e.report, sizeof(boot_input));
+
+    /* keep the chain alive while entries remain; an empty queue stops it.
+       Checked under the lock so a concurrent hid_sched_kick() is not lost. */
+    portENTER_CRITICAL(&hid_sched_mux);
+    hid_sched_stats.reports_sent++;
+    hid_sched_due_us = now + e.delay_after_us;
+    bool more = uxQueueMessagesWaiting(hid_sched_queue) > 0;
+    hid_sched_running = more;
+    portEXIT_CRITICAL(&hid_sched_mux);
+
+    if (more) {
+        esp_timer_start_once(hid_sched_timer, e.delay_after_us);
+    }
+}
+
+static void hid_sched_task(void *arg)
+{
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        hid_sched_step();
+    }
+}
+
+/* esp_timer callback: only wakes the scheduler task */
+static void hid_sched_fire(void *arg)
+{
+    xTaskNotifyGive(hid_sched_task_handle);
+}
+
+static void hid_sched_kick(void)
+{
+    bool start = false;
+    int64_t now = esp_timer_get_time();
+    int64_t wait = 0;
+
+    portENTER_CRITICAL(&hid_sched_mux);
+    if (!hid_sched_running) {
+        hid_sched_running = true;
+        start = true;
+        /* honour the gap after the last report sent */
+        wait = hid_sched_due_us > now ? hid_sched_due_us - now : 0;
+    }
+    portEXIT_CRITICAL(&hid_sched_mux);
+
+    if (start) {
+        hid_sched_arm(now, wait);
+    }
+}
+
+static void hid_set_report_gap_ms(uint32_t gap_ms)
+{
+    hid_report_gap_us = gap_ms * 1000;
+}
+
+/* queue a press/release pair; returns false if the queue is full */
+static bool hid_type_key(uint8_t modifiers, uint8_t keycode)
+{
+    hid_sched_entry_t press = { .report = { modifiers, 0, keycode }, .delay_after_us = HID_KEY_HOLD_MS * 1000 };
+    hid_sched_entry_t release = { .report = { 0 }, .delay_after_us = hid_report_gap_us };
+    bool queued = false;
+
+    /* the scheduler only takes entries out, so with the space checked
+       under the lock neither send can fail and leave a key held down */
+    xSemaphoreTake(hid_type_lock, portMAX_DELAY);
+    if (uxQueueSpacesAvailable(hid_sched_queue) >= 2) {
+        queued = xQueueSend(hid_sched_queue, &press, 0) == pdTRUE &&
+                 xQueueSend(hid_sched_queue, &release, 0) == pdTRUE;
+    }
+    xSemaphoreGive(hid_type_lock);
+    if (!queued) {
+        return false;
+    }
+
+    portENTER_CRITICAL(&hid_sched_mux);
+    hid_sched_stats.keys_typed++;
+    portEXIT_CRITICAL(&hid_sched_mux);
+    hid_sched_kick();
+    return true;
+}
+
+/* ASCII -> (modifier, keycode) for the US layout */
+static bool ascii_to_hid(char c, uint8_t *mod, uint8_t *code)
+{
+    static const char shifted_digits[] = ")!@#$%^&*(";
+    *mod = 0;
+
+    if (c >= 'a' && c <= 'z') {
+        *code = 0x04 + (c - 'a');
+    } else if (c >= 'A' && c <= 'Z') {
+        *mod = 0x02;    // Left Shift
+        *code = 0x04 + (c - 'A');
+    } else if (c >= '1' && c <= '9') {
+        *code = 0x1E + (c - '1');
+    } else if (c == '0') {
+        *code = 0x27;
+    } else if (c == '\n') {
+        *code = 0x28;
+    } else if (c == ' ') {
+        *code = 0x2C;
+    } else if (c == '-') {
+        *code = 0x2D;
+    } else if (c == '.') {
+        *code = 0x37;
     } else {
-        ESP_LOGI(TAG, "Send successful");
+        const char *p = strchr(shifted_digits, c);
+        if (p == NULL || c == 0) {
+            return false;
+        }
+        *mod = 0x02;
+        *code = p == shifted_digits ? 0x27 : 0x1E + (p - shifted_digits - 1);
     }
+    return true;
+}
+
+/* types a string at the fastest rate the scheduler allows */
+static int hid_type_string(const char *str)
+{
+    int queued = 0;
+    uint8_t mod, code;
+
+    for (; *str; str++) {
+        if (!ascii_to_hid(*str, &mod, &code)) {
+            continue;
+        }
+        if (!hid_type_key(mod, code)) {
+            break;
+        }
+        queued++;
+    }
+    return queued;
+}
+
+static void hid_sched_init(void)
+{
+    hid_sched_queue = xQueueCreate(HID_SCHED_QUEUE_LEN, sizeof(hid_sched_entry_t));
+    configASSERT(hid_sched_queue != NULL);
+    hid_type_lock = xSemaphoreCreateMutex();
+    configASSERT(hid_type_lock != NULL);
+
+    const esp_timer_create_args_t args = {
+        .callback = hid_sched_fire,
+        .name = "hid_sched",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&args, &hid_sched_timer));
+
+    /* above the random sender, so a key it queues goes out on time */
+    xTaskCreate(hid_sched_task, "hid_sched", 3072, NULL, 6, &hid_sched_task_handle);
+    configASSERT(hid_sched_task_handle != NULL);
 }
 
 /* prepare and send random reports */
@@ -233,35 +888,13 @@ static void send_random_key_reports(void)
         return;
     }
 
-    // Standard Boot Keyboard Input Report (8 bytes)
-    // Byte 0: Modifiers
-    // Byte 1: Reserved (must be 0)
-    // Bytes 2-7: Key codes (up to 6 keys)
-    uint8_t boot_report[8] = {0};
-    
     // Generate random key (a-z)
-    uint8_t keycode = 0x04 + (rand() % 26); // HID keycodes for a-z
+    char key[2] = { 'a' + rand() % 26, 0 };
 
-    ESP_LOGI(TAG, "=== SENDING KEY: %c (0x%02x) ===", 'a' + (keycode - 0x04), keycode);
-
-    boot_report[0] = 0x00;        // No modifiers
-    boot_report[1] = 0x00;        // Reserved byte (IMPORTANT!)
-    boot_report[2] = keycode;     // First key code    // First keycode
-    
-    ESP_LOGI(TAG, "Sending key press - Report: %02x %02x %02x %02x %02x %02x %02x %02x", 
-             boot_report[0], boot_report[1], boot_report[2], boot_report[3],
-             boot_report[4], boot_report[5], boot_report[6], boot_report[7]);
-    safe_send_indicate(hid.boot_input_handle, boot_report, sizeof(boot_report));
-
-    // Wait longer for key press to register (Android needs more time)
-    vTaskDelay(pdMS_TO_TICKS(500));
-    
-    // Release keys - send all zeros
-    memset(boot_report, 0, sizeof(boot_report));
-    ESP_LOGI(TAG, "Sending key release");
-    safe_send_indicate(hid.boot_input_handle, boot_report, sizeof(boot_report));
-
-    ESP_LOGI(TAG, "=== KEY PRESS AND RELEASE COMPLETED ===");
+    ESP_LOGI(TAG, "=== QUEUEING KEY: %c ===", key[0]);
+    if (hid_type_string(key) == 0) {
+        ESP_LOGW(TAG, "Keystroke queue full");
+    }
 }
 
 /* random sender task: waits for both bits (GATT ready + connected) */
@@ -276,14 +909,56 @@ static void random_sender_task(void *arg)
         xEventGroupWaitBits(hid_evt_group, bits_to_wait, pdFALSE, pdTRUE, portMAX_DELAY);
 
         ESP_LOGI(TAG, "🎉 Connected! Starting to send HID data...");
-        
-        // while connected and ready, send reports every 5s
+
+        // while connected and ready, queue one key per period
         while ((xEventGroupGetBits(hid_evt_group) & bits_to_wait) == bits_to_wait) {
             send_random_key_reports();
-            vTaskDelay(pdMS_TO_TICKS(1000)); // 
+            vTaskDelay(pdMS_TO_TICKS(HID_RANDOM_KEY_PERIOD_MS));
         }
 
         ESP_LOGI(TAG, "❌ Disconnected - stopping HID data");
+        xQueueReset(hid_sched_queue);
+        hid_sched_stats_t sched;
+        hid_sched_get_stats(&sched);
+        ESP_LOGI(TAG, "Keys typed: %lu, reports sent: %lu, scheduler jitter max %lu us",
+                 (unsigned long)sched.keys_typed, (unsigned long)sched.reports_sent,
+                 (unsigned long)sched.max_jitter_us);
+        ESP_LOGI(TAG, "Notifications queued %lu, sent %lu, coalesced %lu, refused %lu, dropped %lu, "
+                 "CONF timeouts %lu, congestion %lu",
+                 (unsigned long)hid_tx_stats.queued, (unsigned long)hid_tx_stats.sent,
+                 (unsigned long)hid_tx_stats.coalesced, (unsigned long)hid_tx_stats.refused,
+                 (unsigned long)hid_tx_stats.dropped, (unsigned long)hid_tx_stats.conf_timeouts,
+                 (unsigned long)hid_tx_stats.congest_events);
+        ESP_LOGI(TAG, "Conn interval %u x1.25 ms, latency %u, %lu updates, CONF latency avg %lu us max %lu us",
+                 hid_conn_stats.interval, hid_conn_stats.latency, (unsigned long)hid_conn_stats.updates,
+                 (unsigned long)(hid_conn_stats.conf_samples ?
+                                 hid_conn_stats.conf_latency_total_us / hid_conn_stats.conf_samples : 0),
+                 (unsigned long)hid_conn_stats.conf_latency_max_us);
+    }
+}
+
+static void start_advertising(adv_profile_t profile)
+{
+    adv_profile = profile;
+    adv_params.adv_int_min = profile == ADV_PROFILE_FAST ? ADV_FAST_ITVL_MIN : ADV_SLOW_ITVL_MIN;
+    adv_params.adv_int_max = profile == ADV_PROFILE_FAST ? ADV_FAST_ITVL_MAX : ADV_SLOW_ITVL_MAX;
+    esp_ble_gap_start_advertising(&adv_params);
+}
+
+/* fast burst after boot or disconnect; the timer drops to the slow profile */
+static void start_adv_burst(void)
+{
+    adv_burst_start_us = esp_timer_get_time();
+    start_advertising(ADV_PROFILE_FAST);
+    esp_timer_stop(adv_profile_timer);
+    esp_timer_start_once(adv_profile_timer, ADV_FAST_DURATION_MS * 1000LL);
+}
+
+static void adv_profile_timeout(void *arg)
+{
+    if ((xEventGroupGetBits(hid_evt_group) & EVT_CONNECTED) == 0) {
+        // restarted with slow parameters once the stop completes
+        esp_ble_gap_stop_advertising();
     }
 }
 
@@ -292,7 +967,32 @@ static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param
 {
     switch (event) {
         case ESP_GAP_BLE_ADV_DATA_SET_COMPLETE_EVT:
-            esp_ble_gap_start_advertising(&adv_params);
+            adv_config_pending &= ~ADV_CONFIG_FLAG;
+            if (adv_config_pending == 0) {
+                start_adv_burst();
+            }
+            break;
+
+        case ESP_GAP_BLE_SCAN_RSP_DATA_SET_COMPLETE_EVT:
+            adv_config_pending &= ~SCAN_RSP_CONFIG_FLAG;
+            if (adv_config_pending == 0) {
+                start_adv_burst();
+            }
+            break;
+
+        case ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT:
+            if ((xEventGroupGetBits(hid_evt_group) & EVT_CONNECTED) == 0) {
+                ESP_LOGI(TAG, "Fast advertising window over, switching to slow profile");
+                start_advertising(ADV_PROFILE_SLOW);
+            }
+            break;
+
+        case ESP_GAP_BLE_ADV_START_COMPLETE_EVT:
+            if (!first_adv_logged && param->adv_start_cmpl.status == ESP_BT_STATUS_SUCCESS) {
+                first_adv_logged = true;
+                ESP_LOGI(TAG, "First advertisement %lld ms after app_main",
+                         (long long)(esp_timer_get_time() - app_start_us) / 1000);
+            }
             break;
             
         case ESP_GAP_BLE_SEC_REQ_EVT:
@@ -324,11 +1024,23 @@ static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param
                 int dev_num = sizeof(bonded_devs) / sizeof(bonded_devs[0]);
                 int count = esp_ble_get_bond_device_list(&dev_num, bonded_devs);
                 ESP_LOGI(TAG, "Bonded devices count: %d", count);
+                // encrypted (paired or bonded reconnect): the one request for
+                // a short interval and no slave latency; hosts tend to refuse
+                // updates asked for before this
+                hid_conn_request(false);
             } else {
                 ESP_LOGE(TAG, "ESP_GAP_BLE_AUTH_CMPL_EVT fail: reason=%d", 
                         param->ble_security.auth_cmpl.fail_reason);
             }
             break;
+
+        case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT:
+            // conn_int is in 1.25 ms units; space reports one interval apart
+            ESP_LOGI(TAG, "Connection interval %d (x1.25 ms), latency %d",
+                     param->update_conn_params.conn_int, param->update_conn_params.latency);
+            hid_set_report_gap_ms((param->update_conn_params.conn_int * 5 + 3) / 4);
+            hid_conn_on_update(param);
+            break;
             
         default:
             break;
@@ -343,173 +1055,32 @@ static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_
         ESP_LOGI(TAG, "GATTS_REG_EVT");
         hid.gatts_if = gatts_if;
         hid.conn_id = 0xFFFF;
-        hid.added_chars = 0;
-        hid.added_descr = 0;
 
         // mark GATT ready
         xEventGroupSetBits(hid_evt_group, EVT_GATTS_READY);
 
         esp_ble_gap_set_device_name("ESP32 - KEYBOARD");
         esp_ble_gap_config_adv_data(&adv_data);
+        esp_ble_gap_config_adv_data(&scan_rsp_data);
 
-        esp_ble_gatts_create_service(gatts_if, &(esp_gatt_srvc_id_t){
-            .is_primary = true,
-            .id = {.inst_id = 0, .uuid = {.len = ESP_UUID_LEN_16, .uuid = {.uuid16 = HID_SERVICE_UUID}}}
-        }, GATTS_NUM_HANDLE);
+        // whole HID service in one call
+        esp_ble_gatts_create_attr_tab(hid_attr_tab, gatts_if, HID_IDX_NB, 0);
         break;
 
-    case ESP_GATTS_CREATE_EVT:
-        ESP_LOGI(TAG, "GATTS_CREATE_EVT svc_handle=%d", param->create.service_handle);
-        hid.service_handle = param->create.service_handle;
-
-        // Add characteristics (HID info, protocol, report_map, reports, boot input/output)
-        {
-            esp_bt_uuid_t u;
-            esp_attr_value_t a;
-
-            // HID Information
-            u = mk_uuid16(HID_INFO_CHAR_UUID);
-            a = (esp_attr_value_t){ .attr_max_len = sizeof(hid_info_value), .attr_len = sizeof(hid_info_value), .attr_value = hid_info_value };
-            esp_ble_gatts_add_char(hid.service_handle, &u, ESP_GATT_PERM_READ, ESP_GATT_CHAR_PROP_BIT_READ, &a, NULL);
-
-            // Protocol Mode
-            u = mk_uuid16(PROTOCOL_MODE_UUID);
-            a = (esp_attr_value_t){ .attr_max_len = 1, .attr_len = 1, .attr_value = &protocol_mode };
-            esp_ble_gatts_add_char(hid.service_handle, &u, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE, ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_WRITE_NR, &a, NULL);
-
-            // Report Map
-            u = mk_uuid16(REPORT_MAP_UUID);
-            a = (esp_attr_value_t){ .attr_max_len = sizeof(report_map), .attr_len = sizeof(report_map), .attr_value = report_map };
-            esp_ble_gatts_add_char(hid.service_handle, &u, ESP_GATT_PERM_READ, ESP_GATT_CHAR_PROP_BIT_READ, &a, NULL);
-
-            // Report 1 (notify, read)
-            u = mk_uuid16(REPORT_CHAR_UUID);
-            a = (esp_attr_value_t){ .attr_max_len = 8, .attr_len = 0, .attr_value = NULL };
-            esp_ble_gatts_add_char(hid.service_handle, &u, ESP_GATT_PERM_READ, ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_NOTIFY, &a, NULL);
-
-            // Report 2 (notify, read)
-            u = mk_uuid16(REPORT_CHAR_UUID);
-            a = (esp_attr_value_t){ .attr_max_len = 4, .attr_len = 0, .attr_value = NULL };
-            esp_ble_gatts_add_char(hid.service_handle, &u, ESP_GATT_PERM_READ, ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_NOTIFY, &a, NULL);
-
-            // Report 3 (read/write)
-            u = mk_uuid16(REPORT_CHAR_UUID);
-            a = (esp_attr_value_t){ .attr_max_len = 16, .attr_len = 0, .attr_value = NULL };
-            esp_ble_gatts_add_char(hid.service_handle, &u, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE, ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_WRITE | ESP_GATT_CHAR_PROP_BIT_WRITE_NR, &a, NULL);
-
-            // Boot Keyboard Input
-            u = mk_uuid16(BOOT_KEYBOARD_INPUT_UUID);
-            a = (esp_attr_value_t){ .attr_max_len = sizeof(boot_input), .attr_len = sizeof(boot_input), .attr_value = boot_input };
-            esp_ble_gatts_add_char(hid.service_handle, &u, ESP_GATT_PERM_READ, 
-                                ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_NOTIFY, &a, NULL);
-
-            // Boot Keyboard Output
-            u = mk_uuid16(BOOT_KEYBOARD_OUTPUT_UUID);
-            uint8_t init_out[1] = {0};
-            a = (esp_attr_value_t){ .attr_max_len = 1, .attr_len = 1, .attr_value = init_out };
-            esp_ble_gatts_add_char(hid.service_handle, &u, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE, ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_WRITE | ESP_GATT_CHAR_PROP_BIT_WRITE_NR, &a, NULL);
-        }
-          
-        break;
-
-    case ESP_GATTS_ADD_CHAR_EVT: {
-        uint16_t uuid16 = param->add_char.char_uuid.uuid.uuid16;
-        hid.added_chars++;
-        ESP_LOGI(TAG, "ADD_CHAR_EVT handle=%d uuid=0x%04x added=%d", param->add_char.attr_handle, uuid16, hid.added_chars);
-
-        if (uuid16 == HID_INFO_CHAR_UUID) {
-            hid.hid_info_handle = param->add_char.attr_handle;
-            // no descriptors
-        } else if (uuid16 == PROTOCOL_MODE_UUID) {
-            hid.protocol_mode_handle = param->add_char.attr_handle;
-            // no descriptors
-        } else if (uuid16 == REPORT_MAP_UUID) {
-            hid.report_map_handle = param->add_char.attr_handle;
-            // no descriptors
-        } else if (uuid16 == REPORT_CHAR_UUID) {
-            // There are three Report chars added in sequence; we need to disambiguate by order:
-            // - first REPORT_CHAR we encounter -> Report1 (ID1) -> add CCCD + Report Reference (ID=1, type=input)
-            // - second -> Report2 (ID2) -> add CCCD + Report Reference (ID=2, type=input)
-            // - third -> Report3 (configurable) -> add Report Reference (ID=3, type=output or vendor - we use input(1)/output(2) as needed)
-            if (!hid.report1_handle) {
-                hid.report1_handle = param->add_char.attr_handle;
-                // add CCCD + report ref (ID=1, type=input)
-                esp_bt_uuid_t cccd = mk_uuid16(CLIENT_CHAR_CFG_UUID);
-                esp_attr_value_t cccd_attr = { .attr_max_len = 2, .attr_len = 0, .attr_value = NULL };
-                esp_ble_gatts_add_char_descr(hid.service_handle, &cccd, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE, &cccd_attr, NULL);
-
-                uint8_t ref1[2] = {0x01, 0x01};
-                esp_bt_uuid_t rr = mk_uuid16(REPORT_REF_DESC_UUID);
-                esp_attr_value_t rr_attr = { .attr_max_len = 2, .attr_len = 2, .attr_value = ref1 };
-                esp_ble_gatts_add_char_descr(hid.service_handle, &rr, ESP_GATT_PERM_READ, &rr_attr, NULL);
-
-            } else if (!hid.report2_handle) {
-                hid.report2_handle = param->add_char.attr_handle;
-                esp_bt_uuid_t cccd = mk_uuid16(CLIENT_CHAR_CFG_UUID);
-                esp_attr_value_t cccd_attr = { .attr_max_len = 2, .attr_len = 0, .attr_value = NULL };
-                esp_ble_gatts_add_char_descr(hid.service_handle, &cccd, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE, &cccd_attr, NULL);
-
-                uint8_t ref2[2] = {0x02, 0x01};
-                esp_bt_uuid_t rr = mk_uuid16(REPORT_REF_DESC_UUID);
-                esp_attr_value_t rr_attr = { .attr_max_len = 2, .attr_len = 2, .attr_value = ref2 };
-                esp_ble_gatts_add_char_descr(hid.service_handle, &rr, ESP_GATT_PERM_READ, &rr_attr, NULL);
-
-            } else {
-                hid.report3_handle = param->add_char.attr_handle;
-                uint8_t ref3[2] = {0x03, 0x02}; // ID=3 type=output (writable)
-                esp_bt_uuid_t rr = mk_uuid16(REPORT_REF_DESC_UUID);
-                esp_attr_value_t rr_attr = { .attr_max_len = 2, .attr_len = 2, .attr_value = ref3 };
-                esp_ble_gatts_add_char_descr(hid.service_handle, &rr, ESP_GATT_PERM_READ, &rr_attr, NULL);
-            }
-        } else if (uuid16 == BOOT_KEYBOARD_INPUT_UUID) {
-            hid.boot_input_handle = param->add_char.attr_handle;
-            // add CCCD for notify
-            esp_bt_uuid_t cccd = mk_uuid16(CLIENT_CHAR_CFG_UUID);
-            esp_attr_value_t cccd_attr = { .attr_max_len = 2, .attr_len = 0, .attr_value = NULL };
-            esp_ble_gatts_add_char_descr(hid.service_handle, &cccd, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE, &cccd_attr, NULL);
-        } else if (uuid16 == BOOT_KEYBOARD_OUTPUT_UUID) {
-            hid.boot_output_handle = param->add_char.attr_handle;
-        } else {
-            ESP_LOGW(TAG, "Unknown char UUID 0x%04x", uuid16);
-        }
-        break;
-    }
-
-    case ESP_GATTS_ADD_CHAR_DESCR_EVT: {
-        hid.added_descr++;
-        uint16_t descr_handle = param->add_char_descr.attr_handle;
-        uint16_t uuid16 = param->add_char_descr.descr_uuid.uuid.uuid16;
-
-        ESP_LOGI(TAG, "ADD_CHAR_DESCR_EVT handle=%d uuid=0x%04x added_descr=%d",
-            descr_handle, uuid16, hid.added_descr);
-
-        if (uuid16 == CLIENT_CHAR_CFG_UUID) {
-            // This is a CCCD - figure out which one based on order
-            if (!hid.report1_cccd_handle) {
-                hid.report1_cccd_handle = param->add_char_descr.attr_handle;
-            } else if (!hid.report2_cccd_handle) {
-                hid.report2_cccd_handle = param->add_char_descr.attr_handle;
-            } else if (!hid.boot_input_cccd_handle) {
-                hid.boot_input_cccd_handle = param->add_char_descr.attr_handle;
-            }
-        } else if (uuid16 == REPORT_REF_DESC_UUID) {
-            // This is a Report Reference descriptor
-            if (!hid.report1_report_ref_handle) {
-                hid.report1_report_ref_handle = param->add_char_descr.attr_handle;
-            } else if (!hid.report2_report_ref_handle) {
-                hid.report2_report_ref_handle = param->add_char_descr.attr_handle;
-            } else if (!hid.report3_report_ref_handle) {
-                hid.report3_report_ref_handle = param->add_char_descr.attr_handle;
-            }
+    case ESP_GATTS_CREAT_ATTR_TAB_EVT:
+        if (param->add_attr_tab.status != ESP_GATT_OK || param->add_attr_tab.num_handle != HID_IDX_NB) {
+            ESP_LOGE(TAG, "Attribute table failed, status=%d, handles=%d",
+                     param->add_attr_tab.status, param->add_attr_tab.num_handle);
+            break;
         }
+        memcpy(hid.handles, param->add_attr_tab.handles, sizeof(hid.handles));
+        ESP_LOGI(TAG, "Attribute table created, handles %d..%d",
+                 hid.handles[IDX_SVC], hid.handles[HID_IDX_NB - 1]);
 
-        // Start service when all expected descriptors are added
-        if (hid.added_descr >= 6) {  // Adjust based on your actual count
-            ESP_LOGI(TAG, "All descriptors added - starting service");
-            esp_ble_gatts_start_service(hid.service_handle);
-        }
+        // index dispatch relies on the handles being contiguous
+        configASSERT(hid.handles[HID_IDX_NB - 1] - hid.handles[IDX_SVC] == HID_IDX_NB - 1);
+        esp_ble_gatts_start_service(hid.handles[IDX_SVC]);
         break;
-    }
 
     case ESP_GATTS_START_EVT:
         //ESP_LOGI(TAG, "SERVICE STARTED");
@@ -527,44 +1098,42 @@ static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_
             rsp.attr_value.offset = param->read.offset;
             rsp.attr_value.len = 0;
 
-            if (param->read.handle == hid.hid_info_handle) {
-                memcpy(rsp.attr_value.value, hid_info_value, sizeof(hid_info_value));
-                rsp.attr_value.len = sizeof(hid_info_value);
-            } else if (param->read.handle == hid.protocol_mode_handle) {
+            switch (hid_attr_index(param->read.handle)) {
+            case IDX_PROTO_MODE_VAL:
                 rsp.attr_value.value[0] = protocol_mode;
                 rsp.attr_value.len = 1;
-            } else if (param->read.handle == hid.report_map_handle) {
-                // Handle report map with offset support
-                uint16_t total_len = sizeof(report_map);
-                uint16_t offset = param->read.offset;
-                uint16_t remaining = total_len - offset;
-                uint16_t copy_len = (remaining > ESP_GATT_MAX_ATTR_LEN) ? ESP_GATT_MAX_ATTR_LEN : remaining;
-                
-                if (offset < total_len) {
-                    memcpy(rsp.attr_value.value, report_map + offset, copy_len);
-                    rsp.attr_value.len = copy_len;
-                } else {
-                    rsp.attr_value.len = 0;
-                }
-                ESP_LOGI(TAG, "Report map read: offset=%d, len=%d, total=%d", offset, copy_len, total_len);
-            } else if (param->read.handle == hid.boot_input_handle) {
+                break;
+            case IDX_BOOT_INPUT_VAL:
                 memcpy(rsp.attr_value.value, boot_input, sizeof(boot_input));
                 rsp.attr_value.len = sizeof(boot_input);
-            } else if (param->read.handle == hid.report1_handle) {
+                break;
+            case IDX_REPORT1_VAL:
                 // Handle report1 read - return empty report
                 rsp.attr_value.value[0] = 0x01; // Report ID
                 rsp.attr_value.len = 8;
-            } else if (param->read.handle == hid.report2_handle) {
+                break;
+            case IDX_REPORT2_VAL:
                 // Handle report2 read - return empty report  
                 rsp.attr_value.value[0] = 0x02; // Report ID
                 rsp.attr_value.len = 4;
-            } else if (param->read.handle == hid.boot_output_handle) {
-                rsp.attr_value.value[0] = 0x00; // LED status
+                break;
+            case IDX_BOOT_OUTPUT_VAL:
+                rsp.attr_value.value[0] = boot_output[0]; // LED status
                 rsp.attr_value.len = 1;
-            } else {
+                break;
+            case IDX_REPORT1_CCCD:
+            case IDX_REPORT2_CCCD:
+            case IDX_BOOT_INPUT_CCCD: {
+                const esp_attr_desc_t *d = &hid_attr_tab[hid_attr_index(param->read.handle)].att_desc;
+                memcpy(rsp.attr_value.value, d->value, 2);
+                rsp.attr_value.len = 2;
+                break;
+            }
+            default:
                 ESP_LOGW(TAG, "Read from unknown handle: %d", param->read.handle);
                 // Send empty response for unknown handles
                 rsp.attr_value.len = 0;
+                break;
             }
 
             esp_err_t ret = esp_ble_gatts_send_response(gatts_if, param->read.conn_id, 
@@ -580,14 +1149,16 @@ static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_
         ESP_LOGI(TAG, "WRITE_EVT handle=%d len=%d need_rsp=%d", 
             param->write.handle, param->write.len, param->write.need_rsp);
 
+        int idx = hid_attr_index(param->write.handle);
+        switch (idx) {
         // CCCD writes (enable/disable notifications)
-        if (param->write.handle == hid.report1_cccd_handle || 
-            param->write.handle == hid.report2_cccd_handle || 
-            param->write.handle == hid.boot_input_cccd_handle) {
-            
+        case IDX_REPORT1_CCCD:
+        case IDX_REPORT2_CCCD:
+        case IDX_BOOT_INPUT_CCCD:
             if (param->write.len >= 2) {
                 uint16_t val = param->write.value[0] | (param->write.value[1] << 8);
                 ESP_LOGI(TAG, "CCCD written 0x%04x to handle %d", val, param->write.handle);
+                memcpy(hid_attr_tab[idx].att_desc.value, param->write.value, 2);
                 
                 // Just log, don't set EVT_PAIRED_READY
                 if (val == 0x0001) {
@@ -596,57 +1167,39 @@ static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_
                     ESP_LOGI(TAG, "NOTIFICATIONS DISABLED by Android");
                 }
             }
-            
-            if (param->write.need_rsp) {
-                esp_err_t ret = esp_ble_gatts_send_response(gatts_if, param->write.conn_id, 
-                                                        param->write.trans_id, ESP_GATT_OK, NULL);
-                if (ret != ESP_OK) {
-                    ESP_LOGE(TAG, "Failed to send CCCD write response: %s", esp_err_to_name(ret));
-                }
-            }
             break;
-        }
 
         // Boot Output (LEDs)
-        if (param->write.handle == hid.boot_output_handle) {
+        case IDX_BOOT_OUTPUT_VAL:
             if (param->write.len >= 1) {
-                uint8_t led = param->write.value[0];
-                ESP_LOGI(TAG, "Boot Output (LEDs) written: 0x%02x", led);
-            }
-            if (param->write.need_rsp) {
-                esp_ble_gatts_send_response(gatts_if, param->write.conn_id, 
-                                        param->write.trans_id, ESP_GATT_OK, NULL);
+                boot_output[0] = param->write.value[0];
+                ESP_LOGI(TAG, "Boot Output (LEDs) written: 0x%02x", boot_output[0]);
             }
             break;
-        }
 
         // Protocol Mode write
-        if (param->write.handle == hid.protocol_mode_handle) {
+        case IDX_PROTO_MODE_VAL:
             if (param->write.len >= 1) {
                 protocol_mode = param->write.value[0];
                 ESP_LOGI(TAG, "Protocol mode set to %d", protocol_mode);
             }
-            if (param->write.need_rsp) {
-                esp_ble_gatts_send_response(gatts_if, param->write.conn_id, 
-                                        param->write.trans_id, ESP_GATT_OK, NULL);
-            }
             break;
-        }
 
         // Report3 writes
-        if (param->write.handle == hid.report3_handle) {
+        case IDX_REPORT3_VAL:
             ESP_LOGI(TAG, "Report3 written, len=%d", param->write.len);
-            if (param->write.need_rsp) {
-                esp_ble_gatts_send_response(gatts_if, param->write.conn_id, 
-                                        param->write.trans_id, ESP_GATT_OK, NULL);
-            }
+            break;
+
+        default:
             break;
         }
 
-        // Default response for any other writes
         if (param->write.need_rsp) {
-            esp_ble_gatts_send_response(gatts_if, param->write.conn_id, 
-                                    param->write.trans_id, ESP_GATT_OK, NULL);
+            esp_err_t ret = esp_ble_gatts_send_response(gatts_if, param->write.conn_id, 
+                                                    param->write.trans_id, ESP_GATT_OK, NULL);
+            if (ret != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to send write response: %s", esp_err_to_name(ret));
+            }
         }
         break;
     }
@@ -655,7 +1208,18 @@ static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_
         ESP_LOGI(TAG, "CONNECT_EVT conn_id=%d, gatts_if=%d", param->connect.conn_id, gatts_if);
         hid.conn_id = param->connect.conn_id;
         hid.gatts_if = gatts_if;  // Make sure this is set
+        memcpy(hid.remote_bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
+        hid_conn_stats.interval = param->connect.conn_params.interval;
+        hid_conn_stats.latency = param->connect.conn_params.latency;
+        hid_conn_stats.timeout = param->connect.conn_params.timeout;
+        hid_conn_on_connect();
         xEventGroupSetBits(hid_evt_group, EVT_CONNECTED);
+        esp_timer_stop(adv_profile_timer);
+#if ADV_MEASUREMENT
+        ESP_LOGI(TAG, "Connected %lld ms after advertising started (%s profile at connect)",
+                 (long long)(esp_timer_get_time() - adv_burst_start_us) / 1000,
+                 adv_profile == ADV_PROFILE_FAST ? "fast" : "slow");
+#endif
         
         // Start security encryption
         esp_ble_set_encryption(param->connect.remote_bda, ESP_BLE_SEC_ENCRYPT_MITM);
@@ -664,11 +1228,25 @@ static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_
     case ESP_GATTS_DISCONNECT_EVT:
         ESP_LOGI(TAG, "DISCONNECT_EVT, reason=0x%02x", param->disconnect.reason);
         hid.conn_id = 0xFFFF;
+        hid_tx_reset();
+        hid_conn_on_disconnect();
         // Clear both connected AND paired ready bits
         xEventGroupClearBits(hid_evt_group, EVT_CONNECTED | EVT_PAIRED_READY);
         
-        // Restart advertising
-        esp_ble_gap_start_advertising(&adv_params);
+        // Restart advertising with a fresh fast burst
+        start_adv_burst();
+        break;
+
+    case ESP_GATTS_CONF_EVT:
+        if (param->conf.status != ESP_GATT_OK) {
+            ESP_LOGD(TAG, "CONF_EVT status=%d", param->conf.status);
+        }
+        hid_tx_on_conf();
+        break;
+
+    case ESP_GATTS_CONGEST_EVT:
+        ESP_LOGD(TAG, "CONGEST_EVT congested=%d", param->congest.congested);
+        hid_tx_on_congest(param->congest.congested);
         break;
 
     default:
@@ -693,6 +1271,8 @@ static void gatts_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_
 /* app_main: init NVS, BT controller, bluedroid and register callbacks */
 void app_main(void)
 {
+    app_start_us = esp_timer_get_time();
+
     esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
         ESP_ERROR_CHECK(nvs_flash_erase());
@@ -728,6 +1308,16 @@ void app_main(void)
     esp_ble_gap_set_security_param(ESP_BLE_SM_SET_INIT_KEY, &init_key, sizeof(init_key));
     esp_ble_gap_set_security_param(ESP_BLE_SM_SET_RSP_KEY, &rsp_key, sizeof(rsp_key));
 
+    const esp_timer_create_args_t adv_timer_args = {
+        .callback = adv_profile_timeout,
+        .name = "adv_profile",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&adv_timer_args, &adv_profile_timer));
+
+    hid_conn_init();
+    hid_tx_init();
+    hid_sched_init();
+
     // register callbacks
     ESP_ERROR_CHECK(esp_ble_gatts_register_callback(gatts_event_handler));
     ESP_ERROR_CHECK(esp_ble_gap_register_callback(gap_event_handler));
@@ -739,8 +1329,6 @@ void app_main(void)
     // init hid struct defaults
     hid.conn_id = 0xFFFF;
     hid.gatts_if = 0;
-    hid.added_chars = 0;
-    hid.added_descr = 0;
 
     // create random sender task - it will wait on event bits
     xTaskCreate(random_sender_task, "rand_send", 4096, NULL, 5, NULL);
@@ -0,0 +1,35 @@
+#include "host_doorcam.h"
+#include "host_test.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "wifi.h"
+#include "mqqt_client.h"
+
+bool host_doorcam_connected(void)
+{
+    return xEventGroupGetBits(wifi_eventgroup) & MQTT_CONNECTED_BIT;
+}
+
+static bool ready(void)
+{
+    sim_broker_stats_t st;
+    sim_broker_get_stats(&st);
+    return st.ready_us != 0;
+}
+
+void host_doorcam_start(const sim_broker_config_t *broker)
+{
+    sim_broker_config_t cfg;
+    if (broker == NULL) {
+        sim_broker_default_config(&cfg);
+        broker = &cfg;
+    }
+    sim_broker_configure(broker);
+    sim_wifi_set_ap(true, 5, 5);
+
+    wifi_init();
+    mqtt_init();
+    CHECK(host_wait_for(host_doorcam_connected, 2000));
+    /* the cmd/# SUBACK */
+    CHECK(host_wait_for(ready, 1000));
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include <stdbool.h>
+#include "sim.h"
+
+/* Brings the door camera firmware up against the simulated station and
+   broker (NULL for the defaults) and waits until commands are routable */
+void host_doorcam_start(const sim_broker_config_t *broker);
+
+/* MQTT_CONNECTED_BIT */
+bool host_doorcam_connected(void);
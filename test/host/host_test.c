@@ -0,0 +1,46 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "host_test.h"
+
+int host_test_failures;
+
+void bench_result(const char *suite, const char *metric, double value, const char *unit)
+{
+    char line[256];
+    snprintf(line, sizeof(line), "{\"suite\":\"%s\",\"metric\":\"%s\",\"value\":%.3f,\"unit\":\"%s\"}",
+             suite, metric, value, unit);
+    printf("BENCH %s\n", line);
+    fflush(stdout);
+
+    const char *path = getenv("BENCH_JSON");
+    if (path && path[0]) {
+        FILE *f = fopen(path, "a");
+        if (f) {
+            fprintf(f, "%s\n", line);
+            fclose(f);
+        }
+    }
+}
+
+bool host_wait_for(bool (*cond)(void), unsigned timeout_ms)
+{
+    for (unsigned i = 0; i < timeout_ms; i++) {
+        if (cond()) {
+            return true;
+        }
+        usleep(1000);
+    }
+    return cond();
+}
+
+int host_test_result(void)
+{
+    if (host_test_failures) {
+        fprintf(stderr, "%d check(s) failed\n", host_test_failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+/* Fails the test, but keeps running so every broken check is reported */
+#define CHECK(cond) do {                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            host_test_failures++;                                           \
+        }                                                                   \
+    } while (0)
+
+extern int host_test_failures;
+
+/* Prints BENCH {"suite":..,"metric":..,"value":..,"unit":..} and appends
+   the same object to $BENCH_JSON when set */
+void bench_result(const char *suite, const char *metric, double value, const char *unit);
+
+/* Polls cond every millisecond for up to timeout_ms; returns its last value */
+bool host_wait_for(bool (*cond)(void), unsigned timeout_ms);
+
+/* 0 when every CHECK passed */
+int host_test_result(void);
@@ -0,0 +1,819 @@
+/* Bluedroid GAP/GATTS and a central connected to it.
+
+   Every callback runs on a "BTC_TASK" thread, btc_us after the API call
+   that caused it, in the order the calls were made, as on the target.
+   The attribute table is copied at creation: ESP_GATT_AUTO_RSP entries are
+   read and written by the stack from that copy, ESP_GATT_RSP_BY_APP ones
+   go to the app as READ/WRITE events and wait for send_response. Service
+   and characteristic declarations are always the stack's.
+
+   Notifications queue in tx_buffers controller buffers and go out
+   pkts_per_event at a time, once per connection interval; CONF_EVT is
+   reported when a notification is sent. A notification that finds every
+   buffer taken is dropped with ESP_GATT_CONGESTED, and CONGEST_EVT brackets
+   the time the buffers are full. */
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "esp_bt.h"
+#include "esp_bt_main.h"
+#include "esp_gap_ble_api.h"
+#include "esp_gatts_api.h"
+#include "esp_gatt_common_api.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sim_bt.h"
+#include "host_internal.h"
+
+#define APP_GATTS_IF    3
+#define ATTR_MAX        64
+#define FIRST_HANDLE    40
+#define TX_MAX          32
+#define PENDING_TMO_US  1000000
+
+typedef enum { ACT_GAP, ACT_GATTS, ACT_CALL } action_kind_t;
+
+typedef struct action {
+    action_kind_t kind;
+    int64_t due_us;
+    int event;
+    union {
+        esp_ble_gap_cb_param_t gap;
+        esp_ble_gatts_cb_param_t gatts;
+    } param;
+    void (*fn)(void);
+    struct action *next;
+    _Alignas(8) uint8_t data[ESP_GATT_MAX_ATTR_LEN];    /* what param points into */
+} action_t;
+
+typedef struct {
+    uint16_t uuid;
+    bool auto_rsp;
+    uint16_t max_len;
+    uint16_t len;
+    uint8_t value[ESP_GATT_MAX_ATTR_LEN];
+} attr_t;
+
+typedef struct {
+    uint16_t handle;
+    uint8_t len;
+    uint8_t data[20];
+} tx_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed;
+static bool running;
+static action_t *actions;
+
+static const sim_bt_config_t DEFAULT_CONFIG = {
+    .btc_us = 300,
+    .conn_interval = 24,        /* 30 ms, a typical phone default */
+    .mtu = 23,
+    .pkts_per_event = 4,
+    .tx_buffers = 10,
+    .auth_ms = 150,
+    .accept_conn_params = true,
+};
+static sim_bt_config_t config = DEFAULT_CONFIG;
+static sim_bt_stats_t stats;
+
+static esp_gatts_cb_t gatts_cb;
+static esp_gap_ble_cb_t gap_cb;
+static bool bluedroid_enabled;
+static bool advertising;
+static bool bonded;
+
+static attr_t attrs[ATTR_MAX];
+static int attr_count;
+
+/* the one connection */
+static bool connected;
+static uint16_t interval;
+static int64_t conn_anchor_us;
+static tx_t tx[TX_MAX];
+static int tx_head, tx_count;
+static bool congested;
+static bool conn_event_scheduled;
+static int lose_conf;
+
+/* the ATT request waiting for send_response */
+static uint32_t next_trans_id = 1;
+static uint32_t pending_trans;
+static bool pending_done;
+static esp_gatt_status_t pending_status;
+static esp_gatt_rsp_t pending_rsp;
+
+static sim_bt_notify_fn notify_hook;
+static void *notify_ctx;
+
+static const esp_bd_addr_t central_bda = { 0x5c, 0x17, 0xcf, 0x01, 0x02, 0x03 };
+
+static struct timespec abs_time(int64_t us)
+{
+    struct timespec ts = host_epoch();
+    ts.tv_sec += us / 1000000;
+    ts.tv_nsec += (long)(us % 1000000) * 1000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    return ts;
+}
+
+static int64_t interval_us(void)
+{
+    return interval * 1250LL;
+}
+
+/* ---- BTC task ---- */
+
+static void btc_task(void *arg)
+{
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        action_t *a = actions;
+        if (a == NULL) {
+            pthread_cond_wait(&changed, &lock);
+            continue;
+        }
+        if (a->due_us > host_time_us()) {
+            struct timespec ts = abs_time(a->due_us);
+            host_cond_wait(&changed, &lock, &ts);
+            continue;
+        }
+        actions = a->next;
+        esp_gap_ble_cb_t gap = gap_cb;
+        esp_gatts_cb_t gatts = gatts_cb;
+        pthread_mutex_unlock(&lock);
+
+        if (a->kind == ACT_GAP && gap) {
+            gap(a->event, &a->param.gap);
+        } else if (a->kind == ACT_GATTS && gatts) {
+            gatts(a->event, APP_GATTS_IF, &a->param.gatts);
+        } else if (a->kind == ACT_CALL) {
+            a->fn();
+        }
+        free(a);
+        pthread_mutex_lock(&lock);
+    }
+}
+
+/* behind every action due at or before it; lock held */
+static void schedule(action_t *a, int64_t due_us)
+{
+    a->due_us = due_us;
+    action_t **p = &actions;
+    while (*p && (*p)->due_us <= due_us) {
+        p = &(*p)->next;
+    }
+    a->next = *p;
+    *p = a;
+    pthread_cond_broadcast(&changed);
+}
+
+static action_t *post_gap(esp_gap_ble_cb_event_t event)
+{
+    action_t *a = calloc(1, sizeof(*a));
+    a->kind = ACT_GAP;
+    a->event = event;
+    schedule(a, host_time_us() + config.btc_us);
+    return a;
+}
+
+static action_t *post_gatts(esp_gatts_cb_event_t event)
+{
+    action_t *a = calloc(1, sizeof(*a));
+    a->kind = ACT_GATTS;
+    a->event = event;
+    schedule(a, host_time_us() + config.btc_us);
+    return a;
+}
+
+static void post_call(void (*fn)(void), int64_t due_us)
+{
+    action_t *a = calloc(1, sizeof(*a));
+    a->kind = ACT_CALL;
+    a->fn = fn;
+    schedule(a, due_us);
+}
+
+/* ---- controller and Bluedroid ---- */
+
+esp_err_t esp_bt_controller_mem_release(esp_bt_mode_t mode)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_controller_init(esp_bt_controller_config_t *cfg)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_controller_enable(esp_bt_mode_t mode)
+{
+    return mode == ESP_BT_MODE_BLE ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t esp_bluedroid_init(void)
+{
+    pthread_mutex_lock(&lock);
+    if (!running) {
+        running = true;
+        host_cond_init(&changed);
+        xTaskCreate(btc_task, "BTC_TASK", 8192, NULL, 19, NULL);
+    }
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_bluedroid_enable(void)
+{
+    bluedroid_enabled = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatt_set_local_mtu(uint16_t mtu)
+{
+    return mtu >= 23 && mtu <= 517 ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+/* ---- GAP ---- */
+
+esp_err_t esp_ble_gap_register_callback(esp_gap_ble_cb_t callback)
+{
+    pthread_mutex_lock(&lock);
+    gap_cb = callback;
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_set_device_name(const char *name)
+{
+    return strlen(name) <= 29 ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t esp_ble_gap_config_adv_data(esp_ble_adv_data_t *adv_data)
+{
+    pthread_mutex_lock(&lock);
+    action_t *a = post_gap(adv_data->set_scan_rsp ? ESP_GAP_BLE_SCAN_RSP_DATA_SET_COMPLETE_EVT
+                                                  : ESP_GAP_BLE_ADV_DATA_SET_COMPLETE_EVT);
+    a->param.gap.adv_data_cmpl.status = ESP_BT_STATUS_SUCCESS;
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+static void adv_started(void)
+{
+    pthread_mutex_lock(&lock);
+    if (!connected) {
+        advertising = true;
+        if (stats.first_adv_us == 0) {
+            stats.first_adv_us = host_time_us();
+        }
+    }
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+}
+
+esp_err_t esp_ble_gap_start_advertising(esp_ble_adv_params_t *adv_params)
+{
+    pthread_mutex_lock(&lock);
+    action_t *a = post_gap(ESP_GAP_BLE_ADV_START_COMPLETE_EVT);
+    bool ok = !connected && !advertising;
+    a->param.gap.adv_start_cmpl.status = ok ? ESP_BT_STATUS_SUCCESS : ESP_BT_STATUS_FAIL;
+    if (ok) {
+        /* advertising is on before the app hears of it */
+        post_call(adv_started, a->due_us - 1);
+    }
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_stop_advertising(void)
+{
+    pthread_mutex_lock(&lock);
+    advertising = false;
+    action_t *a = post_gap(ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT);
+    a->param.gap.adv_stop_cmpl.status = ESP_BT_STATUS_SUCCESS;
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_set_security_param(esp_ble_sm_param_t param_type, void *value, uint8_t len)
+{
+    return value != NULL && len > 0 ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t esp_ble_gap_security_rsp(esp_bd_addr_t bd_addr, bool accept)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_confirm_reply(esp_bd_addr_t bd_addr, bool accept)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_set_encryption(esp_bd_addr_t bd_addr, esp_ble_sec_act_t sec_act)
+{
+    pthread_mutex_lock(&lock);
+    if (!connected) {
+        pthread_mutex_unlock(&lock);
+        return ESP_FAIL;
+    }
+    action_t *a = calloc(1, sizeof(*a));
+    a->kind = ACT_GAP;
+    a->event = ESP_GAP_BLE_AUTH_CMPL_EVT;
+    memcpy(a->param.gap.ble_security.auth_cmpl.bd_addr, bd_addr, sizeof(esp_bd_addr_t));
+    a->param.gap.ble_security.auth_cmpl.success = true;
+    a->param.gap.ble_security.auth_cmpl.auth_mode = ESP_LE_AUTH_REQ_SC_MITM_BOND;
+    schedule(a, host_time_us() + config.btc_us + config.auth_ms * 1000LL);
+    bonded = true;
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+int esp_ble_get_bond_device_num(void)
+{
+    return bonded ? 1 : 0;
+}
+
+esp_err_t esp_ble_get_bond_device_list(int *dev_num, esp_ble_bond_dev_t *dev_list)
+{
+    int n = bonded && *dev_num > 0 ? 1 : 0;
+    if (n) {
+        memcpy(dev_list[0].bd_addr, central_bda, sizeof(esp_bd_addr_t));
+    }
+    *dev_num = n;
+    return ESP_OK;
+}
+
+static uint16_t requested_interval;
+
+static void conn_params_apply(void)
+{
+    pthread_mutex_lock(&lock);
+    if (connected) {
+        interval = requested_interval;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+esp_err_t esp_ble_gap_update_conn_params(esp_ble_conn_update_params_t *params)
+{
+    pthread_mutex_lock(&lock);
+    if (!connected) {
+        pthread_mutex_unlock(&lock);
+        return ESP_FAIL;
+    }
+    stats.conn_param_requests++;
+    if (config.accept_conn_params) {
+        /* the new interval takes effect at an instant six events out */
+        int64_t instant = host_time_us() + 6 * interval_us();
+        requested_interval = params->min_int;
+        post_call(conn_params_apply, instant);
+
+        action_t *a = calloc(1, sizeof(*a));
+        a->kind = ACT_GAP;
+        a->event = ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT;
+        memcpy(a->param.gap.update_conn_params.bda, params->bda, sizeof(esp_bd_addr_t));
+        a->param.gap.update_conn_params.min_int = params->min_int;
+        a->param.gap.update_conn_params.max_int = params->max_int;
+        a->param.gap.update_conn_params.conn_int = params->min_int;
+        a->param.gap.update_conn_params.latency = params->latency;
+        a->param.gap.update_conn_params.timeout = params->timeout;
+        schedule(a, instant + config.btc_us);
+    }
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+/* ---- GATTS ---- */
+
+esp_err_t esp_ble_gatts_register_callback(esp_gatts_cb_t callback)
+{
+    pthread_mutex_lock(&lock);
+    gatts_cb = callback;
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_app_register(uint16_t app_id)
+{
+    if (!bluedroid_enabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    pthread_mutex_lock(&lock);
+    action_t *a = post_gatts(ESP_GATTS_REG_EVT);
+    a->param.gatts.reg.status = ESP_GATT_OK;
+    a->param.gatts.reg.app_id = app_id;
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_create_attr_tab(const esp_gatts_attr_db_t *db, esp_gatt_if_t gatts_if,
+                                        uint16_t max_nb_attr, uint8_t srvc_inst_id)
+{
+    if (gatts_if != APP_GATTS_IF || max_nb_attr == 0 || attr_count + max_nb_attr > ATTR_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&lock);
+    action_t *a = post_gatts(ESP_GATTS_CREAT_ATTR_TAB_EVT);
+    uint16_t *handles = (uint16_t *)a->data;
+    for (int i = 0; i < max_nb_attr; i++) {
+        const esp_attr_desc_t *d = &db[i].att_desc;
+        attr_t *t = &attrs[attr_count];
+
+        memset(t, 0, sizeof(*t));
+        if (d->uuid_length == ESP_UUID_LEN_16) {
+            memcpy(&t->uuid, d->uuid_p, sizeof(t->uuid));
+        }
+        t->auto_rsp = db[i].attr_control.auto_rsp == ESP_GATT_AUTO_RSP;
+        t->max_len = d->max_length;
+        if (d->value && d->length) {
+            t->len = d->length < sizeof(t->value) ? d->length : sizeof(t->value);
+            memcpy(t->value, d->value, t->len);
+        }
+        handles[i] = FIRST_HANDLE + attr_count++;
+    }
+    a->param.gatts.add_attr_tab.status = ESP_GATT_OK;
+    a->param.gatts.add_attr_tab.num_handle = max_nb_attr;
+    a->param.gatts.add_attr_tab.svc_inst_id = srvc_inst_id;
+    a->param.gatts.add_attr_tab.handles = handles;
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+static attr_t *attr_find(uint16_t handle)
+{
+    int i = handle - FIRST_HANDLE;
+    return handle >= FIRST_HANDLE && i < attr_count ? &attrs[i] : NULL;
+}
+
+esp_err_t esp_ble_gatts_start_service(uint16_t service_handle)
+{
+    pthread_mutex_lock(&lock);
+    action_t *a = post_gatts(ESP_GATTS_START_EVT);
+    a->param.gatts.start.status = attr_find(service_handle) ? ESP_GATT_OK : ESP_GATT_INVALID_HANDLE;
+    a->param.gatts.start.service_handle = service_handle;
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_set_attr_value(uint16_t attr_handle, uint16_t length, const uint8_t *value)
+{
+    pthread_mutex_lock(&lock);
+    attr_t *t = attr_find(attr_handle);
+    if (t == NULL || length > t->max_len) {
+        pthread_mutex_unlock(&lock);
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(t->value, value, length);
+    t->len = length;
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+static void post_conf(uint16_t handle, esp_gatt_status_t status)
+{
+    if (status == ESP_GATT_OK && lose_conf > 0) {
+        lose_conf--;
+        return;
+    }
+    action_t *a = post_gatts(ESP_GATTS_CONF_EVT);
+    a->param.gatts.conf.status = status;
+    a->param.gatts.conf.conn_id = 0;
+    a->param.gatts.conf.handle = handle;
+}
+
+static void post_congest(bool on)
+{
+    congested = on;
+    if (on) {
+        stats.congest_events++;
+    }
+    action_t *a = post_gatts(ESP_GATTS_CONGEST_EVT);
+    a->param.gatts.congest.conn_id = 0;
+    a->param.gatts.congest.congested = on;
+}
+
+/* one connection event: the link carries what it can from the buffers */
+static void conn_event(void)
+{
+    tx_t sent[TX_MAX];
+    int n = 0;
+
+    pthread_mutex_lock(&lock);
+    conn_event_scheduled = false;
+    while (connected && tx_count > 0 && n < config.pkts_per_event) {
+        sent[n] = tx[tx_head];
+        tx_head = (tx_head + 1) % TX_MAX;
+        tx_count--;
+        stats.notifications++;
+        post_conf(sent[n].handle, ESP_GATT_OK);
+        n++;
+    }
+    if (congested && tx_count <= config.tx_buffers / 2) {
+        post_congest(false);
+    }
+    if (connected && tx_count > 0) {
+        conn_event_scheduled = true;
+        post_call(conn_event, host_time_us() + interval_us());
+    }
+    sim_bt_notify_fn hook = notify_hook;
+    void *ctx = notify_ctx;
+    pthread_mutex_unlock(&lock);
+
+    for (int i = 0; hook && i < n; i++) {
+        hook(sent[i].handle, sent[i].data, sent[i].len, ctx);
+    }
+}
+
+/* the next connection event boundary after now */
+static int64_t next_conn_event_us(void)
+{
+    int64_t now = host_time_us();
+    int64_t itv = interval_us();
+    return conn_anchor_us + ((now - conn_anchor_us) / itv + 1) * itv;
+}
+
+esp_err_t esp_ble_gatts_send_indicate(esp_gatt_if_t gatts_if, uint16_t conn_id, uint16_t attr_handle,
+                                      uint16_t value_len, uint8_t *value, bool need_confirm)
+{
+    if (!bluedroid_enabled) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    pthread_mutex_lock(&lock);
+    if (value_len > config.mtu - 3 || value_len > sizeof(tx[0].data)) {
+        pthread_mutex_unlock(&lock);
+        return ESP_FAIL;
+    }
+    if (gatts_if != APP_GATTS_IF || !connected || conn_id != 0 || attr_find(attr_handle) == NULL) {
+        post_conf(attr_handle, ESP_GATT_ERROR);
+    } else if (tx_count >= config.tx_buffers) {
+        stats.dropped++;
+        post_conf(attr_handle, ESP_GATT_CONGESTED);
+    } else {
+        tx_t *t = &tx[(tx_head + tx_count++) % TX_MAX];
+        t->handle = attr_handle;
+        t->len = value_len;
+        memcpy(t->data, value, value_len);
+        if (tx_count == config.tx_buffers && !congested) {
+            post_congest(true);
+        }
+        if (!conn_event_scheduled) {
+            conn_event_scheduled = true;
+            post_call(conn_event, next_conn_event_us());
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_send_response(esp_gatt_if_t gatts_if, uint16_t conn_id, uint32_t trans_id,
+                                      esp_gatt_status_t status, esp_gatt_rsp_t *rsp)
+{
+    pthread_mutex_lock(&lock);
+    if (trans_id == 0 || trans_id != pending_trans) {
+        pthread_mutex_unlock(&lock);
+        return ESP_FAIL;
+    }
+    pending_status = status;
+    if (rsp) {
+        pending_rsp = *rsp;
+    } else {
+        memset(&pending_rsp, 0, sizeof(pending_rsp));
+    }
+    pending_done = true;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+/* ---- the central ---- */
+
+void sim_bt_default_config(sim_bt_config_t *cfg)
+{
+    *cfg = DEFAULT_CONFIG;
+}
+
+void sim_bt_configure(const sim_bt_config_t *cfg)
+{
+    pthread_mutex_lock(&lock);
+    config = *cfg;
+    if (config.tx_buffers > TX_MAX) {
+        config.tx_buffers = TX_MAX;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void sim_bt_get_stats(sim_bt_stats_t *out)
+{
+    pthread_mutex_lock(&lock);
+    *out = stats;
+    pthread_mutex_unlock(&lock);
+}
+
+void sim_bt_reset_stats(void)
+{
+    pthread_mutex_lock(&lock);
+    int64_t first_adv = stats.first_adv_us, conn = stats.connected_us;
+    memset(&stats, 0, sizeof(stats));
+    stats.first_adv_us = first_adv;
+    stats.connected_us = conn;
+    pthread_mutex_unlock(&lock);
+}
+
+void sim_bt_on_notify(sim_bt_notify_fn fn, void *ctx)
+{
+    pthread_mutex_lock(&lock);
+    notify_hook = fn;
+    notify_ctx = ctx;
+    pthread_mutex_unlock(&lock);
+}
+
+bool sim_bt_connect(uint32_t timeout_ms)
+{
+    struct timespec ts = abs_time(host_time_us() + timeout_ms * 1000LL);
+
+    pthread_mutex_lock(&lock);
+    while (!advertising || connected) {
+        if (!host_cond_wait(&changed, &lock, &ts)) {
+            pthread_mutex_unlock(&lock);
+            return false;
+        }
+    }
+    advertising = false;
+    connected = true;
+    interval = config.conn_interval;
+    conn_anchor_us = host_time_us();
+    stats.connected_us = conn_anchor_us;
+    tx_head = tx_count = 0;
+    congested = false;
+
+    action_t *a = post_gatts(ESP_GATTS_CONNECT_EVT);
+    a->param.gatts.connect.conn_id = 0;
+    memcpy(a->param.gatts.connect.remote_bda, central_bda, sizeof(esp_bd_addr_t));
+    a->param.gatts.connect.conn_params.interval = interval;
+    a->param.gatts.connect.conn_params.latency = 0;
+    a->param.gatts.connect.conn_params.timeout = 400;
+    pthread_mutex_unlock(&lock);
+    return true;
+}
+
+void sim_bt_disconnect(int reason)
+{
+    pthread_mutex_lock(&lock);
+    if (connected) {
+        connected = false;
+        stats.dropped += tx_count;
+        tx_count = 0;
+        action_t *a = post_gatts(ESP_GATTS_DISCONNECT_EVT);
+        a->param.gatts.disconnect.conn_id = 0;
+        memcpy(a->param.gatts.disconnect.remote_bda, central_bda, sizeof(esp_bd_addr_t));
+        a->param.gatts.disconnect.reason = reason;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/* hands the request in a to the app and waits for send_response; lock held */
+static bool app_request(action_t *a, uint32_t trans_id)
+{
+    struct timespec ts = abs_time(host_time_us() + PENDING_TMO_US);
+
+    pending_trans = trans_id;
+    pending_done = false;
+    stats.app_requests++;
+    while (!pending_done) {
+        if (!host_cond_wait(&changed, &lock, &ts)) {
+            break;
+        }
+    }
+    pending_trans = 0;
+    return pending_done && pending_status == ESP_GATT_OK;
+}
+
+/* sleeps out the rest of the connection event the request went in */
+static void finish_request(int64_t start_us)
+{
+    int64_t left = start_us + interval_us() - host_time_us();
+    pthread_mutex_unlock(&lock);
+    if (left > 0) {
+        usleep(left);
+    }
+}
+
+int sim_bt_read(uint16_t handle, uint16_t offset, uint8_t *out, int max)
+{
+    int64_t start = host_time_us();
+    int len = -1;
+
+    pthread_mutex_lock(&lock);
+    attr_t *t = attr_find(handle);
+    if (!connected || t == NULL) {
+        pthread_mutex_unlock(&lock);
+        return -1;
+    }
+    int room = config.mtu - 1 < max ? config.mtu - 1 : max;
+
+    if (t->uuid == ESP_GATT_UUID_CHAR_DECLARE && t + 1 < attrs + attr_count) {
+        /* properties, value handle, value UUID */
+        uint8_t decl[5] = { t->value[0], (handle + 1) & 0xff, (handle + 1) >> 8,
+                            t[1].uuid & 0xff, t[1].uuid >> 8 };
+        stats.stack_requests++;
+        len = sizeof(decl) < room ? sizeof(decl) : room;
+        memcpy(out, decl, len);
+    } else if (t->auto_rsp || t->uuid == ESP_GATT_UUID_PRI_SERVICE) {
+        stats.stack_requests++;
+        if (offset <= t->len) {
+            len = t->len - offset < room ? t->len - offset : room;
+            memcpy(out, t->value + offset, len);
+        }
+    } else {
+        uint32_t id = next_trans_id++;
+        action_t *a = post_gatts(ESP_GATTS_READ_EVT);
+        a->param.gatts.read.conn_id = 0;
+        a->param.gatts.read.trans_id = id;
+        memcpy(a->param.gatts.read.bda, central_bda, sizeof(esp_bd_addr_t));
+        a->param.gatts.read.handle = handle;
+        a->param.gatts.read.offset = offset;
+        a->param.gatts.read.is_long = offset > 0;
+        a->param.gatts.read.need_rsp = true;
+        if (app_request(a, id)) {
+            len = pending_rsp.attr_value.len < room ? pending_rsp.attr_value.len : room;
+            memcpy(out, pending_rsp.attr_value.value, len);
+        }
+    }
+    finish_request(start);
+    return len;
+}
+
+bool sim_bt_write(uint16_t handle, const void *data, int len)
+{
+    int64_t start = host_time_us();
+    bool ok = true;
+
+    pthread_mutex_lock(&lock);
+    attr_t *t = attr_find(handle);
+    if (!connected || t == NULL || len > config.mtu - 3) {
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+
+    /* the app hears of every write; it answers only those it owns */
+    action_t *a = post_gatts(ESP_GATTS_WRITE_EVT);
+    memcpy(a->data, data, len);
+    a->param.gatts.write.conn_id = 0;
+    memcpy(a->param.gatts.write.bda, central_bda, sizeof(esp_bd_addr_t));
+    a->param.gatts.write.handle = handle;
+    a->param.gatts.write.len = len;
+    a->param.gatts.write.value = a->data;
+    if (t->auto_rsp) {
+        stats.stack_requests++;
+        if (len > t->max_len) {
+            ok = false;
+        } else {
+            memcpy(t->value, data, len);
+            t->len = len;
+        }
+    } else {
+        uint32_t id = next_trans_id++;
+        a->param.gatts.write.trans_id = id;
+        a->param.gatts.write.need_rsp = true;
+        ok = app_request(a, id);
+    }
+    finish_request(start);
+    return ok;
+}
+
+int sim_bt_attr_count(void)
+{
+    pthread_mutex_lock(&lock);
+    int n = attr_count;
+    pthread_mutex_unlock(&lock);
+    return n;
+}
+
+uint16_t sim_bt_attr_handle(int index)
+{
+    return FIRST_HANDLE + index;
+}
+
+uint16_t sim_bt_attr_uuid(uint16_t handle)
+{
+    pthread_mutex_lock(&lock);
+    attr_t *t = attr_find(handle);
+    uint16_t uuid = t ? t->uuid : 0;
+    pthread_mutex_unlock(&lock);
+    return uuid;
+}
+
+void sim_bt_lose_conf(int n)
+{
+    pthread_mutex_lock(&lock);
+    lose_conf = n;
+    pthread_mutex_unlock(&lock);
+}
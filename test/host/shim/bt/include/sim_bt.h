@@ -0,0 +1,54 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Test-side controls of the simulated Bluedroid stack and the central
+   connected to it */
+
+typedef struct {
+    uint32_t btc_us;            /* API call to callback on the BTC task */
+    uint16_t conn_interval;     /* central's choice at connect, 1.25 ms units */
+    uint16_t mtu;               /* ATT MTU; reads return up to mtu - 1 bytes */
+    uint8_t pkts_per_event;     /* notifications the link carries per connection event */
+    uint8_t tx_buffers;         /* controller buffers; the stack congests when they are full */
+    uint32_t auth_ms;           /* esp_ble_set_encryption() to AUTH_CMPL */
+    bool accept_conn_params;    /* central applies update requests (at min_int) */
+} sim_bt_config_t;
+
+typedef struct {
+    uint32_t notifications;     /* delivered to the central */
+    uint32_t dropped;           /* refused while the buffers were full */
+    uint32_t congest_events;
+    uint32_t conn_param_requests;
+    uint32_t app_requests;      /* ATT requests handed to the app (ESP_GATT_RSP_BY_APP) */
+    uint32_t stack_requests;    /* answered by the stack (ESP_GATT_AUTO_RSP) */
+    int64_t first_adv_us;       /* first ADV_START_COMPLETE */
+    int64_t connected_us;
+} sim_bt_stats_t;
+
+void sim_bt_default_config(sim_bt_config_t *cfg);
+void sim_bt_configure(const sim_bt_config_t *cfg);
+void sim_bt_get_stats(sim_bt_stats_t *out);
+void sim_bt_reset_stats(void);
+
+/* Called on the BTC task for every notification the central receives */
+typedef void (*sim_bt_notify_fn)(uint16_t handle, const uint8_t *data, int len, void *ctx);
+void sim_bt_on_notify(sim_bt_notify_fn fn, void *ctx);
+
+/* Connects once the peripheral advertises; false if it does not within timeout_ms */
+bool sim_bt_connect(uint32_t timeout_ms);
+void sim_bt_disconnect(int reason);
+
+/* ATT requests from the central. Each takes one connection interval, plus
+   the BTC round trip when the app answers. Return the value length or
+   false/-1 on an ATT error. */
+int sim_bt_read(uint16_t handle, uint16_t offset, uint8_t *out, int max);
+bool sim_bt_write(uint16_t handle, const void *data, int len);
+
+/* The created attribute table: handle of entry index, its 16-bit UUID */
+int sim_bt_attr_count(void);
+uint16_t sim_bt_attr_handle(int index);
+uint16_t sim_bt_attr_uuid(uint16_t handle);
+
+/* The next n CONF_EVTs are lost */
+void sim_bt_lose_conf(int n);
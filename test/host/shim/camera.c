@@ -0,0 +1,125 @@
+/* esp32-camera: a sensor producing JPEG frames whose size follows the
+   quality and frame size set on it. */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_camera.h"
+#include "sim.h"
+
+#define QUALITY_BEST 10
+
+static pthread_mutex_t camera_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool attached;
+static bool initialized;
+static int width, height;
+static size_t bytes_at_best;
+static int quality = QUALITY_BEST;
+static framesize_t framesize;
+
+static const struct { int width, height; } resolution[FRAMESIZE_INVALID] = {
+    [FRAMESIZE_96X96] = { 96, 96 },     [FRAMESIZE_QQVGA] = { 160, 120 },
+    [FRAMESIZE_QCIF] = { 176, 144 },    [FRAMESIZE_HQVGA] = { 240, 176 },
+    [FRAMESIZE_240X240] = { 240, 240 }, [FRAMESIZE_QVGA] = { 320, 240 },
+    [FRAMESIZE_CIF] = { 400, 296 },     [FRAMESIZE_HVGA] = { 480, 320 },
+    [FRAMESIZE_VGA] = { 640, 480 },     [FRAMESIZE_SVGA] = { 800, 600 },
+};
+static uint8_t *frame;
+static camera_fb_t fb;
+static bool fb_out;
+
+static int set_quality(sensor_t *sensor, int q)
+{
+    if (q < 0 || q > 63) {
+        return -1;
+    }
+    pthread_mutex_lock(&camera_lock);
+    quality = q;
+    pthread_mutex_unlock(&camera_lock);
+    return 0;
+}
+
+static int set_framesize(sensor_t *sensor, framesize_t fs)
+{
+    if (fs < 0 || fs >= FRAMESIZE_INVALID) {
+        return -1;
+    }
+    pthread_mutex_lock(&camera_lock);
+    framesize = fs;
+    pthread_mutex_unlock(&camera_lock);
+    return 0;
+}
+
+static sensor_t sensor = { .set_quality = set_quality, .set_framesize = set_framesize };
+
+void sim_camera_attach(int w, int h, size_t best)
+{
+    pthread_mutex_lock(&camera_lock);
+    width = w;
+    height = h;
+    bytes_at_best = best;
+    free(frame);
+    frame = malloc(best);
+    /* JPEG markers around filler, so a capture is recognisable */
+    memset(frame, 0x55, best);
+    frame[0] = 0xFF;
+    frame[1] = 0xD8;
+    attached = true;
+    pthread_mutex_unlock(&camera_lock);
+}
+
+int sim_camera_quality(void)
+{
+    pthread_mutex_lock(&camera_lock);
+    int q = quality;
+    pthread_mutex_unlock(&camera_lock);
+    return q;
+}
+
+esp_err_t esp_camera_init(const camera_config_t *config)
+{
+    pthread_mutex_lock(&camera_lock);
+    esp_err_t err = ESP_ERR_NOT_FOUND;       /* no sensor answered on SCCB */
+    if (attached && config->frame_size >= 0 && config->frame_size < FRAMESIZE_INVALID) {
+        framesize = config->frame_size;
+        quality = config->jpeg_quality;
+        initialized = true;
+        err = ESP_OK;
+    }
+    pthread_mutex_unlock(&camera_lock);
+    return err;
+}
+
+sensor_t *esp_camera_sensor_get(void)
+{
+    return initialized ? &sensor : NULL;
+}
+
+/* the driver hands out one buffer at a time here */
+camera_fb_t *esp_camera_fb_get(void)
+{
+    pthread_mutex_lock(&camera_lock);
+    if (!initialized || fb_out) {
+        pthread_mutex_unlock(&camera_lock);
+        return NULL;
+    }
+    int w = resolution[framesize].width, h = resolution[framesize].height;
+    size_t len = bytes_at_best * QUALITY_BEST / (quality > QUALITY_BEST ? quality : QUALITY_BEST);
+    len = len * w * h / (width * height);
+    if (len > bytes_at_best) {
+        len = bytes_at_best;
+    }
+    fb = (camera_fb_t){ .buf = frame, .len = len, .width = w, .height = h,
+                        .format = PIXFORMAT_JPEG };
+    gettimeofday(&fb.timestamp, NULL);
+    fb_out = true;
+    pthread_mutex_unlock(&camera_lock);
+    return &fb;
+}
+
+void esp_camera_fb_return(camera_fb_t *ret)
+{
+    pthread_mutex_lock(&camera_lock);
+    fb_out = false;
+    pthread_mutex_unlock(&camera_lock);
+}
@@ -0,0 +1,315 @@
+/* Logging, error names, heap, ROM CRC, deep sleep and GPIO. */
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "esp_rom_crc.h"
+#include "esp_crt_bundle.h"
+#include "esp_sleep.h"
+#include "driver/gpio.h"
+#include "sim.h"
+#include "host_compat.h"
+#include "host_internal.h"
+
+/* ---- log ---- */
+
+static esp_log_level_t log_level(void)
+{
+    static int level = -1;
+    if (level < 0) {
+        const char *env = getenv("DOORCAM_LOG");
+        level = ESP_LOG_WARN;
+        if (env != NULL) {
+            const char *letters = "NEWIDV";
+            const char *at = strchr(letters, env[0]);
+            if (at != NULL && env[0] != 0) {
+                level = (int)(at - letters);
+            }
+        }
+    }
+    return (esp_log_level_t)level;
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+}
+
+uint32_t esp_log_timestamp(void)
+{
+    return (uint32_t)(host_time_us() / 1000);
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    if (level > log_level()) {
+        return;
+    }
+    va_list ap;
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+}
+
+/* ---- errors ---- */
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code) {
+    case ESP_OK:                        return "ESP_OK";
+    case ESP_FAIL:                      return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:                return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:           return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:         return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:          return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:             return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED:         return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT:               return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_RESPONSE:      return "ESP_ERR_INVALID_RESPONSE";
+    case ESP_ERR_INVALID_CRC:           return "ESP_ERR_INVALID_CRC";
+    case ESP_ERR_NVS_NOT_FOUND:         return "ESP_ERR_NVS_NOT_FOUND";
+    case ESP_ERR_NVS_NO_FREE_PAGES:     return "ESP_ERR_NVS_NO_FREE_PAGES";
+    case ESP_ERR_NVS_NEW_VERSION_FOUND: return "ESP_ERR_NVS_NEW_VERSION_FOUND";
+    case ESP_ERR_WIFI_NOT_CONNECT:      return "ESP_ERR_WIFI_NOT_CONNECT";
+    default:                            return "UNKNOWN ERROR";
+    }
+}
+
+void host_error_check_failed(esp_err_t rc, const char *file, int line, const char *expr)
+{
+    fprintf(stderr, "ESP_ERROR_CHECK failed: %s (0x%x) at %s:%d: %s\n",
+            esp_err_to_name(rc), rc, file, line, expr);
+    abort();
+}
+
+/* ---- system and heap ---- */
+
+void esp_restart(void)
+{
+    fprintf(stderr, "esp_restart()\n");
+    exit(3);
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+    return 200 * 1024;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+    return 150 * 1024;
+}
+
+static atomic_uint heap_allocs;
+
+uint32_t sim_heap_allocs(void)
+{
+    return atomic_load(&heap_allocs);
+}
+
+void *host_malloc(size_t size)
+{
+    atomic_fetch_add(&heap_allocs, 1);
+    return malloc(size);
+}
+
+void *host_calloc(size_t n, size_t size)
+{
+    atomic_fetch_add(&heap_allocs, 1);
+    return calloc(n, size);
+}
+
+void *host_realloc(void *ptr, size_t size)
+{
+    atomic_fetch_add(&heap_allocs, 1);
+    return realloc(ptr, size);
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+    return host_malloc(size);
+}
+
+void *heap_caps_calloc(size_t n, size_t size, uint32_t caps)
+{
+    return host_calloc(n, size);
+}
+
+void *heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps)
+{
+    atomic_fetch_add(&heap_allocs, 1);
+    return aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+void heap_caps_free(void *ptr)
+{
+    free(ptr);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    return (caps & MALLOC_CAP_SPIRAM) ? 4 * 1024 * 1024 : 200 * 1024;
+}
+
+/* ---- ROM ---- */
+
+/* same convention as the ROM: the caller's crc is inverted on entry and exit */
+uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len)
+{
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        for (int k = 0; k < 8; k++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+esp_err_t esp_crt_bundle_attach(void *conf)
+{
+    return ESP_OK;
+}
+
+/* ---- deep sleep ---- */
+
+static esp_sleep_wakeup_cause_t wake_cause = ESP_SLEEP_WAKEUP_UNDEFINED;
+static uint64_t wake_pins;
+static void (*sleep_hook)(void);
+
+void sim_sleep_set_wakeup(esp_sleep_wakeup_cause_t cause, uint64_t ext1_pins)
+{
+    wake_cause = cause;
+    wake_pins = ext1_pins;
+}
+
+void sim_sleep_on_deep_sleep(void (*hook)(void))
+{
+    sleep_hook = hook;
+}
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause(void)
+{
+    return wake_cause;
+}
+
+uint64_t esp_sleep_get_ext1_wakeup_status(void)
+{
+    return wake_pins;
+}
+
+esp_err_t esp_sleep_enable_ext1_wakeup(uint64_t mask, esp_sleep_ext1_wakeup_mode_t mode)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_in_us)
+{
+    return ESP_OK;
+}
+
+void esp_deep_sleep_start(void)
+{
+    if (sleep_hook != NULL) {
+        sleep_hook();
+    }
+    exit(0);
+}
+
+/* ---- GPIO ---- */
+
+#define GPIO_COUNT 40
+
+static int levels[GPIO_COUNT];
+static gpio_isr_t isr[GPIO_COUNT];
+static void *isr_arg[GPIO_COUNT];
+
+static bool pin_ok(int pin)
+{
+    return pin >= 0 && pin < GPIO_COUNT;
+}
+
+void sim_gpio_set_level(int pin, int level)
+{
+    if (pin_ok(pin)) {
+        levels[pin] = level;
+    }
+}
+
+int sim_gpio_get_output(int pin)
+{
+    return pin_ok(pin) ? levels[pin] : 0;
+}
+
+void sim_gpio_trigger(int pin)
+{
+    if (pin_ok(pin) && isr[pin] != NULL) {
+        isr[pin](isr_arg[pin]);
+    }
+}
+
+esp_err_t gpio_reset_pin(gpio_num_t pin)
+{
+    return pin_ok(pin) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t pin, gpio_mode_t mode)
+{
+    return pin_ok(pin) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t gpio_set_level(gpio_num_t pin, uint32_t level)
+{
+    if (!pin_ok(pin)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    levels[pin] = level != 0;
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t pin)
+{
+    return pin_ok(pin) ? levels[pin] : 0;
+}
+
+esp_err_t gpio_set_pull_mode(gpio_num_t pin, gpio_pull_mode_t pull)
+{
+    return pin_ok(pin) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t gpio_set_intr_type(gpio_num_t pin, gpio_int_type_t type)
+{
+    return pin_ok(pin) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t gpio_install_isr_service(int flags)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t pin, gpio_isr_t handler, void *arg)
+{
+    if (!pin_ok(pin)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    isr[pin] = handler;
+    isr_arg[pin] = arg;
+    return ESP_OK;
+}
+
+/* ---- newlib ---- */
+
+size_t strlcpy(char *dst, const char *src, size_t size)
+{
+    size_t len = strlen(src);
+    if (size) {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = 0;
+    }
+    return len;
+}
@@ -0,0 +1,198 @@
+/* esp_timer on one dispatcher thread, like ESP_TIMER_TASK dispatch. */
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include "esp_timer.h"
+#include "host_internal.h"
+
+struct host_timer {
+    esp_timer_cb_t callback;
+    void *arg;
+    int64_t due_us;
+    uint64_t period_us;
+    bool active;
+    struct host_timer *next;    /* in the armed list, sorted by due_us */
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static struct host_timer *armed;
+
+static struct timespec epoch;
+static pthread_once_t epoch_once = PTHREAD_ONCE_INIT;
+
+static void epoch_init(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &epoch);
+}
+
+struct timespec host_epoch(void)
+{
+    pthread_once(&epoch_once, epoch_init);
+    return epoch;
+}
+
+int64_t host_time_us(void)
+{
+    struct timespec start = host_epoch(), now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)(now.tv_sec - start.tv_sec) * 1000000 + (now.tv_nsec - start.tv_nsec) / 1000;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return host_time_us();
+}
+
+static struct timespec abs_time(int64_t us)
+{
+    struct timespec ts = host_epoch();
+    ts.tv_sec += us / 1000000;
+    ts.tv_nsec += (long)(us % 1000000) * 1000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    return ts;
+}
+
+static void unlink_timer(struct host_timer *t)
+{
+    for (struct host_timer **p = &armed; *p; p = &(*p)->next) {
+        if (*p == t) {
+            *p = t->next;
+            break;
+        }
+    }
+    t->next = NULL;
+}
+
+static void insert_timer(struct host_timer *t)
+{
+    struct host_timer **p = &armed;
+    while (*p && (*p)->due_us <= t->due_us) {
+        p = &(*p)->next;
+    }
+    t->next = *p;
+    *p = t;
+    pthread_cond_broadcast(&changed);
+}
+
+static void *dispatcher(void *arg)
+{
+    host_task_adopt("esp_timer");
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        if (armed == NULL) {
+            pthread_cond_wait(&changed, &lock);
+            continue;
+        }
+        struct host_timer *t = armed;
+        if (t->due_us > host_time_us()) {
+            struct timespec ts = abs_time(t->due_us);
+            host_cond_wait(&changed, &lock, &ts);
+            continue;
+        }
+
+        armed = t->next;
+        t->next = NULL;
+        if (t->period_us) {
+            t->due_us += t->period_us;
+            insert_timer(t);
+        } else {
+            t->active = false;
+        }
+        esp_timer_cb_t cb = t->callback;
+        void *cb_arg = t->arg;
+        pthread_mutex_unlock(&lock);
+        cb(cb_arg);
+        pthread_mutex_lock(&lock);
+    }
+    return NULL;
+}
+
+static void start_dispatcher(void)
+{
+    pthread_t thread;
+    host_cond_init(&changed);
+    pthread_create(&thread, NULL, dispatcher, NULL);
+    pthread_detach(thread);
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *out)
+{
+    if (args == NULL || args->callback == NULL || out == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_once(&once, start_dispatcher);
+    struct host_timer *t = calloc(1, sizeof(*t));
+    if (t == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    t->callback = args->callback;
+    t->arg = args->arg;
+    *out = t;
+    return ESP_OK;
+}
+
+static esp_err_t start(esp_timer_handle_t t, uint64_t timeout_us, uint64_t period_us)
+{
+    pthread_mutex_lock(&lock);
+    if (t->active) {
+        pthread_mutex_unlock(&lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    t->active = true;
+    t->period_us = period_us;
+    t->due_us = host_time_us() + timeout_us;
+    insert_timer(t);
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return start(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us)
+{
+    return start(timer, period_us, period_us);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t t)
+{
+    pthread_mutex_lock(&lock);
+    if (!t->active) {
+        pthread_mutex_unlock(&lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    unlink_timer(t);
+    t->active = false;
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t t)
+{
+    if (t == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&lock);
+    bool active = t->active;
+    pthread_mutex_unlock(&lock);
+    if (active) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    free(t);
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t t)
+{
+    pthread_mutex_lock(&lock);
+    bool active = t->active;
+    pthread_mutex_unlock(&lock);
+    return active;
+}
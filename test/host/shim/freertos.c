@@ -0,0 +1,483 @@
+/* FreeRTOS tasks, queues, semaphores and event groups on POSIX threads.
+   Priorities are ignored: every task is a thread and the kernel decides. */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "host_internal.h"
+
+struct host_task {
+    pthread_t thread;
+    char name[16];
+    TaskFunction_t fn;
+    void *arg;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notify;
+};
+
+struct host_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    size_t item_size;
+    size_t len;
+    size_t count;
+    size_t head;
+    uint8_t *items;
+};
+
+struct host_event_group {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    EventBits_t bits;
+};
+
+static __thread struct host_task *current;
+
+void host_assert_fail(const char *expr, const char *file, int line)
+{
+    fprintf(stderr, "assert failed: %s (%s:%d)\n", expr, file, line);
+    abort();
+}
+
+/* absolute CLOCK_MONOTONIC deadline for a tick timeout, NULL for forever */
+static const struct timespec *deadline_for(TickType_t wait, struct timespec *ts)
+{
+    if (wait == portMAX_DELAY) {
+        return NULL;
+    }
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec += wait / 1000;
+    ts->tv_nsec += (long)(wait % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+    return ts;
+}
+
+void host_cond_init(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/* false on timeout */
+bool host_cond_wait(pthread_cond_t *cond, pthread_mutex_t *lock, const struct timespec *deadline)
+{
+    if (deadline == NULL) {
+        pthread_cond_wait(cond, lock);
+        return true;
+    }
+    return pthread_cond_timedwait(cond, lock, deadline) != ETIMEDOUT;
+}
+
+/* ---- tasks ---- */
+
+static struct host_task *task_new(const char *name)
+{
+    struct host_task *t = calloc(1, sizeof(*t));
+    configASSERT(t != NULL);
+    strlcpy(t->name, name ? name : "", sizeof(t->name));
+    pthread_mutex_init(&t->lock, NULL);
+    host_cond_init(&t->cond);
+    return t;
+}
+
+struct host_task *host_task_self(void)
+{
+    if (current == NULL) {
+        /* main thread or a thread the shims started themselves */
+        char name[16] = "main";
+        pthread_getname_np(pthread_self(), name, sizeof(name));
+        current = task_new(name);
+        current->thread = pthread_self();
+    }
+    return current;
+}
+
+void host_task_adopt(const char *name)
+{
+    current = task_new(name);
+    current->thread = pthread_self();
+    pthread_setname_np(pthread_self(), current->name);
+}
+
+static void *task_entry(void *p)
+{
+    current = p;
+    pthread_setname_np(pthread_self(), current->name);
+    current->fn(current->arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack, void *arg,
+                       UBaseType_t prio, TaskHandle_t *out)
+{
+    struct host_task *t = task_new(name);
+    t->fn = fn;
+    t->arg = arg;
+    if (out) {
+        *out = t;
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int rc = pthread_create(&t->thread, &attr, task_entry, t);
+    pthread_attr_destroy(&attr);
+    return rc == 0 ? pdPASS : pdFAIL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack, void *arg,
+                                   UBaseType_t prio, TaskHandle_t *out, BaseType_t core)
+{
+    return xTaskCreate(fn, name, stack, arg, prio, out);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task == NULL || task == current) {
+        pthread_exit(NULL);
+    }
+    pthread_cancel(task->thread);
+}
+
+static void sleep_until_ms(uint64_t ms)
+{
+    struct timespec ts = { .tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000000 };
+    ts.tv_sec += host_epoch().tv_sec;
+    ts.tv_nsec += host_epoch().tv_nsec;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    if (ticks == 0) {
+        sched_yield();
+        return;
+    }
+    usleep((useconds_t)ticks * 1000);
+}
+
+void vTaskDelayUntil(TickType_t *last_wake, TickType_t increment)
+{
+    *last_wake += increment;
+    sleep_until_ms(*last_wake);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(host_time_us() / 1000);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return host_task_self();
+}
+
+char *pcTaskGetName(TaskHandle_t task)
+{
+    return (task ? task : host_task_self())->name;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t wait)
+{
+    struct host_task *t = host_task_self();
+    struct timespec ts;
+    const struct timespec *deadline = deadline_for(wait, &ts);
+
+    pthread_mutex_lock(&t->lock);
+    while (t->notify == 0 && wait != 0) {
+        if (!host_cond_wait(&t->cond, &t->lock, deadline)) {
+            break;
+        }
+    }
+    uint32_t value = t->notify;
+    if (value) {
+        t->notify = clear_on_exit ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&t->lock);
+    return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->lock);
+    task->notify++;
+    pthread_cond_broadcast(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken)
+{
+    xTaskNotifyGive(task);
+    if (woken) {
+        *woken = pdFALSE;
+    }
+}
+
+/* ---- critical sections ---- */
+
+void vPortEnterCritical(portMUX_TYPE *mux)
+{
+    unsigned long self = (unsigned long)pthread_self();
+    if (atomic_load_explicit(&mux->owner, memory_order_relaxed) == self) {
+        mux->depth++;
+        return;
+    }
+    unsigned long expected = 0;
+    while (!atomic_compare_exchange_weak_explicit(&mux->owner, &expected, self,
+                                                  memory_order_acquire, memory_order_relaxed)) {
+        expected = 0;
+        sched_yield();
+    }
+    mux->depth = 1;
+}
+
+void vPortExitCritical(portMUX_TYPE *mux)
+{
+    configASSERT(atomic_load_explicit(&mux->owner, memory_order_relaxed) == (unsigned long)pthread_self());
+    if (--mux->depth == 0) {
+        atomic_store_explicit(&mux->owner, 0, memory_order_release);
+    }
+}
+
+/* ---- queues and semaphores ---- */
+
+QueueHandle_t xQueueCreate(UBaseType_t len, UBaseType_t item_size)
+{
+    struct host_queue *q = calloc(1, sizeof(*q));
+    if (q == NULL) {
+        return NULL;
+    }
+    q->len = len;
+    q->item_size = item_size;
+    if (item_size) {
+        q->items = calloc(len, item_size);
+        if (q->items == NULL) {
+            free(q);
+            return NULL;
+        }
+    }
+    pthread_mutex_init(&q->lock, NULL);
+    host_cond_init(&q->changed);
+    return q;
+}
+
+void vQueueDelete(QueueHandle_t q)
+{
+    if (q) {
+        free(q->items);
+        free(q);
+    }
+}
+
+static BaseType_t queue_send(QueueHandle_t q, const void *item, TickType_t wait, bool front)
+{
+    struct timespec ts;
+    const struct timespec *deadline = deadline_for(wait, &ts);
+
+    pthread_mutex_lock(&q->lock);
+    while (q->count == q->len) {
+        if (wait == 0 || !host_cond_wait(&q->changed, &q->lock, deadline)) {
+            pthread_mutex_unlock(&q->lock);
+            return pdFALSE;
+        }
+    }
+    /* semaphores are queues of no items */
+    if (q->item_size && item != NULL) {
+        size_t slot;
+        if (front) {
+            q->head = (q->head + q->len - 1) % q->len;
+            slot = q->head;
+        } else {
+            slot = (q->head + q->count) % q->len;
+        }
+        memcpy(q->items + slot * q->item_size, item, q->item_size);
+    }
+    q->count++;
+    pthread_cond_broadcast(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+    return pdTRUE;
+}
+
+static BaseType_t queue_receive(QueueHandle_t q, void *item, TickType_t wait, bool peek)
+{
+    struct timespec ts;
+    const struct timespec *deadline = deadline_for(wait, &ts);
+
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0) {
+        if (wait == 0 || !host_cond_wait(&q->changed, &q->lock, deadline)) {
+            pthread_mutex_unlock(&q->lock);
+            return pdFALSE;
+        }
+    }
+    if (q->item_size && item) {
+        memcpy(item, q->items + q->head * q->item_size, q->item_size);
+    }
+    if (!peek) {
+        if (q->item_size) {
+            q->head = (q->head + 1) % q->len;
+        }
+        q->count--;
+        pthread_cond_broadcast(&q->changed);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return pdTRUE;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t q, const void *item, TickType_t wait)
+{
+    return queue_send(q, item, wait, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t q, const void *item, TickType_t wait)
+{
+    return queue_send(q, item, wait, true);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t wait)
+{
+    return queue_receive(q, item, wait, false);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t q, void *item, TickType_t wait)
+{
+    return queue_receive(q, item, wait, true);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q)
+{
+    pthread_mutex_lock(&q->lock);
+    UBaseType_t n = q->count;
+    pthread_mutex_unlock(&q->lock);
+    return n;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t q)
+{
+    pthread_mutex_lock(&q->lock);
+    UBaseType_t n = q->len - q->count;
+    pthread_mutex_unlock(&q->lock);
+    return n;
+}
+
+BaseType_t xQueueReset(QueueHandle_t q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->count = 0;
+    q->head = 0;
+    pthread_cond_broadcast(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+    return pdPASS;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial)
+{
+    struct host_queue *q = xQueueCreate(max, 0);
+    if (q) {
+        q->count = initial;
+    }
+    return q;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t wait)
+{
+    return queue_receive(s, NULL, wait, false);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t s)
+{
+    return queue_send(s, NULL, 0, false);
+}
+
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t s)
+{
+    return uxQueueMessagesWaiting(s);
+}
+
+/* ---- event groups ---- */
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+    struct host_event_group *g = calloc(1, sizeof(*g));
+    if (g) {
+        pthread_mutex_init(&g->lock, NULL);
+        host_cond_init(&g->changed);
+    }
+    return g;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t g, EventBits_t bits, BaseType_t clear_on_exit,
+                                BaseType_t wait_all, TickType_t wait)
+{
+    struct timespec ts;
+    const struct timespec *deadline = deadline_for(wait, &ts);
+
+    pthread_mutex_lock(&g->lock);
+    for (;;) {
+        EventBits_t set = g->bits & bits;
+        if (wait_all ? set == bits : set != 0) {
+            EventBits_t value = g->bits;
+            if (clear_on_exit) {
+                g->bits &= ~bits;
+            }
+            pthread_mutex_unlock(&g->lock);
+            return value;
+        }
+        if (wait == 0 || !host_cond_wait(&g->changed, &g->lock, deadline)) {
+            EventBits_t value = g->bits;
+            pthread_mutex_unlock(&g->lock);
+            return value;
+        }
+    }
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t g, EventBits_t bits)
+{
+    pthread_mutex_lock(&g->lock);
+    g->bits |= bits;
+    EventBits_t value = g->bits;
+    pthread_cond_broadcast(&g->changed);
+    pthread_mutex_unlock(&g->lock);
+    return value;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t g, EventBits_t bits)
+{
+    pthread_mutex_lock(&g->lock);
+    EventBits_t value = g->bits;
+    g->bits &= ~bits;
+    pthread_cond_broadcast(&g->changed);
+    pthread_mutex_unlock(&g->lock);
+    return value;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t g)
+{
+    pthread_mutex_lock(&g->lock);
+    EventBits_t value = g->bits;
+    pthread_mutex_unlock(&g->lock);
+    return value;
+}
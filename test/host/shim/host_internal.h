@@ -0,0 +1,22 @@
+#pragma once
+/* Shared between the shim translation units only. */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+struct host_task;
+
+/* CLOCK_MONOTONIC at process start; esp_timer_get_time() counts from here */
+struct timespec host_epoch(void);
+int64_t host_time_us(void);
+
+void host_cond_init(pthread_cond_t *cond);
+bool host_cond_wait(pthread_cond_t *cond, pthread_mutex_t *lock, const struct timespec *deadline);
+
+/* names the calling shim thread and gives it a task handle */
+void host_task_adopt(const char *name);
+struct host_task *host_task_self(void);
+
+/* true while the simulated station has an IP address, or if it was never started */
+bool host_network_up(void);
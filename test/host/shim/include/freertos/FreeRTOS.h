@@ -0,0 +1,43 @@
+#pragma once
+/* Host shim: FreeRTOS on POSIX threads. One tick is one millisecond. */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include "esp_attr.h"
+#include "esp_bit_defs.h"
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+
+#define pdTRUE              1
+#define pdFALSE             0
+#define pdPASS              pdTRUE
+#define pdFAIL              pdFALSE
+#define configTICK_RATE_HZ  1000
+#define portTICK_PERIOD_MS  1
+#define portMAX_DELAY       ((TickType_t)0xffffffffu)
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(ms))
+#define pdTICKS_TO_MS(t)    ((uint32_t)(t))
+#define tskNO_AFFINITY      0x7fffffff
+
+/* recursive, like the ESP-IDF spinlock */
+typedef struct {
+    atomic_ulong owner;
+    unsigned depth;
+} portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED { 0, 0 }
+
+void vPortEnterCritical(portMUX_TYPE *mux);
+void vPortExitCritical(portMUX_TYPE *mux);
+#define portENTER_CRITICAL(mux)      vPortEnterCritical(mux)
+#define portEXIT_CRITICAL(mux)       vPortExitCritical(mux)
+#define portENTER_CRITICAL_ISR(mux)  vPortEnterCritical(mux)
+#define portEXIT_CRITICAL_ISR(mux)   vPortExitCritical(mux)
+#define taskENTER_CRITICAL(mux)      vPortEnterCritical(mux)
+#define taskEXIT_CRITICAL(mux)       vPortExitCritical(mux)
+#define portYIELD_FROM_ISR(woken)    ((void)(woken))
+
+void host_assert_fail(const char *expr, const char *file, int line) __attribute__((noreturn));
+#define configASSERT(x) do { if (!(x)) host_assert_fail(#x, __FILE__, __LINE__); } while (0)
@@ -0,0 +1,16 @@
+#pragma once
+/* newlib functions glibc lacks, force-included into the firmware sources */
+#include <stddef.h>
+
+size_t strlcpy(char *dst, const char *src, size_t size);
+
+#ifdef HOST_COUNT_ALLOCS
+/* heap calls of the firmware sources, counted for sim_heap_allocs() */
+#include <stdlib.h>
+void *host_malloc(size_t size);
+void *host_calloc(size_t n, size_t size);
+void *host_realloc(void *ptr, size_t size);
+#define malloc(size)        host_malloc(size)
+#define calloc(n, size)     host_calloc(n, size)
+#define realloc(ptr, size)  host_realloc(ptr, size)
+#endif
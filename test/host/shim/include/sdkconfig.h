@@ -0,0 +1,43 @@
+#pragma once
+/* Kconfig defaults of main/Kconfig.projbuild, plus what the firmware needs
+   from the IDF components. Tests may predefine any of them. */
+#ifndef CONFIG_WIFI_SSID
+#define CONFIG_WIFI_SSID "doorcam-test"
+#endif
+#ifndef CONFIG_WIFI_PASSWORD
+#define CONFIG_WIFI_PASSWORD "password"
+#endif
+#ifndef CONFIG_MQTT_PROTOCOL_5
+#define CONFIG_MQTT_PROTOCOL_5 1
+#endif
+#ifndef CONFIG_DOORCAM_USER_ID
+#define CONFIG_DOORCAM_USER_ID "user123"
+#endif
+#ifndef CONFIG_DOORCAM_DEVICE_ID
+#define CONFIG_DOORCAM_DEVICE_ID "device01"
+#endif
+#ifndef CONFIG_DOORCAM_BROKER_URI
+#define CONFIG_DOORCAM_BROKER_URI "mqtt://10.237.191.186"
+#endif
+#ifndef CONFIG_DOORCAM_MQTT_USERNAME
+#define CONFIG_DOORCAM_MQTT_USERNAME "esp1"
+#endif
+#ifndef CONFIG_DOORCAM_MQTT_PASSWORD
+#define CONFIG_DOORCAM_MQTT_PASSWORD "password"
+#endif
+#ifndef CONFIG_DOORCAM_MQTT_PERSISTENT_SESSION
+#define CONFIG_DOORCAM_MQTT_PERSISTENT_SESSION 1
+#endif
+#ifndef CONFIG_DOORCAM_MQTT_SESSION_EXPIRY_S
+#define CONFIG_DOORCAM_MQTT_SESSION_EXPIRY_S 86400
+#endif
+#ifndef CONFIG_DOORCAM_MQTT_V5
+#define CONFIG_DOORCAM_MQTT_V5 1
+#endif
+#ifndef CONFIG_DOORCAM_MQTT_TOPIC_ALIAS_MAX
+#define CONFIG_DOORCAM_MQTT_TOPIC_ALIAS_MAX 8
+#endif
+#ifndef CONFIG_DOORCAM_PROVISION_KEY
+#define CONFIG_DOORCAM_PROVISION_KEY ""
+#endif
+/* CONFIG_DOORCAM_LOW_POWER_MODE defaults to n: left undefined */
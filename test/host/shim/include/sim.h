@@ -0,0 +1,103 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_sleep.h"
+
+/* Test-side controls of the simulated board and network */
+
+/* Wi-Fi: whether the AP answers, and how long association and DHCP take */
+void sim_wifi_set_ap(bool reachable, uint32_t assoc_ms, uint32_t dhcp_ms);
+/* Drops the association as if the AP went away (reason 200, beacon timeout) */
+void sim_wifi_drop(void);
+bool sim_wifi_has_ip(void);
+
+/* GPIO inputs and interrupts */
+void sim_gpio_set_level(int pin, int level);
+int sim_gpio_get_output(int pin);
+void sim_gpio_trigger(int pin);
+
+/* Deep sleep: wake cause for the next esp_sleep_get_wakeup_cause(), and the
+   function esp_deep_sleep_start() calls instead of exiting */
+void sim_sleep_set_wakeup(esp_sleep_wakeup_cause_t cause, uint64_t ext1_pins);
+void sim_sleep_on_deep_sleep(void (*hook)(void));
+
+/* Flash partitions backed by a file. size must be a multiple of 4096; the
+   file is created erased if it does not exist yet. */
+esp_err_t sim_partition_attach(const char *label, const char *path, uint32_t size);
+/* Power cut: after budget more bytes are programmed the write in progress
+   stops halfway and every later write or erase fails, until restored */
+void sim_partition_cut_after(size_t budget);
+void sim_partition_restore_power(void);
+uint64_t sim_partition_bytes_written(void);
+
+void sim_nvs_clear(void);
+
+/* esp32-camera: a sensor for esp_camera_init() to find. At width x height
+   a JPEG frame is bytes_at_best at quality 10, shrinking as 10 / quality;
+   other frame sizes scale with their area. */
+void sim_camera_attach(int width, int height, size_t bytes_at_best);
+int sim_camera_quality(void);
+
+/* Heap calls made by the firmware: heap_caps_*() and, in main/, malloc,
+   calloc and realloc. The shims' own allocations are not counted. */
+uint32_t sim_heap_allocs(void);
+
+/* Broker behind the esp-mqtt shim */
+typedef struct {
+    uint32_t connect_ms;        /* TCP connect + CONNECT/CONNACK */
+    uint32_t tls_ms;            /* extra for mqtts:// */
+    uint32_t puback_ms;         /* PUBLISH to PUBACK and SUBSCRIBE to SUBACK */
+    uint32_t reconnect_ms;      /* client retry delay (esp-mqtt reconnect_timeout_ms) */
+    uint32_t bytes_per_s;       /* uplink rate; publish blocks like a full socket, 0 = unlimited */
+    uint32_t outbox_expire_ms;  /* unacknowledged messages older than this are deleted, 0 = never */
+    uint16_t topic_alias_max;   /* CONNACK Topic Alias Maximum (MQTT 5), 0 = aliases not allowed */
+    bool refuse;                /* broker unreachable */
+    bool hold_acks;             /* PUBACKs are not sent until released */
+} sim_broker_config_t;
+
+typedef struct {
+    uint32_t connects;
+    uint32_t sessions_resumed;
+    uint32_t publishes;         /* PUBLISH packets received, retransmissions included */
+    uint32_t subscribes;
+    uint32_t protocol_errors;   /* broker closed the connection */
+    uint32_t deleted;           /* messages dropped from the client outbox by expiry */
+    uint32_t queued;            /* injected while the client was away, kept for its session */
+    uint64_t bytes_up;          /* every client-to-broker packet, fixed headers included */
+    uint64_t payload_bytes;
+    int64_t connect_start_us;   /* last connection attempt */
+    int64_t ready_us;           /* commands routable: CONNACK with a kept session, or the SUBACK */
+} sim_broker_stats_t;
+
+void sim_broker_default_config(sim_broker_config_t *cfg);
+void sim_broker_configure(const sim_broker_config_t *cfg);
+void sim_broker_get_stats(sim_broker_stats_t *out);
+void sim_broker_reset_stats(void);
+/* Forgets every kept session */
+void sim_broker_clear_sessions(void);
+
+/* Called on the publishing thread for every PUBLISH the broker accepts */
+typedef struct {
+    const char *topic;          /* resolved, also when the client sent an alias */
+    const uint8_t *data;
+    int len;
+    int qos;
+    const uint8_t *correlation; /* MQTT 5 correlation data, NULL if none */
+    int correlation_len;
+} sim_broker_msg_t;
+
+typedef void (*sim_broker_publish_fn)(const sim_broker_msg_t *msg, void *ctx);
+void sim_broker_on_publish(sim_broker_publish_fn fn, void *ctx);
+
+/* Broker closes the connection; the client reconnects after reconnect_ms */
+void sim_broker_drop(void);
+/* Sends every held PUBACK */
+void sim_broker_release_acks(void);
+/* Publishes a QoS 1 message: delivered if the client's session subscribes
+   to the topic (returns true), or, while the client is away, kept by its
+   persistent session for a QoS 1 subscription and delivered after the next
+   CONNACK (counted in queued) */
+bool sim_broker_inject(const char *topic, const void *data, int len);
+bool sim_broker_connected(void);
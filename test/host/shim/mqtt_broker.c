@@ -0,0 +1,1023 @@
+/* esp-mqtt client and an in-process broker.
+
+   The client runs its own "mqtt_task" thread for connecting, acknowledgements,
+   incoming messages and enqueued publishes, and dispatches every event from
+   there. esp_mqtt_client_publish() is accounted on the caller's thread, and
+   blocks for as long as the configured uplink needs to carry the packet.
+   Sizes are MQTT 3.1.1 / 5 wire sizes.
+
+   The broker side follows the rules the firmware has to get right: topic
+   aliases only live as long as the connection and may not exceed the
+   CONNACK maximum, an alias-only PUBLISH for an alias the broker has not
+   seen on this connection closes the connection, and the client outbox
+   retransmits unacknowledged QoS 1 messages as they were first sent. A kept
+   session queues injected messages while the client is away, for its QoS 1
+   subscriptions only, and delivers them right after the next CONNACK. */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mqtt_client.h"
+#include "sim.h"
+#include "host_internal.h"
+
+#define TOPIC_MAX       160
+#define ALIAS_LIMIT     64
+#define SESSION_MAX     4
+#define FILTER_MAX      8
+#define CORRELATION_MAX 64
+#define QUEUE_MAX       8
+#define QUEUED_DATA_MAX 128
+
+typedef enum { CLIENT_STOPPED, CLIENT_CONNECTING, CLIENT_CONNECTED } client_state_t;
+
+typedef enum {
+    ACT_CONNECT,
+    ACT_CONNACK,
+    ACT_PUBACK,
+    ACT_SUBACK,
+    ACT_DATA,
+} action_kind_t;
+
+typedef struct action {
+    action_kind_t kind;
+    int64_t due_us;
+    unsigned conn;              /* connection the action belongs to */
+    int msg_id;
+    char topic[TOPIC_MAX];
+    int len;
+    struct action *next;
+    char data[];
+} action_t;
+
+typedef struct message {
+    int msg_id;
+    int qos;
+    uint16_t alias;
+    uint8_t correlation[CORRELATION_MAX];
+    int correlation_len;
+    bool sent;
+    unsigned sent_conn;         /* connection it was last sent on */
+    int64_t created_us;
+    char topic[TOPIC_MAX];
+    int len;
+    struct message *next;
+    char data[];
+} message_t;
+
+typedef struct {
+    char topic[TOPIC_MAX];
+    int len;
+    char data[QUEUED_DATA_MAX];
+} queued_t;
+
+typedef struct {
+    bool used;
+    bool keep;                  /* outlives the connection */
+    char client_id[64];
+    int filters;
+    char filter[FILTER_MAX][TOPIC_MAX];
+    int filter_qos[FILTER_MAX];
+    int queued;
+    queued_t queue[QUEUE_MAX];
+} session_t;
+
+struct esp_mqtt_client {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    client_state_t state;
+    unsigned conn;              /* bumped on every connect and disconnect */
+    int next_msg_id;
+
+    char uri[128];
+    char client_id[64];
+    size_t login_len;
+    esp_mqtt_protocol_ver_t protocol;
+    bool clean_session;
+    uint32_t session_expiry;
+
+    uint16_t alias_max;         /* from the last CONNACK */
+    uint16_t pending_alias;     /* publish properties for the next publish */
+    uint8_t pending_correlation[CORRELATION_MAX];
+    int pending_correlation_len;
+
+    esp_event_handler_t handler;
+    void *handler_arg;
+
+    action_t *actions;          /* sorted by due_us */
+    action_t *held;             /* PUBACKs held by the test */
+    message_t *outbox;          /* in send order */
+    int64_t link_free_us;       /* uplink busy until */
+};
+
+static pthread_mutex_t broker_lock = PTHREAD_MUTEX_INITIALIZER;
+#define DEFAULT_CONFIG { .connect_ms = 20, .puback_ms = 5, .reconnect_ms = 100, .topic_alias_max = 10 }
+
+static sim_broker_config_t config = DEFAULT_CONFIG;
+static sim_broker_stats_t stats;
+static session_t sessions[SESSION_MAX];
+static session_t *session;      /* of the connected client */
+static char alias_map[ALIAS_LIMIT + 1][TOPIC_MAX];
+static sim_broker_publish_fn publish_hook;
+static void *publish_ctx;
+static struct esp_mqtt_client *the_client;
+
+static const char *const MQTT_EVENTS = "MQTT_EVENTS";
+
+/* ---- wire sizes ---- */
+
+static int varint_len(uint32_t v)
+{
+    return v < 128 ? 1 : v < 16384 ? 2 : v < 2097152 ? 3 : 4;
+}
+
+static int packet_len(int remaining)
+{
+    return 1 + varint_len(remaining) + remaining;
+}
+
+static int publish_wire_len(const struct esp_mqtt_client *c, const message_t *m)
+{
+    int remaining = 2 + (int)strlen(m->topic) + (m->qos > 0 ? 2 : 0) + m->len;
+    if (c->protocol == MQTT_PROTOCOL_V_5) {
+        int props = (m->alias ? 3 : 0) + (m->correlation_len ? 3 + m->correlation_len : 0);
+        remaining += varint_len(props) + props;
+    }
+    return packet_len(remaining);
+}
+
+/* ---- broker ---- */
+
+static bool topic_matches(const char *filter, const char *topic)
+{
+    while (*filter) {
+        if (filter[0] == '#') {
+            return true;
+        }
+        if (filter[0] == '+') {
+            while (*topic && *topic != '/') {
+                topic++;
+            }
+            filter++;
+            continue;
+        }
+        if (*filter != *topic) {
+            return false;
+        }
+        filter++;
+        topic++;
+    }
+    return *topic == 0;
+}
+
+static session_t *session_find(const char *client_id)
+{
+    for (int i = 0; i < SESSION_MAX; i++) {
+        if (sessions[i].used && strcmp(sessions[i].client_id, client_id) == 0) {
+            return &sessions[i];
+        }
+    }
+    return NULL;
+}
+
+static session_t *session_new(const char *client_id, bool keep)
+{
+    for (int i = 0; i < SESSION_MAX; i++) {
+        if (!sessions[i].used) {
+            memset(&sessions[i], 0, sizeof(sessions[i]));
+            sessions[i].used = true;
+            sessions[i].keep = keep;
+            snprintf(sessions[i].client_id, sizeof(sessions[i].client_id), "%s", client_id);
+            return &sessions[i];
+        }
+    }
+    return NULL;
+}
+
+/* resolves the topic of an incoming PUBLISH; false is a protocol error */
+static bool broker_resolve(const char *topic, uint16_t alias, char *out)
+{
+    if (alias == 0) {
+        if (topic[0] == 0) {
+            return false;
+        }
+        strcpy(out, topic);
+        return true;
+    }
+    if (alias > config.topic_alias_max || alias > ALIAS_LIMIT) {
+        return false;
+    }
+    if (topic[0] != 0) {
+        strcpy(alias_map[alias], topic);
+    } else if (alias_map[alias][0] == 0) {
+        return false;
+    }
+    strcpy(out, alias_map[alias]);
+    return true;
+}
+
+void sim_broker_default_config(sim_broker_config_t *cfg)
+{
+    *cfg = (sim_broker_config_t)DEFAULT_CONFIG;
+}
+
+void sim_broker_configure(const sim_broker_config_t *cfg)
+{
+    pthread_mutex_lock(&broker_lock);
+    config = *cfg;
+    pthread_mutex_unlock(&broker_lock);
+}
+
+void sim_broker_get_stats(sim_broker_stats_t *out)
+{
+    pthread_mutex_lock(&broker_lock);
+    *out = stats;
+    pthread_mutex_unlock(&broker_lock);
+}
+
+void sim_broker_reset_stats(void)
+{
+    pthread_mutex_lock(&broker_lock);
+    memset(&stats, 0, sizeof(stats));
+    pthread_mutex_unlock(&broker_lock);
+}
+
+void sim_broker_clear_sessions(void)
+{
+    pthread_mutex_lock(&broker_lock);
+    memset(sessions, 0, sizeof(sessions));
+    session = NULL;
+    pthread_mutex_unlock(&broker_lock);
+}
+
+void sim_broker_on_publish(sim_broker_publish_fn fn, void *ctx)
+{
+    pthread_mutex_lock(&broker_lock);
+    publish_hook = fn;
+    publish_ctx = ctx;
+    pthread_mutex_unlock(&broker_lock);
+}
+
+/* ---- client internals, called with c->lock held ---- */
+
+static void schedule(struct esp_mqtt_client *c, action_t *a)
+{
+    action_t **p = &c->actions;
+    while (*p && (*p)->due_us <= a->due_us) {
+        p = &(*p)->next;
+    }
+    a->next = *p;
+    *p = a;
+    pthread_cond_broadcast(&c->changed);
+}
+
+static action_t *action_new(struct esp_mqtt_client *c, action_kind_t kind, int64_t due_us,
+                            int msg_id, const char *topic, const char *data, int len)
+{
+    action_t *a = calloc(1, sizeof(*a) + (len > 0 ? len : 0) + 1);
+    configASSERT(a != NULL);
+    a->kind = kind;
+    a->due_us = due_us;
+    a->conn = c->conn;
+    a->msg_id = msg_id;
+    if (topic) {
+        strlcpy(a->topic, topic, sizeof(a->topic));
+    }
+    if (len > 0) {
+        memcpy(a->data, data, len);
+        a->len = len;
+    }
+    return a;
+}
+
+static int next_msg_id(struct esp_mqtt_client *c)
+{
+    c->next_msg_id = c->next_msg_id % 65535 + 1;
+    return c->next_msg_id;
+}
+
+/* reserves the uplink for bytes; returns when the last byte is out */
+static int64_t link_reserve(struct esp_mqtt_client *c, int bytes)
+{
+    int64_t now = host_time_us();
+    int64_t start = c->link_free_us > now ? c->link_free_us : now;
+    uint32_t rate = config.bytes_per_s;
+    c->link_free_us = start + (rate ? (int64_t)bytes * 1000000 / rate : 0);
+    return c->link_free_us;
+}
+
+static void sleep_until(int64_t us)
+{
+    int64_t wait = us - host_time_us();
+    if (wait > 0) {
+        usleep((useconds_t)wait);
+    }
+}
+
+static void broker_drop_locked(struct esp_mqtt_client *c);
+
+/* called with broker_lock held */
+static void session_end(void)
+{
+    if (session && !session->keep) {
+        session->used = false;
+    }
+    session = NULL;
+    memset(alias_map, 0, sizeof(alias_map));
+}
+
+/* broker receives one PUBLISH; false when it closed the connection */
+static bool send_publish(struct esp_mqtt_client *c, message_t *m, int64_t *done_us)
+{
+    char topic[TOPIC_MAX];
+    int wire = publish_wire_len(c, m);
+
+    pthread_mutex_lock(&broker_lock);
+    stats.publishes++;
+    stats.bytes_up += wire;
+    bool ok = broker_resolve(m->topic, m->alias, topic);
+    if (ok) {
+        stats.payload_bytes += m->len;
+    } else {
+        stats.protocol_errors++;
+    }
+    sim_broker_publish_fn hook = publish_hook;
+    void *ctx = publish_ctx;
+    uint32_t puback_ms = config.puback_ms;
+    bool hold = config.hold_acks;
+    pthread_mutex_unlock(&broker_lock);
+
+    if (!ok) {
+        broker_drop_locked(c);
+        return false;
+    }
+    *done_us = link_reserve(c, wire);
+    m->sent = true;
+    m->sent_conn = c->conn;
+    if (m->qos > 0) {
+        action_t *a = action_new(c, ACT_PUBACK, *done_us + puback_ms * 1000, m->msg_id, NULL, NULL, 0);
+        if (hold) {
+            a->next = c->held;
+            c->held = a;
+        } else {
+            schedule(c, a);
+        }
+    }
+    if (hook) {
+        sim_broker_msg_t msg = {
+            .topic = topic,
+            .data = (const uint8_t *)m->data,
+            .len = m->len,
+            .qos = m->qos,
+            .correlation = m->correlation_len ? m->correlation : NULL,
+            .correlation_len = m->correlation_len,
+        };
+        hook(&msg, ctx);
+    }
+    return true;
+}
+
+static message_t *message_new(struct esp_mqtt_client *c, const char *topic, const char *data,
+                              int len, int qos)
+{
+    message_t *m = calloc(1, sizeof(*m) + len);
+    if (m == NULL) {
+        return NULL;
+    }
+    m->qos = qos;
+    m->msg_id = qos > 0 ? next_msg_id(c) : 0;
+    m->alias = c->pending_alias;
+    memcpy(m->correlation, c->pending_correlation, c->pending_correlation_len);
+    m->correlation_len = c->pending_correlation_len;
+    m->created_us = host_time_us();
+    strncpy(m->topic, topic ? topic : "", sizeof(m->topic) - 1);
+    memcpy(m->data, data, len);
+    m->len = len;
+    c->pending_alias = 0;
+    c->pending_correlation_len = 0;
+    return m;
+}
+
+static void outbox_add(struct esp_mqtt_client *c, message_t *m)
+{
+    message_t **p = &c->outbox;
+    while (*p) {
+        p = &(*p)->next;
+    }
+    *p = m;
+    pthread_cond_broadcast(&c->changed);
+}
+
+static void outbox_remove(struct esp_mqtt_client *c, message_t *m)
+{
+    for (message_t **p = &c->outbox; *p; p = &(*p)->next) {
+        if (*p == m) {
+            *p = m->next;
+            free(m);
+            return;
+        }
+    }
+}
+
+static void free_actions(action_t **list)
+{
+    while (*list) {
+        action_t *a = *list;
+        *list = a->next;
+        free(a);
+    }
+}
+
+static void dispatch(struct esp_mqtt_client *c, esp_mqtt_event_t *ev)
+{
+    ev->client = c;
+    ev->protocol_ver = c->protocol;
+    esp_event_handler_t fn = c->handler;
+    void *arg = c->handler_arg;
+    pthread_mutex_unlock(&c->lock);
+    if (fn) {
+        fn(arg, MQTT_EVENTS, ev->event_id, ev);
+    }
+    pthread_mutex_lock(&c->lock);
+}
+
+static void post_simple(struct esp_mqtt_client *c, esp_mqtt_event_id_t id, int msg_id)
+{
+    esp_mqtt_event_t ev = { .event_id = id, .msg_id = msg_id };
+    dispatch(c, &ev);
+}
+
+/* connection gone: acks in flight are lost, the outbox stays */
+static void broker_drop_locked(struct esp_mqtt_client *c)
+{
+    if (c->state != CLIENT_CONNECTED) {
+        return;
+    }
+    c->state = CLIENT_CONNECTING;
+    c->conn++;
+    free_actions(&c->actions);
+    free_actions(&c->held);
+
+    pthread_mutex_lock(&broker_lock);
+    session_end();
+    uint32_t reconnect_ms = config.reconnect_ms;
+    pthread_mutex_unlock(&broker_lock);
+
+    schedule(c, action_new(c, ACT_CONNECT, host_time_us() + reconnect_ms * 1000, 0, NULL, NULL, 0));
+    post_simple(c, MQTT_EVENT_DISCONNECTED, 0);
+}
+
+static void expire_outbox(struct esp_mqtt_client *c)
+{
+    pthread_mutex_lock(&broker_lock);
+    uint32_t expire_ms = config.outbox_expire_ms;
+    pthread_mutex_unlock(&broker_lock);
+    if (expire_ms == 0) {
+        return;
+    }
+
+    int64_t now = host_time_us();
+    for (message_t *m = c->outbox, *next; m; m = next) {
+        next = m->next;
+        if (now - m->created_us > expire_ms * 1000LL) {
+            int msg_id = m->msg_id;
+            outbox_remove(c, m);
+            pthread_mutex_lock(&broker_lock);
+            stats.deleted++;
+            pthread_mutex_unlock(&broker_lock);
+            post_simple(c, MQTT_EVENT_DELETED, msg_id);
+            next = c->outbox;       /* the list may have changed while unlocked */
+        }
+    }
+}
+
+static void do_connect(struct esp_mqtt_client *c)
+{
+    post_simple(c, MQTT_EVENT_BEFORE_CONNECT, 0);
+    if (c->state != CLIENT_CONNECTING) {
+        return;
+    }
+
+    pthread_mutex_lock(&broker_lock);
+    stats.connect_start_us = host_time_us();
+    uint32_t ms = config.connect_ms;
+    if (strncmp(c->uri, "mqtts://", 8) == 0) {
+        ms += config.tls_ms;
+    }
+    pthread_mutex_unlock(&broker_lock);
+
+    schedule(c, action_new(c, ACT_CONNACK, host_time_us() + ms * 1000, 0, NULL, NULL, 0));
+}
+
+static void do_connack(struct esp_mqtt_client *c)
+{
+    pthread_mutex_lock(&broker_lock);
+    bool refused = config.refuse || !host_network_up();
+    if (refused) {
+        uint32_t reconnect_ms = config.reconnect_ms;
+        pthread_mutex_unlock(&broker_lock);
+        schedule(c, action_new(c, ACT_CONNECT, host_time_us() + reconnect_ms * 1000, 0, NULL, NULL, 0));
+        esp_mqtt_error_codes_t err = { .error_type = 1 };
+        esp_mqtt_event_t ev = { .event_id = MQTT_EVENT_ERROR, .error_handle = &err };
+        dispatch(c, &ev);
+        post_simple(c, MQTT_EVENT_DISCONNECTED, 0);
+        return;
+    }
+
+    int remaining = 10 + 2 + (int)strlen(c->client_id) + (int)c->login_len;
+    if (c->protocol == MQTT_PROTOCOL_V_5) {
+        int props = c->session_expiry ? 5 : 0;
+        remaining += varint_len(props) + props;
+    }
+    stats.connects++;
+    stats.bytes_up += packet_len(remaining);
+
+    bool keep = c->protocol == MQTT_PROTOCOL_V_5 ? c->session_expiry > 0 : !c->clean_session;
+    session_t *s = session_find(c->client_id);
+    bool present = s != NULL && !c->clean_session;
+    if (!present) {
+        if (s) {
+            s->used = false;
+        }
+        s = session_new(c->client_id, keep);
+    }
+    if (present) {
+        stats.sessions_resumed++;
+        if (s->filters > 0) {
+            stats.ready_us = host_time_us();
+        }
+    }
+    if (s) {
+        s->keep = keep;
+    }
+    session = s;
+    memset(alias_map, 0, sizeof(alias_map));
+    c->alias_max = c->protocol == MQTT_PROTOCOL_V_5 ? config.topic_alias_max : 0;
+    int queued = 0;
+    static queued_t held[QUEUE_MAX];    /* taken out of the session */
+    if (present) {
+        queued = s->queued;
+        memcpy(held, s->queue, sizeof(held[0]) * queued);
+        s->queued = 0;
+    }
+    pthread_mutex_unlock(&broker_lock);
+
+    c->state = CLIENT_CONNECTED;
+    c->conn++;
+    c->pending_alias = 0;
+    for (int i = 0; i < queued; i++) {
+        schedule(c, action_new(c, ACT_DATA, host_time_us(), 0, held[i].topic,
+                               held[i].data, held[i].len));
+    }
+    esp_mqtt_event_t ev = { .event_id = MQTT_EVENT_CONNECTED, .session_present = present };
+    dispatch(c, &ev);
+
+    /* retransmit what was sent before, then whatever was waiting */
+    unsigned conn = c->conn;
+    message_t *m = c->outbox;
+    while (m && c->conn == conn) {
+        message_t *next = m->next;
+        int64_t done;
+        /* already published by a handler of the CONNECTED event */
+        if (m->sent && m->sent_conn == conn) {
+            m = next;
+            continue;
+        }
+        if (!send_publish(c, m, &done)) {
+            break;
+        }
+        if (m->qos == 0) {
+            outbox_remove(c, m);
+        }
+        m = next;
+    }
+}
+
+static void do_puback(struct esp_mqtt_client *c, int msg_id)
+{
+    for (message_t *m = c->outbox; m; m = m->next) {
+        if (m->msg_id == msg_id && m->sent) {
+            outbox_remove(c, m);
+            post_simple(c, MQTT_EVENT_PUBLISHED, msg_id);
+            return;
+        }
+    }
+}
+
+static void *client_thread(void *arg)
+{
+    struct esp_mqtt_client *c = arg;
+    host_task_adopt("mqtt_task");
+
+    pthread_mutex_lock(&c->lock);
+    for (;;) {
+        /* enqueued messages go out from here */
+        if (c->state == CLIENT_CONNECTED) {
+            message_t *m = c->outbox;
+            while (m && m->sent) {
+                m = m->next;
+            }
+            if (m) {
+                int64_t done;
+                if (send_publish(c, m, &done)) {
+                    if (m->qos == 0) {
+                        outbox_remove(c, m);
+                    }
+                    pthread_mutex_unlock(&c->lock);
+                    sleep_until(done);
+                    pthread_mutex_lock(&c->lock);
+                }
+                continue;
+            }
+        }
+
+        expire_outbox(c);
+
+        action_t *a = c->actions;
+        if (a == NULL) {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            ts.tv_sec += 1;
+            host_cond_wait(&c->changed, &c->lock, &ts);
+            continue;
+        }
+        if (a->due_us > host_time_us()) {
+            struct timespec ts = host_epoch();
+            ts.tv_sec += a->due_us / 1000000;
+            ts.tv_nsec += (long)(a->due_us % 1000000) * 1000;
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            host_cond_wait(&c->changed, &c->lock, &ts);
+            continue;
+        }
+        c->actions = a->next;
+
+        if (a->conn == c->conn) {
+            switch (a->kind) {
+            case ACT_CONNECT:
+                if (c->state == CLIENT_CONNECTING) {
+                    do_connect(c);
+                }
+                break;
+            case ACT_CONNACK:
+                if (c->state == CLIENT_CONNECTING) {
+                    do_connack(c);
+                }
+                break;
+            case ACT_PUBACK:
+                do_puback(c, a->msg_id);
+                break;
+            case ACT_SUBACK: {
+                pthread_mutex_lock(&broker_lock);
+                stats.ready_us = host_time_us();
+                pthread_mutex_unlock(&broker_lock);
+                post_simple(c, MQTT_EVENT_SUBSCRIBED, a->msg_id);
+                break;
+            }
+            case ACT_DATA: {
+                esp_mqtt_event_t ev = {
+                    .event_id = MQTT_EVENT_DATA,
+                    .topic = a->topic, .topic_len = (int)strlen(a->topic),
+                    .data = a->data, .data_len = a->len, .total_data_len = a->len,
+                };
+                dispatch(c, &ev);
+                break;
+            }
+            }
+        }
+        free(a);
+    }
+    return NULL;
+}
+
+/* ---- esp-mqtt API ---- */
+
+static void apply_config(struct esp_mqtt_client *c, const esp_mqtt_client_config_t *cfg)
+{
+    strncpy(c->uri, cfg->broker.address.uri ? cfg->broker.address.uri : "", sizeof(c->uri) - 1);
+    strncpy(c->client_id, cfg->credentials.client_id ? cfg->credentials.client_id : "esp32",
+            sizeof(c->client_id) - 1);
+    c->login_len = 0;
+    if (cfg->credentials.username) {
+        c->login_len += 2 + strlen(cfg->credentials.username);
+    }
+    if (cfg->credentials.authentication.password) {
+        c->login_len += 2 + strlen(cfg->credentials.authentication.password);
+    }
+    c->protocol = cfg->session.protocol_ver == MQTT_PROTOCOL_V_5 ? MQTT_PROTOCOL_V_5 : MQTT_PROTOCOL_V_3_1_1;
+    c->clean_session = !cfg->session.disable_clean_session;
+    c->session_expiry = 0;
+}
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config)
+{
+    struct esp_mqtt_client *c = calloc(1, sizeof(*c));
+    if (c == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&c->lock, NULL);
+    host_cond_init(&c->changed);
+    apply_config(c, config);
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, client_thread, c);
+    pthread_detach(thread);
+    the_client = c;
+    return c;
+}
+
+esp_err_t esp_mqtt_set_config(esp_mqtt_client_handle_t c, const esp_mqtt_client_config_t *config)
+{
+    pthread_mutex_lock(&c->lock);
+    apply_config(c, config);
+    pthread_mutex_unlock(&c->lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t c, esp_mqtt_event_id_t event,
+                                         esp_event_handler_t handler, void *arg)
+{
+    pthread_mutex_lock(&c->lock);
+    c->handler = handler;
+    c->handler_arg = arg;
+    pthread_mutex_unlock(&c->lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t c)
+{
+    pthread_mutex_lock(&c->lock);
+    if (c->state != CLIENT_STOPPED) {
+        pthread_mutex_unlock(&c->lock);
+        return ESP_FAIL;
+    }
+    c->state = CLIENT_CONNECTING;
+    c->conn++;
+    schedule(c, action_new(c, ACT_CONNECT, host_time_us(), 0, NULL, NULL, 0));
+    pthread_mutex_unlock(&c->lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t c)
+{
+    pthread_mutex_lock(&c->lock);
+    if (c->state == CLIENT_STOPPED) {
+        pthread_mutex_unlock(&c->lock);
+        return ESP_FAIL;
+    }
+    if (c->state == CLIENT_CONNECTED) {
+        pthread_mutex_lock(&broker_lock);
+        session_end();
+        stats.bytes_up += 2;            /* DISCONNECT */
+        pthread_mutex_unlock(&broker_lock);
+    }
+    c->state = CLIENT_STOPPED;
+    c->conn++;
+    free_actions(&c->actions);
+    free_actions(&c->held);
+    pthread_mutex_unlock(&c->lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_reconnect(esp_mqtt_client_handle_t c)
+{
+    pthread_mutex_lock(&c->lock);
+    if (c->state == CLIENT_CONNECTING) {
+        c->conn++;
+        free_actions(&c->actions);
+        schedule(c, action_new(c, ACT_CONNECT, host_time_us(), 0, NULL, NULL, 0));
+    }
+    pthread_mutex_unlock(&c->lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_disconnect(esp_mqtt_client_handle_t c)
+{
+    pthread_mutex_lock(&c->lock);
+    broker_drop_locked(c);
+    pthread_mutex_unlock(&c->lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t c)
+{
+    esp_mqtt_client_stop(c);
+    return ESP_OK;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t c, const char *topic, const char *data,
+                            int len, int qos, int retain)
+{
+    if (len == 0 && data) {
+        len = (int)strlen(data);
+    }
+
+    pthread_mutex_lock(&c->lock);
+    if ((topic == NULL || topic[0] == 0) && c->pending_alias == 0) {
+        pthread_mutex_unlock(&c->lock);
+        return -1;
+    }
+    message_t *m = message_new(c, topic, data, len, qos);
+    if (m == NULL) {
+        pthread_mutex_unlock(&c->lock);
+        return -1;
+    }
+    if (c->state != CLIENT_CONNECTED) {
+        /* QoS 1 waits in the outbox for the next connection */
+        int msg_id = -1;
+        if (qos > 0) {
+            outbox_add(c, m);
+            msg_id = m->msg_id;
+            expire_outbox(c);
+        } else {
+            free(m);
+        }
+        pthread_mutex_unlock(&c->lock);
+        return msg_id;
+    }
+
+    int msg_id = m->msg_id;
+    int64_t done = 0;
+    if (qos > 0) {
+        outbox_add(c, m);
+    }
+    bool ok = send_publish(c, m, &done);
+    if (qos == 0) {
+        free(m);
+    }
+    pthread_mutex_unlock(&c->lock);
+    if (!ok) {
+        return qos > 0 ? msg_id : -1;
+    }
+    sleep_until(done);
+    return msg_id;
+}
+
+int esp_mqtt_client_enqueue(esp_mqtt_client_handle_t c, const char *topic, const char *data,
+                            int len, int qos, int retain, bool store)
+{
+    if (len == 0 && data) {
+        len = (int)strlen(data);
+    }
+
+    pthread_mutex_lock(&c->lock);
+    if (((topic == NULL || topic[0] == 0) && c->pending_alias == 0) || (qos == 0 && !store)) {
+        c->pending_alias = 0;
+        c->pending_correlation_len = 0;
+        pthread_mutex_unlock(&c->lock);
+        return -1;
+    }
+    message_t *m = message_new(c, topic, data, len, qos);
+    if (m == NULL) {
+        pthread_mutex_unlock(&c->lock);
+        return -1;
+    }
+    outbox_add(c, m);
+    int msg_id = m->msg_id;
+    pthread_mutex_unlock(&c->lock);
+    return msg_id;
+}
+
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t c, const char *topic, int qos)
+{
+    pthread_mutex_lock(&c->lock);
+    if (c->state != CLIENT_CONNECTED) {
+        pthread_mutex_unlock(&c->lock);
+        return -1;
+    }
+    int msg_id = next_msg_id(c);
+    int remaining = 2 + (c->protocol == MQTT_PROTOCOL_V_5 ? 1 : 0) + 2 + (int)strlen(topic) + 1;
+
+    pthread_mutex_lock(&broker_lock);
+    stats.subscribes++;
+    stats.bytes_up += packet_len(remaining);
+    if (session && session->filters < FILTER_MAX) {
+        session->filter_qos[session->filters] = qos;
+        strncpy(session->filter[session->filters++], topic, TOPIC_MAX - 1);
+    }
+    uint32_t puback_ms = config.puback_ms;
+    pthread_mutex_unlock(&broker_lock);
+
+    int64_t done = link_reserve(c, packet_len(remaining));
+    schedule(c, action_new(c, ACT_SUBACK, done + puback_ms * 1000, msg_id, NULL, NULL, 0));
+    pthread_mutex_unlock(&c->lock);
+    return msg_id;
+}
+
+int esp_mqtt_client_unsubscribe(esp_mqtt_client_handle_t c, const char *topic)
+{
+    return -1;
+}
+
+int esp_mqtt_client_get_outbox_size(esp_mqtt_client_handle_t c)
+{
+    pthread_mutex_lock(&c->lock);
+    int size = 0;
+    for (message_t *m = c->outbox; m; m = m->next) {
+        size += m->len;
+    }
+    pthread_mutex_unlock(&c->lock);
+    return size;
+}
+
+esp_err_t esp_mqtt5_client_set_publish_property(esp_mqtt5_client_handle_t c,
+                                                const esp_mqtt5_publish_property_config_t *property)
+{
+    pthread_mutex_lock(&c->lock);
+    if (property->topic_alias > c->alias_max || property->correlation_data_len > CORRELATION_MAX) {
+        pthread_mutex_unlock(&c->lock);
+        return ESP_FAIL;
+    }
+    c->pending_alias = property->topic_alias;
+    c->pending_correlation_len = property->correlation_data ? property->correlation_data_len : 0;
+    memcpy(c->pending_correlation, property->correlation_data, c->pending_correlation_len);
+    pthread_mutex_unlock(&c->lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt5_client_set_connect_property(esp_mqtt5_client_handle_t c,
+                                                const esp_mqtt5_connection_property_config_t *property)
+{
+    pthread_mutex_lock(&c->lock);
+    c->session_expiry = property->session_expiry_interval;
+    pthread_mutex_unlock(&c->lock);
+    return ESP_OK;
+}
+
+/* ---- test controls that need the client ---- */
+
+void sim_broker_drop(void)
+{
+    struct esp_mqtt_client *c = the_client;
+    if (c) {
+        pthread_mutex_lock(&c->lock);
+        broker_drop_locked(c);
+        pthread_mutex_unlock(&c->lock);
+    }
+}
+
+void sim_broker_release_acks(void)
+{
+    struct esp_mqtt_client *c = the_client;
+    if (c == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&c->lock);
+    while (c->held) {
+        action_t *a = c->held;
+        c->held = a->next;
+        a->due_us = host_time_us();
+        schedule(c, a);
+    }
+    pthread_mutex_unlock(&c->lock);
+}
+
+bool sim_broker_inject(const char *topic, const void *data, int len)
+{
+    struct esp_mqtt_client *c = the_client;
+    if (c == NULL) {
+        return false;
+    }
+    pthread_mutex_lock(&c->lock);
+    bool routed = false;
+    pthread_mutex_lock(&broker_lock);
+    if (c->state == CLIENT_CONNECTED && session) {
+        for (int i = 0; i < session->filters && !routed; i++) {
+            routed = topic_matches(session->filter[i], topic);
+        }
+    } else if (c->state != CLIENT_CONNECTED) {
+        /* away: a kept session holds it for a QoS 1 subscription */
+        session_t *s = session_find(c->client_id);
+        bool queue = false;
+        for (int i = 0; s && s->keep && i < s->filters && !queue; i++) {
+            queue = s->filter_qos[i] > 0 && topic_matches(s->filter[i], topic);
+        }
+        if (queue && s->queued < QUEUE_MAX && len <= QUEUED_DATA_MAX) {
+            strncpy(s->queue[s->queued].topic, topic, TOPIC_MAX - 1);
+            memcpy(s->queue[s->queued].data, data, len);
+            s->queue[s->queued++].len = len;
+            stats.queued++;
+        }
+    }
+    pthread_mutex_unlock(&broker_lock);
+    if (routed) {
+        schedule(c, action_new(c, ACT_DATA, host_time_us(), 0, topic, data, len));
+    }
+    pthread_mutex_unlock(&c->lock);
+    return routed;
+}
+
+bool sim_broker_connected(void)
+{
+    struct esp_mqtt_client *c = the_client;
+    if (c == NULL) {
+        return false;
+    }
+    pthread_mutex_lock(&c->lock);
+    bool up = c->state == CLIENT_CONNECTED;
+    pthread_mutex_unlock(&c->lock);
+    return up;
+}
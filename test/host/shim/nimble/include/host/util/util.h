@@ -0,0 +1,4 @@
+#pragma once
+#include "host/ble_hs.h"
+
+int ble_hs_util_ensure_addr(int prefer_random);
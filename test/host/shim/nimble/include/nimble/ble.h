@@ -0,0 +1,18 @@
+#pragma once
+#include <stdint.h>
+
+#define BLE_ADDR_PUBLIC     0x00
+#define BLE_ADDR_RANDOM     0x01
+
+#define BLE_OWN_ADDR_PUBLIC 0x00
+#define BLE_OWN_ADDR_RANDOM 0x01
+
+/* HCI reason codes used with ble_gap_terminate() */
+#define BLE_ERR_REM_USER_CONN_TERM  0x13
+#define BLE_ERR_CONN_TERM_LOCAL     0x16
+#define BLE_ERR_CONN_SPVN_TMO       0x08
+
+typedef struct {
+    uint8_t type;
+    uint8_t val[6];
+} ble_addr_t;
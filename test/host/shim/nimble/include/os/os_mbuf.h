@@ -0,0 +1,15 @@
+#pragma once
+#include <stdint.h>
+
+/* a single flat buffer: enough for ATT values and notifications */
+#define OS_MBUF_DATA_MAX 512
+
+struct os_mbuf {
+    uint8_t *om_data;
+    uint16_t om_len;
+    uint8_t om_buf[OS_MBUF_DATA_MAX];
+};
+
+#define OS_MBUF_PKTLEN(om) ((om)->om_len)
+
+int os_mbuf_copydata(const struct os_mbuf *om, int off, int len, void *dst);
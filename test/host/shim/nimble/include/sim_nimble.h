@@ -0,0 +1,66 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Test-side controls of the simulated NimBLE host and the keyboards it can
+   see. Each keyboard is a peripheral with a HID service: Protocol Mode,
+   Report Map, Boot Keyboard Input (with CCCD), Boot Keyboard Output, an
+   input Report with ID 1 (with CCCD and Report Reference), an output Report
+   and a Control Point; a Battery service after it. */
+
+typedef struct {
+    uint32_t host_us;           /* API call to callback on the host task */
+    uint16_t conn_itvl;         /* chosen at connect, 1.25 ms units */
+    uint16_t mtu;               /* read_long returns mtu - 1 bytes per request */
+    uint32_t adv_itvl_ms;       /* keyboards advertise, and are seen by a scan, this often */
+    uint32_t connect_ms;        /* connect request to CONNECT when the keyboard takes it */
+} sim_nimble_config_t;
+
+typedef struct {
+    uint32_t scans;             /* ble_gap_disc() calls that started a scan */
+    uint32_t connects;          /* connections established */
+    uint32_t connect_timeouts;  /* CONNECT with BLE_HS_ETIMEOUT */
+    uint32_t att_requests;      /* ATT round trips, discovery included */
+    uint32_t notifications;     /* delivered to the host */
+} sim_nimble_stats_t;
+
+void sim_nimble_default_config(sim_nimble_config_t *cfg);
+void sim_nimble_configure(const sim_nimble_config_t *cfg);
+void sim_nimble_get_stats(sim_nimble_stats_t *out);
+bool sim_nimble_scanning(void);
+bool sim_nimble_connecting(void);
+
+typedef struct {
+    uint8_t addr[6];
+    const char *name;
+    bool with_hash;             /* a Database Hash in the GATT service */
+    bool bonded;                /* reported in the connection's security state */
+    bool connectable;           /* false: advertises but never takes a connection */
+} sim_kbd_config_t;
+
+/* returns the keyboard index; it does not advertise yet */
+int sim_kbd_add(const sim_kbd_config_t *cfg);
+/* stays on across connections: the keyboard advertises whenever it is not connected */
+void sim_kbd_advertise(int kbd, bool on);
+bool sim_kbd_connected(int kbd);
+
+/* CCCD state of the boot input and of the input Report */
+bool sim_kbd_boot_subscribed(int kbd);
+bool sim_kbd_report_subscribed(int kbd);
+/* connection, and both input CCCDs on after it, in esp_timer time */
+int64_t sim_kbd_connected_us(int kbd);
+int64_t sim_kbd_subscribed_us(int kbd);
+uint8_t sim_kbd_protocol_mode(int kbd);
+/* accepted writes to anything but an input CCCD or the Protocol Mode */
+uint32_t sim_kbd_stray_writes(int kbd);
+
+/* notifications at the next connection event; false unless connected and
+   that characteristic's CCCD is on */
+bool sim_kbd_send_boot(int kbd, const uint8_t report[8]);
+bool sim_kbd_send_report(int kbd, const uint8_t report[8]);
+
+/* the keyboard drops the link (remote user terminated) */
+void sim_kbd_disconnect(int kbd);
+/* a firmware update: the Device Name characteristic goes (or comes back),
+   shifting every later handle by two, and the Database Hash changes */
+void sim_kbd_change_db(int kbd);
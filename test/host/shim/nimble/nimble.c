@@ -0,0 +1,1252 @@
+/* NimBLE host as a central, and the keyboards it can reach.
+
+   Every callback runs on the task that called nimble_port_run(), host_us
+   after the API call or the air event that caused it, in order, as on the
+   target. ATT requests on a link go out one at a time, one connection
+   interval each; discovery takes as many round trips as an MTU of 23
+   needs. As in NimBLE, ble_gattc_disc_all_dscs() reports every attribute
+   after its start handle, declarations and values included, all with the
+   start handle as chr_val_handle. Callbacks still pending when a link
+   drops are discarded.
+
+   A scan reports every advertising keyboard once per adv_itvl_ms. A
+   connect attempt completes connect_ms after the request if the keyboard
+   takes it, and otherwise keeps trying until its duration runs out. */
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "nimble/nimble_port.h"
+#include "nimble/nimble_port_freertos.h"
+#include "host/ble_hs.h"
+#include "host/util/util.h"
+#include "sim_nimble.h"
+#include "host_internal.h"
+
+#define KBD_MAX         8
+#define ATTR_MAX        40
+#define VALUE_MAX       80
+
+#define UUID_PRIMARY    0x2800
+#define UUID_CHR_DECL   0x2803
+#define UUID_CCCD       0x2902
+#define UUID_REPORT_REF 0x2908
+
+typedef enum { ACT_GAP, ACT_ATTR, ACT_SVC, ACT_CHR, ACT_DSC, ACT_CALL } action_kind_t;
+
+typedef struct action {
+    action_kind_t kind;
+    int64_t due_us;
+    int kbd;                    /* link the callback belongs to, or -1 */
+    uint32_t gen;               /* that link's generation, or the scan's */
+    bool scan_event;
+    void *cb;
+    void *cb_arg;
+    uint16_t conn_handle;
+    struct ble_gatt_error error;
+    struct ble_gap_event gap;
+    union {
+        struct ble_gatt_attr attr;
+        struct ble_gatt_svc svc;
+        struct ble_gatt_chr chr;
+        struct ble_gatt_dsc dsc;
+    };
+    bool has_result;
+    uint16_t chr_val_handle;
+    struct os_mbuf om;
+    void (*fn)(struct action *a);
+    struct action *next;
+} action_t;
+
+typedef enum { A_SVC, A_DECL, A_VAL, A_DSC } attr_kind_t;
+
+typedef struct {
+    uint16_t handle;
+    uint16_t uuid;
+    attr_kind_t kind;
+    uint8_t props;              /* A_VAL: characteristic properties */
+    uint16_t end;               /* A_SVC: last handle */
+    uint16_t len;
+    uint8_t value[VALUE_MAX];
+} attr_t;
+
+typedef struct {
+    sim_kbd_config_t cfg;
+    char name[32];
+    attr_t attrs[ATTR_MAX];
+    int attr_count;
+    int boot_cccd, report_cccd, proto;      /* attribute indexes */
+    uint16_t boot_val, report_val;          /* handles */
+    uint8_t db_gen;
+    bool no_name;
+
+    bool adv_on;
+    bool connected;
+    uint16_t conn_handle;
+    uint32_t gen;
+    ble_gap_event_fn *cb;
+    void *cb_arg;
+    int64_t anchor_us;
+    int64_t busy_us;
+    int64_t connected_us;
+    int64_t subscribed_us;
+    uint32_t stray_writes;
+} kbd_t;
+
+struct ble_hs_cfg ble_hs_cfg;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed;
+static bool initialized;
+static bool stopping;
+static action_t *actions;
+
+static const sim_nimble_config_t DEFAULT_CONFIG = {
+    .host_us = 200,
+    .conn_itvl = 24,            /* 30 ms, CONN_ITVL_MAX of the client */
+    .mtu = 23,
+    .adv_itvl_ms = 100,
+    .connect_ms = 40,
+};
+static sim_nimble_config_t config = DEFAULT_CONFIG;
+static sim_nimble_stats_t stats;
+
+static kbd_t kbds[KBD_MAX];
+static int kbd_count;
+static uint16_t next_conn_handle = 1;
+
+static bool scanning;
+static uint32_t scan_gen;
+static ble_gap_event_fn *scan_cb;
+static void *scan_cb_arg;
+
+static struct {
+    bool active;
+    ble_addr_t addr;
+    ble_gap_event_fn *cb;
+    void *cb_arg;
+    int64_t deadline_us;
+    uint32_t gen;
+} conn_req;
+
+/* a keyboard report map: input report 1 (modifiers, reserved, 6 keys) and
+   output report 1 (LEDs) */
+static const uint8_t report_map[] = {
+    0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x85, 0x01,
+    0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02,
+    0x95, 0x01, 0x75, 0x08, 0x81, 0x01,
+    0x95, 0x05, 0x75, 0x01, 0x05, 0x08, 0x19, 0x01, 0x29, 0x05, 0x91, 0x02,
+    0x95, 0x01, 0x75, 0x03, 0x91, 0x01,
+    0x95, 0x06, 0x75, 0x08, 0x15, 0x00, 0x25, 0x65, 0x05, 0x07, 0x19, 0x00, 0x29, 0x65, 0x81, 0x00,
+    0xC0,
+};
+
+static struct timespec abs_time(int64_t us)
+{
+    struct timespec ts = host_epoch();
+    ts.tv_sec += us / 1000000;
+    ts.tv_nsec += (long)(us % 1000000) * 1000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    return ts;
+}
+
+static int64_t itvl_us(void)
+{
+    return config.conn_itvl * 1250LL;
+}
+
+/* ---- host task ---- */
+
+static bool stale(const action_t *a)
+{
+    if (a->scan_event) {
+        return !scanning || a->gen != scan_gen;
+    }
+    return a->kbd >= 0 && kbds[a->kbd].gen != a->gen;
+}
+
+static void run(action_t *a)
+{
+    switch (a->kind) {
+    case ACT_GAP:
+        ((ble_gap_event_fn *)a->cb)(&a->gap, a->cb_arg);
+        break;
+    case ACT_ATTR:
+        ((ble_gatt_attr_fn *)a->cb)(a->conn_handle, &a->error, a->has_result ? &a->attr : NULL, a->cb_arg);
+        break;
+    case ACT_SVC:
+        ((ble_gatt_disc_svc_fn *)a->cb)(a->conn_handle, &a->error, a->has_result ? &a->svc : NULL, a->cb_arg);
+        break;
+    case ACT_CHR:
+        ((ble_gatt_chr_fn *)a->cb)(a->conn_handle, &a->error, a->has_result ? &a->chr : NULL, a->cb_arg);
+        break;
+    case ACT_DSC:
+        ((ble_gatt_dsc_fn *)a->cb)(a->conn_handle, &a->error, a->chr_val_handle,
+                                   a->has_result ? &a->dsc : NULL, a->cb_arg);
+        break;
+    case ACT_CALL:
+        break;
+    }
+}
+
+void nimble_port_run(void)
+{
+    if (ble_hs_cfg.sync_cb) {
+        ble_hs_cfg.sync_cb();
+    }
+
+    pthread_mutex_lock(&lock);
+    while (!stopping) {
+        action_t *a = actions;
+        if (a == NULL) {
+            pthread_cond_wait(&changed, &lock);
+            continue;
+        }
+        if (a->due_us > host_time_us()) {
+            struct timespec ts = abs_time(a->due_us);
+            host_cond_wait(&changed, &lock, &ts);
+            continue;
+        }
+        actions = a->next;
+        if (a->kind == ACT_CALL) {
+            a->fn(a);                       /* simulator state: under the lock */
+        } else if (a->cb && !stale(a)) {
+            pthread_mutex_unlock(&lock);
+            run(a);
+            pthread_mutex_lock(&lock);
+        }
+        free(a);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/* behind every action due at or before it; lock held */
+static void schedule(action_t *a, int64_t due_us)
+{
+    a->due_us = due_us;
+    action_t **p = &actions;
+    while (*p && (*p)->due_us <= due_us) {
+        p = &(*p)->next;
+    }
+    a->next = *p;
+    *p = a;
+    pthread_cond_broadcast(&changed);
+}
+
+static action_t *post(action_kind_t kind, kbd_t *k, void *cb, void *cb_arg, int64_t due_us)
+{
+    action_t *a = calloc(1, sizeof(*a));
+    a->kind = kind;
+    a->kbd = k ? (int)(k - kbds) : -1;
+    a->gen = k ? k->gen : 0;
+    a->cb = cb;
+    a->cb_arg = cb_arg;
+    a->conn_handle = k ? k->conn_handle : BLE_HS_CONN_HANDLE_NONE;
+    a->om.om_data = a->om.om_buf;
+    schedule(a, due_us + config.host_us);
+    return a;
+}
+
+static void post_call(void (*fn)(action_t *a), uint32_t gen, int64_t due_us)
+{
+    action_t *a = calloc(1, sizeof(*a));
+    a->kind = ACT_CALL;
+    a->kbd = -1;
+    a->gen = gen;
+    a->fn = fn;
+    schedule(a, due_us);
+}
+
+static void set_om(action_t *a, const uint8_t *data, int len)
+{
+    memcpy(a->om.om_buf, data, len);
+    a->om.om_len = len;
+}
+
+/* ---- keyboards' attribute tables ---- */
+
+static int add_attr(kbd_t *k, attr_kind_t kind, uint16_t uuid, const void *value, int len)
+{
+    attr_t *at = &k->attrs[k->attr_count];
+    memset(at, 0, sizeof(*at));
+    at->handle = k->attr_count ? k->attrs[k->attr_count - 1].handle + 1 : 1;
+    at->uuid = uuid;
+    at->kind = kind;
+    at->len = len;
+    if (len) {
+        memcpy(at->value, value, len);
+    }
+    return k->attr_count++;
+}
+
+static int add_svc(kbd_t *k, uint16_t uuid)
+{
+    uint8_t v[2] = { uuid & 0xff, uuid >> 8 };
+    return add_attr(k, A_SVC, UUID_PRIMARY, v, 2);
+}
+
+static void end_svc(kbd_t *k, int svc)
+{
+    k->attrs[svc].end = k->attrs[k->attr_count - 1].handle;
+}
+
+/* declaration and value; returns the value's index */
+static int add_chr(kbd_t *k, uint16_t uuid, uint8_t props, const void *value, int len)
+{
+    add_attr(k, A_DECL, UUID_CHR_DECL, NULL, 0);
+    int v = add_attr(k, A_VAL, uuid, value, len);
+    k->attrs[v].props = props;
+    return v;
+}
+
+static int add_dsc(kbd_t *k, uint16_t uuid, const void *value, int len)
+{
+    return add_attr(k, A_DSC, uuid, value, len);
+}
+
+static void add_battery(kbd_t *k)
+{
+    static const uint8_t level = 100;
+    int svc = add_svc(k, 0x180F);
+    add_chr(k, 0x2A19, BLE_GATT_CHR_PROP_READ | BLE_GATT_CHR_PROP_NOTIFY, &level, 1);
+    add_dsc(k, UUID_CCCD, (const uint8_t[2]){ 0 }, 2);
+    end_svc(k, svc);
+}
+
+/* The stale boot input CCCD handle of a table two handles shorter lands
+   on the Boot Keyboard Output value: a write request there succeeds. */
+static void build_db(kbd_t *k)
+{
+    static const uint8_t info[] = { 0x11, 0x01, 0x00, 0x02 };
+    static const uint8_t ref_in[] = { 1, 1 }, ref_out[] = { 1, 2 };
+    static const uint8_t zeros[8] = { 0 };
+    const uint8_t report_mode = 1;
+
+    k->attr_count = 0;
+
+    int svc = add_svc(k, 0x1800);
+    add_chr(k, 0x2A01, BLE_GATT_CHR_PROP_READ, (const uint8_t[2]){ 0xC1, 0x03 }, 2);
+    if (!k->no_name) {
+        add_chr(k, 0x2A00, BLE_GATT_CHR_PROP_READ, k->name, strlen(k->name));
+    }
+    end_svc(k, svc);
+
+    svc = add_svc(k, 0x1801);
+    add_chr(k, 0x2A05, 0x20, zeros, 4);
+    add_dsc(k, UUID_CCCD, zeros, 2);
+    if (k->cfg.with_hash) {
+        uint8_t hash[16];
+        memset(hash, 0xA5, sizeof(hash));
+        hash[0] = k->db_gen;
+        add_chr(k, 0x2B2A, BLE_GATT_CHR_PROP_READ, hash, sizeof(hash));
+    }
+    end_svc(k, svc);
+
+    svc = add_svc(k, 0x1812);
+    add_chr(k, 0x2A4A, BLE_GATT_CHR_PROP_READ, info, sizeof(info));
+    add_chr(k, 0x2A4B, BLE_GATT_CHR_PROP_READ, report_map, sizeof(report_map));
+    k->proto = add_chr(k, 0x2A4E, BLE_GATT_CHR_PROP_READ | BLE_GATT_CHR_PROP_WRITE_NO_RSP, &report_mode, 1);
+    k->boot_val = k->attrs[add_chr(k, 0x2A22, BLE_GATT_CHR_PROP_READ | BLE_GATT_CHR_PROP_NOTIFY, zeros, 8)].handle;
+    k->boot_cccd = add_dsc(k, UUID_CCCD, zeros, 2);
+    add_chr(k, 0x2A32, BLE_GATT_CHR_PROP_READ | BLE_GATT_CHR_PROP_WRITE | BLE_GATT_CHR_PROP_WRITE_NO_RSP, zeros, 1);
+    k->report_val = k->attrs[add_chr(k, 0x2A4D, BLE_GATT_CHR_PROP_READ | BLE_GATT_CHR_PROP_NOTIFY, zeros, 8)].handle;
+    k->report_cccd = add_dsc(k, UUID_CCCD, zeros, 2);
+    add_dsc(k, UUID_REPORT_REF, ref_in, 2);
+    add_chr(k, 0x2A4D, BLE_GATT_CHR_PROP_READ | BLE_GATT_CHR_PROP_WRITE, zeros, 1);
+    add_dsc(k, UUID_REPORT_REF, ref_out, 2);
+    add_chr(k, 0x2A4C, BLE_GATT_CHR_PROP_WRITE_NO_RSP, zeros, 1);
+    end_svc(k, svc);
+
+    add_battery(k);
+}
+
+static attr_t *attr_find(kbd_t *k, uint16_t handle)
+{
+    for (int i = 0; i < k->attr_count; i++) {
+        if (k->attrs[i].handle == handle) {
+            return &k->attrs[i];
+        }
+    }
+    return NULL;
+}
+
+static bool cccd_on(const kbd_t *k, int index)
+{
+    return k->attrs[index].value[0] & 1;
+}
+
+static kbd_t *kbd_by_conn(uint16_t conn_handle)
+{
+    for (int i = 0; i < kbd_count; i++) {
+        if (kbds[i].connected && kbds[i].conn_handle == conn_handle) {
+            return &kbds[i];
+        }
+    }
+    return NULL;
+}
+
+static kbd_t *kbd_by_addr(const ble_addr_t *addr)
+{
+    for (int i = 0; i < kbd_count; i++) {
+        if (memcmp(kbds[i].cfg.addr, addr->val, 6) == 0) {
+            return &kbds[i];
+        }
+    }
+    return NULL;
+}
+
+static bool advertising(const kbd_t *k)
+{
+    return k->adv_on && !k->connected;
+}
+
+/* ---- port ---- */
+
+esp_err_t nimble_port_init(void)
+{
+    pthread_mutex_lock(&lock);
+    if (!initialized) {
+        initialized = true;
+        host_cond_init(&changed);
+    }
+    stopping = false;
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+esp_err_t nimble_port_deinit(void)
+{
+    return ESP_OK;
+}
+
+int nimble_port_stop(void)
+{
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+void nimble_port_freertos_init(TaskFunction_t host_task_fn)
+{
+    xTaskCreate(host_task_fn, "nimble_host", 4096, NULL, 21, NULL);
+}
+
+void nimble_port_freertos_deinit(void)
+{
+}
+
+int ble_hs_util_ensure_addr(int prefer_random)
+{
+    return 0;
+}
+
+int ble_hs_id_infer_auto(int privacy, uint8_t *out_addr_type)
+{
+    *out_addr_type = BLE_OWN_ADDR_PUBLIC;
+    return 0;
+}
+
+int ble_hs_id_set_rnd(const uint8_t *rnd_addr)
+{
+    return 0;
+}
+
+int ble_hs_id_copy_addr(uint8_t id_addr_type, uint8_t *out_id_addr, int *out_is_nrpa)
+{
+    static const uint8_t own[6] = { 0x03, 0x02, 0x01, 0xcf, 0x17, 0x5c };
+    if (out_id_addr) {
+        memcpy(out_id_addr, own, 6);
+    }
+    if (out_is_nrpa) {
+        *out_is_nrpa = 0;
+    }
+    return 0;
+}
+
+uint16_t ble_uuid_u16(const ble_uuid_t *uuid)
+{
+    return uuid->type == BLE_UUID_TYPE_16 ? ((const ble_uuid16_t *)uuid)->value : 0;
+}
+
+int ble_uuid_cmp(const ble_uuid_t *uuid1, const ble_uuid_t *uuid2)
+{
+    if (uuid1->type != uuid2->type) {
+        return uuid1->type - uuid2->type;
+    }
+    return (int)ble_uuid_u16(uuid1) - (int)ble_uuid_u16(uuid2);
+}
+
+int os_mbuf_copydata(const struct os_mbuf *om, int off, int len, void *dst)
+{
+    if (off < 0 || len < 0 || off + len > om->om_len) {
+        return -1;
+    }
+    memcpy(dst, om->om_data + off, len);
+    return 0;
+}
+
+int ble_hs_adv_parse_fields(struct ble_hs_adv_fields *f, const uint8_t *src, uint8_t src_len)
+{
+    static ble_uuid16_t uuids16[8];     /* as NimBLE: valid until the next parse */
+
+    memset(f, 0, sizeof(*f));
+    int i = 0;
+    while (i < src_len) {
+        int len = src[i];
+        if (len == 0) {
+            break;
+        }
+        if (i + 1 + len > src_len) {
+            return BLE_HS_EBADDATA;
+        }
+        uint8_t type = src[i + 1];
+        const uint8_t *data = &src[i + 2];
+        int data_len = len - 1;
+
+        switch (type) {
+        case 0x01:
+            f->flags = data[0];
+            break;
+        case 0x02:
+        case 0x03:
+            for (int u = 0; u + 1 < data_len && f->num_uuids16 < 8; u += 2) {
+                uuids16[f->num_uuids16] = (ble_uuid16_t)BLE_UUID16_INIT(data[u] | data[u + 1] << 8);
+                f->num_uuids16++;
+            }
+            f->uuids16 = uuids16;
+            f->uuids16_is_complete = type == 0x03;
+            break;
+        case 0x08:
+        case 0x09:
+            f->name = data;
+            f->name_len = data_len;
+            f->name_is_complete = type == 0x09;
+            break;
+        case 0x19:
+            f->appearance = data[0] | data[1] << 8;
+            f->appearance_is_present = 1;
+            break;
+        }
+        i += 1 + len;
+    }
+    return 0;
+}
+
+/* ---- GAP: scanning ---- */
+
+static int adv_data(const kbd_t *k, uint8_t *out)
+{
+    int n = 0;
+    out[n++] = 2;
+    out[n++] = 0x01;
+    out[n++] = BLE_HS_ADV_F_DISC_GEN | BLE_HS_ADV_F_BREDR_UNSUP;
+    out[n++] = 3;
+    out[n++] = 0x19;
+    out[n++] = 0xC1;                            /* keyboard */
+    out[n++] = 0x03;
+    out[n++] = 3;
+    out[n++] = 0x03;
+    out[n++] = 0x12;                            /* HID service */
+    out[n++] = 0x18;
+    int name_len = strlen(k->name);
+    out[n++] = name_len + 1;
+    out[n++] = 0x09;
+    memcpy(&out[n], k->name, name_len);
+    return n + name_len;
+}
+
+static void scan_tick(action_t *t)
+{
+    if (!scanning || t->gen != scan_gen) {
+        return;
+    }
+    int64_t now = host_time_us();
+    for (int i = 0; i < kbd_count; i++) {
+        kbd_t *k = &kbds[i];
+        if (!advertising(k)) {
+            continue;
+        }
+        action_t *a = post(ACT_GAP, NULL, scan_cb, scan_cb_arg, now);
+        a->scan_event = true;
+        a->gen = scan_gen;
+        a->gap.type = BLE_GAP_EVENT_DISC;
+        a->gap.disc.event_type = BLE_HCI_ADV_RPT_EVTYPE_ADV_IND;
+        a->gap.disc.addr.type = BLE_ADDR_PUBLIC;
+        memcpy(a->gap.disc.addr.val, k->cfg.addr, 6);
+        a->gap.disc.rssi = -60 - i;
+        a->gap.disc.length_data = adv_data(k, a->om.om_buf);
+        a->gap.disc.data = a->om.om_buf;
+    }
+    post_call(scan_tick, scan_gen, now + config.adv_itvl_ms * 1000LL);
+}
+
+static void scan_done(action_t *t)
+{
+    if (!scanning || t->gen != scan_gen) {
+        return;
+    }
+    scanning = false;
+    action_t *a = post(ACT_GAP, NULL, scan_cb, scan_cb_arg, host_time_us());
+    a->gap.type = BLE_GAP_EVENT_DISC_COMPLETE;
+    a->gap.disc_complete.reason = 0;
+}
+
+int ble_gap_disc(uint8_t own_addr_type, int32_t duration_ms, const struct ble_gap_disc_params *disc_params,
+                 ble_gap_event_fn *cb, void *cb_arg)
+{
+    pthread_mutex_lock(&lock);
+    int rc = 0;
+    if (scanning) {
+        rc = BLE_HS_EALREADY;
+    } else if (conn_req.active) {
+        rc = BLE_HS_EBUSY;
+    } else {
+        scanning = true;
+        scan_gen++;
+        scan_cb = cb;
+        scan_cb_arg = cb_arg;
+        stats.scans++;
+        int64_t now = host_time_us();
+        post_call(scan_tick, scan_gen, now + config.adv_itvl_ms * 1000LL);
+        if (duration_ms != BLE_HS_FOREVER) {
+            post_call(scan_done, scan_gen, now + duration_ms * 1000LL);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return rc;
+}
+
+int ble_gap_disc_cancel(void)
+{
+    pthread_mutex_lock(&lock);
+    int rc = scanning ? 0 : BLE_HS_EALREADY;
+    scanning = false;
+    pthread_mutex_unlock(&lock);
+    return rc;
+}
+
+int ble_gap_disc_active(void)
+{
+    pthread_mutex_lock(&lock);
+    int on = scanning;
+    pthread_mutex_unlock(&lock);
+    return on;
+}
+
+/* ---- GAP: connections ---- */
+
+static void fill_desc(const kbd_t *k, struct ble_gap_conn_desc *desc)
+{
+    memset(desc, 0, sizeof(*desc));
+    desc->conn_handle = k->conn_handle;
+    desc->conn_itvl = config.conn_itvl;
+    desc->conn_latency = 0;
+    desc->supervision_timeout = 500;
+    desc->peer_id_addr.type = BLE_ADDR_PUBLIC;
+    memcpy(desc->peer_id_addr.val, k->cfg.addr, 6);
+    desc->peer_ota_addr = desc->peer_id_addr;
+    desc->sec_state.bonded = k->cfg.bonded;
+    desc->sec_state.encrypted = k->cfg.bonded;
+}
+
+static void establish(kbd_t *k)
+{
+    int64_t now = host_time_us();
+
+    conn_req.active = false;
+    k->connected = true;
+    k->conn_handle = next_conn_handle++;
+    k->gen++;
+    k->cb = conn_req.cb;
+    k->cb_arg = conn_req.cb_arg;
+    k->anchor_us = now;
+    k->busy_us = now;
+    k->connected_us = now;
+    k->subscribed_us = 0;
+    /* CCCDs start off on every connection */
+    memset(k->attrs[k->boot_cccd].value, 0, 2);
+    memset(k->attrs[k->report_cccd].value, 0, 2);
+    stats.connects++;
+
+    action_t *a = post(ACT_GAP, k, k->cb, k->cb_arg, now);
+    a->gap.type = BLE_GAP_EVENT_CONNECT;
+    a->gap.connect.status = 0;
+    a->gap.connect.conn_handle = k->conn_handle;
+}
+
+static void connect_try(action_t *t)
+{
+    if (!conn_req.active || t->gen != conn_req.gen) {
+        return;
+    }
+    int64_t now = host_time_us();
+    kbd_t *k = kbd_by_addr(&conn_req.addr);
+    if (k && advertising(k) && k->cfg.connectable) {
+        establish(k);
+        return;
+    }
+    if (now >= conn_req.deadline_us) {
+        conn_req.active = false;
+        stats.connect_timeouts++;
+        action_t *a = post(ACT_GAP, NULL, conn_req.cb, conn_req.cb_arg, now);
+        a->gap.type = BLE_GAP_EVENT_CONNECT;
+        a->gap.connect.status = BLE_HS_ETIMEOUT;
+        a->gap.connect.conn_handle = BLE_HS_CONN_HANDLE_NONE;
+        return;
+    }
+    int64_t next = now + config.adv_itvl_ms * 1000LL;
+    post_call(connect_try, t->gen, next < conn_req.deadline_us ? next : conn_req.deadline_us);
+}
+
+int ble_gap_connect(uint8_t own_addr_type, const ble_addr_t *peer_addr, int32_t duration_ms,
+                    const struct ble_gap_conn_params *params, ble_gap_event_fn *cb, void *cb_arg)
+{
+    pthread_mutex_lock(&lock);
+    int rc = 0;
+    kbd_t *k = kbd_by_addr(peer_addr);
+    if (conn_req.active) {
+        rc = BLE_HS_EALREADY;
+    } else if (scanning) {
+        rc = BLE_HS_EBUSY;
+    } else if (k && k->connected) {
+        rc = BLE_HS_EALREADY;
+    } else {
+        int64_t now = host_time_us();
+        conn_req.active = true;
+        conn_req.addr = *peer_addr;
+        conn_req.cb = cb;
+        conn_req.cb_arg = cb_arg;
+        conn_req.deadline_us = duration_ms == BLE_HS_FOREVER ? INT64_MAX : now + duration_ms * 1000LL;
+        conn_req.gen++;
+        int64_t first = now + config.connect_ms * 1000LL;
+        post_call(connect_try, conn_req.gen, first < conn_req.deadline_us ? first : conn_req.deadline_us);
+    }
+    pthread_mutex_unlock(&lock);
+    return rc;
+}
+
+int ble_gap_conn_cancel(void)
+{
+    pthread_mutex_lock(&lock);
+    int rc = 0;
+    if (!conn_req.active) {
+        rc = BLE_HS_EALREADY;
+    } else {
+        conn_req.active = false;
+        action_t *a = post(ACT_GAP, NULL, conn_req.cb, conn_req.cb_arg, host_time_us());
+        a->gap.type = BLE_GAP_EVENT_CONNECT;
+        a->gap.connect.status = BLE_HS_EAPP;
+        a->gap.connect.conn_handle = BLE_HS_CONN_HANDLE_NONE;
+    }
+    pthread_mutex_unlock(&lock);
+    return rc;
+}
+
+int ble_gap_conn_active(void)
+{
+    pthread_mutex_lock(&lock);
+    int on = conn_req.active;
+    pthread_mutex_unlock(&lock);
+    return on;
+}
+
+/* lock held; the keyboard advertises again if it was told to */
+static void drop_link(kbd_t *k, int reason, int64_t due_us)
+{
+    struct ble_gap_conn_desc desc;
+    fill_desc(k, &desc);
+    k->connected = false;
+    k->gen++;                               /* discards what is still pending */
+
+    action_t *a = post(ACT_GAP, k, k->cb, k->cb_arg, due_us);
+    a->gap.type = BLE_GAP_EVENT_DISCONNECT;
+    a->gap.disconnect.reason = reason;
+    a->gap.disconnect.conn = desc;
+}
+
+int ble_gap_terminate(uint16_t conn_handle, uint8_t hci_reason)
+{
+    pthread_mutex_lock(&lock);
+    kbd_t *k = kbd_by_conn(conn_handle);
+    int rc = k ? 0 : BLE_HS_ENOTCONN;
+    if (k) {
+        drop_link(k, BLE_HS_HCI_ERR(BLE_ERR_CONN_TERM_LOCAL), host_time_us() + itvl_us());
+    }
+    pthread_mutex_unlock(&lock);
+    return rc;
+}
+
+int ble_gap_conn_find(uint16_t handle, struct ble_gap_conn_desc *out_desc)
+{
+    pthread_mutex_lock(&lock);
+    kbd_t *k = kbd_by_conn(handle);
+    if (k && out_desc) {
+        fill_desc(k, out_desc);
+    }
+    pthread_mutex_unlock(&lock);
+    return k ? 0 : BLE_HS_ENOTCONN;
+}
+
+/* ---- GATT client ---- */
+
+/* the next ATT round trip on the link; lock held */
+static int64_t att_slot(kbd_t *k)
+{
+    int64_t now = host_time_us();
+    k->busy_us = (k->busy_us > now ? k->busy_us : now) + itvl_us();
+    stats.att_requests++;
+    return k->busy_us;
+}
+
+static kbd_t *link_or_fail(uint16_t conn_handle)
+{
+    pthread_mutex_lock(&lock);
+    kbd_t *k = kbd_by_conn(conn_handle);
+    if (k == NULL) {
+        pthread_mutex_unlock(&lock);
+    }
+    return k;
+}
+
+int ble_gattc_disc_svc_by_uuid(uint16_t conn_handle, const ble_uuid_t *uuid, ble_gatt_disc_svc_fn *cb, void *cb_arg)
+{
+    kbd_t *k = link_or_fail(conn_handle);
+    if (k == NULL) {
+        return BLE_HS_ENOTCONN;
+    }
+    /* Find By Type Value: every match in one response, then one more
+       request past the last one */
+    int64_t due = att_slot(k);
+    uint16_t last_end = 0;
+    for (int i = 0; i < k->attr_count; i++) {
+        attr_t *at = &k->attrs[i];
+        if (at->kind != A_SVC || (at->value[0] | at->value[1] << 8) != ble_uuid_u16(uuid)) {
+            continue;
+        }
+        action_t *a = post(ACT_SVC, k, cb, cb_arg, due);
+        a->has_result = true;
+        a->svc.start_handle = at->handle;
+        a->svc.end_handle = at->end;
+        a->svc.uuid.u16 = (ble_uuid16_t)BLE_UUID16_INIT(ble_uuid_u16(uuid));
+        last_end = at->end;
+    }
+    if (last_end != 0xffff) {
+        due = att_slot(k);
+    }
+    action_t *a = post(ACT_SVC, k, cb, cb_arg, due);
+    a->error.status = BLE_HS_EDONE;
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+int ble_gattc_disc_all_chrs(uint16_t conn_handle, uint16_t start_handle, uint16_t end_handle,
+                            ble_gatt_chr_fn *cb, void *cb_arg)
+{
+    kbd_t *k = link_or_fail(conn_handle);
+    if (k == NULL) {
+        return BLE_HS_ENOTCONN;
+    }
+    /* Read By Type: three 7-byte declarations per response at MTU 23 */
+    int per_rsp = (config.mtu - 2) / 7;
+    int n = 0;
+    int64_t due = 0;
+    for (int i = 0; i < k->attr_count; i++) {
+        attr_t *at = &k->attrs[i];
+        if (at->kind != A_DECL || at->handle < start_handle || at->handle > end_handle) {
+            continue;
+        }
+        if (n++ % per_rsp == 0) {
+            due = att_slot(k);
+        }
+        action_t *a = post(ACT_CHR, k, cb, cb_arg, due);
+        a->has_result = true;
+        a->chr.def_handle = at->handle;
+        a->chr.val_handle = k->attrs[i + 1].handle;
+        a->chr.properties = k->attrs[i + 1].props;
+        a->chr.uuid.u16 = (ble_uuid16_t)BLE_UUID16_INIT(k->attrs[i + 1].uuid);
+    }
+    action_t *a = post(ACT_CHR, k, cb, cb_arg, att_slot(k));
+    a->error.status = BLE_HS_EDONE;
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+int ble_gattc_disc_all_dscs(uint16_t conn_handle, uint16_t start_handle, uint16_t end_handle,
+                            ble_gatt_dsc_fn *cb, void *cb_arg)
+{
+    kbd_t *k = link_or_fail(conn_handle);
+    if (k == NULL) {
+        return BLE_HS_ENOTCONN;
+    }
+    /* Find Information from start + 1: five 16-bit entries per response */
+    int per_rsp = (config.mtu - 2) / 4;
+    int n = 0;
+    int64_t due = 0;
+    for (int i = 0; i < k->attr_count; i++) {
+        attr_t *at = &k->attrs[i];
+        if (at->handle <= start_handle || at->handle > end_handle) {
+            continue;
+        }
+        if (n++ % per_rsp == 0) {
+            due = att_slot(k);
+        }
+        action_t *a = post(ACT_DSC, k, cb, cb_arg, due);
+        a->has_result = true;
+        a->chr_val_handle = start_handle;
+        a->dsc.handle = at->handle;
+        a->dsc.uuid.u16 = (ble_uuid16_t)BLE_UUID16_INIT(at->uuid);
+    }
+    action_t *a = post(ACT_DSC, k, cb, cb_arg, att_slot(k));
+    a->chr_val_handle = start_handle;
+    a->error.status = BLE_HS_EDONE;
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+static bool readable(const attr_t *at)
+{
+    return at->kind != A_VAL || (at->props & BLE_GATT_CHR_PROP_READ);
+}
+
+int ble_gattc_read(uint16_t conn_handle, uint16_t attr_handle, ble_gatt_attr_fn *cb, void *cb_arg)
+{
+    kbd_t *k = link_or_fail(conn_handle);
+    if (k == NULL) {
+        return BLE_HS_ENOTCONN;
+    }
+    attr_t *at = attr_find(k, attr_handle);
+    action_t *a = post(ACT_ATTR, k, cb, cb_arg, att_slot(k));
+    a->error.att_handle = attr_handle;
+    if (at == NULL || !readable(at)) {
+        int att_err = at ? 0x02 : BLE_ATT_ERR_INVALID_HANDLE;    /* read not permitted */
+        a->error.status = BLE_HS_ATT_ERR(att_err);
+    } else {
+        int len = at->len < config.mtu - 1 ? at->len : config.mtu - 1;
+        a->has_result = true;
+        a->attr.handle = attr_handle;
+        a->attr.om = &a->om;
+        set_om(a, at->value, len);
+    }
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+int ble_gattc_read_long(uint16_t conn_handle, uint16_t handle, uint16_t offset, ble_gatt_attr_fn *cb, void *cb_arg)
+{
+    kbd_t *k = link_or_fail(conn_handle);
+    if (k == NULL) {
+        return BLE_HS_ENOTCONN;
+    }
+    attr_t *at = attr_find(k, handle);
+    if (at == NULL || !readable(at) || offset > at->len) {
+        action_t *a = post(ACT_ATTR, k, cb, cb_arg, att_slot(k));
+        int att_err = at ? 0x07 : BLE_ATT_ERR_INVALID_HANDLE;    /* invalid offset */
+        a->error.status = BLE_HS_ATT_ERR(att_err);
+        a->error.att_handle = handle;
+        pthread_mutex_unlock(&lock);
+        return 0;
+    }
+    /* Read, then Read Blob until a response comes back short */
+    int piece = config.mtu - 1;
+    int64_t due = 0;
+    for (int off = offset;; off += piece) {
+        int len = at->len - off < piece ? at->len - off : piece;
+        due = att_slot(k);
+        action_t *a = post(ACT_ATTR, k, cb, cb_arg, due);
+        a->has_result = true;
+        a->attr.handle = handle;
+        a->attr.offset = off;
+        a->attr.om = &a->om;
+        set_om(a, at->value + off, len);
+        if (len < piece) {
+            break;
+        }
+    }
+    action_t *a = post(ACT_ATTR, k, cb, cb_arg, due);
+    a->error.status = BLE_HS_EDONE;
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+int ble_gattc_read_by_uuid(uint16_t conn_handle, uint16_t start_handle, uint16_t end_handle,
+                           const ble_uuid_t *uuid, ble_gatt_attr_fn *cb, void *cb_arg)
+{
+    kbd_t *k = link_or_fail(conn_handle);
+    if (k == NULL) {
+        return BLE_HS_ENOTCONN;
+    }
+    int64_t due = att_slot(k);
+    bool found = false;
+    for (int i = 0; i < k->attr_count; i++) {
+        attr_t *at = &k->attrs[i];
+        if (at->handle < start_handle || at->handle > end_handle || at->uuid != ble_uuid_u16(uuid) ||
+            !readable(at)) {
+            continue;
+        }
+        action_t *a = post(ACT_ATTR, k, cb, cb_arg, due);
+        a->has_result = true;
+        a->attr.handle = at->handle;
+        a->attr.om = &a->om;
+        set_om(a, at->value, at->len < config.mtu - 4 ? at->len : config.mtu - 4);
+        found = true;
+        break;
+    }
+    action_t *a = post(ACT_ATTR, k, cb, cb_arg, due);
+    a->error.status = found ? BLE_HS_EDONE : BLE_HS_ATT_ERR(BLE_ATT_ERR_ATTR_NOT_FOUND);
+    a->error.att_handle = found ? 0 : start_handle;
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+/* applies a write on the keyboard; returns an ATT error or 0; lock held */
+static int apply_write(kbd_t *k, uint16_t handle, const void *data, uint16_t len, bool with_rsp)
+{
+    attr_t *at = attr_find(k, handle);
+    if (at == NULL) {
+        return BLE_ATT_ERR_INVALID_HANDLE;
+    }
+    bool cccd = at->kind == A_DSC && at->uuid == UUID_CCCD;
+    uint8_t need = with_rsp ? BLE_GATT_CHR_PROP_WRITE : BLE_GATT_CHR_PROP_WRITE_NO_RSP;
+    if (!cccd && !(at->kind == A_VAL && (at->props & need))) {
+        return BLE_ATT_ERR_WRITE_NOT_PERMITTED;
+    }
+    if (len > VALUE_MAX) {
+        return 0x0d;                        /* invalid attribute value length */
+    }
+
+    int index = at - k->attrs;
+    memcpy(at->value, data, len);
+    at->len = len;
+    if (index == k->boot_cccd || index == k->report_cccd) {
+        if (cccd_on(k, k->boot_cccd) && cccd_on(k, k->report_cccd) && k->subscribed_us == 0) {
+            k->subscribed_us = host_time_us();
+        }
+    } else if (index != k->proto) {
+        k->stray_writes++;
+    }
+    return 0;
+}
+
+static void write_cmd_apply(action_t *t)
+{
+    kbd_t *k = &kbds[t->kbd];
+    if (k->gen == t->gen) {
+        apply_write(k, t->attr.handle, t->om.om_buf, t->om.om_len, false);
+    }
+}
+
+int ble_gattc_write_flat(uint16_t conn_handle, uint16_t attr_handle, const void *data, uint16_t data_len,
+                         ble_gatt_attr_fn *cb, void *cb_arg)
+{
+    kbd_t *k = link_or_fail(conn_handle);
+    if (k == NULL) {
+        return BLE_HS_ENOTCONN;
+    }
+    int64_t due = att_slot(k);
+    /* the keyboard has it by the time the response is on its way */
+    int att_err = apply_write(k, attr_handle, data, data_len, true);
+    action_t *a = post(ACT_ATTR, k, cb, cb_arg, due);
+    a->error.status = BLE_HS_ATT_ERR(att_err);
+    a->error.att_handle = attr_handle;
+    a->attr.handle = attr_handle;
+    a->has_result = att_err == 0;
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+int ble_gattc_write_no_rsp_flat(uint16_t conn_handle, uint16_t attr_handle, const void *data, uint16_t data_len)
+{
+    kbd_t *k = link_or_fail(conn_handle);
+    if (k == NULL) {
+        return BLE_HS_ENOTCONN;
+    }
+    if (data_len > VALUE_MAX) {
+        pthread_mutex_unlock(&lock);
+        return BLE_HS_EMSGSIZE;
+    }
+    /* a Write Command waits for no response: it lands in the next free
+       event without holding up the request after it */
+    int64_t now = host_time_us();
+    action_t *a = calloc(1, sizeof(*a));
+    a->kind = ACT_CALL;
+    a->fn = write_cmd_apply;
+    a->kbd = k - kbds;
+    a->gen = k->gen;
+    a->attr.handle = attr_handle;
+    set_om(a, data, data_len);
+    schedule(a, (k->busy_us > now ? k->busy_us : now) + itvl_us());
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+/* ---- test side ---- */
+
+void sim_nimble_default_config(sim_nimble_config_t *cfg)
+{
+    *cfg = DEFAULT_CONFIG;
+}
+
+void sim_nimble_configure(const sim_nimble_config_t *cfg)
+{
+    pthread_mutex_lock(&lock);
+    config = *cfg;
+    pthread_mutex_unlock(&lock);
+}
+
+void sim_nimble_get_stats(sim_nimble_stats_t *out)
+{
+    pthread_mutex_lock(&lock);
+    *out = stats;
+    pthread_mutex_unlock(&lock);
+}
+
+bool sim_nimble_scanning(void)
+{
+    return ble_gap_disc_active();
+}
+
+bool sim_nimble_connecting(void)
+{
+    return ble_gap_conn_active();
+}
+
+int sim_kbd_add(const sim_kbd_config_t *cfg)
+{
+    pthread_mutex_lock(&lock);
+    int i = -1;
+    if (kbd_count < KBD_MAX) {
+        i = kbd_count++;
+        kbd_t *k = &kbds[i];
+        memset(k, 0, sizeof(*k));
+        k->cfg = *cfg;
+        strncpy(k->name, cfg->name ? cfg->name : "Keyboard", sizeof(k->name) - 1);
+        k->cfg.name = k->name;
+        k->conn_handle = BLE_HS_CONN_HANDLE_NONE;
+        build_db(k);
+    }
+    pthread_mutex_unlock(&lock);
+    return i;
+}
+
+void sim_kbd_advertise(int kbd, bool on)
+{
+    pthread_mutex_lock(&lock);
+    kbds[kbd].adv_on = on;
+    pthread_mutex_unlock(&lock);
+}
+
+bool sim_kbd_connected(int kbd)
+{
+    pthread_mutex_lock(&lock);
+    bool c = kbds[kbd].connected;
+    pthread_mutex_unlock(&lock);
+    return c;
+}
+
+bool sim_kbd_boot_subscribed(int kbd)
+{
+    pthread_mutex_lock(&lock);
+    bool on = kbds[kbd].connected && cccd_on(&kbds[kbd], kbds[kbd].boot_cccd);
+    pthread_mutex_unlock(&lock);
+    return on;
+}
+
+bool sim_kbd_report_subscribed(int kbd)
+{
+    pthread_mutex_lock(&lock);
+    bool on = kbds[kbd].connected && cccd_on(&kbds[kbd], kbds[kbd].report_cccd);
+    pthread_mutex_unlock(&lock);
+    return on;
+}
+
+int64_t sim_kbd_connected_us(int kbd)
+{
+    pthread_mutex_lock(&lock);
+    int64_t t = kbds[kbd].connected_us;
+    pthread_mutex_unlock(&lock);
+    return t;
+}
+
+int64_t sim_kbd_subscribed_us(int kbd)
+{
+    pthread_mutex_lock(&lock);
+    int64_t t = kbds[kbd].subscribed_us;
+    pthread_mutex_unlock(&lock);
+    return t;
+}
+
+uint8_t sim_kbd_protocol_mode(int kbd)
+{
+    pthread_mutex_lock(&lock);
+    uint8_t mode = kbds[kbd].attrs[kbds[kbd].proto].value[0];
+    pthread_mutex_unlock(&lock);
+    return mode;
+}
+
+uint32_t sim_kbd_stray_writes(int kbd)
+{
+    pthread_mutex_lock(&lock);
+    uint32_t n = kbds[kbd].stray_writes;
+    pthread_mutex_unlock(&lock);
+    return n;
+}
+
+/* at the next connection event; lock held */
+static bool notify(kbd_t *k, int cccd, uint16_t val_handle, const uint8_t report[8])
+{
+    if (!k->connected || !cccd_on(k, cccd)) {
+        return false;
+    }
+    int64_t now = host_time_us();
+    int64_t events = (now - k->anchor_us) / itvl_us() + 1;
+    action_t *a = post(ACT_GAP, k, k->cb, k->cb_arg, k->anchor_us + events * itvl_us());
+    a->gap.type = BLE_GAP_EVENT_NOTIFY_RX;
+    a->gap.notify_rx.conn_handle = k->conn_handle;
+    a->gap.notify_rx.attr_handle = val_handle;
+    a->gap.notify_rx.om = &a->om;
+    set_om(a, report, 8);
+    stats.notifications++;
+    return true;
+}
+
+bool sim_kbd_send_boot(int kbd, const uint8_t report[8])
+{
+    pthread_mutex_lock(&lock);
+    bool sent = notify(&kbds[kbd], kbds[kbd].boot_cccd, kbds[kbd].boot_val, report);
+    pthread_mutex_unlock(&lock);
+    return sent;
+}
+
+bool sim_kbd_send_report(int kbd, const uint8_t report[8])
+{
+    pthread_mutex_lock(&lock);
+    bool sent = notify(&kbds[kbd], kbds[kbd].report_cccd, kbds[kbd].report_val, report);
+    pthread_mutex_unlock(&lock);
+    return sent;
+}
+
+void sim_kbd_disconnect(int kbd)
+{
+    pthread_mutex_lock(&lock);
+    kbd_t *k = &kbds[kbd];
+    if (k->connected) {
+        drop_link(k, BLE_HS_HCI_ERR(BLE_ERR_REM_USER_CONN_TERM), host_time_us());
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void sim_kbd_change_db(int kbd)
+{
+    pthread_mutex_lock(&lock);
+    kbd_t *k = &kbds[kbd];
+    k->no_name = !k->no_name;
+    k->db_gen++;
+    build_db(k);
+    pthread_mutex_unlock(&lock);
+}
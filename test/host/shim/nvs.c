@@ -0,0 +1,217 @@
+/* NVS as a list of (namespace, key) blobs in memory. Writes are visible
+   immediately; nvs_commit() only checks the handle. */
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "sim.h"
+
+#define NS_MAX      16
+#define KEY_MAX     16
+#define HANDLE_MAX  16
+
+typedef struct nvs_entry {
+    char ns[NS_MAX];
+    char key[KEY_MAX];
+    size_t len;
+    struct nvs_entry *next;
+    uint8_t value[];
+} nvs_entry_t;
+
+typedef struct {
+    bool open;
+    bool writable;
+    char ns[NS_MAX];
+} nvs_slot_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static nvs_entry_t *entries;
+static nvs_slot_t handles[HANDLE_MAX];
+
+void sim_nvs_clear(void)
+{
+    pthread_mutex_lock(&lock);
+    while (entries) {
+        nvs_entry_t *e = entries;
+        entries = e->next;
+        free(e);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    sim_nvs_clear();
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *ns, nvs_open_mode_t mode, nvs_handle_t *out)
+{
+    if (ns == NULL || strlen(ns) >= NS_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < HANDLE_MAX; i++) {
+        if (!handles[i].open) {
+            handles[i].open = true;
+            handles[i].writable = mode == NVS_READWRITE;
+            strcpy(handles[i].ns, ns);
+            *out = i + 1;
+            pthread_mutex_unlock(&lock);
+            return ESP_OK;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return ESP_ERR_NO_MEM;
+}
+
+static nvs_slot_t *slot(nvs_handle_t h)
+{
+    return h >= 1 && h <= HANDLE_MAX && handles[h - 1].open ? &handles[h - 1] : NULL;
+}
+
+void nvs_close(nvs_handle_t h)
+{
+    pthread_mutex_lock(&lock);
+    nvs_slot_t *s = slot(h);
+    if (s) {
+        s->open = false;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+esp_err_t nvs_commit(nvs_handle_t h)
+{
+    pthread_mutex_lock(&lock);
+    esp_err_t err = slot(h) ? ESP_OK : ESP_ERR_INVALID_ARG;
+    pthread_mutex_unlock(&lock);
+    return err;
+}
+
+static nvs_entry_t **find(const char *ns, const char *key)
+{
+    nvs_entry_t **p = &entries;
+    while (*p && (strcmp((*p)->ns, ns) != 0 || strcmp((*p)->key, key) != 0)) {
+        p = &(*p)->next;
+    }
+    return p;
+}
+
+static esp_err_t get(nvs_handle_t h, const char *key, void *out, size_t *len, bool exact)
+{
+    pthread_mutex_lock(&lock);
+    nvs_slot_t *s = slot(h);
+    if (s == NULL) {
+        pthread_mutex_unlock(&lock);
+        return ESP_ERR_INVALID_ARG;
+    }
+    nvs_entry_t *e = *find(s->ns, key);
+    esp_err_t err = ESP_OK;
+    if (e == NULL) {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    } else if (out == NULL) {
+        *len = e->len;
+    } else if (exact ? *len != e->len : *len < e->len) {
+        err = ESP_ERR_INVALID_SIZE;
+    } else {
+        memcpy(out, e->value, e->len);
+        *len = e->len;
+    }
+    pthread_mutex_unlock(&lock);
+    return err;
+}
+
+static esp_err_t set(nvs_handle_t h, const char *key, const void *value, size_t len)
+{
+    if (key == NULL || strlen(key) >= KEY_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&lock);
+    nvs_slot_t *s = slot(h);
+    if (s == NULL || !s->writable) {
+        pthread_mutex_unlock(&lock);
+        return ESP_ERR_INVALID_ARG;
+    }
+    nvs_entry_t **p = find(s->ns, key);
+    nvs_entry_t *old = *p;
+    nvs_entry_t *e = malloc(sizeof(*e) + len);
+    if (e == NULL) {
+        pthread_mutex_unlock(&lock);
+        return ESP_ERR_NO_MEM;
+    }
+    strcpy(e->ns, s->ns);
+    strcpy(e->key, key);
+    e->len = len;
+    memcpy(e->value, value, len);
+    e->next = old ? old->next : NULL;
+    *p = e;
+    free(old);
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t h, const char *key)
+{
+    pthread_mutex_lock(&lock);
+    nvs_slot_t *s = slot(h);
+    if (s == NULL || !s->writable) {
+        pthread_mutex_unlock(&lock);
+        return ESP_ERR_INVALID_ARG;
+    }
+    nvs_entry_t **p = find(s->ns, key);
+    nvs_entry_t *e = *p;
+    if (e) {
+        *p = e->next;
+        free(e);
+    }
+    pthread_mutex_unlock(&lock);
+    return e ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t h, const char *key, void *out, size_t *len)
+{
+    return get(h, key, out, len, false);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t h, const char *key, const void *value, size_t len)
+{
+    return set(h, key, value, len);
+}
+
+esp_err_t nvs_get_str(nvs_handle_t h, const char *key, char *out, size_t *len)
+{
+    return get(h, key, out, len, false);
+}
+
+esp_err_t nvs_set_str(nvs_handle_t h, const char *key, const char *value)
+{
+    return set(h, key, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_get_u8(nvs_handle_t h, const char *key, uint8_t *out)
+{
+    size_t len = sizeof(*out);
+    return get(h, key, out, &len, true);
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t h, const char *key, uint8_t value)
+{
+    return set(h, key, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t h, const char *key, uint32_t *out)
+{
+    size_t len = sizeof(*out);
+    return get(h, key, out, &len, true);
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t h, const char *key, uint32_t value)
+{
+    return set(h, key, &value, sizeof(value));
+}
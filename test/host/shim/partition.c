@@ -0,0 +1,211 @@
+/* Data partitions backed by files, with NOR flash semantics and a
+   programmable power cut. */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_partition.h"
+#include "sim.h"
+
+#define PART_MAX     4
+#define SECTOR       4096
+
+typedef struct {
+    esp_partition_t part;
+    FILE *file;
+} sim_part_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static sim_part_t parts[PART_MAX];
+static int part_count;
+static bool cut_armed;
+static bool power_off;
+static size_t cut_budget;
+static uint64_t bytes_written;
+
+/* called with lock held */
+static sim_part_t *find_label(const char *label)
+{
+    for (sim_part_t *p = parts; p < parts + part_count; p++) {
+        if (strncmp(p->part.label, label, sizeof(p->part.label)) == 0) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+esp_err_t sim_partition_attach(const char *label, const char *path, uint32_t size)
+{
+    if (size == 0 || size % SECTOR != 0 || strlen(label) >= sizeof(parts[0].part.label)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&lock);
+    sim_part_t *p = find_label(label);
+    if (p != NULL) {
+        fclose(p->file);
+    }
+    if (p == NULL) {
+        if (part_count == PART_MAX) {
+            pthread_mutex_unlock(&lock);
+            return ESP_ERR_NO_MEM;
+        }
+        p = &parts[part_count++];
+    }
+
+    FILE *f = fopen(path, "r+b");
+    if (f == NULL) {
+        f = fopen(path, "w+b");
+    }
+    if (f == NULL) {
+        pthread_mutex_unlock(&lock);
+        return ESP_FAIL;
+    }
+    /* anything past the current end of the file reads as erased */
+    fseek(f, 0, SEEK_END);
+    long have = ftell(f);
+    for (long i = have; i < (long)size; i++) {
+        fputc(0xff, f);
+    }
+    fflush(f);
+
+    memset(p, 0, sizeof(*p));
+    p->part.type = ESP_PARTITION_TYPE_DATA;
+    p->part.subtype = ESP_PARTITION_SUBTYPE_ANY;
+    p->part.size = size;
+    p->part.erase_size = SECTOR;
+    strcpy(p->part.label, label);
+    p->file = f;
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+void sim_partition_cut_after(size_t budget)
+{
+    pthread_mutex_lock(&lock);
+    cut_armed = true;
+    cut_budget = budget;
+    pthread_mutex_unlock(&lock);
+}
+
+void sim_partition_restore_power(void)
+{
+    pthread_mutex_lock(&lock);
+    cut_armed = false;
+    power_off = false;
+    pthread_mutex_unlock(&lock);
+}
+
+uint64_t sim_partition_bytes_written(void)
+{
+    pthread_mutex_lock(&lock);
+    uint64_t n = bytes_written;
+    pthread_mutex_unlock(&lock);
+    return n;
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type,
+                                                esp_partition_subtype_t subtype, const char *label)
+{
+    pthread_mutex_lock(&lock);
+    const esp_partition_t *found = NULL;
+    if (label != NULL) {
+        sim_part_t *p = find_label(label);
+        if (p != NULL && (type == ESP_PARTITION_TYPE_ANY || p->part.type == type)) {
+            found = &p->part;
+        }
+    } else {
+        for (int i = 0; i < part_count && found == NULL; i++) {
+            if (type == ESP_PARTITION_TYPE_ANY || parts[i].part.type == type) {
+                found = &parts[i].part;
+            }
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return found;
+}
+
+static sim_part_t *lookup(const esp_partition_t *part)
+{
+    return (sim_part_t *)((char *)part - offsetof(sim_part_t, part));
+}
+
+static bool in_range(const esp_partition_t *part, size_t offset, size_t size)
+{
+    return part != NULL && offset <= part->size && size <= part->size - offset;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *part, size_t offset, void *dst, size_t size)
+{
+    if (!in_range(part, offset, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    pthread_mutex_lock(&lock);
+    FILE *f = lookup(part)->file;
+    fseek(f, (long)offset, SEEK_SET);
+    size_t n = fread(dst, 1, size, f);
+    pthread_mutex_unlock(&lock);
+    return n == size ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *part, size_t offset, const void *src, size_t size)
+{
+    if (!in_range(part, offset, size)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    pthread_mutex_lock(&lock);
+    if (power_off) {
+        pthread_mutex_unlock(&lock);
+        return ESP_FAIL;
+    }
+    size_t n = size;
+    if (cut_armed && n > cut_budget) {
+        n = cut_budget + (size - cut_budget) / 2;   /* dies halfway through the rest */
+        power_off = true;
+    }
+    if (cut_armed) {
+        cut_budget = cut_budget > n ? cut_budget - n : 0;
+    }
+
+    FILE *f = lookup(part)->file;
+    uint8_t *cur = malloc(n ? n : 1);
+    fseek(f, (long)offset, SEEK_SET);
+    if (fread(cur, 1, n, f) != n) {
+        free(cur);
+        pthread_mutex_unlock(&lock);
+        return ESP_FAIL;
+    }
+    for (size_t i = 0; i < n; i++) {
+        cur[i] &= ((const uint8_t *)src)[i];     /* programming only clears bits */
+    }
+    fseek(f, (long)offset, SEEK_SET);
+    fwrite(cur, 1, n, f);
+    fflush(f);
+    free(cur);
+    bytes_written += n;
+    bool ok = !power_off;
+    pthread_mutex_unlock(&lock);
+    return ok ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *part, size_t offset, size_t size)
+{
+    if (!in_range(part, offset, size) || offset % SECTOR != 0 || size % SECTOR != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&lock);
+    if (power_off) {
+        pthread_mutex_unlock(&lock);
+        return ESP_FAIL;
+    }
+    FILE *f = lookup(part)->file;
+    uint8_t erased[SECTOR];
+    memset(erased, 0xff, sizeof(erased));
+    fseek(f, (long)offset, SEEK_SET);
+    for (size_t done = 0; done < size; done += SECTOR) {
+        fwrite(erased, 1, SECTOR, f);
+    }
+    fflush(f);
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
@@ -0,0 +1,343 @@
+/* Default event loop, netif and a simulated station. Association and DHCP
+   run on their own thread and report back through the event loop, in the
+   order the real driver uses. */
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "esp_wifi.h"
+#include "sim.h"
+#include "host_internal.h"
+
+ESP_EVENT_DEFINE_BASE(WIFI_EVENT);
+ESP_EVENT_DEFINE_BASE(IP_EVENT);
+
+#define HANDLER_MAX  16
+
+typedef struct {
+    esp_event_base_t base;
+    int32_t id;
+    esp_event_handler_t fn;
+    void *arg;
+} handler_t;
+
+typedef struct posted {
+    esp_event_base_t base;
+    int32_t id;
+    struct posted *next;
+    size_t size;
+    uint8_t data[];
+} posted_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed;
+static handler_t handlers[HANDLER_MAX];
+static int handler_count;
+static posted_t *pending, **pending_tail = &pending;
+static bool loop_running;
+
+static struct esp_netif_obj { int unused; } sta;
+
+/* ---- event loop ---- */
+
+static void *loop_thread(void *arg)
+{
+    host_task_adopt("sys_evt");
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        while (pending == NULL) {
+            pthread_cond_wait(&changed, &lock);
+        }
+        posted_t *ev = pending;
+        pending = ev->next;
+        if (pending == NULL) {
+            pending_tail = &pending;
+        }
+
+        handler_t snapshot[HANDLER_MAX];
+        int n = handler_count;
+        memcpy(snapshot, handlers, sizeof(handler_t) * n);
+        pthread_mutex_unlock(&lock);
+        for (int i = 0; i < n; i++) {
+            if ((snapshot[i].base == ESP_EVENT_ANY_BASE || snapshot[i].base == ev->base) &&
+                (snapshot[i].id == ESP_EVENT_ANY_ID || snapshot[i].id == ev->id)) {
+                snapshot[i].fn(snapshot[i].arg, ev->base, ev->id, ev->size ? ev->data : NULL);
+            }
+        }
+        free(ev);
+        pthread_mutex_lock(&lock);
+    }
+    return NULL;
+}
+
+esp_err_t esp_event_loop_create_default(void)
+{
+    pthread_mutex_lock(&lock);
+    if (loop_running) {
+        pthread_mutex_unlock(&lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    loop_running = true;
+    host_cond_init(&changed);
+    pthread_t thread;
+    pthread_create(&thread, NULL, loop_thread, NULL);
+    pthread_detach(thread);
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_register(esp_event_base_t base, int32_t id,
+                                     esp_event_handler_t handler, void *arg)
+{
+    pthread_mutex_lock(&lock);
+    if (handler_count == HANDLER_MAX) {
+        pthread_mutex_unlock(&lock);
+        return ESP_ERR_NO_MEM;
+    }
+    handlers[handler_count++] = (handler_t){ base, id, handler, arg };
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_instance_register(esp_event_base_t base, int32_t id,
+                                              esp_event_handler_t handler, void *arg,
+                                              esp_event_handler_instance_t *instance)
+{
+    return esp_event_handler_register(base, id, handler, arg);
+}
+
+esp_err_t esp_event_post(esp_event_base_t base, int32_t id, const void *data, size_t size,
+                         TickType_t wait)
+{
+    posted_t *ev = malloc(sizeof(*ev) + size);
+    if (ev == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    ev->base = base;
+    ev->id = id;
+    ev->size = size;
+    ev->next = NULL;
+    if (size) {
+        memcpy(ev->data, data, size);
+    }
+
+    pthread_mutex_lock(&lock);
+    if (!loop_running) {
+        pthread_mutex_unlock(&lock);
+        free(ev);
+        return ESP_ERR_INVALID_STATE;
+    }
+    *pending_tail = ev;
+    pending_tail = &ev->next;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+    return ESP_OK;
+}
+
+/* ---- netif ---- */
+
+esp_err_t esp_netif_init(void)
+{
+    return ESP_OK;
+}
+
+esp_netif_t *esp_netif_create_default_wifi_sta(void)
+{
+    return &sta;
+}
+
+esp_err_t esp_netif_dhcpc_stop(esp_netif_t *netif)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_set_ip_info(esp_netif_t *netif, const esp_netif_ip_info_t *info)
+{
+    return ESP_OK;
+}
+
+/* ---- station ---- */
+
+static const uint8_t ap_bssid[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+#define AP_CHANNEL  6
+#define AP_RSSI     -58
+#define AP_IP       0x0a01a8c0u     /* 192.168.1.10 */
+
+static pthread_mutex_t sta_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool ap_reachable = true;
+static uint32_t ap_assoc_ms = 5;
+static uint32_t ap_dhcp_ms = 5;
+static bool started;
+static bool associated;
+static bool has_ip;
+static unsigned attempt;            /* bumped to cancel a connect in flight */
+
+void sim_wifi_set_ap(bool reachable, uint32_t assoc_ms, uint32_t dhcp_ms)
+{
+    pthread_mutex_lock(&sta_lock);
+    ap_reachable = reachable;
+    ap_assoc_ms = assoc_ms;
+    ap_dhcp_ms = dhcp_ms;
+    pthread_mutex_unlock(&sta_lock);
+}
+
+bool sim_wifi_has_ip(void)
+{
+    pthread_mutex_lock(&sta_lock);
+    bool up = has_ip;
+    pthread_mutex_unlock(&sta_lock);
+    return up;
+}
+
+/* tests that never start the station talk to the broker directly */
+bool host_network_up(void)
+{
+    pthread_mutex_lock(&sta_lock);
+    bool up = !started || has_ip;
+    pthread_mutex_unlock(&sta_lock);
+    return up;
+}
+
+static void post_disconnected(uint8_t reason)
+{
+    wifi_event_sta_disconnected_t ev = { .reason = reason, .rssi = AP_RSSI };
+    memcpy(ev.bssid, ap_bssid, sizeof(ev.bssid));
+    esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &ev, sizeof(ev), 0);
+}
+
+void sim_wifi_drop(void)
+{
+    pthread_mutex_lock(&sta_lock);
+    bool was = associated;
+    associated = false;
+    has_ip = false;
+    attempt++;
+    pthread_mutex_unlock(&sta_lock);
+    if (was) {
+        post_disconnected(200);
+    }
+}
+
+static void *connect_thread(void *arg)
+{
+    unsigned my = (unsigned)(uintptr_t)arg;
+
+    pthread_mutex_lock(&sta_lock);
+    uint32_t assoc_ms = ap_assoc_ms, dhcp_ms = ap_dhcp_ms;
+    bool reachable = ap_reachable;
+    pthread_mutex_unlock(&sta_lock);
+
+    usleep(assoc_ms * 1000);
+    pthread_mutex_lock(&sta_lock);
+    if (my != attempt) {
+        pthread_mutex_unlock(&sta_lock);
+        return NULL;
+    }
+    if (!reachable) {
+        pthread_mutex_unlock(&sta_lock);
+        post_disconnected(201);     /* no AP found */
+        return NULL;
+    }
+    associated = true;
+    pthread_mutex_unlock(&sta_lock);
+
+    wifi_event_sta_connected_t conn = { .channel = AP_CHANNEL, .authmode = WIFI_AUTH_WPA2_PSK };
+    memcpy(conn.bssid, ap_bssid, sizeof(conn.bssid));
+    esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, &conn, sizeof(conn), 0);
+
+    usleep(dhcp_ms * 1000);
+    pthread_mutex_lock(&sta_lock);
+    if (my != attempt) {
+        pthread_mutex_unlock(&sta_lock);
+        return NULL;
+    }
+    has_ip = true;
+    pthread_mutex_unlock(&sta_lock);
+
+    ip_event_got_ip_t got = { .esp_netif = &sta, .ip_changed = true };
+    got.ip_info.ip.addr = AP_IP;
+    esp_event_post(IP_EVENT, IP_EVENT_STA_GOT_IP, &got, sizeof(got), 0);
+    return NULL;
+}
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *config)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode)
+{
+    return ESP_OK;
+}
+
+static wifi_config_t sta_config;
+
+esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t *conf)
+{
+    sta_config = *conf;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_config(wifi_interface_t interface, wifi_config_t *conf)
+{
+    *conf = sta_config;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_ps(wifi_ps_type_t type)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_start(void)
+{
+    pthread_mutex_lock(&sta_lock);
+    started = true;
+    pthread_mutex_unlock(&sta_lock);
+    return esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_START, NULL, 0, 0);
+}
+
+esp_err_t esp_wifi_stop(void)
+{
+    sim_wifi_drop();
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_connect(void)
+{
+    pthread_mutex_lock(&sta_lock);
+    unsigned my = ++attempt;
+    pthread_mutex_unlock(&sta_lock);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, connect_thread, (void *)(uintptr_t)my) != 0) {
+        return ESP_FAIL;
+    }
+    pthread_detach(thread);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_disconnect(void)
+{
+    sim_wifi_drop();
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *ap_info)
+{
+    pthread_mutex_lock(&sta_lock);
+    bool up = associated;
+    pthread_mutex_unlock(&sta_lock);
+    if (!up) {
+        return ESP_ERR_WIFI_NOT_CONNECT;
+    }
+    memset(ap_info, 0, sizeof(*ap_info));
+    memcpy(ap_info->bssid, ap_bssid, sizeof(ap_info->bssid));
+    strcpy((char *)ap_info->ssid, "doorcam-sim");
+    ap_info->primary = AP_CHANNEL;
+    ap_info->rssi = AP_RSSI;
+    ap_info->authmode = WIFI_AUTH_WPA2_PSK;
+    return ESP_OK;
+}
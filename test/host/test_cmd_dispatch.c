@@ -0,0 +1,120 @@
+/* Command dispatch: exact matching of the length-bucketed table, and
+   ns/dispatch against the strncmp chain mqtt_event_handler used to walk. */
+#include <stdio.h>
+#include <string.h>
+#include "host_test.h"
+#include "esp_timer.h"
+#include "cmd_dispatch.h"
+
+#define PREFIX          "home/user123/device01/"
+#define DISPATCHES      1000000
+
+/* the firmware's commands, then made-up ones up to a full table */
+static const char *suffixes[CMD_MAX_COMMANDS] = {
+    "cmd/capture", "cmd/reboot", "cmd/lcd/text", "cmd/lcd/clear", "cmd/diag", "cmd/config",
+    "cmd/led", "cmd/chime", "cmd/volume", "cmd/ota", "cmd/night", "cmd/privacy",
+    "cmd/pir/on", "cmd/pir/off", "cmd/lcd/dim", "cmd/time",
+};
+
+static char topics[CMD_MAX_COMMANDS][64];
+static int hits[CMD_MAX_COMMANDS];
+static volatile int chain_hit;
+
+static void count_hit(const char *data, int data_len, void *ctx)
+{
+    hits[(int)(intptr_t)ctx]++;
+}
+
+/* the old if/else chain, comparing only topic_len bytes */
+static int __attribute__((noinline)) chain_dispatch(const char *topic, int topic_len)
+{
+    for (int i = 0; i < CMD_MAX_COMMANDS; i++) {
+        if (strncmp(topic, topics[i], topic_len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void check_matching(void)
+{
+    char t[96];
+
+    for (int i = 0; i < CMD_MAX_COMMANDS; i++) {
+        memset(hits, 0, sizeof(hits));
+        CHECK(cmd_dispatch(topics[i], strlen(topics[i]), "", 0));
+        CHECK(hits[i] == 1);
+    }
+
+    /* prefixes of a command, which the chain matched */
+    snprintf(t, sizeof(t), PREFIX "cmd/lcd");
+    CHECK(!cmd_dispatch(t, strlen(t), "", 0));
+    CHECK(chain_dispatch(t, strlen(t)) >= 0);
+    snprintf(t, sizeof(t), PREFIX "cmd/captur");
+    CHECK(!cmd_dispatch(t, strlen(t), "", 0));
+
+    /* longer, other device, and topic not NUL-terminated at topic_len */
+    snprintf(t, sizeof(t), PREFIX "cmd/capture2");
+    CHECK(!cmd_dispatch(t, strlen(t), "", 0));
+    snprintf(t, sizeof(t), "home/user123/device02/cmd/capture");
+    CHECK(!cmd_dispatch(t, strlen(t), "", 0));
+    memset(hits, 0, sizeof(hits));
+    snprintf(t, sizeof(t), PREFIX "cmd/rebootXYZ");
+    CHECK(cmd_dispatch(t, strlen(PREFIX "cmd/reboot"), "", 0) && hits[1] == 1);
+}
+
+/* a mix of every command and some unknown topics */
+static const char *workload[CMD_MAX_COMMANDS + 4];
+static int workload_len[CMD_MAX_COMMANDS + 4];
+#define WORKLOAD_N ((int)(sizeof(workload) / sizeof(workload[0])))
+
+static void bench(void)
+{
+    static const char *unknown[] = {
+        PREFIX "cmd/unknown", PREFIX "cmd/lcd/blink", PREFIX "status", PREFIX "cmd/x",
+    };
+    for (int i = 0; i < CMD_MAX_COMMANDS; i++) {
+        workload[i] = topics[i];
+    }
+    for (int i = 0; i < 4; i++) {
+        workload[CMD_MAX_COMMANDS + i] = unknown[i];
+    }
+    for (int i = 0; i < WORKLOAD_N; i++) {
+        workload_len[i] = strlen(workload[i]);
+    }
+
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < DISPATCHES; i++) {
+        int k = i % WORKLOAD_N;
+        cmd_dispatch(workload[k], workload_len[k], "", 0);
+    }
+    double table_ns = (esp_timer_get_time() - start) * 1000.0 / DISPATCHES;
+
+    int acc = 0;
+    start = esp_timer_get_time();
+    for (int i = 0; i < DISPATCHES; i++) {
+        int k = i % WORKLOAD_N;
+        acc += chain_dispatch(workload[k], workload_len[k]);
+    }
+    double chain_ns = (esp_timer_get_time() - start) * 1000.0 / DISPATCHES;
+    chain_hit = acc;
+
+    bench_result("cmd_dispatch", "table_ns_per_dispatch", table_ns, "ns");
+    bench_result("cmd_dispatch", "strncmp_chain_ns_per_dispatch", chain_ns, "ns");
+}
+
+int main(void)
+{
+    cmd_dispatch_set_prefix(PREFIX);
+    for (int i = 0; i < CMD_MAX_COMMANDS; i++) {
+        snprintf(topics[i], sizeof(topics[i]), PREFIX "%s", suffixes[i]);
+        CHECK(mqtt_register_command(suffixes[i], CMD_PRIO_LCD, CMD_FLAG_INLINE,
+                                    count_hit, (void *)(intptr_t)i) == ESP_OK);
+    }
+    CHECK(mqtt_register_command("cmd/overflow", CMD_PRIO_LCD, CMD_FLAG_INLINE, count_hit, NULL) ==
+          ESP_ERR_NO_MEM);
+
+    check_matching();
+    bench();
+    return host_test_result();
+}
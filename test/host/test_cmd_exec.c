@@ -0,0 +1,195 @@
+/* Command executor: priority order and coalescing while the worker is
+   busy, then a flood from several tasks with every command accounted for. */
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include "host_test.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "cmd_exec.h"
+
+#define FLOOD_TASKS     4
+#define FLOOD_COMMANDS  5000
+#define LOG_MAX         64
+
+static SemaphoreHandle_t gate;
+static atomic_bool gate_entered;
+static struct {
+    int prio;
+    int seq;
+} order[LOG_MAX];
+static atomic_int order_len;
+static atomic_uint flood_ran;
+static atomic_int flood_running;
+
+static void gate_cmd(const char *data, int data_len, void *ctx)
+{
+    atomic_store(&gate_entered, true);
+    xSemaphoreTake(gate, portMAX_DELAY);
+}
+
+static void logged_cmd(const char *data, int data_len, void *ctx)
+{
+    int n = atomic_fetch_add(&order_len, 1);
+    if (n < LOG_MAX) {
+        order[n].prio = (intptr_t)ctx;
+        order[n].seq = data_len > 0 ? data[0] : -1;
+    }
+}
+
+/* a second function so coalescing of captures does not touch the others */
+static void capture_cmd(const char *data, int data_len, void *ctx)
+{
+    logged_cmd(data, data_len, ctx);
+}
+
+static bool gate_busy(void)
+{
+    return atomic_load(&gate_entered);
+}
+
+static int expected_total;
+
+static bool all_ran(void)
+{
+    return atomic_load(&order_len) >= expected_total;
+}
+
+static void submit(cmd_prio_t prio, uint32_t flags, cmd_fn_t fn, char seq, esp_err_t expect)
+{
+    CHECK(cmd_exec_submit(prio, flags, fn, (void *)(intptr_t)prio, &seq, 1) == expect);
+}
+
+static void check_order_and_coalescing(void)
+{
+    cmd_exec_stats_t before, st;
+    cmd_exec_get_stats(&before);
+
+    /* hold the only worker so everything below piles up */
+    CHECK(cmd_exec_submit(CMD_PRIO_LCD, 0, gate_cmd, NULL, NULL, 0) == ESP_OK);
+    CHECK(host_wait_for(gate_busy, 1000));
+
+    for (char i = 0; i < CMD_QUEUE_LEN; i++) {
+        submit(CMD_PRIO_LCD, 0, logged_cmd, i, ESP_OK);
+    }
+    for (char i = 0; i < 3; i++) {
+        submit(CMD_PRIO_LCD, 0, logged_cmd, 100 + i, ESP_ERR_NO_MEM);
+    }
+    for (char i = 0; i < 50; i++) {
+        submit(CMD_PRIO_CAPTURE, CMD_FLAG_COALESCE, capture_cmd, i, ESP_OK);
+    }
+    for (char i = 0; i < 3; i++) {
+        submit(CMD_PRIO_REBOOT, 0, logged_cmd, i, ESP_OK);
+    }
+
+    cmd_exec_get_stats(&st);
+    CHECK(st.depth[CMD_PRIO_REBOOT] == 3);
+    CHECK(st.depth[CMD_PRIO_CAPTURE] == 1);
+    CHECK(st.depth[CMD_PRIO_LCD] == CMD_QUEUE_LEN);
+
+    expected_total = 3 + 1 + CMD_QUEUE_LEN;
+    xSemaphoreGive(gate);
+    CHECK(host_wait_for(all_ran, 2000));
+
+    /* reboots, then the first capture, then the LCD commands in order */
+    CHECK(atomic_load(&order_len) == expected_total);
+    for (int i = 0; i < 3; i++) {
+        CHECK(order[i].prio == CMD_PRIO_REBOOT && order[i].seq == i);
+    }
+    CHECK(order[3].prio == CMD_PRIO_CAPTURE && order[3].seq == 0);
+    for (int i = 0; i < CMD_QUEUE_LEN; i++) {
+        CHECK(order[4 + i].prio == CMD_PRIO_LCD && order[4 + i].seq == i);
+    }
+
+    cmd_exec_get_stats(&st);
+    CHECK(st.coalesced - before.coalesced == 49);
+    CHECK(st.dropped - before.dropped == 3);
+    CHECK(st.executed - before.executed == 1 + expected_total);
+
+    /* once run, a capture queues again */
+    atomic_store(&order_len, 0);
+    expected_total = 1;
+    submit(CMD_PRIO_CAPTURE, CMD_FLAG_COALESCE, capture_cmd, 7, ESP_OK);
+    CHECK(host_wait_for(all_ran, 1000));
+    CHECK(order[0].seq == 7);
+}
+
+static void flood_cmd(const char *data, int data_len, void *ctx)
+{
+    atomic_fetch_add(&flood_ran, 1);
+}
+
+static void flood_capture(const char *data, int data_len, void *ctx)
+{
+    atomic_fetch_add(&flood_ran, 1);
+}
+
+static atomic_uint flood_refused;
+
+static void flood_task(void *arg)
+{
+    for (int i = 0; i < FLOOD_COMMANDS; i++) {
+        cmd_prio_t prio = (cmd_prio_t)(i % CMD_PRIO_COUNT);
+        bool capture = prio == CMD_PRIO_CAPTURE;
+        if (cmd_exec_submit(prio, capture ? CMD_FLAG_COALESCE : 0,
+                            capture ? flood_capture : flood_cmd, NULL, "x", 1) != ESP_OK) {
+            atomic_fetch_add(&flood_refused, 1);
+        }
+        if (i % 64 == 0) {
+            taskYIELD();
+        }
+    }
+    atomic_fetch_sub(&flood_running, 1);
+    vTaskDelete(NULL);
+}
+
+static cmd_exec_stats_t flood_before;
+
+static bool flood_drained(void)
+{
+    cmd_exec_stats_t st;
+    cmd_exec_get_stats(&st);
+    return atomic_load(&flood_running) == 0 &&
+           st.depth[0] + st.depth[1] + st.depth[2] == 0 &&
+           st.executed - flood_before.executed == atomic_load(&flood_ran);
+}
+
+static void bench_flood(void)
+{
+    cmd_exec_stats_t st;
+    cmd_exec_get_stats(&flood_before);
+
+    atomic_store(&flood_running, FLOOD_TASKS);
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < FLOOD_TASKS; i++) {
+        xTaskCreate(flood_task, "cmd_flood", 2048, NULL, 3, NULL);
+    }
+    CHECK(host_wait_for(flood_drained, 30000));
+    int64_t elapsed = esp_timer_get_time() - start;
+    cmd_exec_get_stats(&st);
+
+    uint32_t submitted = FLOOD_TASKS * FLOOD_COMMANDS;
+    uint32_t executed = st.executed - flood_before.executed;
+    uint32_t coalesced = st.coalesced - flood_before.coalesced;
+    uint32_t dropped = st.dropped - flood_before.dropped;
+    /* every command either ran, was folded into a pending capture or was refused */
+    CHECK(executed + coalesced + dropped == submitted);
+    CHECK(dropped == atomic_load(&flood_refused));
+
+    bench_result("cmd_exec_flood", "commands_per_s", executed * 1e6 / elapsed, "cmd/s");
+    bench_result("cmd_exec_flood", "coalesced", coalesced, "count");
+    bench_result("cmd_exec_flood", "dropped", dropped, "count");
+    bench_result("cmd_exec_flood", "max_wait_us", st.max_wait_us, "us");
+}
+
+int main(void)
+{
+    gate = xSemaphoreCreateBinary();
+    CHECK(cmd_exec_init() == ESP_OK);
+
+    check_order_and_coalescing();
+    bench_flood();
+    return host_test_result();
+}
@@ -0,0 +1,138 @@
+/* Firmware core against the simulated station and broker: publish
+   throughput, command dispatch latency, run-time topic IDs and cmd/config
+   without a provisioning key. */
+#include <stdatomic.h>
+#include <string.h>
+#include "host_test.h"
+#include "host_doorcam.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "wifi.h"
+#include "mqqt_client.h"
+#include "cmd_dispatch.h"
+#include "topics.h"
+
+#define PUBLISH_COUNT   2000
+#define PAYLOAD_LEN     64
+#define COMMAND_COUNT   200
+#define UPLINK_BYTES_S  1000000     /* ~8 Mbit/s, a typical ESP32 TCP uplink */
+
+static SemaphoreHandle_t cmd_done;
+static atomic_llong cmd_run_us;
+
+static void cmd_bench(const char *data, int data_len, void *ctx)
+{
+    atomic_store(&cmd_run_us, esp_timer_get_time());
+    xSemaphoreGive(cmd_done);
+}
+
+static int cmp_i64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void bench_publish(int qos)
+{
+    char payload[PAYLOAD_LEN];
+    memset(payload, 'x', sizeof(payload));
+    sim_broker_stats_t st;
+
+    sim_broker_reset_stats();
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < PUBLISH_COUNT; i++) {
+        CHECK(mqtt_publish_topic(TOPIC_TELEMETRY, payload, sizeof(payload), qos, false) >= 0);
+    }
+    CHECK(mqtt_wait_idle(5000));
+    int64_t elapsed = esp_timer_get_time() - start;
+    sim_broker_get_stats(&st);
+
+    CHECK(st.publishes >= PUBLISH_COUNT);
+    const char *suite = qos ? "publish_qos1" : "publish_qos0";
+    bench_result(suite, "msgs_per_s", PUBLISH_COUNT * 1e6 / elapsed, "msg/s");
+    bench_result(suite, "wire_bytes_per_msg", (double)st.bytes_up / st.publishes, "B");
+}
+
+static void bench_commands(void)
+{
+    static int64_t lat[COMMAND_COUNT];
+    char topic[128];
+    snprintf(topic, sizeof(topic), "%scmd/bench", topic_get(TOPIC_PREFIX));
+
+    int routed = 0;
+    for (int i = 0; i < COMMAND_COUNT; i++) {
+        int64_t sent = esp_timer_get_time();
+        if (!sim_broker_inject(topic, "1", 1)) {
+            continue;
+        }
+        routed++;
+        if (xSemaphoreTake(cmd_done, pdMS_TO_TICKS(1000)) != pdTRUE) {
+            CHECK(!"command not executed");
+            continue;
+        }
+        lat[i] = atomic_load(&cmd_run_us) - sent;
+    }
+    CHECK(routed == COMMAND_COUNT);
+
+    qsort(lat, COMMAND_COUNT, sizeof(lat[0]), cmp_i64);
+    int64_t sum = 0;
+    for (int i = 0; i < COMMAND_COUNT; i++) {
+        sum += lat[i];
+    }
+    bench_result("command_dispatch", "mean_latency", (double)sum / COMMAND_COUNT, "us");
+    bench_result("command_dispatch", "p99_latency", (double)lat[COMMAND_COUNT * 99 / 100], "us");
+}
+
+/* provisioned IDs: rebuilt in the same buffers, longest IDs fit */
+/* with the client running, so under its lock */
+static void check_topic_ids(void)
+{
+    mqtt_topics_lock();
+    CHECK(topics_set_ids("7", "12") == ESP_OK);
+    const char *first = topic_get(TOPIC_CAM_META);
+    CHECK(strcmp(first, "home/user7/device12/cam/img_metadata") == 0);
+    CHECK(topic_len(TOPIC_CAM_META) == strlen(first));
+
+    char id[TOPIC_ID_MAX + 2];
+    memset(id, '9', sizeof(id) - 1);
+    id[sizeof(id) - 1] = 0;
+    CHECK(topics_set_ids(id, "1") == ESP_ERR_INVALID_SIZE);
+    CHECK(topics_set_ids("a/b", "1") == ESP_ERR_INVALID_ARG);
+    id[TOPIC_ID_MAX] = 0;
+    CHECK(topics_set_ids(id, id) == ESP_OK);
+    CHECK(topic_get(TOPIC_CAM_META) == first);
+    CHECK(topic_len(TOPIC_CAM_META) == strlen("home/user/device/cam/img_metadata") + 2 * TOPIC_ID_MAX);
+    CHECK(topic_len(TOPIC_CAM_META) == strlen(first));
+
+    CHECK(topics_set_ids(NULL, NULL) == ESP_OK);
+    CHECK(strcmp(topic_get(TOPIC_PREFIX), TOPIC_BASE) == 0);
+    mqtt_topics_unlock();
+}
+
+/* no provisioning key: cmd/config is taken and dropped, not unknown */
+static void check_config_without_key(void)
+{
+    char topic[128];
+    snprintf(topic, sizeof(topic), "%scmd/config", topic_get(TOPIC_PREFIX));
+    CHECK(CONFIG_DOORCAM_PROVISION_KEY[0] == 0);
+    CHECK(cmd_dispatch(topic, strlen(topic), "uri=mqtt://x\n", 13));
+}
+
+int main(void)
+{
+    cmd_done = xSemaphoreCreateBinary();
+    sim_broker_config_t cfg;
+    sim_broker_default_config(&cfg);
+    cfg.bytes_per_s = UPLINK_BYTES_S;
+    host_doorcam_start(&cfg);
+    CHECK(mqtt_register_command("cmd/bench", CMD_PRIO_LCD, 0, cmd_bench, NULL) == ESP_OK);
+
+    bench_publish(0);
+    bench_publish(1);
+    bench_commands();
+    check_topic_ids();
+    check_config_without_key();
+    return host_test_result();
+}
@@ -0,0 +1,146 @@
+/* Frame pool: concurrent acquire/ref/release from more tasks than slabs,
+   then capture, doorbell and cmd/capture overlapping against the broker
+   with the firmware's heap calls counted. */
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include "host_test.h"
+#include "host_doorcam.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "camera.h"
+#include "frame_pool.h"
+#include "mqqt_client.h"
+#include "topics.h"
+
+#define STRESS_TASKS    6
+#define STRESS_SLABS    4
+#define STRESS_ROUNDS   50000
+#define WARMUP_ROUNDS   4
+#define STEADY_ROUNDS   40
+#define UPLINK_BYTES_S  1000000
+
+static frame_pool_t stress_pool;
+static atomic_int stress_running;
+static atomic_uint stress_ops;
+static atomic_uint stress_clashes;
+
+static atomic_uint frames_published;
+
+/* each task stamps the slab it holds; another stamp means a shared slab */
+static void stress_task(void *arg)
+{
+    uint32_t me = (uintptr_t)arg, seen;
+
+    for (int i = 0; i < STRESS_ROUNDS; i++) {
+        frame_t *fb = frame_pool_acquire(&stress_pool);
+        if (fb == NULL) {
+            taskYIELD();
+            continue;
+        }
+        memcpy(fb->buf, &me, sizeof(me));
+        /* a second holder, as when a frame is queued for publishing */
+        frame_ref(fb);
+        memcpy(&seen, fb->buf, sizeof(seen));
+        frame_release(fb);
+        if (seen != me) {
+            atomic_fetch_add(&stress_clashes, 1);
+        }
+        memcpy(&seen, fb->buf, sizeof(seen));
+        if (seen != me) {
+            atomic_fetch_add(&stress_clashes, 1);
+        }
+        frame_release(fb);
+        atomic_fetch_add(&stress_ops, 1);
+    }
+    atomic_fetch_sub(&stress_running, 1);
+    vTaskDelete(NULL);
+}
+
+static bool stress_finished(void)
+{
+    return atomic_load(&stress_running) == 0;
+}
+
+static void bench_stress(void)
+{
+    CHECK(frame_pool_init(&stress_pool, STRESS_SLABS, 64) == ESP_OK);
+
+    atomic_store(&stress_running, STRESS_TASKS);
+    int64_t start = esp_timer_get_time();
+    for (uintptr_t i = 0; i < STRESS_TASKS; i++) {
+        xTaskCreate(stress_task, "pool_stress", 2048, (void *)(i + 1), 1, NULL);
+    }
+    CHECK(host_wait_for(stress_finished, 60000));
+    int64_t elapsed = esp_timer_get_time() - start;
+
+    CHECK(atomic_load(&stress_clashes) == 0);
+    CHECK(frame_pool_available(&stress_pool) == STRESS_SLABS);
+    bench_result("frame_pool", "handoffs_per_s", atomic_load(&stress_ops) * 1e6 / elapsed, "ops/s");
+}
+
+static void on_publish(const sim_broker_msg_t *msg, void *ctx)
+{
+    size_t n = strlen(msg->topic), m = strlen("cam/img_metadata");
+    if (n >= m && strcmp(msg->topic + n - m, "cam/img_metadata") == 0) {
+        atomic_fetch_add(&frames_published, 1);
+    }
+}
+
+static unsigned expected;
+
+static bool round_published(void)
+{
+    return atomic_load(&frames_published) >= expected;
+}
+
+/* a doorbell press and a cmd/capture at the same time: two frames */
+static void pipeline_round(const char *capture_topic)
+{
+    expected += 2;
+    CHECK(sim_broker_inject(capture_topic, "", 0));
+    publish_doorbell_event(NULL);
+    CHECK(host_wait_for(round_published, 5000));
+    CHECK(mqtt_wait_idle(5000));
+}
+
+static void bench_steady_state(void)
+{
+    char topic[128];
+    snprintf(topic, sizeof(topic), "%scmd/capture", topic_get(TOPIC_PREFIX));
+
+    for (int i = 0; i < WARMUP_ROUNDS; i++) {
+        pipeline_round(topic);
+    }
+
+    uint32_t allocs = sim_heap_allocs();
+    unsigned frames = atomic_load(&frames_published);
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < STEADY_ROUNDS; i++) {
+        pipeline_round(topic);
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    allocs = sim_heap_allocs() - allocs;
+    frames = atomic_load(&frames_published) - frames;
+
+    CHECK(frames == 2 * STEADY_ROUNDS);
+    CHECK(allocs == 0);
+    bench_result("frame_pipeline", "heap_allocs_per_frame", (double)allocs / frames, "count");
+    bench_result("frame_pipeline", "frames_per_s", frames * 1e6 / elapsed, "frames/s");
+}
+
+int main(void)
+{
+    bench_stress();
+
+    CHECK(camera_init() == ESP_OK);
+    sim_broker_on_publish(on_publish, NULL);
+    sim_broker_config_t cfg;
+    sim_broker_default_config(&cfg);
+    cfg.bytes_per_s = UPLINK_BYTES_S;
+    host_doorcam_start(&cfg);
+
+    bench_steady_state();
+    return host_test_result();
+}
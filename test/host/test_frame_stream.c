@@ -0,0 +1,187 @@
+/* Chunked frame streaming: frames are reassembled from the chunk headers
+   the broker sees, with telemetry PUBACKs mixed in, and the bytes the
+   streamer copies are counted. */
+#include <stdio.h>
+#include <string.h>
+#include "host_test.h"
+#include "host_doorcam.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "frame_pool.h"
+#include "frame_stream.h"
+#include "mqqt_client.h"
+#include "topics.h"
+
+#define MAX_FRAME       (64 * 1024)
+#define MAX_CHUNKS      (MAX_FRAME / FRAME_STREAM_CHUNK_SIZE)
+#define RX_FRAMES       16
+#define UPLINK_BYTES_S  1000000
+
+static const size_t frame_sizes[] = { 75, 4096, 4097, 20000, 65536, 65536, 33333 };
+#define FRAME_COUNT (sizeof(frame_sizes) / sizeof(frame_sizes[0]))
+
+static struct {
+    size_t size;                /* from the metadata */
+    int chunks;
+    int received;
+    bool seen[MAX_CHUNKS];
+    bool bad;
+    uint8_t buf[MAX_FRAME];
+} rx[RX_FRAMES];
+
+static frame_pool_t pool;
+static volatile bool telemetry_run;
+
+static bool ends_with(const char *s, const char *suffix)
+{
+    size_t n = strlen(s), m = strlen(suffix);
+    return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+static void on_publish(const sim_broker_msg_t *msg, void *ctx)
+{
+    if (ends_with(msg->topic, "cam/img_metadata")) {
+        char json[256];
+        unsigned id, size, chunks;
+        snprintf(json, sizeof(json), "%.*s", msg->len, (const char *)msg->data);
+        const char *s = strstr(json, "\"size\":"), *c = strstr(json, "\"chunks\":");
+        if (sscanf(json, "{\"frame\":%u", &id) == 1 && s && c && id < RX_FRAMES &&
+            sscanf(s, "\"size\":%u", &size) == 1 && sscanf(c, "\"chunks\":%u", &chunks) == 1) {
+            rx[id].size = size;
+            rx[id].chunks = chunks;
+        }
+        return;
+    }
+    if (!ends_with(msg->topic, "cam/image")) {
+        return;
+    }
+
+    frame_chunk_hdr_t hdr;
+    const uint8_t *data = msg->data;
+    int len = msg->len;
+    if (msg->correlation_len == sizeof(hdr)) {
+        memcpy(&hdr, msg->correlation, sizeof(hdr));
+    } else {
+        /* MQTT 3.1.1: in front of the chunk */
+        CHECK(len >= (int)sizeof(hdr));
+        memcpy(&hdr, data, sizeof(hdr));
+        data += sizeof(hdr);
+        len -= sizeof(hdr);
+    }
+    if (hdr.frame_id >= RX_FRAMES || hdr.chunk_idx >= MAX_CHUNKS || hdr.chunk_idx >= hdr.total) {
+        CHECK(!"bad chunk header");
+        return;
+    }
+    typeof(rx[0]) *f = &rx[hdr.frame_id];
+    size_t off = (size_t)hdr.chunk_idx * FRAME_STREAM_CHUNK_SIZE;
+    if (f->seen[hdr.chunk_idx] || hdr.total != f->chunks || off + len > MAX_FRAME) {
+        f->bad = true;
+        return;
+    }
+    memcpy(f->buf + off, data, len);
+    f->seen[hdr.chunk_idx] = true;
+    f->received++;
+}
+
+static uint8_t pattern(uint32_t frame, size_t i)
+{
+    return (uint8_t)(i * 31 + frame * 7 + (i >> 8));
+}
+
+/* QoS 1 telemetry whose PUBACKs interleave with the chunks' */
+static void telemetry_noise(void *arg)
+{
+    while (telemetry_run) {
+        mqtt_publish_topic(TOPIC_TELEMETRY, "{}", 0, 1, false);
+        vTaskDelay(pdMS_TO_TICKS(2));
+    }
+    vTaskDelete(NULL);
+}
+
+static void bench_frames(void)
+{
+    frame_stream_stats_t before, after;
+    sim_broker_stats_t st;
+    size_t total = 0;
+
+    frame_stream_get_stats(&before);
+    sim_broker_reset_stats();
+    telemetry_run = true;
+    xTaskCreate(telemetry_noise, "telemetry_noise", 4096, NULL, 1, NULL);
+
+    int64_t start = esp_timer_get_time();
+    for (uint32_t id = 0; id < FRAME_COUNT; id++) {
+        frame_t *fb = frame_pool_acquire(&pool);
+        fb->len = frame_sizes[id];
+        fb->width = fb->height = 0;
+        fb->timestamp_us = esp_timer_get_time();
+        for (size_t i = 0; i < fb->len; i++) {
+            fb->buf[i] = pattern(id, i);
+        }
+        CHECK(frame_stream_publish(fb) == ESP_OK);
+        total += fb->len;
+        frame_release(fb);
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    telemetry_run = false;
+
+    frame_stream_get_stats(&after);
+    sim_broker_get_stats(&st);
+    for (uint32_t id = 0; id < FRAME_COUNT; id++) {
+        bool intact = rx[id].size == frame_sizes[id] && rx[id].received == rx[id].chunks && !rx[id].bad;
+        for (size_t i = 0; intact && i < rx[id].size; i++) {
+            intact = rx[id].buf[i] == pattern(id, i);
+        }
+        CHECK(intact);
+    }
+    CHECK(after.ack_timeouts == before.ack_timeouts);
+
+    bench_result("frame_stream", "bytes_copied_per_frame",
+                 (double)(after.bytes_copied - before.bytes_copied) / FRAME_COUNT, "B");
+    bench_result("frame_stream", "throughput", total / (elapsed / 1e6) / 1024, "KiB/s");
+}
+
+/* chunks that expire unacknowledged end the frame right away */
+static void check_deleted(void)
+{
+    sim_broker_config_t cfg;
+    frame_stream_stats_t st;
+
+    sim_broker_default_config(&cfg);
+    cfg.bytes_per_s = UPLINK_BYTES_S;
+    cfg.hold_acks = true;
+    cfg.outbox_expire_ms = 200;
+    sim_broker_configure(&cfg);
+
+    frame_t *fb = frame_pool_acquire(&pool);
+    fb->len = 20000;
+    int64_t start = esp_timer_get_time();
+    CHECK(frame_stream_publish(fb) != ESP_OK);
+    CHECK(esp_timer_get_time() - start < FRAME_STREAM_ACK_TIMEOUT_MS * 1000LL / 2);
+    frame_stream_get_stats(&st);
+    CHECK(st.chunks_deleted > 0);
+
+    /* the window is whole again */
+    cfg.hold_acks = false;
+    cfg.outbox_expire_ms = 0;
+    sim_broker_configure(&cfg);
+    sim_broker_release_acks();
+    CHECK(frame_stream_publish(fb) == ESP_OK);
+    frame_release(fb);
+}
+
+int main(void)
+{
+    CHECK(frame_pool_init(&pool, 1, MAX_FRAME) == ESP_OK);
+    sim_broker_on_publish(on_publish, NULL);
+
+    sim_broker_config_t cfg;
+    sim_broker_default_config(&cfg);
+    cfg.bytes_per_s = UPLINK_BYTES_S;
+    host_doorcam_start(&cfg);
+
+    bench_frames();
+    check_deleted();
+    return host_test_result();
+}
@@ -0,0 +1,216 @@
+/* Keyboard report decoder of the BLE client: the server's report map, boot
+   and report-protocol input, rollover, the event ring filling up, and
+   ns/report for a typed text. */
+#include "ble_hid_server.c"     /* for its report_map */
+#include "host_test.h"
+#include "hid_decoder.h"
+
+#define TYPED_TEXT  "The quick brown fox jumps over the lazy dog 0123456789\n"
+#define BENCH_ROUNDS 20000
+#define MAX_EVENTS  HID_EVENT_RING_SIZE
+
+static hid_key_event_t got[MAX_EVENTS];
+static int got_n;
+
+static void collect(const hid_key_event_t *ev, void *ctx)
+{
+    if (got_n < MAX_EVENTS) {
+        got[got_n] = *ev;
+    }
+    got_n++;
+}
+
+static int drain(void)
+{
+    got_n = 0;
+    hid_decoder_drain(collect, NULL);
+    return got_n;
+}
+
+static bool event_is(int i, uint8_t keycode, bool pressed, const char *utf8)
+{
+    return i < got_n && got[i].keycode == keycode && got[i].pressed == pressed &&
+           strcmp(got[i].utf8, utf8) == 0;
+}
+
+static void check_server_map(void)
+{
+    hid_decoder_t d;
+    hid_decoder_init(&d, 0);
+
+    /* both collections use report ID 1: one keyboard layout */
+    CHECK(hid_decoder_parse_report_map(&d, report_map, sizeof(report_map)) == 1);
+    CHECK(hid_decoder_has_layout(&d, 1));
+    CHECK(!hid_decoder_has_layout(&d, 2));
+    CHECK(d.layouts[0].id == 1 && d.layouts[0].mod_bit == 0 && d.layouts[0].keys_bit == 16 &&
+          d.layouts[0].keys_count == 6);
+
+    /* report 1 as the server sends it, without the ID byte */
+    CHECK(hid_decoder_feed(&d, 1, (const uint8_t[8]){ 0x02, 0, 0x04 }, 8, 1) == 2);
+    CHECK(drain() == 2);
+    CHECK(event_is(0, 0xE1, true, "") && event_is(1, 0x04, true, "A"));
+    CHECK(got[1].report_id == 1 && got[1].modifiers == 0x02);
+
+    /* an ID the map has no keyboard layout for */
+    CHECK(hid_decoder_feed(&d, 2, (const uint8_t[4]){ 0, 0, 0x05 }, 4, 2) == 0);
+}
+
+static void check_boot(void)
+{
+    hid_decoder_t d;
+    hid_decoder_init(&d, 7);
+
+    /* two keys, then one released, then shift lifted with the other */
+    CHECK(hid_decoder_feed(&d, HID_BOOT_REPORT_ID, (const uint8_t[8]){ 0, 0, 0x0B, 0x0C }, 8, 1) == 2);
+    CHECK(hid_decoder_feed(&d, HID_BOOT_REPORT_ID, (const uint8_t[8]){ 0x20, 0, 0x0C }, 8, 2) == 2);
+    CHECK(hid_decoder_feed(&d, HID_BOOT_REPORT_ID, (const uint8_t[8]){ 0 }, 8, 3) == 2);
+    CHECK(drain() == 6);
+    CHECK(event_is(0, 0x0B, true, "h") && event_is(1, 0x0C, true, "i"));
+    /* releases before modifier changes */
+    CHECK(event_is(2, 0x0B, false, "") && event_is(3, 0xE5, true, ""));
+    CHECK(event_is(4, 0x0C, false, "") && event_is(5, 0xE5, false, ""));
+    CHECK(got[0].source == 7 && got[5].timestamp_ms == 3);
+
+    /* phantom state keeps the last report */
+    CHECK(hid_decoder_feed(&d, HID_BOOT_REPORT_ID, (const uint8_t[8]){ 0, 0, 0x04 }, 8, 4) == 1);
+    CHECK(hid_decoder_feed(&d, HID_BOOT_REPORT_ID, (const uint8_t[8]){ 0, 0, 1, 1, 1, 1, 1, 1 }, 8, 5) == 0);
+    CHECK(hid_decoder_feed(&d, HID_BOOT_REPORT_ID, (const uint8_t[8]){ 0, 0, 0x04 }, 8, 6) == 0);
+
+    /* short report: missing bytes read as zero */
+    CHECK(hid_decoder_feed(&d, HID_BOOT_REPORT_ID, (const uint8_t[2]){ 0, 0 }, 2, 7) == 1);
+    drain();
+    CHECK(event_is(1, 0x04, false, ""));
+
+    /* reset forgets the keys held */
+    CHECK(hid_decoder_feed(&d, HID_BOOT_REPORT_ID, (const uint8_t[8]){ 0, 0, 0x04 }, 8, 8) == 1);
+    hid_decoder_reset(&d);
+    CHECK(hid_decoder_feed(&d, HID_BOOT_REPORT_ID, (const uint8_t[8]){ 0, 0, 0x04 }, 8, 9) == 1);
+    hid_decoder_reset(&d);
+    drain();
+}
+
+/* a link lost with keys down: one release each, modifiers last */
+static void check_release_all(void)
+{
+    hid_decoder_t d;
+    hid_decoder_init(&d, 2);
+    CHECK(hid_decoder_parse_report_map(&d, report_map, sizeof(report_map)) == 1);
+
+    CHECK(hid_decoder_feed(&d, 1, (const uint8_t[8]){ 0x02, 0, 0x04, 0x05 }, 8, 1) == 3);
+    CHECK(hid_decoder_feed(&d, HID_BOOT_REPORT_ID, (const uint8_t[8]){ 0, 0, 0x06 }, 8, 2) == 1);
+    drain();
+
+    CHECK(hid_decoder_release_all(&d, 3) == 4);
+    CHECK(drain() == 4);
+    CHECK(event_is(0, 0x04, false, "") && event_is(1, 0x05, false, "") && event_is(2, 0xE1, false, ""));
+    CHECK(got[0].report_id == 1 && got[2].modifiers == 0);
+    CHECK(event_is(3, 0x06, false, "") && got[3].report_id == HID_BOOT_REPORT_ID);
+    CHECK(got[3].source == 2 && got[3].timestamp_ms == 3);
+
+    /* nothing held any more */
+    CHECK(hid_decoder_release_all(&d, 4) == 0);
+    CHECK(hid_decoder_feed(&d, 1, (const uint8_t[8]){ 0 }, 8, 5) == 0);
+}
+
+/* a map with its key array ahead of the modifiers, under report ID 3 */
+static void check_custom_layout(void)
+{
+    static const uint8_t map[] = {
+        0x05, 0x01, 0x09, 0x06, 0xA1, 0x01,
+        0x85, 0x03,                     /* Report ID 3 */
+        0x05, 0x07, 0x19, 0x00, 0x29, 0x65, 0x75, 0x08, 0x95, 0x04, 0x81, 0x00,    /* 4 keys */
+        0x19, 0xE0, 0x29, 0xE7, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02,                /* modifiers */
+        0xC0,
+        0x05, 0x0C, 0x09, 0x01, 0xA1, 0x01, 0x85, 0x04,     /* consumer, ID 4 */
+        0x75, 0x10, 0x95, 0x01, 0x81, 0x00, 0xC0,
+    };
+    hid_decoder_t d;
+    hid_decoder_init(&d, 1);
+
+    CHECK(hid_decoder_parse_report_map(&d, map, sizeof(map)) == 1);
+    CHECK(hid_decoder_has_layout(&d, 3) && !hid_decoder_has_layout(&d, 4));
+    CHECK(hid_decoder_feed(&d, 3, (const uint8_t[5]){ 0x1E, 0, 0, 0, 0x02 }, 5, 1) == 2);
+    CHECK(drain() == 2);
+    CHECK(event_is(0, 0xE1, true, "") && event_is(1, 0x1E, true, "!"));
+    CHECK(hid_decoder_feed(&d, 4, (const uint8_t[2]){ 0xE9, 0 }, 2, 2) == 0);
+}
+
+static void check_ring_full(void)
+{
+    hid_decoder_t d;
+    hid_decoder_init(&d, 0);
+    uint32_t dropped = hid_decoder_dropped();
+
+    /* one press and one release per round, nobody draining */
+    int queued = 0;
+    for (int i = 0; i < HID_EVENT_RING_SIZE; i++) {
+        queued += hid_decoder_feed(&d, HID_BOOT_REPORT_ID, (const uint8_t[8]){ 0, 0, 0x04 + i % 26 }, 8, i);
+        queued += hid_decoder_feed(&d, HID_BOOT_REPORT_ID, (const uint8_t[8]){ 0 }, 8, i);
+    }
+    CHECK(queued == HID_EVENT_RING_SIZE);
+    CHECK(hid_decoder_dropped() - dropped == HID_EVENT_RING_SIZE);
+    CHECK(drain() == HID_EVENT_RING_SIZE);
+    CHECK(event_is(0, 0x04, true, "a"));
+}
+
+/* the US map the server's ascii_to_hid() uses, fed as boot reports */
+static void bench(void)
+{
+    static uint8_t reports[2 * sizeof(TYPED_TEXT)][8];
+    int n = 0;
+    uint8_t mod, code;
+
+    for (const char *c = TYPED_TEXT; *c; c++) {
+        if (ascii_to_hid(*c, &mod, &code)) {
+            memset(reports[n], 0, 8);
+            reports[n][0] = mod;
+            reports[n++][2] = code;
+            memset(reports[n++], 0, 8);
+        }
+    }
+
+    hid_decoder_t d;
+    hid_decoder_init(&d, 0);
+    char text[sizeof(TYPED_TEXT)];
+    int len = 0;
+    for (int i = 0; i < n; i++) {
+        hid_decoder_feed(&d, HID_BOOT_REPORT_ID, reports[i], 8, i);
+        drain();
+        for (int e = 0; e < got_n; e++) {
+            if (got[e].pressed && got[e].utf8[0]) {
+                text[len++] = got[e].utf8[0];
+            }
+        }
+    }
+    text[len] = 0;
+    CHECK(strcmp(text, TYPED_TEXT) == 0);
+
+    int64_t start = esp_timer_get_time();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        for (int i = 0; i < n; i++) {
+            hid_decoder_feed(&d, HID_BOOT_REPORT_ID, reports[i], 8, i);
+        }
+        hid_decoder_drain(collect, NULL);
+        got_n = 0;
+    }
+    double ns = (esp_timer_get_time() - start) * 1000.0 / ((double)BENCH_ROUNDS * n);
+    bench_result("hid_decoder", "ns_per_report", ns, "ns");
+
+    start = esp_timer_get_time();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        hid_decoder_parse_report_map(&d, report_map, sizeof(report_map));
+    }
+    bench_result("hid_decoder", "report_map_parse_ns",
+                 (esp_timer_get_time() - start) * 1000.0 / BENCH_ROUNDS, "ns");
+}
+
+int main(void)
+{
+    check_server_map();
+    check_boot();
+    check_release_all();
+    check_custom_layout();
+    check_ring_full();
+    bench();
+    return host_test_result();
+}
@@ -0,0 +1,258 @@
+/* BLE HID keyboard against the simulated Bluedroid stack and a central:
+   app_main to advertising, service discovery, keystrokes/s with the
+   scheduler's timing jitter, and typing through a congested link and lost
+   confirmations. */
+#include "ble_hid_server.c"     /* the keyboard's statics are what is under test */
+#include "host_test.h"
+#include "sim_bt.h"
+
+#define TYPED_TEXT      "the quick brown fox jumps over the lazy dog 0123456789\n"
+#define TYPED_REPEAT    2
+#define CONGESTED_TEXT  "pack my box with five dozen liquor jugs\n"
+
+static struct {
+    const char *expect;         /* next key of the typed text to see pressed */
+    uint32_t reports;
+    bool released;              /* last report had no key down */
+    int64_t first_us;
+    int64_t last_us;
+    int64_t press_us;
+    uint32_t holds;
+    uint32_t hold_dev_max_us;   /* press to release, off HID_KEY_HOLD_MS */
+    uint64_t hold_dev_total_us;
+} rx = { .expect = "" };
+
+static void on_notify(uint16_t handle, const uint8_t *data, int len, void *ctx)
+{
+    if (handle != hid.handles[IDX_BOOT_INPUT_VAL] || len != 8) {
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+    if (rx.reports++ == 0) {
+        rx.first_us = now;
+    }
+    rx.last_us = now;
+    if (data[2]) {
+        rx.press_us = now;
+    } else if (!rx.released && rx.press_us) {
+        int64_t dev = now - rx.press_us - HID_KEY_HOLD_MS * 1000;
+        uint32_t d = dev < 0 ? -dev : dev;
+        rx.holds++;
+        rx.hold_dev_total_us += d;
+        if (d > rx.hold_dev_max_us) {
+            rx.hold_dev_max_us = d;
+        }
+    }
+    rx.released = data[2] == 0;
+
+    /* random keys from random_sender_task may land in between */
+    uint8_t mod, code;
+    if (*rx.expect && data[2] && ascii_to_hid(*rx.expect, &mod, &code) &&
+        data[0] == mod && data[2] == code) {
+        rx.expect++;
+    }
+}
+
+static bool advertising_started(void)
+{
+    sim_bt_stats_t st;
+    sim_bt_get_stats(&st);
+    return st.first_adv_us != 0;
+}
+
+static bool fast_interval(void)
+{
+    return hid_conn_stats.interval == HID_FAST_ITVL_MIN;
+}
+
+static bool idle_check_stopped(void)
+{
+    return hid.conn_id == 0xFFFF && !esp_timer_is_active(hid_idle_timer);
+}
+
+static bool typed_all(void)
+{
+    return *rx.expect == 0 && rx.released;
+}
+
+/* what a HID host reads and enables after connecting */
+static void bench_discovery(void)
+{
+    uint8_t buf[ESP_GATT_MAX_ATTR_LEN];
+    sim_bt_stats_t st;
+    int n = sim_bt_attr_count();
+
+    sim_bt_reset_stats();
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < n; i++) {
+        uint16_t h = sim_bt_attr_handle(i);
+        switch (sim_bt_attr_uuid(h)) {
+        case ESP_GATT_UUID_PRI_SERVICE:
+        case ESP_GATT_UUID_CHAR_DECLARE:
+        case HID_INFO_CHAR_UUID:
+        case PROTOCOL_MODE_UUID:
+        case REPORT_REF_DESC_UUID:
+            CHECK(sim_bt_read(h, 0, buf, sizeof(buf)) > 0);
+            break;
+        case REPORT_MAP_UUID: {
+            int off = 0, got;
+            while ((got = sim_bt_read(h, off, buf, sizeof(buf))) > 0) {
+                off += got;
+            }
+            CHECK(off == sizeof(report_map));
+            break;
+        }
+        case CLIENT_CHAR_CFG_UUID:
+            CHECK(sim_bt_write(h, (const uint8_t[]){ 0x01, 0x00 }, 2));
+            break;
+        }
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    sim_bt_get_stats(&st);
+    /* only Protocol Mode and the three CCCDs reach the app */
+    CHECK(st.app_requests == 4);
+
+    bench_result("hid_discovery", "discovery_ms", elapsed / 1000.0, "ms");
+    bench_result("hid_discovery", "app_requests", st.app_requests, "count");
+    bench_result("hid_discovery", "stack_requests", st.stack_requests, "count");
+}
+
+/* the scheduler queue holds 32 keys; top it up as it drains */
+static void type_text(const char *text)
+{
+    rx.expect = text;
+    for (const char *p = text; *p; ) {
+        int n = hid_type_string(p);
+        p += n;
+        if (n == 0) {
+            vTaskDelay(pdMS_TO_TICKS(10));
+        }
+    }
+}
+
+static void bench_typing(void)
+{
+    static char text[sizeof(TYPED_TEXT) * TYPED_REPEAT];
+    sim_bt_stats_t st;
+
+    text[0] = 0;
+    for (int i = 0; i < TYPED_REPEAT; i++) {
+        strcat(text, TYPED_TEXT);
+    }
+    int keys = strlen(text);
+    rx.expect = text;
+    rx.reports = 0;
+    rx.holds = 0;
+    rx.hold_dev_max_us = 0;
+    rx.hold_dev_total_us = 0;
+    hid_sched_stats_t before, after;
+    hid_sched_get_stats(&before);
+    portENTER_CRITICAL(&hid_sched_mux);
+    hid_sched_stats.max_jitter_us = 0;
+    portEXIT_CRITICAL(&hid_sched_mux);
+    sim_bt_reset_stats();
+    hid_conn_stats.conf_latency_max_us = 0;
+    hid_conn_stats.conf_latency_total_us = 0;
+    hid_conn_stats.conf_samples = 0;
+
+    type_text(text);
+    CHECK(host_wait_for(typed_all, 30000));
+    sim_bt_get_stats(&st);
+    hid_sched_get_stats(&after);
+    uint32_t steps = after.reports_sent - before.reports_sent;
+
+    double secs = (rx.last_us - rx.first_us) / 1e6;
+    CHECK(rx.reports >= 2 * keys);
+    CHECK(st.dropped == 0);
+    bench_result("hid_report_rate", "reports_per_s", rx.reports / secs, "reports/s");
+    bench_result("hid_report_rate", "keys_per_s", keys / secs, "keys/s");
+    bench_result("hid_report_rate", "conf_latency_avg_us",
+                 hid_conn_stats.conf_samples ? (double)hid_conn_stats.conf_latency_total_us /
+                                               hid_conn_stats.conf_samples : 0, "us");
+    bench_result("hid_report_rate", "tx_dropped", hid_tx_stats.dropped, "count");
+    /* timer due to hid_sched_task sending, and key hold time at the central */
+    bench_result("hid_jitter", "sched_jitter_avg_us",
+                 steps ? (double)(after.total_jitter_us - before.total_jitter_us) / steps : 0, "us");
+    bench_result("hid_jitter", "sched_jitter_max_us", after.max_jitter_us, "us");
+    bench_result("hid_jitter", "hold_jitter_avg_us",
+                 rx.holds ? (double)rx.hold_dev_total_us / rx.holds : 0, "us");
+    bench_result("hid_jitter", "hold_jitter_max_us", rx.hold_dev_max_us, "us");
+}
+
+/* another report source filling the TX queue behind the scheduler's back */
+static void flood_task(void *arg)
+{
+    static const uint8_t report[8] = { 0x01 };
+    for (int i = 0; i < 4 * HID_TX_QUEUE_LEN; i++) {
+        safe_send_indicate(hid.handles[IDX_REPORT1_VAL], report, sizeof(report));
+        vTaskDelay(pdMS_TO_TICKS(2));
+    }
+    vTaskDelete(NULL);
+}
+
+/* one notification per connection event and two controller buffers, with
+   the TX queue kept full: every key still arrives, in order */
+static void check_congestion(void)
+{
+    sim_bt_config_t cfg, saved;
+    sim_bt_stats_t st;
+
+    sim_bt_default_config(&saved);
+    cfg = saved;
+    cfg.pkts_per_event = 1;
+    cfg.tx_buffers = 2;
+    sim_bt_configure(&cfg);
+    sim_bt_reset_stats();
+    uint32_t dropped = hid_tx_stats.dropped, refused = hid_tx_stats.refused;
+
+    xTaskCreate(flood_task, "hid_flood", 2048, NULL, 5, NULL);
+    type_text(CONGESTED_TEXT);
+    CHECK(host_wait_for(typed_all, 30000));
+    sim_bt_get_stats(&st);
+
+    CHECK(st.congest_events > 0);
+    CHECK(st.dropped == 0);
+    CHECK(hid_tx_stats.dropped == dropped);
+    bench_result("hid_congestion", "congest_events", st.congest_events, "count");
+    bench_result("hid_congestion", "tx_refused", hid_tx_stats.refused - refused, "count");
+
+    sim_bt_configure(&saved);
+    vTaskDelay(pdMS_TO_TICKS(200));
+}
+
+/* the window fills with notifications whose CONF_EVT never comes */
+static void check_lost_conf(void)
+{
+    uint32_t timeouts = hid_tx_stats.conf_timeouts;
+
+    sim_bt_lose_conf(HID_TX_MAX_INFLIGHT);
+    int64_t start = esp_timer_get_time();
+    type_text("lost\n");
+    CHECK(host_wait_for(typed_all, 5000));
+    CHECK(hid_tx_stats.conf_timeouts > timeouts);
+    bench_result("hid_congestion", "lost_conf_recovery_ms", (esp_timer_get_time() - start) / 1000.0, "ms");
+}
+
+int main(void)
+{
+    sim_bt_on_notify(on_notify, NULL);
+
+    app_main();
+    CHECK(host_wait_for(advertising_started, 2000));
+    sim_bt_stats_t st;
+    sim_bt_get_stats(&st);
+    bench_result("hid_startup", "app_main_to_adv_ms", (st.first_adv_us - app_start_us) / 1000.0, "ms");
+
+    CHECK(sim_bt_connect(2000));
+    bench_discovery();
+    CHECK(host_wait_for(fast_interval, 2000));
+    /* asked for once, after encryption, not again at connect */
+    CHECK(hid_conn_stats.requests == 1);
+    bench_typing();
+    check_congestion();
+    check_lost_conf();
+
+    sim_bt_disconnect(0x13);
+    CHECK(host_wait_for(idle_check_stopped, 1000));
+    return host_test_result();
+}
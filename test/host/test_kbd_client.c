@@ -0,0 +1,283 @@
+/* BLE keyboard client on the simulated NimBLE host: three keyboards and one
+   that advertises but never takes a connection. The connect attempt on the
+   latter must time out and the scan go on to the others; every keyboard's
+   keys must come out under its own source, once; a keyboard dropping the
+   link with a key down must yield that key's release. Reconnects compare
+   connect-to-first-report with and without the handle cache, and a peer
+   without a database hash gets its cached handles only if bonded. */
+#include <stdatomic.h>
+#include "keyboard_connect.c"
+#include "host_test.h"
+#include "sim_nimble.h"
+
+#define KBDS        3
+#define MAX_EVENTS  256
+
+static const uint8_t addrs[KBDS + 1][6] = {
+    { 0x01, 0x00, 0x00, 0xad, 0xde, 0xc0 },
+    { 0x02, 0x00, 0x00, 0xad, 0xde, 0xc0 },
+    { 0x03, 0x00, 0x00, 0xad, 0xde, 0xc0 },
+    { 0x04, 0x00, 0x00, 0xad, 0xde, 0xc0 },
+};
+
+static int kbd[KBDS];
+static int ghost;
+
+static hid_key_event_t events[MAX_EVENTS];
+static atomic_int event_count;
+
+static void collect(const hid_key_event_t *ev, void *ctx)
+{
+    int n = atomic_load(&event_count);
+    if (n < MAX_EVENTS) {
+        events[n] = *ev;
+        atomic_store(&event_count, n + 1);
+    }
+}
+
+/* key_event_task, handing the events to the test */
+static void collect_task(void *param)
+{
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        hid_decoder_drain(collect, NULL);
+    }
+}
+
+/* app_main, with collect_task in place of key_event_task */
+static void start_client(void)
+{
+    CHECK(nvs_flash_init() == ESP_OK);
+    for (int i = 0; i < MAX_PEERS; i++)
+        g_peers[i].conn_handle = BLE_HS_CONN_HANDLE_NONE;
+    nimble_port_init();
+    ble_hs_cfg.sync_cb = on_sync;
+    xTaskCreate(collect_task, "kbd_events", 3072, NULL, 5, &g_event_task);
+    nimble_port_freertos_init(host_task);
+}
+
+static bool all_subscribed(void)
+{
+    for (int i = 0; i < KBDS; i++) {
+        if (!sim_kbd_boot_subscribed(kbd[i]) || !sim_kbd_report_subscribed(kbd[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* the decoder source of the peer slot holding that keyboard */
+static int source_of(int k)
+{
+    for (int i = 0; i < MAX_PEERS; i++) {
+        if (g_peers[i].in_use && memcmp(g_peers[i].addr.val, addrs[k], 6) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int wait_events(int n, uint32_t timeout_ms)
+{
+    int64_t end = esp_timer_get_time() + timeout_ms * 1000LL;
+    while (atomic_load(&event_count) < n && esp_timer_get_time() < end) {
+        vTaskDelay(pdMS_TO_TICKS(5));
+    }
+    return atomic_load(&event_count);
+}
+
+static void press(int k, uint8_t code, bool boot_too)
+{
+    const uint8_t down[8] = { 0, 0, code };
+    CHECK(sim_kbd_send_report(kbd[k], down));
+    if (boot_too) {
+        /* some keyboards keep notifying the boot input in report protocol */
+        CHECK(sim_kbd_send_boot(kbd[k], down));
+    }
+}
+
+static void release(int k)
+{
+    const uint8_t up[8] = { 0 };
+    CHECK(sim_kbd_send_report(kbd[k], up));
+}
+
+static void check_connect(void)
+{
+    sim_nimble_stats_t st;
+    int64_t start = esp_timer_get_time();
+
+    start_client();
+    CHECK(host_wait_for(all_subscribed, 20000));
+    int64_t elapsed_ms = (esp_timer_get_time() - start) / 1000;
+
+    sim_nimble_get_stats(&st);
+    /* one attempt on the ghost, given up, then the rest of the scan */
+    CHECK(st.connect_timeouts == 1);
+    CHECK(st.connects == KBDS);
+    CHECK(elapsed_ms >= CONNECT_TIMEOUT_MS);
+    CHECK(!g_connecting && g_num_peers == KBDS);
+    CHECK(!sim_kbd_connected(ghost));
+    for (int i = 0; i < KBDS; i++) {
+        CHECK(sim_kbd_protocol_mode(kbd[i]) == HID_PROTO_REPORT);
+        CHECK(source_of(i) >= 0);
+    }
+    bench_result("kbd_client", "all_subscribed_ms", elapsed_ms, "ms");
+}
+
+static void check_typing(void)
+{
+    atomic_store(&event_count, 0);
+
+    /* all three at once; one of them duplicates on the boot input */
+    for (int i = 0; i < KBDS; i++) {
+        press(i, 0x04 + i, i == 1);
+    }
+    vTaskDelay(pdMS_TO_TICKS(100));
+    for (int i = 0; i < KBDS; i++) {
+        release(i);
+    }
+    vTaskDelay(pdMS_TO_TICKS(100));
+    CHECK(wait_events(2 * KBDS, 2000) == 2 * KBDS);
+
+    for (int i = 0; i < KBDS; i++) {
+        int src = source_of(i);
+        int presses = 0, releases = 0;
+        for (int e = 0; e < atomic_load(&event_count); e++) {
+            if (events[e].source != src) {
+                continue;
+            }
+            CHECK(events[e].keycode == 0x04 + i && events[e].report_id == 1);
+            presses += events[e].pressed;
+            releases += !events[e].pressed;
+            if (events[e].pressed) {
+                CHECK(events[e].utf8[0] == 'a' + i);
+            }
+        }
+        CHECK(presses == 1 && releases == 1);
+    }
+}
+
+static bool reconnected(void)
+{
+    return sim_kbd_report_subscribed(kbd[1]);
+}
+
+static void check_drop_while_held(void)
+{
+    atomic_store(&event_count, 0);
+
+    /* shift+z down, then the keyboard goes away */
+    const uint8_t down[8] = { 0x02, 0, 0x1D };
+    CHECK(sim_kbd_send_report(kbd[1], down));
+    CHECK(wait_events(2, 1000) == 2);
+    int src = source_of(1);
+    sim_kbd_disconnect(kbd[1]);
+
+    CHECK(wait_events(4, 1000) == 4);
+    CHECK(events[2].source == src && events[2].keycode == 0x1D && !events[2].pressed);
+    CHECK(events[3].source == src && events[3].keycode == 0xE1 && !events[3].pressed);
+    CHECK(events[3].modifiers == 0);
+
+    /* it advertises again and comes back through the fast scan */
+    int64_t start = esp_timer_get_time();
+    CHECK(host_wait_for(reconnected, 5000));
+    bench_result("kbd_client", "reconnect_ms", (esp_timer_get_time() - start) / 1000, "ms");
+
+    /* a fresh start: nothing held from before the drop */
+    atomic_store(&event_count, 0);
+    release(1);
+    vTaskDelay(pdMS_TO_TICKS(200));
+    CHECK(atomic_load(&event_count) == 0);
+}
+
+/* the keyboard drops the link and comes back; a key goes out as soon as
+   both input CCCDs are on. Returns its peer, whose first_report_ms covers
+   connect to that key. */
+static peer_t *reconnect(int k, uint32_t *att_requests)
+{
+    sim_nimble_stats_t before, after;
+    sim_nimble_get_stats(&before);
+    sim_kbd_disconnect(kbd[k]);
+
+    int64_t end = esp_timer_get_time() + 5000000;
+    while (!(sim_kbd_boot_subscribed(kbd[k]) && sim_kbd_report_subscribed(kbd[k])) && esp_timer_get_time() < end) {
+        vTaskDelay(1);
+    }
+    press(k, 0x04, false);
+    int src = source_of(k);
+    CHECK(src >= 0);
+    if (src < 0) {
+        return &g_peers[0];
+    }
+    peer_t *p = &g_peers[src];
+    while (p->stats.first_report_ms == 0 && esp_timer_get_time() < end) {
+        vTaskDelay(1);
+    }
+    CHECK(p->stats.first_report_ms != 0);
+    release(k);
+    vTaskDelay(pdMS_TO_TICKS(100));
+
+    sim_nimble_get_stats(&after);
+    *att_requests = after.att_requests - before.att_requests;
+    return p;
+}
+
+static void check_cache(void)
+{
+    uint32_t att_cached, att_full, att;
+
+    /* hash unchanged: straight to the CCCDs */
+    peer_t *p = reconnect(0, &att_cached);
+    CHECK(p->from_cache && p->have_hash);
+    uint32_t cached_ms = p->stats.first_report_ms;
+
+    /* hash changed: full discovery */
+    sim_kbd_change_db(kbd[0]);
+    p = reconnect(0, &att_full);
+    CHECK(!p->from_cache);
+    uint32_t full_ms = p->stats.first_report_ms;
+    CHECK(sim_kbd_stray_writes(kbd[0]) == 0);
+    CHECK(cached_ms < full_ms && att_cached < att_full);
+
+    bench_result("kbd_client", "first_report_ms_cached", cached_ms, "ms");
+    bench_result("kbd_client", "first_report_ms_discovery", full_ms, "ms");
+    bench_result("kbd_client", "att_requests_cached", att_cached, "requests");
+    bench_result("kbd_client", "att_requests_discovery", att_full, "requests");
+
+    /* no hash, bonded: the cache is trusted */
+    p = reconnect(2, &att);
+    CHECK(p->from_cache && !p->have_hash);
+
+    /* no hash, not bonded, table moved: discovered again, and nothing is
+       written through the stale handles */
+    sim_kbd_change_db(kbd[1]);
+    p = reconnect(1, &att);
+    CHECK(!p->from_cache && !p->have_hash);
+    CHECK(sim_kbd_stray_writes(kbd[1]) == 0);
+    CHECK(sim_kbd_report_subscribed(kbd[1]));
+}
+
+int main(void)
+{
+    /* the ghost is seen first in every scan */
+    sim_kbd_config_t gcfg = { .name = "Ghost", .with_hash = true, .connectable = false };
+    memcpy(gcfg.addr, addrs[KBDS], 6);
+    ghost = sim_kbd_add(&gcfg);
+    for (int i = 0; i < KBDS; i++) {
+        /* with a hash; without, unbonded; without, bonded */
+        sim_kbd_config_t cfg = { .name = "Keyboard", .with_hash = i == 0, .bonded = i == 2, .connectable = true };
+        memcpy(cfg.addr, addrs[i], 6);
+        kbd[i] = sim_kbd_add(&cfg);
+    }
+    sim_kbd_advertise(ghost, true);
+    for (int i = 0; i < KBDS; i++) {
+        sim_kbd_advertise(kbd[i], true);
+    }
+
+    check_connect();
+    check_typing();
+    check_drop_while_held();
+    check_cache();
+    return host_test_result();
+}
@@ -0,0 +1,167 @@
+/* Snapshot quality feedback: replays an uplink bandwidth trace against the
+   broker and reports capture-to-acknowledged snapshot latency per step,
+   checking quality settles where the link rate puts it, one move per
+   window.
+   LINK_TRACE names a file of "duration_ms bytes_per_s" lines to replay
+   instead of the built-in trace. */
+#include <stdio.h>
+#include <stdlib.h>
+#include "host_test.h"
+#include "host_doorcam.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "camera.h"
+#include "link_budget.h"
+#include "mqqt_client.h"
+
+#define JPEG_BYTES_AT_BEST  (24 * 1024)
+#define SNAPSHOT_PERIOD_MS  250
+#define MAX_STEPS           32
+#define MAX_SNAPSHOTS       256
+
+typedef struct {
+    uint32_t ms;
+    uint32_t bytes_per_s;
+} trace_step_t;
+
+static const trace_step_t default_trace[] = {
+    { 3000, 400000 },   /* good Wi-Fi */
+    { 6000,  20000 },   /* far from the AP */
+    { 6000,   8000 },   /* barely associated */
+    { 5000, 400000 },   /* back to good */
+};
+
+static trace_step_t trace[MAX_STEPS];
+static int trace_len;
+
+static void load_trace(void)
+{
+    const char *path = getenv("LINK_TRACE");
+    FILE *f = path ? fopen(path, "r") : NULL;
+
+    trace_len = 0;
+    if (f) {
+        while (trace_len < MAX_STEPS &&
+               fscanf(f, "%u %u", &trace[trace_len].ms, &trace[trace_len].bytes_per_s) == 2) {
+            trace_len++;
+        }
+        fclose(f);
+    }
+    if (trace_len == 0) {
+        CHECK(path == NULL);
+        trace_len = sizeof(default_trace) / sizeof(default_trace[0]);
+        for (int i = 0; i < trace_len; i++) {
+            trace[i] = default_trace[i];
+        }
+    }
+}
+
+static int cmp_i64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int64_t p95(int64_t *v, int n)
+{
+    if (n == 0) {
+        return 0;
+    }
+    qsort(v, n, sizeof(v[0]), cmp_i64);
+    return v[(n * 95 + 99) / 100 - 1];
+}
+
+/* one snapshot at a time, as a doorbell press would send it */
+static int64_t snapshot(void)
+{
+    frame_t *fb = camera_capture();
+    if (fb == NULL) {
+        CHECK(!"no frame");
+        return 0;
+    }
+    int64_t captured = fb->timestamp_us;
+    publish_image(fb);
+    frame_release(fb);
+    CHECK(mqtt_wait_idle(30000));
+    return esp_timer_get_time() - captured;
+}
+
+static void replay(void)
+{
+    static int64_t lat[MAX_SNAPSHOTS], settle[MAX_SNAPSHOTS], all[MAX_STEPS * MAX_SNAPSHOTS];
+    sim_broker_config_t cfg;
+    char metric[48];
+    int total = 0, changes = 0, since_change = 0, last_quality = sim_camera_quality();
+
+    sim_broker_default_config(&cfg);
+    for (int s = 0; s < trace_len; s++) {
+        cfg.bytes_per_s = trace[s].bytes_per_s;
+        sim_broker_configure(&cfg);
+
+        int n = 0;
+        int64_t start = esp_timer_get_time(), end = start + trace[s].ms * 1000LL;
+        while (esp_timer_get_time() < end && n < MAX_SNAPSHOTS) {
+            int64_t t = esp_timer_get_time();
+            lat[n++] = snapshot();
+            all[total++] = lat[n - 1];
+            /* a whole window at one quality before the next move */
+            since_change++;
+            if (sim_camera_quality() != last_quality) {
+                CHECK(changes == 0 || since_change >= LINK_MIN_SAMPLES);
+                last_quality = sim_camera_quality();
+                changes++;
+                since_change = 0;
+            }
+            int64_t spent = (esp_timer_get_time() - t) / 1000;
+            if (spent < SNAPSHOT_PERIOD_MS) {
+                vTaskDelay(pdMS_TO_TICKS(SNAPSHOT_PERIOD_MS - spent));
+            }
+        }
+
+        /* once adapted (last quarter of the step), it keeps to the target */
+        int late = 0;
+        for (int i = n * 3 / 4; i < n; i++) {
+            settle[late++] = lat[i];
+        }
+        int64_t settled = p95(settle, late);
+        if (trace[s].bytes_per_s * (LINK_TARGET_P95_MS / 1000) >
+            JPEG_BYTES_AT_BEST * LINK_QUALITY_BEST / LINK_QUALITY_WORST * 2) {
+            CHECK(settled <= LINK_TARGET_P95_MS * 1000LL);
+            /* where the link rate puts it, well short of the worst */
+            CHECK(sim_camera_quality() < LINK_QUALITY_WORST);
+        }
+
+        snprintf(metric, sizeof(metric), "step%d_%ukBps_p95_ms", s, trace[s].bytes_per_s / 1000);
+        bench_result("link_budget", metric, p95(lat, n) / 1000.0, "ms");
+        snprintf(metric, sizeof(metric), "step%d_settled_p95_ms", s);
+        bench_result("link_budget", metric, settled / 1000.0, "ms");
+        snprintf(metric, sizeof(metric), "step%d_quality", s);
+        bench_result("link_budget", metric, sim_camera_quality(), "q");
+    }
+    bench_result("link_budget", "p95_ms", p95(all, total) / 1000.0, "ms");
+    bench_result("link_budget", "quality_changes", changes, "count");
+}
+
+int main(void)
+{
+    load_trace();
+    sim_camera_attach(640, 480, JPEG_BYTES_AT_BEST);
+    CHECK(camera_init() == ESP_OK);
+    host_doorcam_start(NULL);
+
+    /* sensor JPEGs are sent whole */
+    frame_t *fb = camera_capture();
+    CHECK(fb && fb->format == FRAME_FORMAT_JPEG);
+    CHECK(fb && camera_crop(fb, &(frame_roi_t){ 0, 0, 64, 64 }) == NULL);
+    if (fb) {
+        frame_release(fb);
+    }
+
+    replay();
+    /* the good step at the end brings quality back up */
+    if (trace_len == sizeof(default_trace) / sizeof(default_trace[0])) {
+        CHECK(sim_camera_quality() < LINK_QUALITY_WORST);
+    }
+    return host_test_result();
+}
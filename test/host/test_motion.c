@@ -0,0 +1,137 @@
+/* Motion detector: the SWAR SAD kernel against the scalar reference on
+   aligned and unaligned rows, their throughput, and detection of a moving
+   square on RGB and grayscale frames, down to the bottom edge. */
+#include <stdint.h>
+#include <string.h>
+#include "host_test.h"
+#include "esp_timer.h"
+#include "motion.h"
+
+#define PAIRS           20000
+#define BENCH_FRAMES    2000
+#define SRC_WIDTH       160
+#define SRC_HEIGHT      120
+
+static uint8_t a[MOTION_WIDTH * MOTION_HEIGHT] __attribute__((aligned(4)));
+static uint8_t b[MOTION_WIDTH * MOTION_HEIGHT] __attribute__((aligned(4)));
+static uint8_t rgb[SRC_WIDTH * SRC_HEIGHT * 3];
+static volatile uint32_t sink;
+
+static uint32_t rng = 0x12345678;
+
+static uint32_t next_rand(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static void fill_random(uint8_t *p, size_t n, int mode)
+{
+    for (size_t i = 0; i < n; i++) {
+        uint32_t r = next_rand();
+        switch (mode) {
+        case 0:  p[i] = r; break;
+        case 1:  p[i] = r & 1 ? 255 : 0; break;            /* extremes only */
+        default: p[i] = 128 + (int)(r % 9) - 4; break;     /* near neighbours */
+        }
+    }
+}
+
+static void check_kernel(void)
+{
+    int mismatches = 0;
+
+    for (int i = 0; i < PAIRS; i++) {
+        fill_random(a, sizeof(a), i % 3);
+        fill_random(b, sizeof(b), (i / 3) % 3);
+        /* blocks off the word grid too, as a caller's rows may be */
+        int bx = next_rand() % (MOTION_BLOCKS_X - 1), by = next_rand() % MOTION_BLOCKS_Y;
+        size_t off = (size_t)by * MOTION_BLOCK * MOTION_WIDTH + bx * MOTION_BLOCK + i % 4;
+        if (motion_sad_block(a + off, b + off, MOTION_WIDTH) !=
+            motion_sad_block_ref(a + off, b + off, MOTION_WIDTH)) {
+            mismatches++;
+        }
+    }
+    CHECK(mismatches == 0);
+
+    memset(a, 0, sizeof(a));
+    memset(b, 255, sizeof(b));
+    CHECK(motion_sad_block(a, b, MOTION_WIDTH) == 255 * MOTION_BLOCK * MOTION_BLOCK);
+    CHECK(motion_sad_block(b, a, MOTION_WIDTH) == 255 * MOTION_BLOCK * MOTION_BLOCK);
+}
+
+/* every block of a downscaled frame, as motion_process() walks them */
+static double megapixels_per_s(uint32_t (*sad)(const uint8_t *, const uint8_t *, int))
+{
+    uint32_t acc = 0;
+
+    fill_random(a, sizeof(a), 0);
+    fill_random(b, sizeof(b), 0);
+    int64_t start = esp_timer_get_time();
+    for (int f = 0; f < BENCH_FRAMES; f++) {
+        for (int by = 0; by < MOTION_BLOCKS_Y; by++) {
+            for (int bx = 0; bx < MOTION_BLOCKS_X; bx++) {
+                size_t off = (size_t)by * MOTION_BLOCK * MOTION_WIDTH + bx * MOTION_BLOCK;
+                acc += sad(a + off, b + off, MOTION_WIDTH);
+            }
+        }
+        a[f % sizeof(a)]++;
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    sink = acc;
+
+    double pixels = (double)BENCH_FRAMES * MOTION_BLOCKS_X * MOTION_BLOCKS_Y * MOTION_BLOCK * MOTION_BLOCK;
+    return pixels / elapsed;
+}
+
+/* a 40x(height) square at square_x, square_y on a dark frame */
+static void draw_frame(int bpp, int square_x, int square_y, int height)
+{
+    memset(rgb, 40, sizeof(rgb));
+    for (int y = square_y; y < square_y + height; y++) {
+        for (int x = square_x; x < square_x + 40; x++) {
+            memset(&rgb[(y * SRC_WIDTH + x) * bpp], 230, bpp);
+        }
+    }
+}
+
+static void check_detection(frame_format_t format, int square_y, int height)
+{
+    int bpp = format == FRAME_FORMAT_RGB888 ? 3 : 1;
+    size_t len = (size_t)SRC_WIDTH * SRC_HEIGHT * bpp;
+    frame_t fb = { .buf = rgb, .capacity = len, .len = len,
+                   .width = SRC_WIDTH, .height = SRC_HEIGHT, .format = format };
+    motion_result_t res;
+
+    motion_init();
+    draw_frame(bpp, 0, square_y, height);
+    CHECK(!motion_process(&fb, &res));      /* takes the background */
+    CHECK(!motion_process(&fb, &res));
+
+    draw_frame(bpp, 100, square_y, height);
+    CHECK(motion_process(&fb, &res));
+    CHECK(res.changed_blocks >= MOTION_MIN_BLOCKS);
+    /* the box covers where the square went */
+    CHECK(res.roi.x <= 100 && res.roi.x + res.roi.w >= 140);
+    CHECK(res.roi.y <= square_y && res.roi.y + res.roi.h >= square_y + height);
+}
+
+int main(void)
+{
+    check_kernel();
+    check_detection(FRAME_FORMAT_RGB888, 40, 40);
+    check_detection(FRAME_FORMAT_GRAYSCALE, 40, 40);
+    /* the last rows of the frame, below a 60-row grid of 8-row blocks */
+    check_detection(FRAME_FORMAT_GRAYSCALE, SRC_HEIGHT - 8, 8);
+
+    /* the host compiler vectorizes the scalar loop (PSADBW on x86), which
+       the ESP32's LX6 cannot; the ratio here says nothing about the target */
+    double swar = megapixels_per_s(motion_sad_block);
+    double scalar = megapixels_per_s(motion_sad_block_ref);
+    bench_result("motion_sad", "swar_mpix_per_s", swar, "MP/s");
+    bench_result("motion_sad", "scalar_mpix_per_s", scalar, "MP/s");
+    bench_result("motion_sad", "speedup", swar / scalar, "x");
+    return host_test_result();
+}
@@ -0,0 +1,98 @@
+/* Persistent MQTT session: connect start to commands routable with the
+   broker keeping the session and with it forgotten, and a command sent
+   while the device is away not acted on after the reconnect. */
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include "host_test.h"
+#include "host_doorcam.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "cmd_dispatch.h"
+#include "mqqt_client.h"
+#include "topics.h"
+#include "sim.h"
+
+static atomic_int cmd_runs;
+
+static void cmd_test(const char *data, int data_len, void *ctx)
+{
+    atomic_fetch_add(&cmd_runs, 1);
+}
+
+static bool ready(void)
+{
+    sim_broker_stats_t st;
+    sim_broker_get_stats(&st);
+    return st.ready_us != 0;
+}
+
+static bool cmd_ran(void)
+{
+    return atomic_load(&cmd_runs) > 0;
+}
+
+/* drops the connection and returns connect start to ready, in ms */
+static int64_t reconnect(sim_broker_stats_t *st)
+{
+    sim_broker_reset_stats();
+    sim_broker_drop();
+    CHECK(host_wait_for(ready, 2000));
+    sim_broker_get_stats(st);
+    return (st->ready_us - st->connect_start_us) / 1000;
+}
+
+/* sent while the link is down: the session must not have kept it */
+static void check_offline_command(const char *topic)
+{
+    sim_broker_config_t cfg;
+    sim_broker_default_config(&cfg);
+    cfg.reconnect_ms = 500;
+    sim_broker_configure(&cfg);
+
+    atomic_store(&cmd_runs, 0);
+    sim_broker_reset_stats();
+    sim_broker_drop();
+    CHECK(!sim_broker_inject(topic, "1", 1));
+    CHECK(host_wait_for(ready, 2000));
+    vTaskDelay(pdMS_TO_TICKS(200));
+
+    sim_broker_stats_t st;
+    sim_broker_get_stats(&st);
+    CHECK(st.sessions_resumed == 1 && st.queued == 0);
+    CHECK(atomic_load(&cmd_runs) == 0);
+
+    /* and live ones still get through */
+    CHECK(sim_broker_inject(topic, "1", 1));
+    CHECK(host_wait_for(cmd_ran, 1000));
+
+    sim_broker_default_config(&cfg);
+    sim_broker_configure(&cfg);
+}
+
+int main(void)
+{
+    sim_broker_stats_t st;
+    host_doorcam_start(NULL);
+    CHECK(mqtt_register_command("cmd/test", CMD_PRIO_LCD, 0, cmd_test, NULL) == ESP_OK);
+    sim_broker_get_stats(&st);
+    CHECK(st.sessions_resumed == 0 && st.subscribes == 1);
+
+    /* session kept: ready at the CONNACK, no SUBSCRIBE */
+    int64_t kept_ms = reconnect(&st);
+    CHECK(st.sessions_resumed == 1 && st.subscribes == 0);
+
+    /* session lost on the broker: subscribe again */
+    sim_broker_clear_sessions();
+    int64_t new_ms = reconnect(&st);
+    CHECK(st.sessions_resumed == 0 && st.subscribes == 1);
+    CHECK(new_ms > kept_ms);
+
+    char topic[128];
+    snprintf(topic, sizeof(topic), "%scmd/test", topic_get(TOPIC_PREFIX));
+    check_offline_command(topic);
+
+    bench_result("mqtt_session", "reconnect_ms_session_kept", kept_ms, "ms");
+    bench_result("mqtt_session", "reconnect_ms_session_new", new_ms, "ms");
+    return host_test_result();
+}
@@ -0,0 +1,180 @@
+/* Flash outbox on a file-backed partition: appends that wrap the ring
+   several times, a power cut in the middle of a record, replay in order
+   once the broker is reachable, appends while a slow replay runs, and a
+   record kept until its PUBACK is in. */
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include "host_test.h"
+#include "host_doorcam.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "outbox.h"
+#include "mqqt_client.h"
+
+#define PART_FILE       "test_outbox.bin"
+#define PART_SECTORS    4
+#define PART_SIZE       (PART_SECTORS * 4096)
+#define TOPIC           "t/outbox"
+/* 16 byte header + topic + data: exactly 16 records per sector */
+#define DATA_LEN        (256 - 16 - (int)sizeof(TOPIC) + 1)
+#define WRAP_RECORDS    (PART_SECTORS * 16 * 2 + 5)
+#define TORN_ID         WRAP_RECORDS
+#define AFTER_BOOT      6
+#define SLOW_RECORDS    20
+#define SLOW_BYTES_S    2560        /* ~100 ms per record on the uplink */
+
+static atomic_int received[512];
+static atomic_int received_count;
+
+static void record(int id, char *out)
+{
+    memset(out, 'a' + id % 26, DATA_LEN);
+    snprintf(out, DATA_LEN, "%06d", id);
+    out[6] = '-';
+}
+
+static esp_err_t append(int id)
+{
+    char data[DATA_LEN];
+    record(id, data);
+    return outbox_append(TOPIC, data, DATA_LEN, 1);
+}
+
+static void on_publish(const sim_broker_msg_t *msg, void *ctx)
+{
+    int id;
+    if (strcmp(msg->topic, TOPIC) != 0 || msg->len != DATA_LEN || sscanf((const char *)msg->data, "%6d", &id) != 1) {
+        return;
+    }
+    char expect[DATA_LEN];
+    record(id, expect);
+    CHECK(memcmp(expect, msg->data, DATA_LEN) == 0);
+
+    int n = atomic_fetch_add(&received_count, 1);
+    if (n < (int)(sizeof(received) / sizeof(received[0]))) {
+        received[n] = id;
+    }
+}
+
+static bool drained(void)
+{
+    return !outbox_pending();
+}
+
+static void bench_append(void)
+{
+    int failed = 0;
+    int64_t start = esp_timer_get_time();
+    uint64_t written = sim_partition_bytes_written();
+    for (int id = 0; id < WRAP_RECORDS; id++) {
+        failed += append(id) != ESP_OK;
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    written = sim_partition_bytes_written() - written;
+
+    /* records end exactly on sector boundaries, including the last one */
+    CHECK(failed == 0);
+    bench_result("outbox", "appends_per_s", WRAP_RECORDS * 1e6 / elapsed, "records/s");
+    bench_result("outbox", "flash_bytes_per_record", (double)written / WRAP_RECORDS, "B");
+}
+
+static void check_power_cut(void)
+{
+    /* dies in the middle of the record body; the header never lands */
+    sim_partition_cut_after(100);
+    CHECK(append(TORN_ID) != ESP_OK);
+    sim_partition_restore_power();
+
+    /* reboot */
+    CHECK(outbox_init() == ESP_OK);
+    CHECK(outbox_pending());
+    for (int id = TORN_ID + 1; id <= TORN_ID + AFTER_BOOT; id++) {
+        CHECK(append(id) == ESP_OK);
+    }
+}
+
+static void check_replay(void)
+{
+    sim_broker_on_publish(on_publish, NULL);
+    int64_t start = esp_timer_get_time();
+    host_doorcam_start(NULL);
+    CHECK(host_wait_for(drained, 30000));
+    CHECK(mqtt_wait_idle(5000));
+    int64_t elapsed = esp_timer_get_time() - start;
+
+    int n = atomic_load(&received_count);
+    /* the newest sectors before the cut, oldest first, then what came after */
+    CHECK(n > AFTER_BOOT);
+    for (int i = 1; i < n; i++) {
+        int expect = received[i - 1] + 1 == TORN_ID ? TORN_ID + 1 : received[i - 1] + 1;
+        CHECK(received[i] == expect);
+    }
+    CHECK(received[n - 1] == TORN_ID + AFTER_BOOT);
+    CHECK(received[n - AFTER_BOOT - 1] == TORN_ID - 1);
+    /* the torn sector is skipped after the reboot, which evicts one more */
+    CHECK(n - AFTER_BOOT >= (PART_SECTORS - 2) * 16);
+    bench_result("outbox", "replay_per_s", n * 1e6 / elapsed, "records/s");
+}
+
+/* appends go on while the drain task waits for the uplink */
+static void check_append_during_replay(void)
+{
+    sim_broker_config_t cfg;
+    sim_broker_default_config(&cfg);
+    cfg.bytes_per_s = SLOW_BYTES_S;
+    sim_broker_configure(&cfg);
+
+    int64_t worst = 0;
+    for (int i = 0; i < SLOW_RECORDS; i++) {
+        int64_t t = esp_timer_get_time();
+        CHECK(append(1000 + i) == ESP_OK);
+        t = esp_timer_get_time() - t;
+        if (t > worst) {
+            worst = t;
+        }
+        vTaskDelay(pdMS_TO_TICKS(30));
+    }
+    CHECK(worst < 50000);
+    CHECK(host_wait_for(drained, 30000));
+    bench_result("outbox", "append_max_us_while_draining", worst, "us");
+}
+
+/* the broker has the record, but until it acknowledges it stays stored */
+static void check_kept_until_acked(void)
+{
+    sim_broker_config_t cfg;
+    sim_broker_default_config(&cfg);
+    cfg.hold_acks = true;
+    sim_broker_configure(&cfg);
+
+    int before = atomic_load(&received_count);
+    CHECK(append(2000) == ESP_OK);
+    vTaskDelay(pdMS_TO_TICKS(500));
+    CHECK(atomic_load(&received_count) == before + 1);
+    CHECK(outbox_pending());
+
+    sim_broker_release_acks();
+    CHECK(host_wait_for(drained, 2000));
+    CHECK(atomic_load(&received_count) == before + 1);
+
+    sim_broker_default_config(&cfg);
+    sim_broker_configure(&cfg);
+}
+
+int main(void)
+{
+    remove(PART_FILE);
+    CHECK(sim_partition_attach(OUTBOX_PARTITION_LABEL, PART_FILE, PART_SIZE) == ESP_OK);
+    CHECK(outbox_init() == ESP_OK);
+
+    bench_append();
+    check_power_cut();
+    check_replay();
+    check_append_during_replay();
+    check_kept_until_acked();
+
+    remove(PART_FILE);
+    return host_test_result();
+}
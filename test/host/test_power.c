@@ -0,0 +1,78 @@
+/* Low-power duty cycle from a doorbell wake to deep sleep. With "no_ap" the
+   access point never answers: the press must land in the outbox and the
+   device must still go to sleep within the connect budget. */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "host_test.h"
+#include "sim.h"
+#include "esp_timer.h"
+#include "camera.h"
+#include "outbox.h"
+#include "power.h"
+#include "mqqt_client.h"
+
+#define ASSOC_MS            300
+#define DHCP_MS             100
+#define JPEG_BYTES_AT_BEST  (8 * 1024)
+
+static bool no_ap;
+static int doorbell_events;
+/* per run: ctest runs both modes at once */
+static char part_file[64];
+
+static void on_publish(const sim_broker_msg_t *msg, void *ctx)
+{
+    size_t n = strlen(msg->topic);
+    if (n >= 8 && strcmp(msg->topic + n - 8, "doorbell") == 0) {
+        doorbell_events++;
+    }
+}
+
+static void on_deep_sleep(void)
+{
+    int64_t awake_ms = esp_timer_get_time() / 1000;
+    const power_rtc_state_t *rtc = power_rtc_state();
+
+    CHECK(rtc->wake_count == 1 && rtc->doorbell_wakes == 1);
+    if (no_ap) {
+        /* no publish wait when offline: just the connect budget */
+        CHECK(awake_ms < POWER_CONNECT_TIMEOUT_MS + 500);
+        CHECK(outbox_pending());
+        CHECK(doorbell_events == 0);
+        bench_result("power", "no_ap_wake_to_sleep_ms", awake_ms, "ms");
+    } else {
+        CHECK(doorbell_events == 1);
+        CHECK(rtc->last_wake_to_publish_ms > 0 && rtc->last_wake_to_publish_ms <= awake_ms);
+        bench_result("power", "wake_to_publish_ms", rtc->last_wake_to_publish_ms, "ms");
+        bench_result("power", "wake_to_sleep_ms", awake_ms, "ms");
+    }
+    remove(part_file);
+    exit(host_test_result());
+}
+
+int main(int argc, char **argv)
+{
+    no_ap = argc > 1 && strcmp(argv[1], "no_ap") == 0;
+    snprintf(part_file, sizeof(part_file), "test_power_%s_%d.bin",
+             no_ap ? "no_ap" : "ap", (int)getpid());
+
+    remove(part_file);
+    CHECK(sim_partition_attach(OUTBOX_PARTITION_LABEL, part_file, 4 * 4096) == ESP_OK);
+    CHECK(outbox_init() == ESP_OK);
+    sim_camera_attach(640, 480, JPEG_BYTES_AT_BEST);
+    CHECK(camera_init() == ESP_OK);
+
+    sim_broker_config_t cfg;
+    sim_broker_default_config(&cfg);
+    sim_broker_configure(&cfg);
+    sim_broker_on_publish(on_publish, NULL);
+    sim_wifi_set_ap(!no_ap, ASSOC_MS, DHCP_MS);
+
+    sim_sleep_set_wakeup(ESP_SLEEP_WAKEUP_EXT1, 1ULL << DOORBELL_GPIO);
+    sim_sleep_on_deep_sleep(on_deep_sleep);
+    power_run_duty_cycle();
+
+    CHECK(!"power_run_duty_cycle returned");
+    return host_test_result();
+}
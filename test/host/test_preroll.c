@@ -0,0 +1,157 @@
+/* Pre-roll ring: push/take throughput between a producer and a consumer
+   task, then a doorbell burst of preview-size pre-roll frames plus the
+   full-size live one. */
+#include <stdatomic.h>
+#include <string.h>
+#include "host_test.h"
+#include "host_doorcam.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "camera.h"
+#include "preroll.h"
+#include "mqqt_client.h"
+#include "sim.h"
+
+#define RING_PUSHES     200000
+/* ring, consumer's batch and the producer's next frame */
+#define RING_SLABS      (2 * PREROLL_FRAMES + 1)
+#define BURST_FRAMES    (PREROLL_FRAMES + 1)
+
+static frame_pool_t ring_pool;
+static atomic_bool producer_done;
+static atomic_int tasks_running;
+static atomic_uint taken;
+static atomic_uint out_of_order;
+
+static struct {
+    unsigned count;
+    long captured_ms[BURST_FRAMES];
+    int width[BURST_FRAMES];
+} burst;
+
+/* timestamp_us carries the push sequence number */
+static void producer_task(void *arg)
+{
+    for (int64_t seq = 1; seq <= RING_PUSHES; ) {
+        frame_t *fb = frame_pool_acquire(&ring_pool);
+        if (fb == NULL) {
+            taskYIELD();
+            continue;
+        }
+        fb->timestamp_us = seq++;
+        preroll_push(fb);
+    }
+    atomic_store(&producer_done, true);
+    atomic_fetch_sub(&tasks_running, 1);
+    vTaskDelete(NULL);
+}
+
+static void consumer_task(void *arg)
+{
+    frame_t *out[PREROLL_FRAMES];
+    for (;;) {
+        bool done = atomic_load(&producer_done);
+        size_t n = preroll_take(out, PREROLL_FRAMES);
+        /* oldest first within a take; a frame taken twice would show up
+           as a double release in the pool count */
+        for (size_t i = 0; i < n; i++) {
+            if (i > 0 && out[i]->timestamp_us <= out[i - 1]->timestamp_us) {
+                atomic_fetch_add(&out_of_order, 1);
+            }
+        }
+        for (size_t i = 0; i < n; i++) {
+            frame_release(out[i]);
+        }
+        atomic_fetch_add(&taken, n);
+        if (done && n == 0) {
+            break;
+        }
+    }
+    atomic_fetch_sub(&tasks_running, 1);
+    vTaskDelete(NULL);
+}
+
+static bool tasks_finished(void)
+{
+    return atomic_load(&tasks_running) == 0;
+}
+
+static void bench_ring(void)
+{
+    CHECK(frame_pool_init(&ring_pool, RING_SLABS, 16) == ESP_OK);
+
+    atomic_store(&tasks_running, 2);
+    int64_t start = esp_timer_get_time();
+    xTaskCreate(consumer_task, "ring_consumer", 2048, NULL, 1, NULL);
+    xTaskCreate(producer_task, "ring_producer", 2048, NULL, 2, NULL);
+    CHECK(host_wait_for(tasks_finished, 60000));
+    int64_t elapsed = esp_timer_get_time() - start;
+
+    CHECK(atomic_load(&out_of_order) == 0);
+    CHECK(atomic_load(&taken) > 0 && atomic_load(&taken) <= RING_PUSHES);
+    /* every frame the producer overwrote went back to the pool */
+    CHECK(frame_pool_available(&ring_pool) == RING_SLABS);
+
+    bench_result("preroll_ring", "pushes_per_s", RING_PUSHES * 1e6 / elapsed, "ops/s");
+    bench_result("preroll_ring", "frames_taken_per_s", atomic_load(&taken) * 1e6 / elapsed, "frames/s");
+}
+
+static void on_publish(const sim_broker_msg_t *msg, void *ctx)
+{
+    /* outlives p and w below */
+    char json[256];
+    size_t n = strlen(msg->topic), m = strlen("cam/img_metadata");
+    if (n < m || strcmp(msg->topic + n - m, "cam/img_metadata") != 0) {
+        return;
+    }
+    snprintf(json, sizeof(json), "%.*s", msg->len, (const char *)msg->data);
+    const char *p = strstr(json, "\"captured_ms\":");
+    const char *w = strstr(json, "\"width\":");
+    if (p && w && burst.count < BURST_FRAMES) {
+        sscanf(p, "\"captured_ms\":%ld", &burst.captured_ms[burst.count]);
+        sscanf(w, "\"width\":%d", &burst.width[burst.count]);
+    }
+    burst.count++;
+}
+
+static bool burst_published(void)
+{
+    return burst.count >= BURST_FRAMES;
+}
+
+static void check_doorbell_burst(void)
+{
+    sim_camera_attach(640, 480, 24 * 1024);
+    CHECK(camera_init() == ESP_OK);
+    CHECK(preroll_init() == ESP_OK);
+    sim_broker_on_publish(on_publish, NULL);
+    host_doorcam_start(NULL);
+
+    /* let the preview task fill the ring */
+    vTaskDelay(pdMS_TO_TICKS(PREROLL_INTERVAL_MS * (PREROLL_FRAMES + 1)));
+    long pressed_ms = esp_timer_get_time() / 1000;
+    publish_doorbell_event(NULL);
+
+    CHECK(host_wait_for(burst_published, 5000));
+    CHECK(mqtt_wait_idle(5000));
+    CHECK(burst.count == BURST_FRAMES);
+    for (int i = 0; i < BURST_FRAMES - 1; i++) {
+        CHECK(burst.captured_ms[i] < pressed_ms);
+        CHECK(burst.captured_ms[i] <= burst.captured_ms[i + 1]);
+    }
+    CHECK(burst.captured_ms[BURST_FRAMES - 1] >= pressed_ms);
+    /* pre-roll at the preview size, the live frame full size */
+    for (int i = 0; i < BURST_FRAMES - 1; i++) {
+        CHECK(burst.width[i] == CAMERA_PREVIEW_WIDTH);
+    }
+    CHECK(burst.width[BURST_FRAMES - 1] == CAMERA_FRAME_WIDTH);
+}
+
+int main(void)
+{
+    /* the consumer empties the ring before the preview task takes it over */
+    bench_ring();
+    check_doorbell_burst();
+    return host_test_result();
+}
@@ -0,0 +1,133 @@
+/* Signed cmd/config: messages with a bad signature, signed for another
+   device or topic, or replaying a seq are dropped; a valid one moves the
+   device to its new identity, timed from the message to the first
+   command handled on the new topics. */
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include "host_test.h"
+#include "host_doorcam.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "cmd_dispatch.h"
+#include "mbedtls/md.h"
+#include "esp_timer.h"
+#include "mqqt_client.h"
+#include "provision.h"
+#include "topics.h"
+#include "sim.h"
+
+static atomic_int cmd_runs;
+
+static void cmd_test(const char *data, int data_len, void *ctx)
+{
+    atomic_fetch_add(&cmd_runs, 1);
+}
+
+static bool cmd_ran(void)
+{
+    return atomic_load(&cmd_runs) > 0;
+}
+
+static bool ready(void)
+{
+    sim_broker_stats_t st;
+    sim_broker_get_stats(&st);
+    return st.ready_us != 0;
+}
+
+static bool applied(void)
+{
+    provision_timing_t t;
+    provision_get_timing(&t);
+    return t.seq != 0;
+}
+
+static void topic_for(char *topic, size_t size, const char *suffix)
+{
+    snprintf(topic, size, "%s%s", topic_get(TOPIC_PREFIX), suffix);
+}
+
+/* body followed by its sig= line, signed as if for device_id on topic */
+static int sign(char *out, size_t size, const char *device_id, const char *topic, const char *body)
+{
+    char signed_msg[512];
+    uint8_t mac[32];
+    int n = snprintf(signed_msg, sizeof(signed_msg), "%s\n%s\n%s", device_id, topic, body);
+    CHECK(mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256),
+                          (const uint8_t *)CONFIG_DOORCAM_PROVISION_KEY,
+                          strlen(CONFIG_DOORCAM_PROVISION_KEY),
+                          (const uint8_t *)signed_msg, n, mac) == 0);
+
+    int len = snprintf(out, size, "%ssig=", body);
+    for (int i = 0; i < 32; i++) {
+        len += snprintf(out + len, size - len, "%02x", mac[i]);
+    }
+    return len;
+}
+
+/* delivered, but the stored configuration stays at seq */
+static void check_rejected(const char *topic, const char *msg, int len, uint32_t seq)
+{
+    CHECK(sim_broker_inject(topic, msg, len));
+    vTaskDelay(pdMS_TO_TICKS(200));
+    CHECK(provision_get()->seq == seq);
+}
+
+int main(void)
+{
+    char config_topic[128], other_topic[128], msg[512];
+    int len;
+
+    sim_nvs_clear();
+    host_doorcam_start(NULL);
+    CHECK(mqtt_register_command("cmd/test", CMD_PRIO_LCD, 0, cmd_test, NULL) == ESP_OK);
+    CHECK(provision_get()->seq == 0);
+    topic_for(config_topic, sizeof(config_topic), "cmd/config");
+    topic_for(other_topic, sizeof(other_topic), "cmd/lcd/text");
+
+    /* "sig=" inside a value is not the signature */
+    const char *body = "seq=1\npass=sig=0123\nuser_id=u9\ndevice_id=d9\n";
+
+    len = sign(msg, sizeof(msg), CONFIG_DOORCAM_DEVICE_ID, config_topic, body);
+    strstr(msg, "u9")[1] = '8';
+    check_rejected(config_topic, msg, len, 0);
+
+    len = sign(msg, sizeof(msg), "device02", config_topic, body);
+    check_rejected(config_topic, msg, len, 0);
+
+    len = sign(msg, sizeof(msg), CONFIG_DOORCAM_DEVICE_ID, other_topic, body);
+    check_rejected(config_topic, msg, len, 0);
+
+    /* the one meant for this device, with the new identity */
+    len = sign(msg, sizeof(msg), CONFIG_DOORCAM_DEVICE_ID, config_topic, body);
+    sim_broker_reset_stats();
+    int64_t start = esp_timer_get_time();
+    CHECK(sim_broker_inject(config_topic, msg, len));
+    CHECK(host_wait_for(applied, 2000));
+    CHECK(host_wait_for(ready, 2000));
+    CHECK(strcmp(topic_get(TOPIC_PREFIX), "home/useru9/deviced9/") == 0);
+    CHECK(strcmp(provision_get()->password, "sig=0123") == 0);
+
+    char test_topic[128];
+    topic_for(test_topic, sizeof(test_topic), "cmd/test");
+    CHECK(sim_broker_inject(test_topic, "1", 1));
+    CHECK(host_wait_for(cmd_ran, 1000));
+    int64_t routable_ms = (esp_timer_get_time() - start) / 1000;
+
+    provision_timing_t t;
+    provision_get_timing(&t);
+    CHECK(t.seq == 1);
+
+    /* the same seq again, correctly signed for the new identity */
+    topic_for(config_topic, sizeof(config_topic), "cmd/config");
+    len = sign(msg, sizeof(msg), "d9", config_topic, "seq=1\nuser_id=u8\n");
+    check_rejected(config_topic, msg, len, 1);
+    CHECK(strcmp(topic_get(TOPIC_PREFIX), "home/useru9/deviced9/") == 0);
+
+    bench_result("provision", "config_verify_ms", t.verify_us / 1000.0, "ms");
+    bench_result("provision", "config_store_ms", t.store_us / 1000.0, "ms");
+    bench_result("provision", "config_apply_ms", t.apply_us / 1000.0, "ms");
+    bench_result("provision", "config_to_command_ms", routable_ms, "ms");
+    return host_test_result();
+}
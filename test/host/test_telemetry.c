@@ -0,0 +1,83 @@
+/* Telemetry: an hour of samples as batched binary records and as the old
+   per-value text topics, in messages and bytes on the wire. */
+#include <string.h>
+#include "host_test.h"
+#include "host_doorcam.h"
+#include "mqqt_client.h"
+#include "telemetry.h"
+
+#define HOUR_SAMPLES    (3600 * 1000 / TELEMETRY_SAMPLE_MS)
+#define LOW_FROM        100     /* battery low for samples [LOW_FROM, LOW_UNTIL) */
+#define LOW_UNTIL       200
+
+static telemetry_sample_t sample_at(int i)
+{
+    return (telemetry_sample_t){
+        .uptime_s = i * TELEMETRY_SAMPLE_MS / 1000,
+        .free_heap = 180000,
+        .temp_centi = 2150 + (i % 3) * 10,      /* well inside the delta */
+        .battery = i >= LOW_FROM && i < LOW_UNTIL ? TELEMETRY_BATTERY_LOW - 5 : 80,
+        .rssi = -60,
+    };
+}
+
+static uint32_t report(const char *suite)
+{
+    sim_broker_stats_t st;
+    sim_broker_get_stats(&st);
+    bench_result(suite, "messages_per_hour", st.publishes, "msg");
+    bench_result(suite, "wire_bytes_per_hour", st.bytes_up, "B");
+    return st.publishes;
+}
+
+static void hour_batched(void)
+{
+    uint32_t low_span = 0;
+
+    for (int i = 0; i < HOUR_SAMPLES; i++) {
+        telemetry_sample_t s = sample_at(i);
+        bool sent = telemetry_add(&s);
+        if (i == LOW_FROM || i == LOW_UNTIL) {
+            CHECK(sent);            /* both crossings flush at once */
+        } else if (i > LOW_FROM && i < LOW_UNTIL) {
+            low_span += sent;
+        }
+    }
+    telemetry_flush();
+    CHECK(mqtt_wait_idle(5000));
+
+    /* while low, only full windows go out */
+    CHECK(low_span == (LOW_UNTIL - LOW_FROM - 1) / TELEMETRY_MAX_SAMPLES);
+}
+
+/* what TELEMETRY_COMPAT_TOPICS sends for every sample */
+static void hour_compat(void)
+{
+    for (int i = 0; i < HOUR_SAMPLES; i++) {
+        telemetry_sample_t s = sample_at(i);
+        publish_temperature(s.temp_centi / 100.0f);
+        publish_battery(s.battery);
+    }
+    CHECK(mqtt_wait_idle(10000));
+}
+
+int main(void)
+{
+    host_doorcam_start(NULL);
+    /* the first sample of telemetry_task; the next one is 10 s away */
+    CHECK(mqtt_wait_idle(2000));
+    telemetry_flush();
+    CHECK(mqtt_wait_idle(2000));
+
+    sim_broker_reset_stats();
+    hour_batched();
+    uint32_t batched = report("telemetry_batched");
+
+    sim_broker_reset_stats();
+    hour_compat();
+    uint32_t compat = report("telemetry_compat");
+
+    CHECK(compat >= 2 * HOUR_SAMPLES);
+    CHECK(batched * 10 < compat);
+    return host_test_result();
+}
@@ -0,0 +1,92 @@
+/* Event trace: cost per event, counter and histogram update, and what
+   happens when more tasks record than there are rings. */
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host_test.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "trace.h"
+
+#define BENCH_EVENTS    1000000
+#define EXTRA_TASKS     3
+#define EVENTS_EACH     10
+
+static atomic_int done;
+
+static void record_task(void *arg)
+{
+    for (int i = 0; i < EVENTS_EACH; i++) {
+        trace_instant(TRACE_EV_CMD_EXEC, i);
+    }
+    atomic_fetch_add(&done, 1);
+    vTaskDelete(NULL);
+}
+
+static bool all_done(void)
+{
+    return atomic_load(&done) == TRACE_MAX_TASKS - 1 + EXTRA_TASKS;
+}
+
+static uint32_t counter(const uint8_t *dump, trace_counter_id_t id)
+{
+    uint32_t v;
+    /* 20-byte header: magic, version, tasks, three sizes, 3 reserved, now_us */
+    memcpy(&v, dump + 20 + 4 * id, sizeof(v));
+    return v;
+}
+
+static void bench(void)
+{
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_EVENTS; i++) {
+        trace_instant(TRACE_EV_MQTT_PUBLISH, i);
+    }
+    bench_result("trace", "event_ns", (esp_timer_get_time() - start) * 1000.0 / BENCH_EVENTS, "ns");
+
+    start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_EVENTS; i++) {
+        trace_count(TRACE_CNT_PUBLISH);
+    }
+    bench_result("trace", "count_ns", (esp_timer_get_time() - start) * 1000.0 / BENCH_EVENTS, "ns");
+
+    start = esp_timer_get_time();
+    for (int i = 0; i < BENCH_EVENTS; i++) {
+        trace_hist(TRACE_HIST_PUBACK_US, i & 0xFFFF);
+    }
+    bench_result("trace", "hist_ns", (esp_timer_get_time() - start) * 1000.0 / BENCH_EVENTS, "ns");
+}
+
+/* the main thread holds one ring; the other tasks take the rest and three
+   find none */
+static void check_untraced(void)
+{
+    for (int i = 0; i < TRACE_MAX_TASKS - 1 + EXTRA_TASKS; i++) {
+        CHECK(xTaskCreate(record_task, "rec", 4096, NULL, 5, NULL) == pdPASS);
+    }
+    CHECK(host_wait_for(all_done, 5000));
+
+    size_t size = trace_snapshot_size();
+    uint8_t *dump = malloc(size);
+    size_t len = trace_snapshot(dump, size);
+    CHECK(len > 20);
+    CHECK(dump[5] == TRACE_MAX_TASKS);                  /* rings in the dump */
+    CHECK(counter(dump, TRACE_CNT_UNTRACED_TASKS) == EXTRA_TASKS);
+    CHECK(counter(dump, TRACE_CNT_PUBLISH) == BENCH_EVENTS);
+    free(dump);
+
+    /* once per task, not per event */
+    trace_instant(TRACE_EV_CMD_EXEC, 0);
+    dump = malloc(size);
+    trace_snapshot(dump, size);
+    CHECK(counter(dump, TRACE_CNT_UNTRACED_TASKS) == EXTRA_TASKS);
+    free(dump);
+}
+
+int main(void)
+{
+    bench();
+    check_untraced();
+    return host_test_result();
+}
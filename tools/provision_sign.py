@@ -0,0 +1,45 @@
+#!/usr/bin/env python3
+"""Build a signed cmd/config message (see main/provision.h).
+
+    tools/provision_sign.py --key "$KEY" --user-id user123 --device-id device01 \
+        --seq 7 uri=mqtts://broker:8883 user_id=u42 \
+        | mosquitto_pub -h <broker> -t 'home/useruser123/devicedevice01/cmd/config' -s
+
+--key is CONFIG_DOORCAM_PROVISION_KEY of the device; --seq must be higher
+than the last configuration the device accepted. --user-id and --device-id
+are the identity the device has now: the signature covers its device ID and
+the topic, so the message is only accepted there.
+"""
+import argparse
+import hashlib
+import hmac
+import sys
+
+KEYS = ("uri", "user", "pass", "user_id", "device_id")
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("--key", required=True)
+    ap.add_argument("--seq", type=int, required=True)
+    ap.add_argument("--user-id", required=True)
+    ap.add_argument("--device-id", required=True)
+    ap.add_argument("fields", nargs="*", metavar="key=value", help="one of: " + ", ".join(KEYS))
+    args = ap.parse_args()
+
+    body = "seq=%d\n" % args.seq
+    for f in args.fields:
+        k, sep, v = f.partition("=")
+        if not sep or k not in KEYS or "\n" in v:
+            sys.exit("bad field: %s" % f)
+        body += "%s=%s\n" % (k, v)
+
+    topic = "home/user%s/device%s/cmd/config" % (args.user_id, args.device_id)
+    signed = "%s\n%s\n%s" % (args.device_id, topic, body)
+    sig = hmac.new(args.key.encode(), signed.encode(), hashlib.sha256).hexdigest()
+    print("topic: " + topic, file=sys.stderr)
+    sys.stdout.write(body + "sig=" + sig)
+
+
+if __name__ == "__main__":
+    main()
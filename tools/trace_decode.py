@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+"""Convert a trace dump from the <prefix>/diag topic into Chrome trace JSON.
+
+Capture a dump with e.g.
+
+    mosquitto_sub -h <broker> -t 'home/user123/device01/diag' -C 1 > dump.bin &
+    mosquitto_pub -h <broker> -t 'home/user123/device01/cmd/diag' -n
+    tools/trace_decode.py dump.bin > trace.json
+
+and open trace.json in chrome://tracing or ui.perfetto.dev. Event, counter
+and histogram names are read from main/trace.h, so the header must match
+the firmware that produced the dump. Counters and histograms are printed
+to stderr.
+"""
+import argparse
+import json
+import os
+import re
+import struct
+import sys
+
+MAGIC = 0x31435254
+VERSION = 1
+HEADER = struct.Struct("<IBBBBB3xQ")
+EVENT = struct.Struct("<IHBxI")
+NAME_LEN = 16
+
+DEFAULT_HEADER = os.path.join(os.path.dirname(__file__), "..", "main", "trace.h")
+
+
+def read_names(header, table):
+    """Names of one X-macro table, in enum order."""
+    text = open(header).read()
+    m = re.search(r"#define %s\(X\)(.*?)\n\n" % table, text, re.S)
+    if not m:
+        sys.exit("%s not found in %s" % (table, header))
+    return re.findall(r'X\(\s*\w+\s*,\s*"([^"]+)"\s*\)', m.group(1))
+
+
+def hist_summary(buckets):
+    total = sum(buckets)
+    if total == 0:
+        return "empty"
+    parts = []
+    for q in (0.5, 0.95, 0.99):
+        need, seen = q * total, 0
+        for b, n in enumerate(buckets):
+            seen += n
+            if seen >= need:
+                parts.append("p%d<%d us" % (q * 100, 1 << b))
+                break
+    return "%d samples, %s" % (total, ", ".join(parts))
+
+
+def decode(data, header):
+    events = read_names(header, "TRACE_EVENTS")
+    counters = read_names(header, "TRACE_COUNTERS")
+    hists = read_names(header, "TRACE_HISTOGRAMS")
+
+    magic, version, tasks, ncnt, nhist, nbuckets, now_us = HEADER.unpack_from(data, 0)
+    if magic != MAGIC or version != VERSION:
+        sys.exit("not a version %d trace dump" % VERSION)
+    if ncnt != len(counters) or nhist != len(hists):
+        sys.exit("dump does not match %s" % header)
+    off = HEADER.size
+
+    cnt = struct.unpack_from("<%dI" % ncnt, data, off)
+    off += 4 * ncnt
+    for name, v in zip(counters, cnt):
+        print("%-16s %u" % (name, v), file=sys.stderr)
+    for name in hists:
+        buckets = struct.unpack_from("<%dI" % nbuckets, data, off)
+        off += 4 * nbuckets
+        print("%-16s %s" % (name, hist_summary(buckets)), file=sys.stderr)
+
+    now32 = now_us & 0xFFFFFFFF
+    out = []
+    for tid in range(tasks):
+        name = data[off:off + NAME_LEN].split(b"\0")[0].decode(errors="replace")
+        (count,) = struct.unpack_from("<I", data, off + NAME_LEN)
+        off += NAME_LEN + 4
+        out.append({"ph": "M", "name": "thread_name", "pid": 0, "tid": tid,
+                    "args": {"name": name}})
+        for _ in range(count):
+            ts32, eid, ph, arg = EVENT.unpack_from(data, off)
+            off += EVENT.size
+            # timestamps are the low 32 bits of esp_timer; unwrap against now
+            ts = now_us - ((now32 - ts32) & 0xFFFFFFFF)
+            ev = {"name": events[eid] if eid < len(events) else "ev%d" % eid,
+                  "ph": chr(ph), "ts": ts, "pid": 0, "tid": tid}
+            if ev["ph"] == "C":
+                ev["args"] = {"value": arg}
+            else:
+                ev["args"] = {"arg": arg}
+                if ev["ph"] == "I":
+                    ev["ph"], ev["s"] = "i", "t"
+            out.append(ev)
+    return {"traceEvents": out, "displayTimeUnit": "ms"}
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("dump", help="binary dump, '-' for stdin")
+    ap.add_argument("--header", default=DEFAULT_HEADER, help="trace.h of the firmware")
+    args = ap.parse_args()
+
+    data = sys.stdin.buffer.read() if args.dump == "-" else open(args.dump, "rb").read()
+    json.dump(decode(data, args.header), sys.stdout)
+
+
+if __name__ == "__main__":
+    main()